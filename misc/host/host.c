@@ -0,0 +1,60 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+#include "../../src/common/common.h"
+#include "../../src/mm/page.h"
+#include "../../src/mm/kmem.h"
+
+// Simulated RAM for the page allocator
+static uint8_t HOST_HEAP[HOST_HEAP_SIZE] __attribute__((aligned(4096)));
+
+const size_t HEAP_START = (size_t)HOST_HEAP;
+size_t HEAP_SIZE = HOST_HEAP_SIZE;
+
+// No vector unit as far as src/plic/cpu.h is concerned
+const size_t MISA = 0;
+
+void host_halt(void) {
+  fflush(stdout);
+  abort();
+}
+
+void kprintf(const char *format, ...) {
+  va_list arg;
+  va_start(arg, format);
+  vfprintf(stderr, format, arg);
+  va_end(arg);
+}
+
+int kputchar(int character) {
+  return fputc(character, stderr);
+}
+
+// The real one lives in src/common/common.c next to the vectorized
+// memory routines, which we leave to the host's libc
+void page_zero(void *ptr, size_t num) {
+  memset(ptr, 0, num);
+}
+
+void host_mm_init(void) {
+  memset(HOST_HEAP, 0xa5, sizeof(HOST_HEAP));
+  page_init();
+  kmem_init();
+}
+
+static uint64_t HOST_RAND_STATE = 1;
+
+void host_srand(uint64_t seed) {
+  HOST_RAND_STATE = seed != 0 ? seed : 1;
+}
+
+uint64_t host_rand(void) {
+  uint64_t x = HOST_RAND_STATE;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  HOST_RAND_STATE = x;
+  return x;
+}
@@ -0,0 +1,36 @@
+#ifndef HOST_H
+#define HOST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Host-native build of the memory management code in src/mm/
+ *
+ * The files in src/mm/ are compiled as-is with -DHOST and linked
+ * against host.c, which stands in for the rest of the kernel:
+ *
+ * - HEAP_START/HEAP_SIZE describe a page-aligned static array instead
+ *   of the region after the kernel image
+ * - kprintf() goes to stderr
+ * - HALT() (and so PANIC()/ASSERT()) aborts
+ *
+ * Physical addresses are simply host addresses, so page tables built
+ * by map() can be walked with virt_to_phys() as usual
+ */
+
+// Size of the simulated heap
+#define HOST_HEAP_SIZE (32ull << 20)
+
+// Normally provided by the linker script through src/asm/crt0.s
+extern const size_t HEAP_START;
+extern size_t HEAP_SIZE;
+
+// Reset the allocators to their state right after boot
+void host_mm_init(void);
+
+// Simple xorshift PRNG so that runs are reproducible from a seed
+uint64_t host_rand(void);
+void host_srand(uint64_t);
+
+#endif
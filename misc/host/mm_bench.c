@@ -0,0 +1,106 @@
+/*
+ * Host benchmarks for src/mm/, mirroring the in-guest ones in
+ * src/bench/bench.c
+ *
+ * Usage: mm_bench [rounds]
+ *
+ * Prints "bench name=... [size=...] iters=... ns=..." lines. Meant to
+ * be run under perf, e.g.
+ *
+ *   perf record -g ./mm_bench 100 && perf report
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "host.h"
+#include "../../src/mm/page.h"
+#include "../../src/mm/kmem.h"
+#include "../../src/mm/sv39.h"
+
+#define BENCH_ALLOC_BATCH 32
+#define BENCH_KMALLOC_SLOTS 64
+#define BENCH_KMALLOC_OPS 8192
+#define BENCH_MAP_PAGES 1024
+#define BENCH_MAP_VADDR 0x4000000000ull
+
+static size_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char *name, size_t size, size_t iters, size_t ns) {
+  printf("bench name=%s ", name);
+  if (size != 0)
+    printf("size=%zu ", size);
+  printf("iters=%zu ns=%zu\n", iters, ns);
+}
+
+static void bench_alloc_pages(size_t n, size_t rounds) {
+  void *pages[BENCH_ALLOC_BATCH];
+  size_t alloc_ns = 0, dealloc_ns = 0;
+  for (size_t round = 0; round < rounds; ++round) {
+    size_t start = now_ns();
+    for (size_t i = 0; i < BENCH_ALLOC_BATCH; ++i)
+      if ((pages[i] = alloc_pages(n)) == NULL)
+	abort();
+    alloc_ns += now_ns() - start;
+    start = now_ns();
+    for (size_t i = 0; i < BENCH_ALLOC_BATCH; ++i)
+      dealloc_pages(pages[i]);
+    dealloc_ns += now_ns() - start;
+  }
+  report("alloc_pages", n, rounds * BENCH_ALLOC_BATCH, alloc_ns);
+  report("dealloc_pages", n, rounds * BENCH_ALLOC_BATCH, dealloc_ns);
+}
+
+static void bench_kmalloc(size_t rounds) {
+  void *slots[BENCH_KMALLOC_SLOTS] = { NULL };
+  uint32_t seed = 1;
+  size_t start = now_ns();
+  for (size_t i = 0; i < rounds * BENCH_KMALLOC_OPS; ++i) {
+    seed = seed * 1664525 + 1013904223;
+    size_t slot = (seed >> 8) % BENCH_KMALLOC_SLOTS;
+    if (slots[slot] != NULL) {
+      kfree(slots[slot]);
+      slots[slot] = NULL;
+    } else
+      slots[slot] = kmalloc(8 + (seed >> 20) % 505);
+  }
+  report("kmalloc_kfree", 0, rounds * BENCH_KMALLOC_OPS, now_ns() - start);
+  for (size_t i = 0; i < BENCH_KMALLOC_SLOTS; ++i)
+    kfree(slots[i]);
+}
+
+static void bench_map(size_t rounds) {
+  size_t map_ns = 0, translate_ns = 0;
+  for (size_t round = 0; round < rounds; ++round) {
+    struct page_table *root = alloc_page();
+    size_t paddr = (size_t)root;
+    size_t start = now_ns();
+    for (size_t i = 0; i < BENCH_MAP_PAGES; ++i)
+      map(root, BENCH_MAP_VADDR + i * PAGE_SIZE, paddr, PTE_RW, 0);
+    map_ns += now_ns() - start;
+    start = now_ns();
+    for (size_t i = 0; i < BENCH_MAP_PAGES; ++i)
+      if (virt_to_phys(root, BENCH_MAP_VADDR + i * PAGE_SIZE) != paddr)
+	abort();
+    translate_ns += now_ns() - start;
+    unmap(root);
+    dealloc_pages(root);
+  }
+  report("map", 0, rounds * BENCH_MAP_PAGES, map_ns);
+  report("virt_to_phys", 0, rounds * BENCH_MAP_PAGES, translate_ns);
+}
+
+int main(int argc, char **argv) {
+  size_t rounds = argc > 1 ? strtoull(argv[1], NULL, 0) : 16;
+  host_mm_init();
+  bench_alloc_pages(1, rounds);
+  bench_alloc_pages(4, rounds);
+  bench_alloc_pages(16, rounds);
+  bench_alloc_pages(64, rounds);
+  bench_kmalloc(rounds);
+  bench_map(rounds);
+  return 0;
+}
@@ -0,0 +1,720 @@
+/*
+ * Randomized tests for src/mm/ on the host
+ *
+ * Usage: mm_test [seed [ops]]
+ *
+ * Every run is reproducible from its seed, so fuzzing is just a matter
+ * of trying many seeds, e.g.
+ *
+ *   for s in $(seq 1000); do ./mm_test $s || break; done
+ *
+ * Any inconsistency aborts, either here or in an ASSERT() of the code
+ * under test
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+#include "../../src/mm/page.h"
+#include "../../src/mm/kmem.h"
+#include "../../src/mm/sv39.h"
+#include "../../src/mm/zram.h"
+#include "../../src/mm/ksm.h"
+#include "../../src/mm/huge.h"
+#include "../../src/mm/slab.h"
+
+#define CHECK(condition, ...) ({\
+  if (!(condition)) {\
+    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,\
+	    #condition);\
+    fprintf(stderr, __VA_ARGS__);\
+    fputc('\n', stderr);\
+    abort();\
+  }\
+})
+
+#define MAX_LIVE 256
+
+struct allocation {
+  uint8_t *ptr;
+  size_t size;
+  uint8_t tag;
+};
+
+static int is_filled(const uint8_t *ptr, size_t size, uint8_t value) {
+  for (size_t i = 0; i < size; ++i)
+    if (ptr[i] != value)
+      return 0;
+  return 1;
+}
+
+static int overlaps(const struct allocation *a, const uint8_t *ptr,
+		    size_t size) {
+  return a->ptr < ptr + size && ptr < a->ptr + a->size;
+}
+
+// Largest number of contiguous pages alloc_pages() can currently hand out
+static size_t largest_allocation(void) {
+  size_t lo = 0, hi = get_num_pages();
+  while (lo < hi) {
+    size_t mid = (lo + hi + 1) / 2;
+    void *p = alloc_pages(mid);
+    if (p != NULL) {
+      dealloc_pages(p);
+      lo = mid;
+    } else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+// Random alloc_pages()/dealloc_pages() sequence checked against a
+// shadow list of live allocations
+static void test_pages(size_t ops) {
+  struct allocation live[MAX_LIVE];
+  size_t num_live = 0;
+  size_t baseline = largest_allocation();
+  CHECK(baseline > 0, "no free pages at all");
+  struct page_stats stats;
+  page_get_stats(&stats, 0);
+  size_t used = stats.used_pages;
+
+  for (size_t op = 0; op < ops; ++op) {
+    if (num_live == MAX_LIVE || (num_live > 0 && host_rand() % 2)) {
+      size_t i = host_rand() % num_live;
+      CHECK(is_filled(live[i].ptr, live[i].size, live[i].tag),
+	    "op %zu: allocation %p was overwritten", op, live[i].ptr);
+      dealloc_pages(live[i].ptr);
+      used -= live[i].size / PAGE_SIZE;
+      live[i] = live[--num_live];
+      continue;
+    }
+    // Mostly small allocations with the occasional large one
+    size_t n = host_rand() % 8 == 0 ? 1 + host_rand() % 64 :
+	1 + host_rand() % 4;
+    uint8_t *p = alloc_pages(n);
+    if (p == NULL)
+      continue;
+    size_t size = n * PAGE_SIZE;
+    CHECK((size_t)p % PAGE_SIZE == 0, "op %zu: %p is not page aligned", op,
+	  p);
+    CHECK(HEAP_START <= (size_t)p && (size_t)p + size <= HEAP_START +
+	  HEAP_SIZE, "op %zu: %p is outside the heap", op, p);
+    CHECK(is_filled(p, size, 0), "op %zu: %p was not zeroed", op, p);
+    for (size_t i = 0; i < num_live; ++i)
+      CHECK(!overlaps(&live[i], p, size), "op %zu: %p overlaps %p", op, p,
+	    live[i].ptr);
+    uint8_t tag = 1 + host_rand() % 255;
+    memset(p, tag, size);
+    live[num_live++] = (struct allocation) {
+    p, size, tag};
+    used += n;
+    if (op % 64 == 0) {
+      page_get_stats(&stats, 1);
+      CHECK(stats.used_pages == used, "op %zu: %zu pages used, expected %zu",
+	    op, stats.used_pages, used);
+      CHECK(stats.free_pages == stats.total_pages - used,
+	    "op %zu: free and used pages do not add up", op);
+      size_t extents = 0;
+      for (size_t i = 0; i < PAGE_EXTENT_BUCKETS; ++i)
+	extents += stats.free_extents[i];
+      CHECK(stats.largest_free_extent <= stats.free_pages
+	    && (extents > 0) == (stats.free_pages > 0),
+	    "op %zu: inconsistent free extents", op);
+    }
+  }
+
+  while (num_live > 0) {
+    --num_live;
+    CHECK(is_filled(live[num_live].ptr, live[num_live].size,
+		    live[num_live].tag), "allocation %p was overwritten",
+	  live[num_live].ptr);
+    dealloc_pages(live[num_live].ptr);
+  }
+  page_get_stats(&stats, 1);
+  CHECK(stats.largest_free_extent == baseline,
+	"largest free extent %zu, expected %zu", stats.largest_free_extent,
+	baseline);
+  CHECK(largest_allocation() == baseline,
+	"pages leaked: largest allocation %zu, expected %zu",
+	largest_allocation(), baseline);
+}
+
+// Random kmalloc()/kfree() sequence, checked the same way
+static void test_kmalloc(size_t ops) {
+  struct allocation live[MAX_LIVE];
+  size_t num_live = 0;
+  size_t arena = kmem_get_num_allocations() * PAGE_SIZE;
+  struct kmem_stats stats;
+  kmem_get_stats(&stats);
+  size_t in_use = stats.bytes_in_use;
+
+  for (size_t op = 0; op < ops; ++op) {
+    if (num_live == MAX_LIVE || (num_live > 0 && host_rand() % 2)) {
+      size_t i = host_rand() % num_live;
+      CHECK(is_filled(live[i].ptr, live[i].size, live[i].tag),
+	    "op %zu: allocation %p was overwritten", op, live[i].ptr);
+      kfree(live[i].ptr);
+      live[i] = live[--num_live];
+      continue;
+    }
+    size_t size = 1 + host_rand() % (host_rand() % 8 == 0 ? 8192 : 256);
+    uint8_t *p = kmalloc(size);
+    if (p == NULL)
+      continue;
+    CHECK((size_t)p % sizeof(size_t) == 0, "op %zu: %p is misaligned", op,
+	  p);
+    for (size_t i = 0; i < num_live; ++i)
+      CHECK(!overlaps(&live[i], p, size), "op %zu: %p overlaps %p", op, p,
+	    live[i].ptr);
+    uint8_t tag = 1 + host_rand() % 255;
+    memset(p, tag, size);
+    live[num_live++] = (struct allocation) {
+    p, size, tag};
+  }
+
+  kmem_get_stats(&stats);
+  CHECK(stats.allocations == num_live, "%zu blocks in use, expected %zu",
+	stats.allocations, num_live);
+  CHECK(stats.bytes_in_use >= in_use && stats.peak_bytes_in_use >=
+	stats.bytes_in_use, "kmalloc byte counts are inconsistent");
+  while (num_live > 0) {
+    --num_live;
+    kfree(live[num_live].ptr);
+  }
+  kmem_get_stats(&stats);
+  CHECK(stats.bytes_in_use == in_use, "%zu bytes in use after freeing all, "
+	"expected %zu", stats.bytes_in_use, in_use);
+  // Everything should have been coalesced back into a single block
+  void *p = kmalloc(arena - sizeof(size_t));
+  CHECK(p != NULL, "kmalloc arena did not coalesce after freeing all");
+  kfree(p);
+}
+
+// Random slab_alloc()/slab_free() sequence for two object sizes, checked
+// the same way, then check that freeing everything gives the pages back
+static void test_slab(size_t ops) {
+  struct slab_cache caches[2] = {
+    SLAB_CACHE(uint8_t[24]), SLAB_CACHE(uint8_t[1200])
+  };
+  struct allocation live[MAX_LIVE];
+  struct slab_cache *owner[MAX_LIVE];
+  size_t num_live = 0;
+  struct page_stats stats;
+  page_get_stats(&stats, 0);
+  size_t used = stats.used_pages;
+
+  for (size_t op = 0; op < ops; ++op) {
+    if (num_live == MAX_LIVE || (num_live > 0 && host_rand() % 2)) {
+      size_t i = host_rand() % num_live;
+      CHECK(is_filled(live[i].ptr, live[i].size, live[i].tag),
+	    "op %zu: object %p was overwritten", op, live[i].ptr);
+      slab_free(owner[i], live[i].ptr);
+      live[i] = live[--num_live];
+      owner[i] = owner[num_live];
+      continue;
+    }
+    struct slab_cache *cache = &caches[host_rand() % 2];
+    uint8_t *p = slab_alloc(cache);
+    if (p == NULL)
+      continue;
+    CHECK((size_t)p % sizeof(size_t) == 0, "op %zu: %p is misaligned", op,
+	  p);
+    CHECK((size_t)p / PAGE_SIZE == ((size_t)p + cache->size - 1) / PAGE_SIZE,
+	  "op %zu: %p crosses a page boundary", op, p);
+    for (size_t i = 0; i < num_live; ++i)
+      CHECK(!overlaps(&live[i], p, cache->size), "op %zu: %p overlaps %p",
+	    op, p, live[i].ptr);
+    uint8_t tag = 1 + host_rand() % 255;
+    memset(p, tag, cache->size);
+    owner[num_live] = cache;
+    live[num_live++] = (struct allocation) {
+    p, cache->size, tag};
+  }
+
+  CHECK(caches[0].objects + caches[1].objects == num_live,
+	"%zu objects in use, expected %zu",
+	caches[0].objects + caches[1].objects, num_live);
+  while (num_live > 0) {
+    --num_live;
+    slab_free(owner[num_live], live[num_live].ptr);
+  }
+  // Each cache keeps its last slab
+  for (size_t i = 0; i < 2; ++i)
+    CHECK(caches[i].objects == 0 && caches[i].slabs <= 1,
+	  "cache %zu: %zu objects in %zu slabs left", i, caches[i].objects,
+	  caches[i].slabs);
+  page_get_stats(&stats, 0);
+  CHECK(stats.used_pages == used + caches[0].slabs + caches[1].slabs,
+	"%zu pages in use, expected %zu", stats.used_pages,
+	used + caches[0].slabs + caches[1].slabs);
+  for (size_t i = 0; i < 2; ++i)
+    if (caches[i].partial != NULL)
+      dealloc_pages(caches[i].partial);
+}
+
+// Map random 4 KiB pages and 2 MiB megapages, then check translations
+// and copies across page boundaries
+static void test_sv39(void) {
+  size_t baseline = largest_allocation();
+  struct page_table *root = alloc_page();
+  CHECK(root != NULL, "no page for the root page table");
+
+  // 4 KiB pages below 256 GiB, megapages above, so they never collide
+#define NUM_PAGES 512
+#define NUM_MEGAPAGES 32
+  size_t vaddrs[NUM_PAGES], paddrs[NUM_PAGES];
+  for (size_t i = 0; i < NUM_PAGES; ++i) {
+    size_t vaddr;
+    int unique;
+    do {
+      vaddr = (1 + host_rand() % ((256ull << 30) / PAGE_SIZE - 1)) * PAGE_SIZE;
+      unique = 1;
+      for (size_t j = 0; j < i; ++j)
+	unique &= vaddrs[j] != vaddr;
+    } while (!unique);
+    vaddrs[i] = vaddr;
+    paddrs[i] = (1 + host_rand() % (1ull << 30)) * PAGE_SIZE;
+    map(root, vaddrs[i], paddrs[i], PTE_USER_RW, 0);
+  }
+  for (size_t i = 0; i < NUM_MEGAPAGES; ++i) {
+    size_t vaddr = (256ull << 30) + i * (1ull << 21);
+    size_t paddr = (1 + host_rand() % (1ull << 20)) << 21;
+    map(root, vaddr, paddr, PTE_RW, 1);
+    size_t offset = host_rand() % (1ull << 21);
+    CHECK(virt_to_phys(root, vaddr + offset) == paddr + offset,
+	  "megapage %zx+%zx translated wrongly", vaddr, offset);
+  }
+  for (size_t i = 0; i < NUM_PAGES; ++i) {
+    size_t offset = host_rand() % PAGE_SIZE;
+    CHECK(virt_to_phys(root, vaddrs[i] + offset) == paddrs[i] + offset,
+	  "page %zx+%zx translated wrongly", vaddrs[i], offset);
+  }
+  CHECK(virt_to_phys(root, 511ull << 30) == 0,
+	"unmapped address translated");
+  unmap(root);
+  memset(root, 0, sizeof(*root));
+
+  // copy_to_user()/copy_from_user() through real pages in reverse order
+  uint8_t *pages[4];
+  size_t base = 0x1000000000ull;
+  for (size_t i = 0; i < 4; ++i) {
+    pages[i] = alloc_page();
+    CHECK(pages[i] != NULL, "no page for copy test");
+  }
+  for (size_t i = 0; i < 4; ++i)
+    map(root, base + i * PAGE_SIZE, (size_t)pages[3 - i], PTE_USER_RW, 0);
+  uint8_t src[3 * PAGE_SIZE], dst[3 * PAGE_SIZE];
+  for (size_t i = 0; i < sizeof(src); ++i)
+    src[i] = host_rand();
+  size_t start = base + PAGE_SIZE / 2;
+  CHECK(copy_to_user(root, start, src, sizeof(src)) == sizeof(src),
+	"copy_to_user() fell short");
+  CHECK(memcmp(pages[3] + PAGE_SIZE / 2, src, PAGE_SIZE / 2) == 0,
+	"copy_to_user() wrote to the wrong page");
+  CHECK(copy_from_user(root, dst, start, sizeof(dst)) == sizeof(dst),
+	"copy_from_user() fell short");
+  CHECK(memcmp(src, dst, sizeof(src)) == 0, "copy round trip mismatch");
+  CHECK(copy_from_user(root, dst, base + 4 * PAGE_SIZE - 8, 16) == 8,
+	"copy_from_user() read past the mapping");
+
+  // What SYS_READ and friends are handed must be user memory: the
+  // kernel's global mappings are in every address space
+  size_t kernel = 0x80200000;
+  map(root, kernel, (size_t)pages[0], PTE_RW | PTE_GLOBAL, 0);
+  map(root, kernel + PAGE_SIZE, (size_t)pages[1], PTE_USER_RW, 0);
+  map(root, base + 4 * PAGE_SIZE, (size_t)pages[2], PTE_RW, 0);
+  CHECK(copy_to_user(root, kernel, src, 8) == 0
+	&& copy_from_user(root, dst, kernel, 8) == 0,
+	"copied to/from a kernel mapping");
+  CHECK(copy_to_user(root, kernel + PAGE_SIZE, src, 8) == 0,
+	"copied below the start of user space");
+  CHECK(copy_to_user(root, base + 4 * PAGE_SIZE, src, 8) == 0,
+	"copied to a page without PTE_USER");
+  CHECK(copy_to_user(root, base + 4 * PAGE_SIZE - 8, src, 16) == 8,
+	"copy_to_user() wrote past the user mapping");
+  // Never written through, so any frame will do
+  size_t huge = base + (1ull << 21);
+  map(root, huge, 1ull << 21, PTE_USER | PTE_READ, 1);
+  CHECK(copy_to_user(root, huge + 8, src, 8) == 0,
+	"copied to a read-only megapage");
+
+  unmap(root);
+  for (size_t i = 0; i < 4; ++i)
+    dealloc_pages(pages[i]);
+  dealloc_pages(root);
+  CHECK(largest_allocation() == baseline,
+	"page tables leaked: largest allocation %zu, expected %zu",
+	largest_allocation(), baseline);
+}
+
+// Split the heap into two nodes and check that allocations stay on
+// the preferred node until it is full, then fall back to the other
+static void test_zones(void) {
+  page_init();
+  struct page_stats stats;
+  page_get_stats(&stats, 0);
+  size_t total = stats.total_pages;
+  size_t split = HEAP_START + HEAP_SIZE / 2;
+  page_set_node(split, HEAP_START + HEAP_SIZE, 1);
+  page_get_stats(&stats, 0);
+  CHECK(stats.num_zones == 2, "%zu zones after split", stats.num_zones);
+  CHECK(stats.zones[0].node == 0 && stats.zones[1].node == 1,
+	"zones on nodes %zu and %zu", stats.zones[0].node,
+	stats.zones[1].node);
+  CHECK(stats.zones[0].total_pages + stats.zones[1].total_pages == total,
+	"zones cover %zu of %zu pages",
+	stats.zones[0].total_pages + stats.zones[1].total_pages, total);
+  size_t node1_pages = stats.zones[1].total_pages;
+
+  page_set_local_node(1);
+  CHECK(page_get_local_node() == 1, "local node not set");
+  uint8_t *p = alloc_page();
+  CHECK(p != NULL && (size_t)p >= stats.zones[1].start_addr,
+	"alloc_page() did not use the local node: %p", (void *)p);
+  dealloc_pages(p);
+  p = alloc_pages_node(1, 0);
+  CHECK(p != NULL && (size_t)p < stats.zones[1].start_addr,
+	"alloc_pages_node() did not use the requested node: %p", (void *)p);
+  dealloc_pages(p);
+
+  // Fill node 1, after which allocations spill over to node 0
+  void *fill = alloc_pages(node1_pages);
+  CHECK(fill != NULL, "cannot allocate all %zu pages of node 1",
+	node1_pages);
+  p = alloc_pages(2);
+  CHECK(p != NULL && (size_t)p < stats.zones[1].start_addr,
+	"no fallback to node 0: %p", (void *)p);
+  page_get_stats(&stats, 1);
+  CHECK(stats.zones[0].remote_pages == 2 && stats.zones[0].used_pages == 2,
+	"node 0: %zu remote, %zu used pages", stats.zones[0].remote_pages,
+	stats.zones[0].used_pages);
+  CHECK(stats.zones[1].used_pages == node1_pages
+	&& stats.zones[1].remote_pages == 0,
+	"node 1: %zu used, %zu remote pages", stats.zones[1].used_pages,
+	stats.zones[1].remote_pages);
+  CHECK(alloc_pages(stats.zones[0].total_pages) == NULL,
+	"allocation spanning both zones succeeded");
+  dealloc_pages(p);
+  dealloc_pages(fill);
+  page_get_stats(&stats, 1);
+  CHECK(stats.used_pages == 0, "%zu pages still in use", stats.used_pages);
+  CHECK(stats.largest_free_extent == stats.zones[0].total_pages
+	|| stats.largest_free_extent == node1_pages,
+	"largest free extent %zu spans zones", stats.largest_free_extent);
+}
+
+// Compress pages of varying compressibility through the zram pool and
+// check that they come back intact and that the pool is freed again
+static void test_zram(void) {
+#define ZRAM_PAGES 64
+  struct page_stats pages;
+  page_get_stats(&pages, 0);
+  size_t used = pages.used_pages;
+  uint8_t copies[ZRAM_PAGES][PAGE_SIZE];
+  uint64_t entries[ZRAM_PAGES];
+  struct zram_stats before, stats;
+  zram_get_stats(&before);
+  for (size_t i = 0; i < ZRAM_PAGES; ++i) {
+    uint8_t *page = alloc_page();
+    CHECK(page != NULL, "no page for zram test");
+    // Zeroes, short repeating patterns, text-like bytes and noise
+    size_t period = 1 + host_rand() % 64;
+    for (size_t j = 0; j < PAGE_SIZE; ++j)
+      switch (i % 4) {
+      case 0:
+	page[j] = j < 100 ? host_rand() : 0;
+	break;
+      case 1:
+	page[j] = j % period * 7;
+	break;
+      case 2:
+	page[j] = 'a' + host_rand() % 4;
+	break;
+      default:
+	page[j] = host_rand();
+      }
+    memcpy(copies[i], page, PAGE_SIZE);
+
+    uint8_t buf[PAGE_SIZE + PAGE_SIZE / 16];
+    size_t len = zram_compress(page, PAGE_SIZE, buf, sizeof(buf));
+    uint8_t out[PAGE_SIZE];
+    CHECK(len != 0, "page %zu does not fit in %zu bytes", i, sizeof(buf));
+    CHECK(zram_decompress(buf, len, out, sizeof(out)) == PAGE_SIZE
+	  && memcmp(out, page, PAGE_SIZE) == 0,
+	  "page %zu does not survive a round trip", i);
+    CHECK(len < 2 || zram_decompress(buf, len - 1, out, sizeof(out))
+	  != PAGE_SIZE, "truncated page %zu decompressed", i);
+
+    entries[i] = zram_store(page);
+    if (i % 4 == 3) {
+      CHECK(entries[i] == 0, "random page %zu was compressed", i);
+      dealloc_pages(page);
+    } else
+      CHECK(entries[i] != 0 && (entries[i] & PTE_SWAPPED)
+	    && !PTE_IS_VALID(entries[i]), "bad swap entry %llx for page %zu",
+	    (unsigned long long)entries[i], i);
+  }
+  zram_get_stats(&stats);
+  size_t stored = ZRAM_PAGES - ZRAM_PAGES / 4;
+  CHECK(stats.stored_pages - before.stored_pages == stored
+	&& stats.swap_outs - before.swap_outs == stored
+	&& stats.incompressible - before.incompressible == ZRAM_PAGES / 4,
+	"%zu pages stored, %zu incompressible",
+	stats.stored_pages - before.stored_pages,
+	stats.incompressible - before.incompressible);
+  CHECK(stats.compressed_bytes < stored * PAGE_SIZE / 2,
+	"%zu pages take %zu bytes", stored, stats.compressed_bytes);
+
+  for (size_t k = 0; k < ZRAM_PAGES; ++k) {
+    // Load in a scrambled order
+    size_t i = k * 37 % ZRAM_PAGES;
+    if (entries[i] == 0)
+      continue;
+    uint8_t *page = alloc_page();
+    CHECK(page != NULL, "no page to load into");
+    CHECK(zram_load(entries[i], page) == 0
+	  && memcmp(page, copies[i], PAGE_SIZE) == 0,
+	  "page %zu changed in zram", i);
+    dealloc_pages(page);
+  }
+  zram_get_stats(&stats);
+  CHECK(stats.stored_pages == before.stored_pages
+	&& stats.compressed_bytes == before.compressed_bytes
+	&& stats.swap_ins - before.swap_ins == stored,
+	"%zu pages, %zu bytes left in zram", stats.stored_pages,
+	stats.compressed_bytes);
+  // Only the page further stores would go to is left
+  CHECK(stats.pool_pages <= 1, "%zu pool pages left", stats.pool_pages);
+  page_get_stats(&pages, 0);
+  CHECK(pages.used_pages == used + stats.pool_pages,
+	"zram leaked %zu pages", pages.used_pages - used - stats.pool_pages);
+}
+
+// Reclaim handler for test_reclaim(): frees the page it was given
+static void *RECLAIMABLE = NULL;
+static size_t RECLAIM_CALLS = 0;
+
+static size_t test_reclaim_handler(size_t n) {
+  ++RECLAIM_CALLS;
+  CHECK(alloc_page() == NULL, "allocation inside reclaim succeeded");
+  if (RECLAIMABLE == NULL)
+    return 0;
+  dealloc_pages(RECLAIMABLE);
+  RECLAIMABLE = NULL;
+  return 1;
+}
+
+// Exhaust memory and check that alloc_pages() turns to the reclaim
+// handler exactly once per failure
+static void test_reclaim(void) {
+  page_init();
+  page_set_reclaim_handler(test_reclaim_handler);
+  void *all = alloc_pages(get_num_pages() - 1);
+  CHECK(all != NULL, "cannot allocate all pages");
+  RECLAIMABLE = alloc_page();
+  CHECK(RECLAIMABLE != NULL, "cannot allocate the last page");
+  struct page_stats stats;
+  page_get_stats(&stats, 0);
+  size_t failures = stats.alloc_failures;
+
+  void *page = alloc_page();
+  CHECK(page != NULL && RECLAIM_CALLS == 1,
+	"reclaim did not make room: %p after %zu calls", page, RECLAIM_CALLS);
+  CHECK(alloc_page() == NULL && RECLAIM_CALLS == 2,
+	"allocation without anything to reclaim: %zu calls", RECLAIM_CALLS);
+  page_get_stats(&stats, 0);
+  // One for the failed allocation, one for each attempt made from
+  // within the handler
+  CHECK(stats.alloc_failures - failures == 3, "%zu failures counted",
+	stats.alloc_failures - failures);
+  page_set_reclaim_handler(NULL);
+  dealloc_pages(page);
+  dealloc_pages(all);
+}
+
+// Map the same contents into two address spaces, merge them and undo
+// the merge the way copy-on-write faults do
+static void test_ksm(void) {
+#define KSM_PAGES 16
+  struct page_stats pages;
+  page_get_stats(&pages, 0);
+  size_t used = pages.used_pages;
+  struct ksm_stats before, stats;
+  ksm_get_stats(&before);
+  struct page_table *roots[2];
+  size_t base = 0x2000000000ull;
+  for (size_t r = 0; r < 2; ++r) {
+    roots[r] = alloc_page();
+    CHECK(roots[r] != NULL, "no page for the root page table");
+    for (size_t i = 0; i < KSM_PAGES; ++i) {
+      uint8_t *page = alloc_page();
+      CHECK(page != NULL, "no page for ksm test");
+      // Odd pages differ between the two address spaces
+      memset(page, i % 2 ? (int)(r * KSM_PAGES + i) : (int)i, PAGE_SIZE);
+      map(roots[r], base + i * PAGE_SIZE, (size_t)page, PTE_USER_RW, 0);
+    }
+  }
+  page_get_stats(&pages, 0);
+  size_t mapped = pages.used_pages;
+  // Interleaved, as a candidate is forgotten once another page with
+  // the same hash bucket comes along
+  for (size_t i = 0; i < KSM_PAGES; ++i)
+    for (size_t r = 0; r < 2; ++r)
+      ksm_merge(roots[r], base + i * PAGE_SIZE);
+
+  ksm_get_stats(&stats);
+  CHECK(stats.merged - before.merged == KSM_PAGES / 2
+	&& stats.shared_frames - before.shared_frames == KSM_PAGES / 2
+	&& stats.sharing - before.sharing == KSM_PAGES,
+	"%zu merged into %zu frames, %zu mappings",
+	stats.merged - before.merged,
+	stats.shared_frames - before.shared_frames,
+	stats.sharing - before.sharing);
+  page_get_stats(&pages, 0);
+  CHECK(pages.used_pages == mapped - KSM_PAGES / 2,
+	"merging freed %zu pages", mapped - pages.used_pages);
+  for (size_t i = 0; i < KSM_PAGES; ++i) {
+    uint64_t *a = get_pte(roots[0], base + i * PAGE_SIZE);
+    uint64_t *b = get_pte(roots[1], base + i * PAGE_SIZE);
+    CHECK(a != NULL && b != NULL && PTE_IS_VALID(*a) && PTE_IS_VALID(*b),
+	  "page %zu unmapped by merging", i);
+    size_t frame_a = virt_to_phys(roots[0], base + i * PAGE_SIZE);
+    size_t frame_b = virt_to_phys(roots[1], base + i * PAGE_SIZE);
+    if (i % 2) {
+      CHECK(frame_a != frame_b && (*a & PTE_WRITE) && (*b & PTE_WRITE)
+	    && ksm_refs(frame_a) == 0, "different page %zu was merged", i);
+      continue;
+    }
+    CHECK(frame_a == frame_b && !(*a & PTE_WRITE) && !(*b & PTE_WRITE)
+	  && ksm_refs(frame_a) == 2, "page %zu was not merged", i);
+    CHECK(is_filled((uint8_t *) frame_a, PAGE_SIZE, i),
+	  "merged page %zu has the wrong contents", i);
+    uint8_t byte = 0;
+    CHECK(copy_to_user(roots[0], base + i * PAGE_SIZE, &byte, 1) == 0,
+	  "copy_to_user() wrote to shared page %zu", i);
+    CHECK(copy_from_user(roots[0], &byte, base + i * PAGE_SIZE, 1) == 1
+	  && byte == i, "copy_from_user() cannot read shared page %zu", i);
+  }
+
+  // Undo: the first address space gets copies, the second keeps the
+  // shared frames as private pages
+  for (size_t i = 0; i < KSM_PAGES; i += 2) {
+    size_t vaddr = base + i * PAGE_SIZE;
+    size_t frame = virt_to_phys(roots[0], vaddr);
+    uint8_t *copy = alloc_page();
+    CHECK(copy != NULL, "no page for copy");
+    memcpy(copy, (void *)frame, PAGE_SIZE);
+    map(roots[0], vaddr, (size_t)copy, PTE_USER_RW, 0);
+    ksm_unshare(frame);
+    CHECK(ksm_refs(frame) == 1, "%zu mappings left after copy",
+	  ksm_refs(frame));
+    ksm_unshare(frame);
+    CHECK(ksm_refs(frame) == 0, "frame still shared by its last user");
+    *get_pte(roots[1], vaddr) |= PTE_WRITE;
+  }
+  ksm_get_stats(&stats);
+  CHECK(stats.shared_frames == before.shared_frames
+	&& stats.sharing == before.sharing
+	&& stats.unshared - before.unshared == KSM_PAGES,
+	"%zu frames still shared", stats.shared_frames);
+  for (size_t r = 0; r < 2; ++r) {
+    for (size_t i = 0; i < KSM_PAGES; ++i)
+      dealloc_pages((void *)virt_to_phys(roots[r], base + i * PAGE_SIZE));
+    // The odd pages are still candidates
+    ksm_forget(roots[r]);
+    unmap(roots[r]);
+    dealloc_pages(roots[r]);
+  }
+  page_get_stats(&pages, 0);
+  CHECK(pages.used_pages == used, "ksm leaked %zu pages",
+	pages.used_pages - used);
+}
+
+// Map a megapage, split it into 4 KiB pages, free one of them, fill the
+// block up again and collapse it back into a megapage
+static void test_huge(void) {
+  struct page_stats pages;
+  page_get_stats(&pages, 0);
+  size_t used = pages.used_pages;
+  struct huge_stats before, stats;
+  huge_get_stats(&before);
+  struct page_table *root = alloc_page();
+  CHECK(root != NULL, "no page for the root page table");
+  size_t base = 0x2000000000ull;
+  CHECK(huge_map(root, base) == 0, "no free megapage");
+  CHECK(huge_map(root, base) != 0, "megapage mapped twice");
+  size_t frame = virt_to_phys(root, base);
+  CHECK(frame % HUGE_PAGE_SIZE == 0
+	&& virt_to_phys(root, base + HUGE_PAGE_SIZE - 1) ==
+	frame + HUGE_PAGE_SIZE - 1, "megapage at %zx", frame);
+  CHECK(huge_pte(root, base + HUGE_PAGE_SIZE / 2) != NULL
+	&& get_pte(root, base) == NULL, "not mapped as a megapage");
+  for (size_t i = 0; i < HUGE_PAGE_PAGES; ++i)
+    memset((uint8_t *) frame + i * PAGE_SIZE, (int)i, PAGE_SIZE);
+
+  CHECK(huge_split(root, base + 7 * PAGE_SIZE) == 0, "split failed");
+  CHECK(huge_pte(root, base) == NULL, "still a megapage after split");
+  for (size_t i = 0; i < HUGE_PAGE_PAGES; ++i) {
+    uint64_t *pte = get_pte(root, base + i * PAGE_SIZE);
+    CHECK(pte != NULL && PTE_IS_VALID(*pte) && (*pte & PTE_WRITE)
+	  && virt_to_phys(root, base + i * PAGE_SIZE) == frame + i * PAGE_SIZE,
+	  "page %zu mapped wrong after split", i);
+  }
+  // The pages of a split megapage are freed one at a time
+  size_t hole = base + 5 * PAGE_SIZE;
+  dealloc_pages((void *)virt_to_phys(root, hole));
+  *get_pte(root, hole) = 0;
+  CHECK(huge_collapse(root, base) == 0, "collapsed a block with a hole");
+  uint8_t *page = alloc_page();
+  CHECK(page != NULL, "no page to fill the hole");
+  memset(page, 5, PAGE_SIZE);
+  map(root, hole, (size_t)page, PTE_USER_RW, 0);
+  // Read-only pages may be shared by same-page merging
+  *get_pte(root, base) &= ~(uint64_t) PTE_WRITE;
+  CHECK(huge_collapse(root, base) == 0, "collapsed a read-only page");
+  *get_pte(root, base) |= PTE_WRITE;
+  CHECK(huge_collapse(root, base) == 1, "full block not collapsed");
+  frame = virt_to_phys(root, base);
+  CHECK(huge_pte(root, base) != NULL && frame % HUGE_PAGE_SIZE == 0,
+	"collapsed into %zx", frame);
+  for (size_t i = 0; i < HUGE_PAGE_PAGES; ++i)
+    CHECK(is_filled((uint8_t *) frame + i * PAGE_SIZE, PAGE_SIZE, i),
+	  "page %zu has the wrong contents after collapse", i);
+
+  huge_get_stats(&stats);
+  CHECK(stats.mapped == before.mapped + 1
+	&& stats.allocated == before.allocated + 1
+	&& stats.split == before.split + 1
+	&& stats.collapsed == before.collapsed + 1,
+	"%zu mapped, %zu allocated, %zu split, %zu collapsed",
+	stats.mapped - before.mapped, stats.allocated - before.allocated,
+	stats.split - before.split, stats.collapsed - before.collapsed);
+  huge_free(root, base);
+  CHECK(huge_pte(root, base) == NULL, "megapage still mapped");
+  unmap(root);
+  dealloc_pages(root);
+  page_get_stats(&pages, 0);
+  CHECK(pages.used_pages == used, "huge pages leaked %zu pages",
+	pages.used_pages - used);
+}
+
+int main(int argc, char **argv) {
+  uint64_t seed = argc > 1 ? strtoull(argv[1], NULL, 0) : 1;
+  size_t ops = argc > 2 ? strtoull(argv[2], NULL, 0) : 20000;
+  host_srand(seed);
+  test_zones();
+  test_reclaim();
+  host_mm_init();
+
+  test_pages(ops);
+  test_kmalloc(ops);
+  test_slab(ops);
+  test_sv39();
+  test_zram();
+  test_ksm();
+  test_huge();
+  printf("mm_test: seed %llu, %zu ops: ok\n", (unsigned long long)seed,
+	 ops);
+  return 0;
+}
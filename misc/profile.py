@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""Symbolize samples from the kernel's sampling profiler (src/profile/)
+
+Usage: profile.py <kernel image> <console log> [<folded output>]
+
+Reads the "prof <pid> <mode> <pc> [<return address> ...]" lines that
+profile_dump() prints to the console, resolves the addresses against
+the kernel image with addr2line and prints a flat profile. If an output
+file is given, folded stacks are written to it, suitable for
+flamegraph.pl.
+
+User programs are linked into the kernel image and mapped at a fixed
+offset (USER_TEXT_OFFSET in src/process/process.h), which is subtracted
+from user addresses before lookup.
+
+Set ADDR2LINE to use a different addr2line than riscv64-elf-addr2line.
+"""
+
+import collections
+import os
+import subprocess
+import sys
+
+USER_TEXT_OFFSET = 0x1000000000
+MODE_USER = 0
+
+
+def parse(log):
+    samples = []
+    with open(log, errors="replace") as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) < 4 or fields[0] != "prof":
+                continue
+            try:
+                pid, mode, *addrs = (int(x, 16) for x in fields[1:])
+            except ValueError:
+                continue
+            if mode == MODE_USER:
+                addrs = [a - USER_TEXT_OFFSET if a >= USER_TEXT_OFFSET else a
+                         for a in addrs]
+            # Return addresses point after the call, so look up the call
+            # itself
+            addrs = addrs[:1] + [a - 1 for a in addrs[1:]]
+            samples.append((pid, mode, addrs))
+    return samples
+
+
+def symbolize(image, addrs):
+    addr2line = os.environ.get("ADDR2LINE", "riscv64-elf-addr2line")
+    addrs = sorted(set(addrs))
+    if not addrs:
+        return {}
+    result = subprocess.run([addr2line, "-f", "-e", image],
+                            input="\n".join(hex(a) for a in addrs),
+                            capture_output=True, text=True, check=True)
+    lines = result.stdout.splitlines()
+    symbols = {}
+    for i, addr in enumerate(addrs):
+        function = lines[2 * i] if 2 * i < len(lines) else "??"
+        symbols[addr] = function if function != "??" else hex(addr)
+    return symbols
+
+
+def main():
+    if len(sys.argv) not in (3, 4):
+        sys.exit(__doc__.strip().splitlines()[2])
+    image, log = sys.argv[1], sys.argv[2]
+    samples = parse(log)
+    if not samples:
+        sys.exit("profile.py: no samples found in " + log)
+    symbols = symbolize(image, [a for _, _, addrs in samples for a in addrs])
+
+    total = len(samples)
+    self_counts = collections.Counter()
+    total_counts = collections.Counter()
+    modes = collections.Counter()
+    folded = collections.Counter()
+    for pid, mode, addrs in samples:
+        frames = [symbols[a] for a in addrs]
+        self_counts[frames[0]] += 1
+        for function in set(frames):
+            total_counts[function] += 1
+        modes["user" if mode == MODE_USER else "kernel"] += 1
+        label = "[pid %d]" % pid if mode == MODE_USER else "[kernel]"
+        folded[";".join([label] + frames[::-1])] += 1
+
+    print("%d samples: %s" % (total, ", ".join(
+        "%s %.1f%%" % (m, 100.0 * c / total) for m, c in modes.items())))
+    print()
+    print("%8s %7s %8s %7s  %s" % ("self", "", "total", "", "function"))
+    for function, count in self_counts.most_common():
+        print("%8d %6.2f%% %8d %6.2f%%  %s" % (
+            count, 100.0 * count / total, total_counts[function],
+            100.0 * total_counts[function] / total, function))
+
+    if len(sys.argv) == 4:
+        with open(sys.argv[3], "w") as f:
+            for stack, count in sorted(folded.items()):
+                f.write("%s %d\n" % (stack, count))
+
+
+if __name__ == "__main__":
+    main()
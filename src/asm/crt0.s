@@ -11,6 +11,10 @@
 # Use alternative macro syntax (see GNU assembler docs for details)
 .altmacro
 
+# Offsets into struct trap_frame (see src/plic/trap_frame.h)
+.set FREGS_OFFSET, NUM_GP_REGS * REG_SIZE
+.set FCSR_OFFSET, (NUM_GP_REGS * 2 + 3) * REG_SIZE
+
 # Common macros
 .macro save_gp i, basereg=t6
   sd x\i, ((\i) * REG_SIZE)(\basereg)
@@ -18,15 +22,18 @@
 .macro load_gp i, basereg=t6
   ld x\i, ((\i) * REG_SIZE)(\basereg)
 .endm
+.macro save_fp i, basereg=t6
+  fsd f\i, FREGS_OFFSET + ((\i) * REG_SIZE)(\basereg)
+.endm
+.macro load_fp i, basereg=t6
+  fld f\i, FREGS_OFFSET + ((\i) * REG_SIZE)(\basereg)
+.endm
 
 # Importation of linker symbols
 .section .rodata
 .global HEAP_START
 HEAP_START: .dword __heap_start
 
-.global HEAP_SIZE
-HEAP_SIZE: .dword __heap_size
-
 .global INIT_START
 INIT_START: .dword __init_start
 
@@ -66,116 +73,356 @@ KERNEL_STACK_END: .dword __kernel_stack_end
 .global MAKE_SYSCALL
 MAKE_SYSCALL: .dword make_syscall
 
+.global IPC_SYSCALL
+IPC_SYSCALL: .dword ipc_syscall
+
 .section .data
 .global KERNEL_TABLE
 KERNEL_TABLE: .dword 0
 
+# Size of the heap, from the end of the kernel image to the end of RAM
+# This defaults to 128 MiB of RAM and is updated from the device tree
+# during boot (see src/fdt/)
+.global HEAP_SIZE
+HEAP_SIZE: .dword __heap_size
+
+# Device tree address passed by QEMU in a1
+.global BOOT_FDT
+BOOT_FDT: .dword 0
+
+# misa as read at boot, since S-mode cannot read it (see src/plic/cpu.h)
+# This lives in .data rather than .bss as it is set before BSS is zeroed
+.global MISA
+MISA: .dword 0
+
+# mtime at _start and once BSS is zeroed (see src/common/boot.h)
+.global BOOT_TIME_START
+BOOT_TIME_START: .dword 0
+.global BOOT_TIME_BSS
+BOOT_TIME_BSS: .dword 0
+
 .section .init, "ax"
 .global _start
 _start:
+  # Only the boot hart (0) runs the kernel; park all others
+  csrr t0, mhartid
+  bnez t0, park
+
   # Initialize CSRs for M-mode
+  # Only a thin layer (timer and SBI calls, see src/sbi/) stays in
+  # M-mode; the kernel itself runs in S-mode under Sv39
 
   # Supervisor address translation and protection
   # SATP should already be zero, but just to make sure ...
+  # The kernel enables paging itself once its page table is built
   csrw satp, zero
 
-  # Machine status
-  # MPP = mstatus[12:11]
-  #      MPP=3 (M-level access with no translation)
-  li t0, 0b11 << 11
-  csrw mstatus, t0
-
-  # Machine exception program counter
-  # Set this to kmain so executing mret jumps to kmain
-  la t0, kmain
-  csrw mepc, t0
-
   # Do not allow interrupts in M-mode
   csrw mie, zero
 
-  # Zero the BSS section
-  la t0, __bss_start
-  la t1, __bss_end
-__bss_zero_loop_start:
-  bgeu t0, t1, __bss_zero_loop_end
-  sd zero, 0(t0)
-  addi t0, t0, 8
-  j __bss_zero_loop_start
-__bss_zero_loop_end:
-
   # Initialize global pointer register
   .option push
   .option norelax
   la gp, __global_pointer
   .option pop
 
+  # Note the time for the boot report (after gp, which `la` may use)
+  # The device tree is not parsed yet, so this assumes QEMU's CLINT
+  li t1, 0x0200BFF8
+  ld t0, 0(t1)
+  la t1, BOOT_TIME_START
+  sd t0, 0(t1)
+
+  la t0, BOOT_FDT
+  sd a1, 0(t0)
+
   # Initialize stack and frame pointer registers
   la sp, __kernel_stack_end
   mv fp, sp
 
+  # Record the supported extensions for the memory routines in
+  # src/common/common.c, and turn on the vector unit if there is one
+  csrr t0, misa
+  la t1, MISA
+  sd t0, 0(t1)
+
+  # Zero the BSS section
+  la a0, __bss_start
+  li a1, 0
+  la a2, __bss_end
+  sub a2, a2, a0
+  call memset
+  li t1, 0x0200BFF8
+  ld t0, 0(t1)
+  la t1, BOOT_TIME_BSS
+  sd t0, 0(t1)
+
+  # M-mode trap vector, with mscratch pointing to the top of a
+  # dedicated M-mode stack
+  la t0, m_trap_vector
+  csrw mtvec, t0
+  la t0, __m_stack_end
+  csrw mscratch, t0
+
+  # Push the first timer deadline to infinity so that we don't take a
+  # timer interrupt before the kernel asks for one
+  li t0, -1
+  li t1, 0x02004000
+  sd t0, 0(t1)
+
+  # Delegate to S-mode:
+  # - Illegal instruction (2), breakpoint (3), U-mode ecall (8) and
+  #   instruction/load/store page faults (12, 13, 15)
+  # - Supervisor software (1), timer (5) and external (9) interrupts
+  li t0, (1 << 2) | (1 << 3) | (1 << 8) | (1 << 12) | (1 << 13) | (1 << 15)
+  csrw medeleg, t0
+  li t0, (1 << 1) | (1 << 5) | (1 << 9)
+  csrw mideleg, t0
+
+  # The machine timer is the only interrupt M-mode takes itself
+  # It is forwarded to S-mode as a supervisor timer interrupt
+  li t0, 1 << 7
+  csrw mie, t0
+
+  # Define PMP region to allow (indirect) access to all
+  # physical memory in S-mode and U-mode
+  # By default, M-mode can access all physical memory and
+  # no other modes can access any physical memory
+  # pmp0cfg = pmpcfg0[7:0]
+  #      A=TOR         X=1        W=1        R=1
+  li t0, (0b01 << 3) | (1 << 2) | (1 << 1) | (1 << 0)
+  csrw pmpcfg0, t0
+  # Set all 1's for the top address (exclusive)
+  # The bottom address (inclusive) is implicitly 0 when setting
+  # pmpcfg0 and pmpaddr0
+  li t0, -1
+  csrw pmpaddr0, t0
+
+  # Let S-mode read the cycle, time and instret counters
+  li t0, 0b111
+  csrw mcounteren, t0
+
+  # Machine status
+  # MPP = mstatus[12:11]
+  #      MPP=1 (S-mode)
+  li t0, 0b01 << 11
+  csrw mstatus, t0
+
+  # Machine exception program counter
+  # Set this to kmain so executing mret jumps to kmain in S-mode
+  la t0, kmain
+  csrw mepc, t0
+
   # If kmain returns, we're done with everything so halt forever
   la ra, halt_forever
 
-  # Now jump to kmain for M-mode initialization
+  # Now jump to kmain for S-mode initialization
   mret
 
 # We're already done with everything - let's halt forever
 halt_forever:
-  csrw mie, zero
+  csrw sie, zero
   wfi
   j halt_forever
 
-# Interrupt handler
-interrupt_handler:
-  # Save all general purpose registers into kernel trap frame
-  # No need to save floating point registers since we haven't used them yet
-  # No need to save satp, trap_stack since we don't modify them
-  # No need to save hartid since that is always 0
-  # (we only have a single CPU core)
-  # This requires a bit of trickery to do correctly:
-  # 
-  # 0. mscratch has address of kernel trap frame - see kinit() for details
-  # 1. Atomically swap mscratch and t6 registers
-  #    Now t6 has address of kernel trap frame, and mscratch the
-  #    original value of t6
-  # 2. Now save registers x1-x30 into kernel trap frame, using
-  #    t6=x31 as base
-  #    No need to save zero=x0 since that is read-only zero
-  # 3. Move address of kernel trap frame to t5=x30 so we don't lose it
-  # 4. Move mscratch (= original value of t6) back into t6 and save that
-  # 5. Write address of kernel trap frame from t5 back into mscratch
-  csrrw t6, mscratch, t6
+# Secondary harts wait here forever, as the kernel only runs on one
+park:
+  wfi
+  j park
+
+# M-mode trap vector
+# Saves all general purpose registers on the M-mode stack and hands
+# them to m_mode_trap_handler(), which may modify them (e.g. to return
+# SBI results in a0) and returns the PC to resume at
+.align 4
+m_trap_vector:
+  # Swap in the M-mode stack; mscratch now holds the interrupted sp
+  csrrw sp, mscratch, sp
+  addi sp, sp, -(NUM_GP_REGS * REG_SIZE)
+  .set i, 1
+  .rept 31
+    save_gp %i, sp
+    .set i, i + 1
+  .endr
+
+  # The interrupted context might not share our global pointer
+  .option push
+  .option norelax
+  la gp, __global_pointer
+  .option pop
+
+  csrr a0, mcause
+  csrr a1, mepc
+  mv a2, sp
+  call m_mode_trap_handler
+  csrw mepc, a0
+
   .set i, 1
-  .rept 30
-    save_gp %i
+  .rept 31
+    load_gp %i, sp
     .set i, i + 1
   .endr
+  addi sp, sp, NUM_GP_REGS * REG_SIZE
+  csrrw sp, mscratch, sp
+  mret
+
+# S-mode trap vectors
+# stvec is in vectored mode: exceptions, including system calls, land on
+# the first entry and interrupts on the entry of their cause, so the
+# timer and external interrupts skip decoding scause
+#
+# The registers of the interrupted process are saved into its trap
+# frame. Only the caller-saved ones (ra, sp, t0-t6, a0-a7) are saved up
+# front: the C code we call preserves the rest (gp, tp, s0-s11) itself,
+# so traps that return to the same process, i.e. external interrupts and
+# system calls that cannot switch processes (not in SYSCALL_SWITCHES),
+# neither save nor restore them. Traps that may switch processes save
+# them too, as the process is resumed from its trap frame
+# (switch_to_user), which must then be complete
+#
+# Floating point registers are switched lazily from C, see
+# src/process/fp.c
+# No need to save satp, trap_stack since we don't modify them
+# No need to save hartid since that is always 0
+# (we only have a single CPU core)
+#
+# The kernel is mapped into every address space (with global
+# mappings), so there is no need to switch satp here
+.align 6
+s_trap_vectors:
+  j s_exception_entry # 0
+  j s_trap_entry # 1: supervisor software interrupt
+  j s_trap_entry
+  j s_trap_entry
+  j s_trap_entry
+  j s_timer_entry # 5: supervisor timer interrupt
+  j s_trap_entry
+  j s_trap_entry
+  j s_trap_entry
+  j s_external_entry # 9: supervisor external interrupt
+  .rept 6
+    j s_trap_entry
+  .endr
+
+# System calls that may switch processes, by number (see
+# src/process/syscall.h): SYS_EXIT, SYS_YIELD, SYS_IPC_SEND, SYS_IPC_RECV,
+# SYS_IPC_CALL, SYS_FUTEX_WAIT, SYS_WAITPID and SYS_KILL
+# Numbers of 64 and up (unknown system calls) take the slow path too
+.set SYSCALL_SWITCHES, (1 << 0) | (1 << 9) | (1 << 16) | (1 << 17) | (1 << 18) | (1 << 20) | (1 << 24) | (1 << 25)
+
+.macro save_caller_saved basereg
+  .irp i, 1, 2, 5, 6, 7, 10, 11, 12, 13, 14, 15, 16, 17, 28, 29, 30
+    save_gp \i, \basereg
+  .endr
+.endm
+.macro load_caller_saved basereg
+  .irp i, 1, 2, 5, 6, 7, 10, 11, 12, 13, 14, 15, 16, 17, 28, 29, 30
+    load_gp \i, \basereg
+  .endr
+.endm
+.macro save_callee_saved basereg
+  .irp i, 3, 4, 8, 9, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27
+    save_gp \i, \basereg
+  .endr
+.endm
+
+# Save the caller-saved registers into the trap frame, leaving its
+# address in t5
+# This requires a bit of trickery to do correctly:
+# 
+# 0. sscratch has address of the trap frame of the interrupted
+#    process - see switch_to_user for details - or 0 if we
+#    interrupted the kernel itself, see s_trap_from_kernel
+# 1. Atomically swap sscratch and t6 registers
+#    Now t6 has address of trap frame, and sscratch the
+#    original value of t6
+# 2. Now save registers into the trap frame, using t6=x31 as base
+#    No need to save zero=x0 since that is read-only zero
+# 3. Move address of trap frame to t5=x30 so we don't lose it
+# 4. Move sscratch (= original value of t6) back into t6 and save that
+# 5. Zero sscratch, as we are in the kernel now
+.macro s_trap_enter
+  csrrw t6, sscratch, t6
+  beqz t6, s_trap_from_kernel
+  save_caller_saved t6
   mv t5, t6
-  csrr t6, mscratch
+  csrr t6, sscratch
   save_gp 31, t5
-  csrw mscratch, t5
-
-  # Now invoke our M-mode trap handler
-  csrr a0, mepc
-  csrr a1, mtval
-  csrr a2, mcause
-  csrr a3, mhartid
-  csrr a4, mstatus
-  mv a5, t5 # t5 still contains copy of mscratch
-  # Make sure we use the kernel stack as our trap stack
-  # instead of that of our user process
-  # Best practice is probably to allocate a page for
-  # dedicated use as the trap stack, but using the kernel
-  # stack directly seems to work for now
-  la sp, __kernel_stack_end
-  call m_mode_trap_handler
+  csrw sscratch, zero
+.endm
 
-  # m_mode_trap_handler returns the PC value via a0
-  csrw mepc, a0
+# Switch to the kernel stack, keeping the trap frame address (t5) at its
+# top for the way back
+# Best practice is probably to allocate a page for dedicated use as the
+# trap stack, but using the kernel stack directly seems to work for now
+.macro s_trap_stack
+  la sp, __kernel_stack_end
+  addi sp, sp, -16
+  sd t5, 0(sp)
+.endm
 
+# Exceptions, with a fast path for system calls that return to the
+# calling process
+s_exception_entry:
+  s_trap_enter
+  csrr t0, scause
+  li t1, 8 # environment call from U-mode
+  bne t0, t1, 1f
+  li t1, 64
+  bgeu a0, t1, 1f
+  li t1, SYSCALL_SWITCHES
+  srl t1, t1, a0
+  andi t1, t1, 1
+  bnez t1, 1f
+  csrr a0, sepc
+  mv a1, t5
+  s_trap_stack
+  call s_syscall_handler
+  j s_trap_return_partial
+1:
+  save_callee_saved t5
+  j s_trap_full
+
+# External interrupts only run the top halves of their handlers and any
+# deferred work (see src/plic/work.h), and never switch processes
+s_external_entry:
+  s_trap_enter
+  csrr a0, sepc
+  s_trap_stack
+  call s_external_handler
+  j s_trap_return_partial
+
+# The timer interrupt always ends in a context switch (which may be back
+# to the same process), so s_timer_handler() does not return
+s_timer_entry:
+  s_trap_enter
+  save_callee_saved t5
+  csrr a0, sepc
+  s_trap_stack
+  call s_timer_handler
+
+# Any other interrupt
+s_trap_entry:
+  s_trap_enter
+  save_callee_saved t5
+
+# Call the generic trap handler with the full trap frame in t5
+s_trap_full:
+  csrr a0, sepc
+  csrr a1, stval
+  csrr a2, scause
+  mv a3, zero # hartid - we only have a single CPU core
+  csrr a4, sstatus
+  mv a5, t5
+  s_trap_stack
+  call s_mode_trap_handler
+
+  # The trap handler returns the PC value via a0
   # Restore registers and return
   # This is more straightforward, since we can overwrite t6=x31 at the end
-  csrr t6, mscratch
+  csrw sepc, a0
+  ld t6, 0(sp)
+  csrw sscratch, t6
   .set i, 1
   .rept 31
     load_gp %i
@@ -183,53 +430,166 @@ interrupt_handler:
   .endr
 
   # Continue execution at the given PC value
-  mret
+  sret
+
+# Return from a trap that only saved the caller-saved registers, with
+# the PC value in a0
+s_trap_return_partial:
+  csrw sepc, a0
+  ld t6, 0(sp)
+  csrw sscratch, t6
+  load_caller_saved t6
+  load_gp 31, t6
+  sret
+
+# Traps taken in the kernel itself, e.g. external interrupts while
+# deferred work runs (see src/plic/work.h)
+# Registers are saved on the current stack rather than in a trap frame,
+# laid out like the registers of a trap frame, with the interrupted sp
+# in the slot of x2, and the handler returns straight to the
+# interrupted code
+.set KERNEL_FRAME_SIZE, NUM_GP_REGS * REG_SIZE
+s_trap_from_kernel:
+  # Restore t6, leaving sscratch 0 again
+  csrrw t6, sscratch, t6
+  addi sp, sp, -KERNEL_FRAME_SIZE
+  .set i, 1
+  .rept 31
+    .if i != 2
+      save_gp %i, sp
+    .endif
+    .set i, i + 1
+  .endr
+  addi t0, sp, KERNEL_FRAME_SIZE
+  sd t0, (2 * REG_SIZE)(sp)
+
+  csrr a0, sepc
+  csrr a1, stval
+  csrr a2, scause
+  mv a3, zero
+  csrr a4, sstatus
+  mv a5, sp
+  call s_mode_trap_handler
+  csrw sepc, a0
+
+  .set i, 1
+  .rept 31
+    .if i != 2
+      load_gp %i, sp
+    .endif
+    .set i, i + 1
+  .endr
+  addi sp, sp, KERNEL_FRAME_SIZE
+  sret
+
+# Save/restore all floating point registers and fcsr to/from a trap frame
+# sstatus.FS must not be Off
+# a0 - frame address
+.global fp_save
+fp_save:
+  .set i, 0
+  .rept 32
+    save_fp %i, a0
+    .set i, i + 1
+  .endr
+  frcsr t0
+  sd t0, FCSR_OFFSET(a0)
+  ret
+
+.global fp_restore
+fp_restore:
+  .set i, 0
+  .rept 32
+    load_fp %i, a0
+    .set i, i + 1
+  .endr
+  ld t0, FCSR_OFFSET(a0)
+  fscsr t0
+  ret
 
 .global make_syscall
 make_syscall:
   ecall
   ret
 
+# IPC system calls from C (see src/ipc/ipc.h)
+# a0 - system call number, a1 - endpoint, a2 - message address,
+# a3 - reply endpoint (SYS_IPC_CALL)
+# The message is passed in a2-a5 and, except for SYS_IPC_SEND, the one
+# received in a1-a4 is stored back over it
+.set SYS_IPC_SEND, 16
+.global ipc_syscall
+ipc_syscall:
+  mv a6, a3
+  mv t0, a2
+  mv t1, a0
+  ld a2, 0(t0)
+  ld a3, 8(t0)
+  ld a4, 16(t0)
+  ld a5, 24(t0)
+  ecall
+  li t2, SYS_IPC_SEND
+  beq t1, t2, 1f
+  sd a1, 0(t0)
+  sd a2, 8(t0)
+  sd a3, 16(t0)
+  sd a4, 24(t0)
+1:
+  ret
+
+# Call into the M-mode layer from S-mode
+# a0 - SBI function, a1 and a2 - arguments
+.global sbi_call
+sbi_call:
+  mv a7, a0
+  mv a0, a1
+  mv a1, a2
+  ecall
+  ret
+
+# Install the S-mode trap vector
+# sscratch is 0 whenever the kernel runs, see s_trap_vectors
+.global s_mode_trap_init
+s_mode_trap_init:
+  csrw sscratch, zero
+  la t0, s_trap_vectors
+  ori t0, t0, 1 # vectored mode
+  csrw stvec, t0
+  ret
+
 .global switch_to_user
 switch_to_user:
   # a0 - frame address
-  csrw mscratch, a0
-  
-  # Set MPP=0 (U-mode), MPIE=1, SPIE=1
-  li t0, (0b00 << 11) | (1 << 7) | (1 << 5)
-  csrw mstatus, t0
+  csrw sscratch, a0
+
+  # Set SPP=0 (U-mode), SPIE=1
+  # Leave the remaining sstatus fields alone
+  li t0, 1 << 8
+  csrc sstatus, t0
+  li t0, 1 << 5
+  csrs sstatus, t0
 
   # a1 - program counter
-  csrw mepc, a1
+  csrw sepc, a1
 
-  # a2 - SATP register
-  csrw satp, a2
-  
-  # Enable external, timer and software interrupts from
-  # M-mode and S-mode alike
-  li t0, 0xAAA
-  csrw mie, t0
+  # Enable external, timer and software interrupts in S-mode
+  li t0, 0x222
+  csrw sie, t0
 
   # Set interrupt handler
-  la t0, interrupt_handler
-  csrw mtvec, t0
+  la t0, s_trap_vectors
+  ori t0, t0, 1 # vectored mode
+  csrw stvec, t0
+
+  # a2 - SATP register, or 0 to stay in the current address space
+  # (between threads of a process), which also keeps the TLB
+  # Kernel mappings are global, so they survive the switch
+  beqz a2, 1f
+  csrw satp, a2
 
   # Sync SATP for all address spaces, for all harts
   sfence.vma
-
-  # Define PMP region to allow (indirect) access to all
-  # physical memory in U-mode
-  # By default, M-mode can access all physical memory and
-  # no other modes can access any physical memory
-  # pmp0cfg = pmpcfg0[7:0]
-  #      A=TOR         X=1        W=1        R=1
-  li t0, (0b01 << 3) | (1 << 2) | (1 << 1) | (1 << 0)
-  csrw pmpcfg0, t0
-  # Set all 1's for the top address (exclusive)
-  # The bottom address (inclusive) is implicitly 0 when setting
-  # pmpcfg0 and pmpaddr0
-  li t0, -1
-  csrw pmpaddr0, t0
+1:
 
   # Load process context frame
   mv t6, a0
@@ -240,4 +600,4 @@ switch_to_user:
   .endr
 
   # Now jump to U-mode
-  mret
+  sret
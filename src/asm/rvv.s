@@ -0,0 +1,109 @@
+# Vectorized memory routines for CPUs with the V extension (RVV 1.0)
+# Only ever called through the wrappers in src/common/common.c, which
+# check misa first and fall back to scalar code otherwise, and switch the
+# vector unit on for the duration of the call
+#
+# The kernel itself is built for rv64g; these routines use v0-v23 and
+# do not preserve them. The vector unit is Off in user space, so no
+# process has vector registers of its own to preserve
+
+.option norvc
+.option push
+.option arch, +v
+
+.section .text
+
+# void rvv_memset(void *dst, int c, size_t n)
+.global rvv_memset
+rvv_memset:
+  vsetvli t0, zero, e8, m8, ta, ma
+  vmv.v.x v0, a1
+1:
+  beqz a2, 2f
+  vsetvli t0, a2, e8, m8, ta, ma
+  vse8.v v0, (a0)
+  add a0, a0, t0
+  sub a2, a2, t0
+  j 1b
+2:
+  ret
+
+# void rvv_memcpy(void *dst, const void *src, size_t n)
+# Copies front to back, so it is also safe for overlapping buffers
+# with dst < src
+.global rvv_memcpy
+rvv_memcpy:
+  beqz a2, 1f
+  vsetvli t0, a2, e8, m8, ta, ma
+  vle8.v v0, (a1)
+  vse8.v v0, (a0)
+  add a0, a0, t0
+  add a1, a1, t0
+  sub a2, a2, t0
+  j rvv_memcpy
+1:
+  ret
+
+# void rvv_memcpy_backward(void *dst, const void *src, size_t n)
+# Copies back to front for overlapping buffers with dst > src
+.global rvv_memcpy_backward
+rvv_memcpy_backward:
+  add a0, a0, a2
+  add a1, a1, a2
+1:
+  beqz a2, 2f
+  vsetvli t0, a2, e8, m8, ta, ma
+  sub a0, a0, t0
+  sub a1, a1, t0
+  vle8.v v0, (a1)
+  vse8.v v0, (a0)
+  sub a2, a2, t0
+  j 1b
+2:
+  ret
+
+# int rvv_memcmp(const void *a, const void *b, size_t n)
+.global rvv_memcmp
+rvv_memcmp:
+  beqz a2, 2f
+  vsetvli t0, a2, e8, m8, ta, ma
+  vle8.v v0, (a0)
+  vle8.v v8, (a1)
+  vmsne.vv v16, v0, v8
+  vfirst.m t1, v16
+  bgez t1, 1f
+  add a0, a0, t0
+  add a1, a1, t0
+  sub a2, a2, t0
+  j rvv_memcmp
+1:
+  # First differing byte is at index t1 of this chunk
+  add a0, a0, t1
+  add a1, a1, t1
+  lbu t2, 0(a0)
+  lbu t3, 0(a1)
+  sub a0, t2, t3
+  ret
+2:
+  li a0, 0
+  ret
+
+# void rvv_page_zero(void *dst, size_t n)
+# `dst` must be 8-byte aligned and `n` a multiple of 8
+.global rvv_page_zero
+rvv_page_zero:
+  srli a1, a1, 3
+  vsetvli t0, zero, e64, m8, ta, ma
+  vmv.v.i v0, 0
+1:
+  beqz a1, 2f
+  vsetvli t0, a1, e64, m8, ta, ma
+  vse64.v v0, (a0)
+  slli t1, t0, 3
+  add a0, a0, t1
+  sub a1, a1, t0
+  j 1b
+2:
+  ret
+
+.option pop
@@ -0,0 +1,274 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "bench.h"
+#include "../common/common.h"
+#include "../uart/uart.h"
+#include "../syscon/syscon.h"
+#include "../plic/cpu.h"
+#include "../mm/page.h"
+#include "../mm/kmem.h"
+#include "../mm/sv39.h"
+#include "../process/process.h"
+#include "../process/sched.h"
+#include "../process/syscall.h"
+#include "../profile/profile.h"
+#include "../ipc/ipc.h"
+#include "../ipc/futex.h"
+#include "../rtc/rtc.h"
+
+// Number of allocations live at once in the page allocator benchmark,
+// and how many times the whole batch is allocated and freed
+#define BENCH_ALLOC_BATCH 32
+#define BENCH_ALLOC_ROUNDS 16
+
+// kmalloc()/kfree() churn: operations on a fixed set of slots
+#define BENCH_KMALLOC_SLOTS 64
+#define BENCH_KMALLOC_OPS 8192
+
+// Pages mapped (and then translated) in a fresh address space
+#define BENCH_MAP_PAGES 1024
+#define BENCH_MAP_VADDR 0x4000000000ull
+
+// IPC endpoints of the U-mode benchmarks, created by bench_run() before
+// anything else, so their numbers are known in advance
+#define BENCH_IPC_REQUEST 0
+#define BENCH_IPC_REPLY 1
+
+struct bench_clock {
+  size_t cycles;
+  size_t ticks;
+};
+
+static struct bench_clock bench_start(void) {
+  struct bench_clock clock = {.cycles = GET_CYCLE(),.ticks = GET_MTIME() };
+  return clock;
+}
+
+// Print the result of a benchmark started at `start`
+static void bench_end(const char *name, size_t iters,
+		      struct bench_clock start) {
+  size_t cycles = GET_CYCLE() - start.cycles;
+  size_t ticks = GET_MTIME() - start.ticks;
+  kprintf("bench name=%s iters=%lu cycles=%lu ticks=%lu us=%lu\n", name,
+	  iters, cycles, ticks, TICKS_TO_US(ticks));
+}
+
+static void bench_alloc_pages(size_t n) {
+  void *pages[BENCH_ALLOC_BATCH];
+  size_t alloc_cycles = 0, alloc_ticks = 0;
+  size_t dealloc_cycles = 0, dealloc_ticks = 0;
+  for (size_t round = 0; round < BENCH_ALLOC_ROUNDS; ++round) {
+    struct bench_clock start = bench_start();
+    for (size_t i = 0; i < BENCH_ALLOC_BATCH; ++i) {
+      pages[i] = alloc_pages(n);
+      ASSERT(pages[i] != NULL,
+	     "bench_alloc_pages(): out of memory allocating %d pages\n", n);
+    }
+    alloc_cycles += GET_CYCLE() - start.cycles;
+    alloc_ticks += GET_MTIME() - start.ticks;
+
+    start = bench_start();
+    for (size_t i = 0; i < BENCH_ALLOC_BATCH; ++i)
+      dealloc_pages(pages[i]);
+    dealloc_cycles += GET_CYCLE() - start.cycles;
+    dealloc_ticks += GET_MTIME() - start.ticks;
+  }
+  size_t iters = BENCH_ALLOC_BATCH * BENCH_ALLOC_ROUNDS;
+  kprintf("bench name=alloc_pages size=%lu iters=%lu cycles=%lu ticks=%lu"
+	  " us=%lu\n", n, iters, alloc_cycles, alloc_ticks,
+	  TICKS_TO_US(alloc_ticks));
+  kprintf("bench name=dealloc_pages size=%lu iters=%lu cycles=%lu ticks=%lu"
+	  " us=%lu\n", n, iters, dealloc_cycles, dealloc_ticks,
+	  TICKS_TO_US(dealloc_ticks));
+}
+
+// Random mix of kmalloc() and kfree() with sizes between 8 and 512 bytes
+static void bench_kmalloc(void) {
+  void *slots[BENCH_KMALLOC_SLOTS] = { NULL };
+  uint32_t seed = 1;
+  struct bench_clock start = bench_start();
+  for (size_t i = 0; i < BENCH_KMALLOC_OPS; ++i) {
+    // Numerical Recipes LCG, deterministic across runs
+    seed = seed * 1664525 + 1013904223;
+    size_t slot = (seed >> 8) % BENCH_KMALLOC_SLOTS;
+    if (slots[slot] != NULL) {
+      kfree(slots[slot]);
+      slots[slot] = NULL;
+    } else
+      slots[slot] = kmalloc(8 + (seed >> 20) % 505);
+  }
+  bench_end("kmalloc_kfree", BENCH_KMALLOC_OPS, start);
+  for (size_t i = 0; i < BENCH_KMALLOC_SLOTS; ++i)
+    kfree(slots[i]);
+}
+
+static void bench_map(void) {
+  struct page_table *root = (struct page_table *)alloc_page();
+  ASSERT(root != NULL, "bench_map(): failed to allocate root page table\n");
+  // The pages are never accessed, so any physical address will do
+  size_t paddr = (size_t)root;
+
+  struct bench_clock start = bench_start();
+  for (size_t i = 0; i < BENCH_MAP_PAGES; ++i)
+    map(root, BENCH_MAP_VADDR + i * PAGE_SIZE, paddr, PTE_RW, 0);
+  bench_end("map", BENCH_MAP_PAGES, start);
+
+  start = bench_start();
+  for (size_t i = 0; i < BENCH_MAP_PAGES; ++i)
+    ASSERT(virt_to_phys(root, BENCH_MAP_VADDR + i * PAGE_SIZE) == paddr,
+	   "bench_map(): wrong translation for page %d\n", i);
+  bench_end("virt_to_phys", BENCH_MAP_PAGES, start);
+
+  unmap(root);
+  dealloc_pages(root);
+}
+
+/*
+ * U-mode benchmarks
+ *
+ * These run as processes, so like init_process() they must not touch
+ * kernel data or call anything but make_syscall()
+ */
+
+// Second thread of bench_user_ping()
+static void bench_user_thread(void) {
+  while (1)
+    make_syscall(SYS_YIELD);
+}
+
+// Null system call round trip and wall clock reads, then ping-pong with bench_user_pong()
+// through SYS_YIELD, which is two context switches per iteration, the
+// same with a thread of its own, then IPC round trips with
+// bench_user_server()
+static void bench_user_ping(void) {
+  size_t cycles = GET_CYCLE();
+  size_t ticks = GET_TIME();
+  for (size_t i = 0; i < BENCH_USER_ITERS; ++i)
+    make_syscall(SYS_GETPID);
+  make_syscall(SYS_BENCH, BENCH_SYSCALL, BENCH_USER_ITERS,
+	       GET_CYCLE() - cycles, GET_TIME() - ticks, 0);
+
+  cycles = GET_CYCLE();
+  ticks = GET_TIME();
+  for (size_t i = 0; i < BENCH_USER_ITERS; ++i)
+    (void)TIME_PAGE_NOW_NS();
+  make_syscall(SYS_BENCH, BENCH_CLOCK_GETTIME, BENCH_USER_ITERS,
+	       GET_CYCLE() - cycles, GET_TIME() - ticks, 0);
+
+  cycles = GET_CYCLE();
+  ticks = GET_TIME();
+  for (size_t i = 0; i < BENCH_USER_ITERS; ++i)
+    make_syscall(SYS_YIELD);
+  make_syscall(SYS_BENCH, BENCH_CONTEXT_SWITCH, 2 * BENCH_USER_ITERS,
+	       GET_CYCLE() - cycles, GET_TIME() - ticks, 0);
+
+  // bench_user_pong() goes to sleep at its next turn, leaving the CPU to
+  // this thread and the new one
+  make_syscall(SYS_THREAD_CREATE, bench_user_thread, 0);
+  cycles = GET_CYCLE();
+  ticks = GET_TIME();
+  for (size_t i = 0; i < BENCH_USER_ITERS; ++i)
+    make_syscall(SYS_YIELD);
+  make_syscall(SYS_BENCH, BENCH_THREAD_SWITCH, 2 * BENCH_USER_ITERS,
+	       GET_CYCLE() - cycles, GET_TIME() - ticks, 0);
+
+  struct ipc_message msg;
+  cycles = GET_CYCLE();
+  ticks = GET_TIME();
+  for (size_t i = 0; i < BENCH_USER_ITERS; ++i) {
+    msg.tag = 0;
+    msg.words[0] = i;
+    ipc_syscall(SYS_IPC_CALL, BENCH_IPC_REQUEST, &msg, BENCH_IPC_REPLY);
+  }
+  make_syscall(SYS_BENCH, BENCH_IPC_PINGPONG, BENCH_USER_ITERS,
+	       GET_CYCLE() - cycles, GET_TIME() - ticks, 0);
+
+  // The pages come back into the same buffer, written to each time as a
+  // producer would
+  size_t buf = make_syscall(SYS_MMAP, (size_t)-1, 0,
+			    BENCH_IPC_PAGES * PAGE_SIZE, PROT_READ | PROT_WRITE);
+  make_syscall(SYS_IPC_WINDOW, buf, BENCH_IPC_PAGES);
+  cycles = GET_CYCLE();
+  ticks = GET_TIME();
+  for (size_t i = 0; i < BENCH_IPC_BULK_ITERS; ++i) {
+    for (size_t j = 0; j < BENCH_IPC_PAGES; ++j)
+      *(volatile size_t *)(buf + j * PAGE_SIZE) = i;
+    msg.tag = IPC_PAGES;
+    msg.words[0] = buf;
+    msg.words[1] = BENCH_IPC_PAGES;
+    ipc_syscall(SYS_IPC_CALL, BENCH_IPC_REQUEST, &msg, BENCH_IPC_REPLY);
+  }
+  make_syscall(SYS_BENCH, BENCH_IPC_BULK, BENCH_IPC_BULK_ITERS,
+	       GET_CYCLE() - cycles, GET_TIME() - ticks, BENCH_IPC_PAGES);
+}
+
+// Yield as many times as bench_user_ping() does, then sleep for good
+static void bench_user_pong(void) {
+  for (size_t i = 0; i < BENCH_USER_ITERS; ++i)
+    make_syscall(SYS_YIELD);
+  uint32_t never = 0;
+  while (1)
+    make_syscall(SYS_FUTEX_WAIT, &never, 0, 0);
+}
+
+// Echo every request back, including its pages, which arrive in a
+// window of the server's own and are moved back from there
+static void bench_user_server(void) {
+  size_t buf = make_syscall(SYS_MMAP, (size_t)-1, 0,
+			    BENCH_IPC_PAGES * PAGE_SIZE, PROT_READ | PROT_WRITE);
+  make_syscall(SYS_IPC_WINDOW, buf, BENCH_IPC_PAGES);
+  struct ipc_message msg;
+  ipc_syscall(SYS_IPC_RECV, BENCH_IPC_REQUEST, &msg, 0);
+  while (1)
+    ipc_syscall(SYS_IPC_CALL, BENCH_IPC_REPLY, &msg, BENCH_IPC_REQUEST);
+}
+
+// Called through SYS_BENCH with the result of a U-mode benchmark
+// The IPC bulk benchmark is the last one, so power off after it
+// (dumping the profile first, for `make profile EXTRA_CFLAGS=-DBENCH`)
+void bench_report(size_t id, size_t iters, size_t cycles, size_t ticks,
+		  size_t size) {
+  static const char *const names[] = {
+    "syscall", "context_switch", "ipc_pingpong", "ipc_bulk", "thread_switch",
+    "clock_gettime"
+  };
+  ASSERT(id < sizeof(names) / sizeof(names[0]),
+	 "bench_report(): unknown benchmark %d\n", id);
+  if (size != 0)
+    kprintf("bench name=%s size=%lu iters=%lu cycles=%lu ticks=%lu us=%lu\n",
+	    names[id], size, iters, cycles, ticks, TICKS_TO_US(ticks));
+  else
+    kprintf("bench name=%s iters=%lu cycles=%lu ticks=%lu us=%lu\n",
+	    names[id], iters, cycles, ticks, TICKS_TO_US(ticks));
+  if (id == BENCH_IPC_BULK) {
+    kprintf("bench done\n");
+    profile_dump();
+    poweroff();
+  }
+}
+
+// Run all benchmarks; does not return
+// Called instead of starting the init processes
+void bench_run(void) {
+  kprintf("Running benchmarks ...\n");
+  bench_alloc_pages(1);
+  bench_alloc_pages(4);
+  bench_alloc_pages(16);
+  bench_alloc_pages(64);
+  bench_kmalloc();
+  bench_map();
+
+  // Let U-mode read the cycle and time counters
+  CSR_WRITE(scounteren, 0b111);
+  ASSERT(ipc_create() == BENCH_IPC_REQUEST
+	 && ipc_create() == BENCH_IPC_REPLY,
+	 "bench_run(): failed to create IPC endpoints\n");
+  // The server runs first, to be waiting for requests before the
+  // others start
+  sched_enqueue(bench_user_server);
+  sched_enqueue(bench_user_ping);
+  sched_enqueue(bench_user_pong);
+  struct process *process = sched_schedule();
+  process_switch(NULL, process);
+  PANIC("bench_run(): failed to start benchmark process\n");
+}
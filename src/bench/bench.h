@@ -0,0 +1,46 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+
+/*
+ * In-guest microbenchmarks
+ *
+ * Only built into the kernel with `make bench`, which defines BENCH.
+ * The kernel then runs the benchmarks instead of the init processes and
+ * powers off when done, printing one line per benchmark:
+ *
+ *   bench name=<name> [size=<pages>] iters=<n> cycles=<c> ticks=<t> us=<u>
+ *
+ * `cycles` comes from rdcycle and `ticks` from mtime, at the device tree
+ * timebase, both summed over all `iters` iterations; `us` is `ticks` in
+ * microseconds (TICKS_TO_US())
+ */
+
+// Benchmarks run in U-mode, reported through SYS_BENCH with their
+// iterations, cycles, ticks and size in pages (0 if they have none)
+// - ipc_pingpong: round trips of a register message through SYS_IPC_CALL
+// - ipc_bulk: round trips of BENCH_IPC_PAGES pages, moved to the server
+//   and back
+// - thread_switch: like context_switch, between two threads of a
+//   process, which share an address space
+// - clock_gettime: reads of the wall clock from the time page, without
+//   a system call (compare with syscall)
+#define BENCH_SYSCALL 0
+#define BENCH_CONTEXT_SWITCH 1
+#define BENCH_IPC_PINGPONG 2
+#define BENCH_IPC_BULK 3
+#define BENCH_THREAD_SWITCH 4
+#define BENCH_CLOCK_GETTIME 5
+
+// Iterations of the U-mode benchmarks
+#define BENCH_USER_ITERS 4096
+
+// Pages per message and round trips of the IPC bulk benchmark
+#define BENCH_IPC_PAGES 16
+#define BENCH_IPC_BULK_ITERS 512
+
+void bench_run(void);
+void bench_report(size_t, size_t, size_t, size_t, size_t);
+
+#endif
@@ -0,0 +1,45 @@
+#include <stddef.h>
+#include "boot.h"
+#include "common.h"
+#include "../uart/uart.h"
+#include "../plic/cpu.h"
+
+// Set by _start in src/asm/crt0.s
+extern const size_t BOOT_TIME_START;
+extern const size_t BOOT_TIME_BSS;
+
+struct boot_phase {
+  const char *name;
+  size_t end;
+};
+
+static struct boot_phase BOOT_PHASES[BOOT_MAX_PHASES];
+static size_t BOOT_NUM_PHASES = 0;
+
+// Record that phase `name` ended now; it started where the previous
+// phase ended
+void boot_phase(const char *name) {
+  if (BOOT_NUM_PHASES == BOOT_MAX_PHASES)
+    return;
+  BOOT_PHASES[BOOT_NUM_PHASES].name = name;
+  BOOT_PHASES[BOOT_NUM_PHASES].end = GET_MTIME();
+  ++BOOT_NUM_PHASES;
+}
+
+static void boot_print_phase(const char *name, size_t start, size_t end) {
+  size_t ticks = end - start;
+  kprintf("  %-20s %8lu ticks %5lu us\n", name, ticks,
+	  ticks * US_PER_SECOND / TICKS_PER_SECOND);
+}
+
+void boot_print_phases(void) {
+  kprintf("Boot phases (mtime %lu ticks per second):\n", TICKS_PER_SECOND);
+  boot_print_phase("firmware", 0, BOOT_TIME_START);
+  boot_print_phase("bss clear", BOOT_TIME_START, BOOT_TIME_BSS);
+  size_t start = BOOT_TIME_BSS;
+  for (size_t i = 0; i < BOOT_NUM_PHASES; ++i) {
+    boot_print_phase(BOOT_PHASES[i].name, start, BOOT_PHASES[i].end);
+    start = BOOT_PHASES[i].end;
+  }
+  boot_print_phase("total", 0, start);
+}
@@ -0,0 +1,20 @@
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <stddef.h>
+
+/*
+ * Boot phase timing
+ *
+ * kmain() calls boot_phase() as each phase of booting completes, and
+ * boot_print_phases() prints how long each one took in mtime ticks,
+ * starting from the two timestamps taken by _start in src/asm/crt0.s:
+ * on entry and once BSS is zeroed
+ */
+
+#define BOOT_MAX_PHASES 16
+
+void boot_phase(const char *);
+void boot_print_phases(void);
+
+#endif
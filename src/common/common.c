@@ -1,4 +1,7 @@
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "common.h"
 #include "../uart/uart.h"
 
@@ -15,3 +18,189 @@ char *strcpy(char *destination, const char *source) {
   *tmp = '\0';
   return destination;
 }
+
+// Vector implementations, defined in src/asm/rvv.s
+void rvv_memset(void *, int, size_t);
+void rvv_memcpy(void *, const void *, size_t);
+void rvv_memcpy_backward(void *, const void *, size_t);
+int rvv_memcmp(const void *, const void *, size_t);
+void rvv_page_zero(void *, size_t);
+
+// The vector unit is only switched on (sstatus.VS) around the calls
+// below, so user space never sees it on: the kernel's vector registers
+// cannot leak into a process, nor can the kernel clobber a process's, as
+// a vector instruction from U-mode traps as illegal instead
+// Interrupts are held off meanwhile, since a handler copying memory
+// would clobber the registers of the copy it interrupted
+static size_t vector_begin(void) {
+  size_t sstatus = CSR_READ(sstatus);
+  CSR_CLEAR(sstatus, SSTATUS_SIE);
+  CSR_SET(sstatus, SSTATUS_VS_INITIAL);
+  return sstatus;
+}
+
+static void vector_end(size_t sstatus) {
+  CSR_CLEAR(sstatus, SSTATUS_VS | SSTATUS_SIE);
+  CSR_SET(sstatus, sstatus & (SSTATUS_VS | SSTATUS_SIE));
+}
+
+#define WORD_SIZE sizeof(size_t)
+#define IS_WORD_ALIGNED(p) (((size_t)(p) & (WORD_SIZE - 1)) == 0)
+
+void *memset(void *ptr, int value, size_t num) {
+  if (HAS_VECTOR()) {
+    size_t sstatus = vector_begin();
+    rvv_memset(ptr, value, num);
+    vector_end(sstatus);
+    return ptr;
+  }
+  uint8_t *p = (uint8_t *) ptr;
+  while (num > 0 && !IS_WORD_ALIGNED(p)) {
+    *p++ = (uint8_t) value;
+    --num;
+  }
+  // Replicate the byte into every byte of a word
+  size_t word = (uint8_t) value * 0x0101010101010101ull;
+  size_t *w = (size_t *)p;
+  for (; num >= 4 * WORD_SIZE; num -= 4 * WORD_SIZE, w += 4) {
+    w[0] = word;
+    w[1] = word;
+    w[2] = word;
+    w[3] = word;
+  }
+  for (; num >= WORD_SIZE; num -= WORD_SIZE)
+    *w++ = word;
+  p = (uint8_t *) w;
+  while (num--)
+    *p++ = (uint8_t) value;
+  return ptr;
+}
+
+// Scalar front to back copy, also used by memmove() when dst < src
+static void copy_forward(uint8_t * d, const uint8_t * s, size_t num) {
+  // Word copies only pay off if both pointers can be aligned at once
+  if (((size_t)d & (WORD_SIZE - 1)) == ((size_t)s & (WORD_SIZE - 1))) {
+    while (num > 0 && !IS_WORD_ALIGNED(d)) {
+      *d++ = *s++;
+      --num;
+    }
+    size_t *dw = (size_t *)d;
+    const size_t *sw = (const size_t *)s;
+    for (; num >= 4 * WORD_SIZE; num -= 4 * WORD_SIZE, dw += 4, sw += 4) {
+      dw[0] = sw[0];
+      dw[1] = sw[1];
+      dw[2] = sw[2];
+      dw[3] = sw[3];
+    }
+    for (; num >= WORD_SIZE; num -= WORD_SIZE)
+      *dw++ = *sw++;
+    d = (uint8_t *) dw;
+    s = (const uint8_t *)sw;
+  }
+  while (num--)
+    *d++ = *s++;
+}
+
+// Scalar back to front copy for overlapping buffers with dst > src
+static void copy_backward(uint8_t * d, const uint8_t * s, size_t num) {
+  d += num;
+  s += num;
+  if (((size_t)d & (WORD_SIZE - 1)) == ((size_t)s & (WORD_SIZE - 1))) {
+    while (num > 0 && !IS_WORD_ALIGNED(d)) {
+      *--d = *--s;
+      --num;
+    }
+    size_t *dw = (size_t *)d;
+    const size_t *sw = (const size_t *)s;
+    for (; num >= WORD_SIZE; num -= WORD_SIZE)
+      *--dw = *--sw;
+    d = (uint8_t *) dw;
+    s = (const uint8_t *)sw;
+  }
+  while (num--)
+    *--d = *--s;
+}
+
+void *memcpy(void *destination, const void *source, size_t num) {
+  if (HAS_VECTOR()) {
+    size_t sstatus = vector_begin();
+    rvv_memcpy(destination, source, num);
+    vector_end(sstatus);
+  } else
+    copy_forward((uint8_t *) destination, (const uint8_t *)source, num);
+  return destination;
+}
+
+void *memmove(void *destination, const void *source, size_t num) {
+  uint8_t *d = (uint8_t *) destination;
+  const uint8_t *s = (const uint8_t *)source;
+  if (d == s || num == 0)
+    return destination;
+  // Only a destination overlapping the end of the source needs to be
+  // copied back to front
+  bool backward = s < d && d < s + num;
+  if (HAS_VECTOR()) {
+    size_t sstatus = vector_begin();
+    if (backward)
+      rvv_memcpy_backward(d, s, num);
+    else
+      rvv_memcpy(d, s, num);
+    vector_end(sstatus);
+  } else if (backward)
+    copy_backward(d, s, num);
+  else
+    copy_forward(d, s, num);
+  return destination;
+}
+
+int memcmp(const void *ptr1, const void *ptr2, size_t num) {
+  if (HAS_VECTOR()) {
+    size_t sstatus = vector_begin();
+    int result = rvv_memcmp(ptr1, ptr2, num);
+    vector_end(sstatus);
+    return result;
+  }
+  const uint8_t *a = (const uint8_t *)ptr1;
+  const uint8_t *b = (const uint8_t *)ptr2;
+  // Skip over equal words, then find the differing byte
+  if (IS_WORD_ALIGNED(a) && IS_WORD_ALIGNED(b))
+    while (num >= WORD_SIZE && *(const size_t *)a == *(const size_t *)b) {
+      a += WORD_SIZE;
+      b += WORD_SIZE;
+      num -= WORD_SIZE;
+    }
+  for (; num > 0; --num, ++a, ++b)
+    if (*a != *b)
+      return (int)*a - (int)*b;
+  return 0;
+}
+
+// Zero `num` bytes starting at the word-aligned `ptr`
+// `num` must be a multiple of 64, as is the case for whole pages
+void page_zero(void *ptr, size_t num) {
+  if (HAS_VECTOR()) {
+    size_t sstatus = vector_begin();
+    rvv_page_zero(ptr, num);
+    vector_end(sstatus);
+    return;
+  }
+  size_t *w = (size_t *)ptr;
+  for (; num > 0; num -= 8 * WORD_SIZE, w += 8) {
+    w[0] = 0;
+    w[1] = 0;
+    w[2] = 0;
+    w[3] = 0;
+    w[4] = 0;
+    w[5] = 0;
+    w[6] = 0;
+    w[7] = 0;
+  }
+}
+
+int strcmp(const char *str1, const char *str2) {
+  while (*str1 && *str1 == *str2) {
+    ++str1;
+    ++str2;
+  }
+  return (int)(uint8_t) * str1 - (int)(uint8_t) * str2;
+}
@@ -1,13 +1,20 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <stddef.h>
 #include "../plic/cpu.h"
 #include "../uart/uart.h"
 
+#ifdef HOST
+// Host-native builds (see misc/host/) abort instead
+void host_halt(void);
+#define HALT() host_halt()
+#else
 #define HALT() ({\
-  SET_MIE(0);\
+  SET_SIE(0);\
   asm volatile ("wfi");\
 })
+#endif
 
 #define PANIC(format, ...) ({\
   kprintf("Kernel panic at %s:%d:\n" format,\
@@ -26,5 +33,11 @@
 
 int toupper(int);
 char *strcpy(char *, const char *);
+int strcmp(const char *, const char *);
+void *memset(void *, int, size_t);
+void *memcpy(void *, const void *, size_t);
+void *memmove(void *, const void *, size_t);
+int memcmp(const void *, const void *, size_t);
+void page_zero(void *, size_t);
 
 #endif
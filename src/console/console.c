@@ -0,0 +1,269 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "console.h"
+#include "../common/common.h"
+#include "../common/boot.h"
+#include "../uart/uart.h"
+#include "../plic/cpu.h"
+#include "../process/process.h"
+#include "../process/sched.h"
+#include "../latency/latency.h"
+#include "../mm/page.h"
+#include "../mm/kmem.h"
+#include "../mm/ksm.h"
+#include "../mm/huge.h"
+#include "../rtc/rtc.h"
+
+// Most processes listed by `top`
+#define CONSOLE_TOP_MAX 32
+
+static char CONSOLE_LINE[CONSOLE_LINE_MAX];
+static size_t CONSOLE_LINE_LEN = 0;
+
+static void console_help(const char *);
+static void console_top(const char *);
+static void console_lat(const char *);
+static void console_mem(const char *);
+static void console_boot(const char *);
+static void console_ksm(const char *);
+static void console_huge(const char *);
+static void console_date(const char *);
+
+static const struct console_command CONSOLE_COMMANDS[] = {
+  {"help", "list commands", console_help},
+  {"top", "per-process CPU time, context switches, faults and memory",
+   console_top},
+  {"lat", "latency histograms; `lat reset` clears them", console_lat},
+  {"mem", "memory usage per NUMA zone, free extents and zram",
+   console_mem},
+  {"boot", "time taken by each boot phase", console_boot},
+  {"ksm", "same-page merging statistics; `ksm on|off` toggles it",
+   console_ksm},
+  {"huge", "transparent huge page statistics; `huge on|off` toggles them",
+   console_huge},
+  {"date", "wall-clock time; `date <seconds since 1970>` sets it",
+   console_date},
+};
+
+#define CONSOLE_NUM_COMMANDS \
+  (sizeof(CONSOLE_COMMANDS) / sizeof(CONSOLE_COMMANDS[0]))
+
+static void console_help(const char *args) {
+  for (size_t i = 0; i < CONSOLE_NUM_COMMANDS; ++i)
+    kprintf("%s - %s\n", CONSOLE_COMMANDS[i].name, CONSOLE_COMMANDS[i].help);
+}
+
+// Print `ticks` of mtime as milliseconds, to the microsecond
+static void console_print_ms(size_t ticks) {
+  size_t us = TICKS_TO_US(ticks);
+  kprintf("%lu.%lu%lu%lu", us / 1000, us / 100 % 10, us / 10 % 10, us % 10);
+}
+
+// The CONSOLE_TOP_MAX processes with the most CPU time so far, highest
+// first, out of TOP_TOTAL seen, as collected by console_top_add()
+static struct process *TOP_PROCESSES[CONSOLE_TOP_MAX];
+static size_t TOP_COUNT;
+static size_t TOP_TOTAL;
+
+#define CPU_TIME(process) ((process)->utime + (process)->stime)
+
+static void console_top_add(struct process *process) {
+  ++TOP_TOTAL;
+  if (TOP_COUNT == CONSOLE_TOP_MAX) {
+    if (CPU_TIME(TOP_PROCESSES[TOP_COUNT - 1]) >= CPU_TIME(process))
+      return;
+    --TOP_COUNT;
+  }
+  size_t i = TOP_COUNT++;
+  while (i > 0 && CPU_TIME(TOP_PROCESSES[i - 1]) < CPU_TIME(process)) {
+    TOP_PROCESSES[i] = TOP_PROCESSES[i - 1];
+    --i;
+  }
+  TOP_PROCESSES[i] = process;
+}
+
+// Like top(1): processes ordered by CPU time, highest first
+static void console_top(const char *args) {
+  TOP_COUNT = 0;
+  TOP_TOTAL = 0;
+  sched_for_each(console_top_add);
+  size_t total = TOP_TOTAL;
+  size_t count = TOP_COUNT;
+  struct process_stats stats[CONSOLE_TOP_MAX];
+  for (size_t i = 0; i < count; ++i)
+    process_get_stats(TOP_PROCESSES[i], &stats[i]);
+
+  size_t uptime = GET_MTIME();
+  kprintf("uptime ");
+  console_print_ms(uptime);
+  kprintf(" ms, %lu processes\n", total);
+  kprintf("  PID %%CPU     USER ms      SYS ms   VCSW  IVCSW FAULTS SYSCALLS"
+	  "  RSS   WS SWAP MISS THRT\n");
+  for (size_t i = 0; i < count; ++i) {
+    struct process_stats *s = &stats[i];
+    // Share of CPU since boot, in tenths of a percent
+    size_t permille = uptime != 0 ? (s->utime + s->stime) * 1000 / uptime : 0;
+    kprintf("%5lu %3lu.%lu ", s->pid, permille / 10, permille % 10);
+    console_print_ms(s->utime);
+    kprintf(" ");
+    console_print_ms(s->stime);
+    kprintf(" %6lu %6lu %6lu %8lu %4lu %4lu %4lu %4lu %4lu\n", s->nvcsw,
+	    s->nivcsw, s->page_faults, s->syscalls, s->resident_pages,
+	    s->working_set_pages, s->swapped_pages, s->deadline_misses,
+	    s->deadline_throttles);
+  }
+}
+
+static void console_lat(const char *args) {
+  if (args[0] == '\0')
+    latency_print_all();
+  else if (strcmp(args, "reset") == 0) {
+    latency_reset();
+    kprintf("Latency histograms cleared\n");
+  } else
+    kprintf("usage: lat [reset]\n");
+}
+
+static void console_mem(const char *args) {
+  struct mem_stats stats;
+  mem_get_stats(&stats, 1);
+  struct page_stats *pages = &stats.pages;
+  struct kmem_stats *kmem = &stats.kmem;
+  size_t kernel_pages = pages->metadata_pages + kmem->arena_bytes / PAGE_SIZE;
+  kprintf("pages: %lu total, %lu used, %lu free, %lu kernel "
+	  "(%lu metadata + %lu kmalloc arena), %lu failed allocations\n",
+	  pages->total_pages, pages->used_pages, pages->free_pages,
+	  kernel_pages, pages->metadata_pages, kmem->arena_bytes / PAGE_SIZE,
+	  pages->alloc_failures);
+  kprintf("kmalloc: %lu of %lu bytes in use (peak %lu) in %lu blocks, "
+	  "%lu failed allocations\n", kmem->bytes_in_use, kmem->arena_bytes,
+	  kmem->peak_bytes_in_use, kmem->allocations, kmem->alloc_failures);
+  for (size_t i = 0; i < pages->num_zones; ++i)
+    kprintf("  zone %p node %lu%s: %8lu pages, %8lu used, %8lu remote\n",
+	    pages->zones[i].start_addr, pages->zones[i].node,
+	    pages->zones[i].node == page_get_local_node()? " (local)" : "",
+	    pages->zones[i].total_pages, pages->zones[i].used_pages,
+	    pages->zones[i].remote_pages);
+  // Fraction of free memory outside the largest free extent, i.e. not
+  // available to the largest possible allocation
+  size_t fragmentation = pages->free_pages != 0 ?
+      (pages->free_pages - pages->largest_free_extent) * 100 /
+      pages->free_pages : 0;
+  kprintf("free extents: largest %lu pages, fragmentation %lu%%\n",
+	  pages->largest_free_extent, fragmentation);
+  for (size_t i = 0; i < PAGE_EXTENT_BUCKETS; ++i)
+    if (pages->free_extents[i] != 0)
+      kprintf("  %8lu - %8lu pages %8lu\n", 1ul << i, (2ul << i) - 1,
+	      pages->free_extents[i]);
+  struct zram_stats *zram = &stats.zram;
+  // Compression ratio, in hundredths
+  size_t ratio = zram->compressed_bytes != 0 ?
+      zram->stored_pages * PAGE_SIZE * 100 / zram->compressed_bytes : 0;
+  kprintf("zram: %lu pages in %lu bytes (%lu pool pages), ratio %lu.%lu%lu, "
+	  "%lu swap-outs, %lu swap-ins, %lu incompressible\n",
+	  zram->stored_pages, zram->compressed_bytes, zram->pool_pages,
+	  ratio / 100, ratio / 10 % 10, ratio % 10, zram->swap_outs,
+	  zram->swap_ins, zram->incompressible);
+}
+
+static void console_boot(const char *args) {
+  boot_print_phases();
+}
+
+static void console_ksm(const char *args) {
+  if (strcmp(args, "on") == 0)
+    ksm_set_enabled(1);
+  else if (strcmp(args, "off") == 0)
+    ksm_set_enabled(0);
+  else if (args[0] != '\0') {
+    kprintf("usage: ksm [on|off]\n");
+    return;
+  }
+  struct ksm_stats stats;
+  ksm_get_stats(&stats);
+  kprintf("ksm %s: %lu shared frames mapped %lu times (%lu pages saved), "
+	  "%lu pages scanned, %lu merged, %lu copy-on-write faults\n",
+	  ksm_enabled()? "on" : "off", stats.shared_frames, stats.sharing,
+	  stats.sharing - stats.shared_frames, stats.scanned, stats.merged,
+	  stats.unshared);
+}
+
+static void console_huge(const char *args) {
+  if (strcmp(args, "on") == 0)
+    huge_set_enabled(1);
+  else if (strcmp(args, "off") == 0)
+    huge_set_enabled(0);
+  else if (args[0] != '\0') {
+    kprintf("usage: huge [on|off]\n");
+    return;
+  }
+  struct huge_stats stats;
+  huge_get_stats(&stats);
+  kprintf("huge pages %s: %lu mapped, %lu allocated on fault "
+	  "(%lu fallbacks to 4 KiB), %lu collapsed, %lu split\n",
+	  huge_enabled()? "on" : "off", stats.mapped, stats.allocated,
+	  stats.fallbacks, stats.collapsed, stats.split);
+}
+
+static void console_date(const char *args) {
+  if (args[0] != '\0') {
+    uint64_t secs = 0;
+    for (const char *p = args; *p != '\0'; ++p) {
+      if (*p < '0' || *p > '9') {
+	kprintf("usage: date [seconds since 1970]\n");
+	return;
+      }
+      secs = secs * 10 + (*p - '0');
+    }
+    rtc_set(secs * NS_PER_SECOND);
+  }
+  rtc_print_date(rtc_now_ns());
+  kputchar('\n');
+}
+
+static void console_run(const char *line) {
+  while (*line == ' ')
+    ++line;
+  if (*line == '\0')
+    return;
+  for (size_t i = 0; i < CONSOLE_NUM_COMMANDS; ++i) {
+    const char *name = CONSOLE_COMMANDS[i].name;
+    size_t len = 0;
+    while (name[len] != '\0' && name[len] == line[len])
+      ++len;
+    if (name[len] == '\0' && (line[len] == '\0' || line[len] == ' ')) {
+      const char *args = &line[len];
+      while (*args == ' ')
+	++args;
+      CONSOLE_COMMANDS[i].run(args);
+      return;
+    }
+  }
+  kprintf("unknown command: %s (try help)\n", line);
+}
+
+// Handle a character received on the UART
+void console_input(char c) {
+  switch (c) {
+  case '\r':
+  case '\n':
+    kprintf("\n");
+    CONSOLE_LINE[CONSOLE_LINE_LEN] = '\0';
+    CONSOLE_LINE_LEN = 0;
+    console_run(CONSOLE_LINE);
+    break;
+  case 127:
+    // Backspace
+    if (CONSOLE_LINE_LEN > 0) {
+      --CONSOLE_LINE_LEN;
+      kprintf("%c %c", 8, 8);
+    }
+    break;
+  default:
+    if (CONSOLE_LINE_LEN < CONSOLE_LINE_MAX - 1
+	&& ' ' <= c && c <= '~') {
+      CONSOLE_LINE[CONSOLE_LINE_LEN++] = c;
+      kputchar(c);
+    }
+  }
+}
@@ -0,0 +1,25 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stddef.h>
+
+/*
+ * Kernel console on the UART
+ *
+ * Received characters are echoed and collected into a line, which is
+ * run as a command when Enter is pressed. Type `help` for a list of
+ * commands
+ */
+
+#define CONSOLE_LINE_MAX 64
+
+struct console_command {
+  const char *name;
+  const char *help;
+  // Called with the rest of the line after the command name
+  void (*run)(const char *);
+};
+
+void console_input(char);
+
+#endif
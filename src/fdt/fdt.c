@@ -0,0 +1,269 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "fdt.h"
+#include "../common/common.h"
+#include "../uart/uart.h"
+#include "../mm/page.h"
+
+extern const size_t INIT_START;
+
+// QEMU virt defaults, see misc/riscv64-virt.dts
+struct platform PLATFORM = {
+  .ram_start = 0x80000000,
+  .ram_size = 0x8000000,
+  .total_ram = 0x8000000,
+  .memory = {{.start = 0x80000000,.size = 0x8000000,.node = 0}},
+  .num_memory = 1,
+  .num_harts = 1,
+  .timebase_frequency = 10000000,
+  .uart = 0x10000000,
+  .plic = 0xc000000,
+  .clint = 0x2000000,
+  .syscon = 0x100000,
+  .rtc = 0x101000,
+  .virtio = 0x10001000,
+  .virtio_slots = 8,
+};
+
+// What fdt_init() keeps track of for each node on the path to the
+// current one
+struct fdt_node {
+  const char *name;
+  // #address-cells and #size-cells, which apply to the children
+  size_t address_cells;
+  size_t size_cells;
+  const char *compatible;
+  size_t compatible_len;
+  const char *device_type;
+  const uint8_t *reg;
+  size_t reg_len;
+  size_t numa_node;
+};
+
+static uint32_t fdt32(const void *ptr) {
+  return __builtin_bswap32(*(const uint32_t *)ptr);
+}
+
+// Read a number made up of `cells` big endian 32-bit cells
+static size_t fdt_cells(const uint8_t *ptr, size_t cells) {
+  size_t value = 0;
+  for (size_t i = 0; i < cells; ++i)
+    value = (value << 32) | fdt32(&ptr[4 * i]);
+  return value;
+}
+
+// Whether the string list of a compatible property contains `name`
+static int fdt_is_compatible(struct fdt_node const *node, const char *name) {
+  const char *str = node->compatible;
+  if (str == NULL)
+    return 0;
+  const char *end = str + node->compatible_len;
+  while (str < end) {
+    if (strcmp(str, name) == 0)
+      return 1;
+    while (str < end && *str != '\0')
+      ++str;
+    ++str;
+  }
+  return 0;
+}
+
+// Collect what we need from a node once all its properties (and
+// children) have been seen
+static void fdt_visit(struct platform *platform, struct fdt_node *nodes,
+		      size_t depth) {
+  struct fdt_node *node = &nodes[depth];
+  // reg is encoded with the parent's #address-cells and #size-cells
+  size_t address_cells = depth > 0 ? nodes[depth - 1].address_cells : 2;
+  size_t size_cells = depth > 0 ? nodes[depth - 1].size_cells : 1;
+  size_t entry_len = 4 * (address_cells + size_cells);
+  size_t base = 0;
+  if (node->reg != NULL && node->reg_len >= entry_len)
+    base = fdt_cells(node->reg, address_cells);
+
+  if (node->device_type != NULL && strcmp(node->device_type, "memory") == 0) {
+    for (size_t i = 0; entry_len != 0 && i + entry_len <= node->reg_len;
+	 i += entry_len) {
+      size_t start = fdt_cells(&node->reg[i], address_cells);
+      size_t size = fdt_cells(&node->reg[i + 4 * address_cells], size_cells);
+      platform->total_ram += size;
+      if (size == 0 || platform->num_memory == PLATFORM_MAX_MEMORY)
+	continue;
+      // Insertion sort by address
+      size_t j = platform->num_memory++;
+      for (; j > 0 && platform->memory[j - 1].start > start; --j)
+	platform->memory[j] = platform->memory[j - 1];
+      platform->memory[j] = (struct platform_memory) {
+      .start = start,.size = size,.node = node->numa_node};
+    }
+  } else if (node->device_type != NULL
+	     && strcmp(node->device_type, "cpu") == 0) {
+    ++platform->num_harts;
+    // The reg of a cpu node is its hart ID
+    if (node->reg != NULL && node->reg_len >= 4 * address_cells
+	&& base < PLATFORM_MAX_HARTS)
+      platform->hart_node[base] = node->numa_node;
+  }
+  else if (base == 0)
+    return;
+  else if (fdt_is_compatible(node, "ns16550a"))
+    platform->uart = base;
+  else if (fdt_is_compatible(node, "riscv,plic0"))
+    platform->plic = base;
+  else if (fdt_is_compatible(node, "riscv,clint0"))
+    platform->clint = base;
+  else if (fdt_is_compatible(node, "sifive,test0"))
+    platform->syscon = base;
+  else if (fdt_is_compatible(node, "google,goldfish-rtc"))
+    platform->rtc = base;
+  else if (fdt_is_compatible(node, "virtio,mmio")) {
+    if (platform->virtio_slots == 0 || base < platform->virtio)
+      platform->virtio = base;
+    ++platform->virtio_slots;
+  }
+}
+
+// Find the RAM we are running from: the range containing INIT_START,
+// extended over any ranges directly adjacent to it (e.g. the same RAM
+// split between two NUMA nodes)
+static void fdt_find_ram(struct platform *platform) {
+  for (size_t i = 0; i < platform->num_memory; ++i) {
+    struct platform_memory *mem = &platform->memory[i];
+    if (INIT_START < mem->start || INIT_START - mem->start >= mem->size)
+      continue;
+    size_t first = i, last = i;
+    while (first > 0 && platform->memory[first - 1].start
+	   + platform->memory[first - 1].size == platform->memory[first].start)
+      --first;
+    while (last + 1 < platform->num_memory
+	   && platform->memory[last].start + platform->memory[last].size ==
+	   platform->memory[last + 1].start)
+      ++last;
+    platform->ram_start = platform->memory[first].start;
+    platform->ram_size = platform->memory[last].start
+	+ platform->memory[last].size - platform->ram_start;
+    return;
+  }
+}
+
+// Parse the device tree at `addr` into PLATFORM
+// Returns 0 on success and -1 (leaving PLATFORM as it is) if there is no
+// valid device tree at `addr`
+// Runs before paging is enabled, so that the tree can be anywhere in
+// memory; nothing refers to it afterwards
+int fdt_init(size_t addr) {
+  if (addr == 0 || addr % 8 != 0)
+    return -1;
+  const struct fdt_header *header = (const struct fdt_header *)addr;
+  if (fdt32(&header->magic) != FDT_MAGIC || fdt32(&header->version) < 16)
+    return -1;
+  const uint8_t *ptr = (const uint8_t *)addr + fdt32(&header->off_dt_struct);
+  const uint8_t *end = ptr + fdt32(&header->size_dt_struct);
+  const char *strings =
+      (const char *)addr + fdt32(&header->off_dt_strings);
+
+  struct platform platform = PLATFORM;
+  platform.total_ram = 0;
+  platform.num_memory = 0;
+  platform.num_harts = 0;
+  memset(platform.hart_node, 0, sizeof(platform.hart_node));
+  platform.virtio_slots = 0;
+  struct fdt_node nodes[FDT_MAX_DEPTH];
+  size_t depth = 0;		// number of nodes on the current path
+  while (ptr + 4 <= end) {
+    uint32_t token = fdt32(ptr);
+    ptr += 4;
+    switch (token) {
+    case FDT_BEGIN_NODE:
+      {
+	if (depth == FDT_MAX_DEPTH)
+	  return -1;
+	struct fdt_node *node = &nodes[depth++];
+	node->name = (const char *)ptr;
+	node->address_cells = 2;
+	node->size_cells = 1;
+	node->compatible = NULL;
+	node->compatible_len = 0;
+	node->device_type = NULL;
+	node->reg = NULL;
+	node->reg_len = 0;
+	node->numa_node = 0;
+	// The name is NUL terminated and padded to 4 bytes
+	while (ptr < end && *ptr != '\0')
+	  ++ptr;
+	ptr = (const uint8_t *)align_val((size_t)ptr + 1, 2);
+      }
+      break;
+    case FDT_END_NODE:
+      if (depth == 0)
+	return -1;
+      fdt_visit(&platform, nodes, --depth);
+      break;
+    case FDT_PROP:
+      {
+	if (depth == 0 || ptr + 8 > end)
+	  return -1;
+	size_t len = fdt32(ptr);
+	const char *name = strings + fdt32(ptr + 4);
+	const uint8_t *value = ptr + 8;
+	ptr = (const uint8_t *)align_val((size_t)value + len, 2);
+	struct fdt_node *node = &nodes[depth - 1];
+	if (strcmp(name, "#address-cells") == 0 && len == 4)
+	  node->address_cells = fdt32(value);
+	else if (strcmp(name, "#size-cells") == 0 && len == 4)
+	  node->size_cells = fdt32(value);
+	else if (strcmp(name, "compatible") == 0) {
+	  node->compatible = (const char *)value;
+	  node->compatible_len = len;
+	} else if (strcmp(name, "device_type") == 0)
+	  node->device_type = (const char *)value;
+	else if (strcmp(name, "reg") == 0) {
+	  node->reg = value;
+	  node->reg_len = len;
+	} else if (strcmp(name, "numa-node-id") == 0 && len == 4)
+	  node->numa_node = fdt32(value);
+	else if (strcmp(name, "timebase-frequency") == 0
+		   && (len == 4 || len == 8))
+	  platform.timebase_frequency = fdt_cells(value, len / 4);
+      }
+      break;
+    case FDT_NOP:
+      break;
+    case FDT_END:
+      if (depth != 0)
+	return -1;
+      if (platform.num_harts == 0)
+	platform.num_harts = 1;
+      if (platform.num_memory == 0) {
+	memcpy(platform.memory, PLATFORM.memory, sizeof(platform.memory));
+	platform.num_memory = PLATFORM.num_memory;
+	platform.total_ram = PLATFORM.total_ram;
+      }
+      fdt_find_ram(&platform);
+      if (platform.virtio_slots == 0) {
+	platform.virtio = PLATFORM.virtio;
+	platform.virtio_slots = PLATFORM.virtio_slots;
+      }
+      PLATFORM = platform;
+      return 0;
+    default:
+      return -1;
+    }
+  }
+  return -1;
+}
+
+void fdt_print(void) {
+  kprintf("RAM: %lu MiB at %p (%lu MiB in total), %lu hart(s), "
+	  "timebase %lu Hz\n", PLATFORM.ram_size >> 20, PLATFORM.ram_start,
+	  PLATFORM.total_ram >> 20, PLATFORM.num_harts,
+	  PLATFORM.timebase_frequency);
+  kprintf("UART at %p, PLIC at %p, CLINT at %p, syscon at %p, RTC at %p, "
+	  "%lu virtio-mmio slot(s) at %p\n", PLATFORM.uart, PLATFORM.plic,
+	  PLATFORM.clint, PLATFORM.syscon, PLATFORM.rtc, PLATFORM.virtio_slots,
+	  PLATFORM.virtio);
+  for (size_t i = 0; i < PLATFORM.num_memory; ++i)
+    kprintf("Memory [%p, %p) on node %lu\n", PLATFORM.memory[i].start,
+	    PLATFORM.memory[i].start + PLATFORM.memory[i].size,
+	    PLATFORM.memory[i].node);
+}
@@ -0,0 +1,95 @@
+#ifndef FDT_H
+#define FDT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Flattened device tree (FDT)
+ *
+ * QEMU passes the address of a flattened device tree in a1 on reset,
+ * which _start saves in BOOT_FDT (see src/asm/crt0.s). fdt_init() walks
+ * it once during boot and fills in PLATFORM with the RAM range, number
+ * of harts, timebase frequency and device addresses it finds, along
+ * with the NUMA node (numa-node-id property) of each memory range and
+ * hart, which default to node 0
+ *
+ * PLATFORM starts out with the values for the QEMU virt board with
+ * 128 MiB of RAM (see misc/riscv64-virt.dts), which are kept for
+ * anything the tree does not describe, or if there is no valid tree
+ *
+ * See the Devicetree Specification, chapter 5 (Flattened Devicetree
+ * (DTB) Format): https://www.devicetree.org/specifications/
+ */
+
+#define FDT_MAGIC 0xd00dfeed
+
+// Structure block tokens
+#define FDT_BEGIN_NODE 0x1
+#define FDT_END_NODE 0x2
+#define FDT_PROP 0x3
+#define FDT_NOP 0x4
+#define FDT_END 0x9
+
+// Deepest node nesting fdt_init() follows
+#define FDT_MAX_DEPTH 8
+
+// Most /memory ranges and harts whose NUMA node is recorded
+#define PLATFORM_MAX_MEMORY 8
+#define PLATFORM_MAX_HARTS 8
+
+// All fields are big endian
+struct fdt_header {
+  uint32_t magic;
+  uint32_t totalsize;
+  uint32_t off_dt_struct;
+  uint32_t off_dt_strings;
+  uint32_t off_mem_rsvmap;
+  uint32_t version;
+  uint32_t last_comp_version;
+  uint32_t boot_cpuid_phys;
+  uint32_t size_dt_strings;
+  uint32_t size_dt_struct;
+};
+
+struct platform_memory {
+  size_t start;
+  size_t size;
+  size_t node;
+};
+
+struct platform {
+  // Contiguous RAM the kernel was loaded into, which may span several
+  // of the memory ranges below
+  size_t ram_start;
+  size_t ram_size;
+  // Sum of all /memory ranges, including any not usable by the kernel
+  size_t total_ram;
+  // /memory ranges in address order
+  struct platform_memory memory[PLATFORM_MAX_MEMORY];
+  size_t num_memory;
+  size_t num_harts;
+  // NUMA node of each hart, by hart ID
+  size_t hart_node[PLATFORM_MAX_HARTS];
+  // mtime ticks per second
+  size_t timebase_frequency;
+  size_t uart;
+  size_t plic;
+  size_t clint;
+  size_t syscon;
+  size_t rtc;
+  // Lowest virtio-mmio slot and number of slots, which are assumed to
+  // be VIRTIO_MMIO_STRIDE apart and use consecutive interrupt sources
+  size_t virtio;
+  size_t virtio_slots;
+};
+
+extern struct platform PLATFORM;
+
+// Set by _start in src/asm/crt0.s
+extern const size_t BOOT_FDT;
+
+int fdt_init(size_t);
+void fdt_print(void);
+
+#endif
@@ -0,0 +1,380 @@
+#include <stdbool.h>
+#include "ext2.h"
+#include "../virtio/block.h"
+#include "../common/common.h"
+#include "../uart/uart.h"
+#include "../mm/page.h"
+#include "../mm/kmem.h"
+
+// Small direct-mapped cache of metadata blocks (bitmaps, inode tables,
+// indirect blocks and directories)
+// File contents never go through here - see page_cache.c
+#define EXT2_NUM_BUFFERS 32
+
+struct ext2_buffer {
+  uint32_t block;
+  bool valid;
+  void *data;
+};
+
+static struct ext2_superblock EXT2_SB;
+static struct ext2_group_desc *EXT2_GDT = NULL;
+static size_t EXT2_NUM_GROUPS = 0;
+static size_t EXT2_BLOCK_SIZE = 0;
+static size_t EXT2_INODE_SIZE = 0;
+static bool EXT2_MOUNTED = false;
+static bool EXT2_SB_DIRTY = false;
+static struct ext2_buffer EXT2_BUFFERS[EXT2_NUM_BUFFERS];
+static struct ext2_inode_info *EXT2_INODES = NULL;
+
+int ext2_mounted(void) {
+  return EXT2_MOUNTED;
+}
+
+size_t ext2_block_size(void) {
+  return EXT2_BLOCK_SIZE;
+}
+
+size_t ext2_block_to_sector(uint32_t block) {
+  return (size_t)block * (EXT2_BLOCK_SIZE >> BLOCK_SECTOR_ORDER);
+}
+
+// Return a pointer to the cached contents of `block`, reading it from
+// disk if necessary
+// The pointer is only valid until the next call to ext2_bread()
+static void *ext2_bread(uint32_t block) {
+  struct ext2_buffer *b = &EXT2_BUFFERS[block % EXT2_NUM_BUFFERS];
+  if (!b->valid || b->block != block) {
+    b->valid = false;
+    if (block_read(ext2_block_to_sector(block), b->data, EXT2_BLOCK_SIZE))
+      return NULL;
+    b->block = block;
+    b->valid = true;
+  }
+  return b->data;
+}
+
+// Write a block previously returned by ext2_bread() back to disk
+static int ext2_bwrite(uint32_t block) {
+  struct ext2_buffer *b = &EXT2_BUFFERS[block % EXT2_NUM_BUFFERS];
+  ASSERT(b->valid
+	 && b->block == block,
+	 "ext2_bwrite(): block %d is not in the buffer cache\n", block);
+  return block_write(ext2_block_to_sector(block), b->data, EXT2_BLOCK_SIZE);
+}
+
+// Block holding the group descriptor table
+static uint32_t ext2_gdt_block(void) {
+  return EXT2_SB.s_first_data_block + 1;
+}
+
+int ext2_mount(void) {
+  if (!block_present())
+    return -1;
+  if (block_read
+      (EXT2_SUPERBLOCK_OFFSET >> BLOCK_SECTOR_ORDER, &EXT2_SB,
+       sizeof(struct ext2_superblock)))
+    return -1;
+  if (EXT2_SB.s_magic != EXT2_SUPER_MAGIC) {
+    kprintf("ext2_mount(): bad superblock magic %x\n", EXT2_SB.s_magic);
+    return -1;
+  }
+  if (EXT2_SB.s_rev_level >= 1
+      && (EXT2_SB.s_feature_incompat & ~EXT2_FEATURE_INCOMPAT_FILETYPE)) {
+    kprintf("ext2_mount(): unsupported incompatible features %x\n",
+	    EXT2_SB.s_feature_incompat);
+    return -1;
+  }
+  EXT2_BLOCK_SIZE = (size_t)EXT2_MIN_BLOCK_SIZE << EXT2_SB.s_log_block_size;
+  if (EXT2_BLOCK_SIZE > PAGE_SIZE) {
+    kprintf("ext2_mount(): block size %d exceeds the page size\n",
+	    EXT2_BLOCK_SIZE);
+    return -1;
+  }
+  EXT2_INODE_SIZE = EXT2_SB.s_rev_level >= 1 ? EXT2_SB.s_inode_size : 128;
+
+  for (size_t i = 0; i < EXT2_NUM_BUFFERS; ++i) {
+    EXT2_BUFFERS[i].valid = false;
+    EXT2_BUFFERS[i].data = alloc_page();
+    ASSERT(EXT2_BUFFERS[i].data != NULL,
+	   "ext2_mount(): failed to allocate metadata buffers\n");
+  }
+
+  // Read the whole group descriptor table into memory
+  EXT2_NUM_GROUPS =
+      (EXT2_SB.s_blocks_count - EXT2_SB.s_first_data_block +
+       EXT2_SB.s_blocks_per_group - 1) / EXT2_SB.s_blocks_per_group;
+  size_t gdt_bytes =
+      align_val(EXT2_NUM_GROUPS * sizeof(struct ext2_group_desc),
+		EXT2_SB.s_log_block_size + 10);
+  EXT2_GDT = alloc_pages(align_val(gdt_bytes, PAGE_ORDER) / PAGE_SIZE);
+  ASSERT(EXT2_GDT != NULL,
+	 "ext2_mount(): failed to allocate group descriptor table\n");
+  if (block_read
+      (ext2_block_to_sector(ext2_gdt_block()), EXT2_GDT, gdt_bytes))
+    return -1;
+
+  EXT2_MOUNTED = true;
+  kprintf("ext2: mounted volume with %d blocks of %d bytes in %d groups\n",
+	  EXT2_SB.s_blocks_count, EXT2_BLOCK_SIZE, EXT2_NUM_GROUPS);
+  return 0;
+}
+
+// Write back the superblock and the group descriptor table if any
+// allocation changed their free counts
+int ext2_sync_metadata(void) {
+  if (!EXT2_SB_DIRTY)
+    return 0;
+  EXT2_SB_DIRTY = false;
+  if (block_write
+      (EXT2_SUPERBLOCK_OFFSET >> BLOCK_SECTOR_ORDER, &EXT2_SB,
+       sizeof(struct ext2_superblock)))
+    return -1;
+  size_t gdt_bytes =
+      align_val(EXT2_NUM_GROUPS * sizeof(struct ext2_group_desc),
+		EXT2_SB.s_log_block_size + 10);
+  return block_write(ext2_block_to_sector(ext2_gdt_block()), EXT2_GDT,
+		     gdt_bytes);
+}
+
+// Location of an inode on disk
+static uint32_t ext2_inode_block(uint32_t ino, size_t *offset) {
+  size_t group = (ino - 1) / EXT2_SB.s_inodes_per_group;
+  size_t index = (ino - 1) % EXT2_SB.s_inodes_per_group;
+  size_t byte = index * EXT2_INODE_SIZE;
+  *offset = byte % EXT2_BLOCK_SIZE;
+  return EXT2_GDT[group].bg_inode_table + byte / EXT2_BLOCK_SIZE;
+}
+
+// Get the in-core inode for `ino`, reading it from disk if no one
+// else has it open
+struct ext2_inode_info *ext2_iget(uint32_t ino) {
+  if (ino == 0 || ino > EXT2_SB.s_inodes_count)
+    return NULL;
+  for (struct ext2_inode_info * i = EXT2_INODES; i != NULL; i = i->next)
+    if (i->ino == ino) {
+      ++i->refcount;
+      return i;
+    }
+  struct ext2_inode_info *inode = kmalloc(sizeof(struct ext2_inode_info));
+  if (inode == NULL)
+    return NULL;
+  size_t offset;
+  uint8_t *data = ext2_bread(ext2_inode_block(ino, &offset));
+  if (data == NULL) {
+    kfree(inode);
+    return NULL;
+  }
+  memcpy(&inode->raw, &data[offset], sizeof(struct ext2_inode));
+  inode->ino = ino;
+  inode->refcount = 1;
+  inode->next = EXT2_INODES;
+  EXT2_INODES = inode;
+  return inode;
+}
+
+void ext2_iput(struct ext2_inode_info *inode) {
+  if (inode == NULL || --inode->refcount > 0)
+    return;
+  struct ext2_inode_info **p = &EXT2_INODES;
+  while (*p != inode)
+    p = &(*p)->next;
+  *p = inode->next;
+  kfree(inode);
+}
+
+int ext2_write_inode(struct ext2_inode_info *inode) {
+  size_t offset;
+  uint32_t block = ext2_inode_block(inode->ino, &offset);
+  uint8_t *data = ext2_bread(block);
+  if (data == NULL)
+    return -1;
+  memcpy(&data[offset], &inode->raw, sizeof(struct ext2_inode));
+  return ext2_bwrite(block);
+}
+
+size_t ext2_inode_size(const struct ext2_inode_info *inode) {
+  size_t size = inode->raw.i_size;
+  if ((inode->raw.i_mode & EXT2_S_IFMT) == EXT2_S_IFREG)
+    size |= (size_t)inode->raw.i_size_high << 32;
+  return size;
+}
+
+void ext2_set_inode_size(struct ext2_inode_info *inode, size_t size) {
+  inode->raw.i_size = (uint32_t) size;
+  inode->raw.i_size_high = (uint32_t) (size >> 32);
+}
+
+// Allocate a free block, preferring the block group `hint`
+// Returns 0 if the volume is full
+static uint32_t ext2_alloc_block(size_t hint) {
+  for (size_t n = 0; n < EXT2_NUM_GROUPS; ++n) {
+    size_t group = (hint + n) % EXT2_NUM_GROUPS;
+    if (EXT2_GDT[group].bg_free_blocks_count == 0)
+      continue;
+    uint32_t bitmap_block = EXT2_GDT[group].bg_block_bitmap;
+    uint8_t *bitmap = ext2_bread(bitmap_block);
+    if (bitmap == NULL)
+      return 0;
+    size_t first = EXT2_SB.s_first_data_block +
+	group * EXT2_SB.s_blocks_per_group;
+    for (size_t bit = 0; bit < EXT2_SB.s_blocks_per_group; ++bit) {
+      if (first + bit >= EXT2_SB.s_blocks_count)
+	break;
+      if (bitmap[bit / 8] == 0xff) {
+	bit |= 7;
+	continue;
+      }
+      if (bitmap[bit / 8] & (1 << (bit % 8)))
+	continue;
+      bitmap[bit / 8] |= 1 << (bit % 8);
+      if (ext2_bwrite(bitmap_block))
+	return 0;
+      --EXT2_GDT[group].bg_free_blocks_count;
+      --EXT2_SB.s_free_blocks_count;
+      EXT2_SB_DIRTY = true;
+      return first + bit;
+    }
+  }
+  return 0;
+}
+
+// Allocate a block for `inode` and account for it in i_blocks
+static uint32_t ext2_alloc_inode_block(struct ext2_inode_info *inode,
+				       bool zero) {
+  size_t group = (inode->ino - 1) / EXT2_SB.s_inodes_per_group;
+  uint32_t block = ext2_alloc_block(group);
+  if (block == 0)
+    return 0;
+  inode->raw.i_blocks += EXT2_BLOCK_SIZE >> BLOCK_SECTOR_ORDER;
+  if (zero) {
+    struct ext2_buffer *b = &EXT2_BUFFERS[block % EXT2_NUM_BUFFERS];
+    memset(b->data, 0, EXT2_BLOCK_SIZE);
+    b->block = block;
+    b->valid = true;
+    if (ext2_bwrite(block))
+      return 0;
+  }
+  return block;
+}
+
+// Follow `depth` levels of indirection starting at *slot to find the
+// block holding logical block `index` of that subtree
+static uint32_t ext2_bmap_indirect(struct ext2_inode_info *inode,
+				   uint32_t * slot, size_t index, int depth,
+				   int create) {
+  uint32_t block = *slot;
+  if (block == 0) {
+    if (!create)
+      return 0;
+    block = ext2_alloc_inode_block(inode, depth > 0);
+    if (block == 0)
+      return 0;
+    *slot = block;
+  }
+  size_t ptrs_per_block = EXT2_BLOCK_SIZE / sizeof(uint32_t);
+  for (; depth > 0; --depth) {
+    size_t span = 1;
+    for (int i = 1; i < depth; ++i)
+      span *= ptrs_per_block;
+    size_t entry = index / span;
+    index %= span;
+    uint32_t *table = ext2_bread(block);
+    if (table == NULL)
+      return 0;
+    uint32_t next = table[entry];
+    if (next == 0) {
+      if (!create)
+	return 0;
+      next = ext2_alloc_inode_block(inode, depth > 1);
+      if (next == 0)
+	return 0;
+      // Allocation may have evicted our table from the buffer cache
+      table = ext2_bread(block);
+      if (table == NULL)
+	return 0;
+      table[entry] = next;
+      if (ext2_bwrite(block))
+	return 0;
+    }
+    block = next;
+  }
+  return block;
+}
+
+// Map logical block `lblock` of `inode` to a block on disk
+// If `create` is nonzero, missing blocks (and indirect blocks) are
+// allocated and the caller is responsible for writing back the inode
+// Returns 0 for holes, or on failure
+uint32_t ext2_bmap(struct ext2_inode_info *inode, size_t lblock, int create) {
+  size_t ptrs_per_block = EXT2_BLOCK_SIZE / sizeof(uint32_t);
+  uint32_t *blocks = inode->raw.i_block;
+  if (lblock < EXT2_NDIR_BLOCKS)
+    return ext2_bmap_indirect(inode, &blocks[lblock], 0, 0, create);
+  lblock -= EXT2_NDIR_BLOCKS;
+  if (lblock < ptrs_per_block)
+    return ext2_bmap_indirect(inode, &blocks[EXT2_IND_BLOCK], lblock, 1,
+			      create);
+  lblock -= ptrs_per_block;
+  if (lblock < ptrs_per_block * ptrs_per_block)
+    return ext2_bmap_indirect(inode, &blocks[EXT2_DIND_BLOCK], lblock, 2,
+			      create);
+  lblock -= ptrs_per_block * ptrs_per_block;
+  return ext2_bmap_indirect(inode, &blocks[EXT2_TIND_BLOCK], lblock, 3,
+			    create);
+}
+
+// Look up `name` (of length `len`) in directory `dir`
+static uint32_t ext2_dir_lookup(struct ext2_inode_info *dir, const char *name,
+				size_t len) {
+  size_t size = ext2_inode_size(dir);
+  for (size_t lblock = 0; lblock * EXT2_BLOCK_SIZE < size; ++lblock) {
+    uint32_t block = ext2_bmap(dir, lblock, 0);
+    if (block == 0)
+      continue;
+    uint8_t *data = ext2_bread(block);
+    if (data == NULL)
+      return 0;
+    size_t offset = 0;
+    while (offset < EXT2_BLOCK_SIZE) {
+      struct ext2_dir_entry *entry = (struct ext2_dir_entry *)&data[offset];
+      if (entry->rec_len == 0)
+	break;
+      if (entry->inode != 0 && entry->name_len == len) {
+	size_t i = 0;
+	while (i < len && entry->name[i] == name[i])
+	  ++i;
+	if (i == len)
+	  return entry->inode;
+      }
+      offset += entry->rec_len;
+    }
+  }
+  return 0;
+}
+
+// Resolve an absolute path to an inode number, or 0 if not found
+uint32_t ext2_lookup(const char *path) {
+  if (!EXT2_MOUNTED || path == NULL || *path != '/')
+    return 0;
+  uint32_t ino = EXT2_ROOT_INO;
+  while (*path) {
+    while (*path == '/')
+      ++path;
+    if (!*path)
+      break;
+    const char *end = path;
+    while (*end && *end != '/')
+      ++end;
+    struct ext2_inode_info *dir = ext2_iget(ino);
+    if (dir == NULL)
+      return 0;
+    ino = (dir->raw.i_mode & EXT2_S_IFMT) == EXT2_S_IFDIR ?
+	ext2_dir_lookup(dir, path, end - path) : 0;
+    ext2_iput(dir);
+    if (ino == 0)
+      return 0;
+    path = end;
+  }
+  return ino;
+}
@@ -0,0 +1,142 @@
+#ifndef EXT2_H
+#define EXT2_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Second extended filesystem (ext2)
+ * See https://www.nongnu.org/ext2-doc/ext2.html for the on-disk format
+ *
+ * Test images can be created on the host with, e.g.
+ * `mke2fs -t ext2 -b 4096 -d <directory> hdd.img 32M`
+ */
+
+// The superblock always lives at byte offset 1024 of the volume
+#define EXT2_SUPERBLOCK_OFFSET 1024
+// Block sizes are 1024 << s_log_block_size
+#define EXT2_MIN_BLOCK_SIZE 1024
+#define EXT2_SUPER_MAGIC 0xEF53
+#define EXT2_ROOT_INO 2
+
+// Number of direct, single, double and triple indirect block pointers
+#define EXT2_NDIR_BLOCKS 12
+#define EXT2_IND_BLOCK 12
+#define EXT2_DIND_BLOCK 13
+#define EXT2_TIND_BLOCK 14
+#define EXT2_N_BLOCKS 15
+
+// Feature flags we understand
+#define EXT2_FEATURE_INCOMPAT_FILETYPE 0x0002
+#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER 0x0001
+#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE 0x0002
+
+// Inode mode
+#define EXT2_S_IFMT 0xF000
+#define EXT2_S_IFREG 0x8000
+#define EXT2_S_IFDIR 0x4000
+
+struct ext2_superblock {
+  uint32_t s_inodes_count;
+  uint32_t s_blocks_count;
+  uint32_t s_r_blocks_count;
+  uint32_t s_free_blocks_count;
+  uint32_t s_free_inodes_count;
+  uint32_t s_first_data_block;
+  uint32_t s_log_block_size;
+  uint32_t s_log_frag_size;
+  uint32_t s_blocks_per_group;
+  uint32_t s_frags_per_group;
+  uint32_t s_inodes_per_group;
+  uint32_t s_mtime;
+  uint32_t s_wtime;
+  uint16_t s_mnt_count;
+  uint16_t s_max_mnt_count;
+  uint16_t s_magic;
+  uint16_t s_state;
+  uint16_t s_errors;
+  uint16_t s_minor_rev_level;
+  uint32_t s_lastcheck;
+  uint32_t s_checkinterval;
+  uint32_t s_creator_os;
+  uint32_t s_rev_level;
+  uint16_t s_def_resuid;
+  uint16_t s_def_resgid;
+  // EXT2_DYNAMIC_REV (revision 1) only
+  uint32_t s_first_ino;
+  uint16_t s_inode_size;
+  uint16_t s_block_group_nr;
+  uint32_t s_feature_compat;
+  uint32_t s_feature_incompat;
+  uint32_t s_feature_ro_compat;
+  uint8_t s_uuid[16];
+  char s_volume_name[16];
+  uint8_t s_padding[1024 - 136];
+};
+
+struct ext2_group_desc {
+  uint32_t bg_block_bitmap;
+  uint32_t bg_inode_bitmap;
+  uint32_t bg_inode_table;
+  uint16_t bg_free_blocks_count;
+  uint16_t bg_free_inodes_count;
+  uint16_t bg_used_dirs_count;
+  uint16_t bg_pad;
+  uint32_t bg_reserved[3];
+};
+
+struct ext2_inode {
+  uint16_t i_mode;
+  uint16_t i_uid;
+  uint32_t i_size;
+  uint32_t i_atime;
+  uint32_t i_ctime;
+  uint32_t i_mtime;
+  uint32_t i_dtime;
+  uint16_t i_gid;
+  uint16_t i_links_count;
+  uint32_t i_blocks;
+  uint32_t i_flags;
+  uint32_t i_osd1;
+  uint32_t i_block[EXT2_N_BLOCKS];
+  uint32_t i_generation;
+  uint32_t i_file_acl;
+  uint32_t i_size_high;
+  uint32_t i_faddr;
+  uint8_t i_osd2[12];
+};
+
+struct ext2_dir_entry {
+  uint32_t inode;
+  uint16_t rec_len;
+  uint8_t name_len;
+  uint8_t file_type;
+  char name[];
+};
+
+// In-core inode
+// Every open file of the same inode shares one of these so that
+// sizes and block pointers stay consistent between them
+struct ext2_inode_info {
+  uint32_t ino;
+  uint32_t refcount;
+  struct ext2_inode raw;
+  struct ext2_inode_info *next;
+};
+
+int ext2_mount(void);
+int ext2_mounted(void);
+size_t ext2_block_size(void);
+size_t ext2_block_to_sector(uint32_t);
+int ext2_sync_metadata(void);
+
+struct ext2_inode_info *ext2_iget(uint32_t);
+void ext2_iput(struct ext2_inode_info *);
+int ext2_write_inode(struct ext2_inode_info *);
+size_t ext2_inode_size(const struct ext2_inode_info *);
+void ext2_set_inode_size(struct ext2_inode_info *, size_t);
+
+uint32_t ext2_lookup(const char *);
+uint32_t ext2_bmap(struct ext2_inode_info *, size_t, int);
+
+#endif
@@ -0,0 +1,201 @@
+#include <stdbool.h>
+#include "file.h"
+#include "page_cache.h"
+#include "../common/common.h"
+#include "../mm/kmem.h"
+#include "../mm/page.h"
+
+struct file *file_open(const char *path, int flags) {
+  uint32_t ino = ext2_lookup(path);
+  if (ino == 0)
+    return NULL;
+  struct ext2_inode_info *inode = ext2_iget(ino);
+  if (inode == NULL)
+    return NULL;
+  if ((inode->raw.i_mode & EXT2_S_IFMT) != EXT2_S_IFREG) {
+    ext2_iput(inode);
+    return NULL;
+  }
+  struct file *file = kmalloc(sizeof(struct file));
+  if (file == NULL) {
+    ext2_iput(inode);
+    return NULL;
+  }
+  file->inode = inode;
+  file->offset = 0;
+  file->flags = flags;
+  file->ra_next = 0;
+  file->ra_window = PAGE_CACHE_RA_MIN / 2;
+  return file;
+}
+
+void file_close(struct file *file) {
+  if (file == NULL)
+    return;
+  if ((file->flags & O_ACCMODE) != O_RDONLY)
+    page_cache_writeback(file->inode);
+  ext2_iput(file->inode);
+  kfree(file);
+}
+
+// Number of pages to read ahead when accessing page `index`
+// Sequential readers get a window that doubles up to PAGE_CACHE_RA_MAX,
+// random readers get none
+static size_t file_readahead(struct file *file, size_t index) {
+  if (index + 1 == file->ra_next)
+    return 0;
+  if (index == file->ra_next) {
+    if (file->ra_window < PAGE_CACHE_RA_MIN)
+      file->ra_window = PAGE_CACHE_RA_MIN;
+    else if (file->ra_window < PAGE_CACHE_RA_MAX)
+      file->ra_window *= 2;
+  } else
+    file->ra_window = 0;
+  file->ra_next = index + 1;
+  return file->ra_window;
+}
+
+// Read up to `len` bytes at the current offset into the user buffer at
+// virtual address `buf`
+size_t file_read(struct file *file, struct page_table *root, size_t buf,
+		 size_t len) {
+  if ((file->flags & O_ACCMODE) == O_WRONLY)
+    return FILE_ERROR;
+  size_t size = ext2_inode_size(file->inode);
+  if (file->offset >= size)
+    return 0;
+  if (len > size - file->offset)
+    len = size - file->offset;
+  size_t done = 0;
+  while (done < len) {
+    size_t index = file->offset / PAGE_SIZE;
+    size_t pgoff = file->offset % PAGE_SIZE;
+    size_t chunk = PAGE_SIZE - pgoff;
+    if (chunk > len - done)
+      chunk = len - done;
+    struct cache_page *page =
+	page_cache_get(file->inode, index, file_readahead(file, index));
+    if (page == NULL)
+      return done > 0 ? done : FILE_ERROR;
+    size_t copied = copy_to_user(root, buf + done,
+				 &((uint8_t *) page->data)[pgoff], chunk);
+    done += copied;
+    file->offset += copied;
+    if (copied < chunk)
+      return done > 0 ? done : FILE_ERROR;
+  }
+  return done;
+}
+
+// Write `len` bytes from the user buffer at virtual address `buf` at the
+// current offset, growing the file as necessary
+// Data lands in the page cache and reaches the disk in batches
+size_t file_write(struct file *file, struct page_table *root, size_t buf,
+		  size_t len) {
+  if ((file->flags & O_ACCMODE) == O_RDONLY)
+    return FILE_ERROR;
+  struct ext2_inode_info *inode = file->inode;
+  size_t block_size = ext2_block_size();
+  uint32_t old_blocks = inode->raw.i_blocks;
+  size_t old_size = ext2_inode_size(inode);
+  size_t done = 0;
+  while (done < len) {
+    size_t index = file->offset / PAGE_SIZE;
+    size_t pgoff = file->offset % PAGE_SIZE;
+    size_t chunk = PAGE_SIZE - pgoff;
+    if (chunk > len - done)
+      chunk = len - done;
+    struct cache_page *page =
+	page_cache_get_for_write(inode, index, chunk == PAGE_SIZE);
+    if (page == NULL)
+      break;
+
+    // Allocate disk blocks now so that writeback never has to
+    size_t first = file->offset / block_size;
+    size_t last = (file->offset + chunk - 1) / block_size;
+    bool allocated = true;
+    for (size_t lblock = first; lblock <= last; ++lblock)
+      if (ext2_bmap(inode, lblock, 1) == 0) {
+	allocated = false;
+	break;
+      }
+    if (!allocated)
+      break;
+
+    size_t copied = copy_from_user(root, &((uint8_t *) page->data)[pgoff],
+				   buf + done, chunk);
+    page_cache_mark_dirty(page);
+    done += copied;
+    file->offset += copied;
+    if (file->offset > ext2_inode_size(inode))
+      ext2_set_inode_size(inode, file->offset);
+    if (copied < chunk)
+      break;
+  }
+  if (inode->raw.i_blocks != old_blocks || ext2_inode_size(inode) != old_size)
+    ext2_write_inode(inode);
+  return done > 0 || len == 0 ? done : FILE_ERROR;
+}
+
+size_t file_seek(struct file *file, size_t offset, int whence) {
+  switch (whence) {
+  case SEEK_SET:
+    file->offset = offset;
+    break;
+  case SEEK_CUR:
+    file->offset += offset;
+    break;
+  case SEEK_END:
+    file->offset = ext2_inode_size(file->inode) + offset;
+    break;
+  default:
+    return FILE_ERROR;
+  }
+  return file->offset;
+}
+
+// Map `len` bytes of the file starting at page-aligned `offset` into
+// `root` at virtual address `vaddr`
+// Page cache pages are mapped directly, so nothing is copied and all
+// mappings of the same file share the same physical pages
+// The pages stay pinned in the page cache, and the inode referenced, until
+// the mapping is dropped with file_munmap()
+// Returns the number of bytes mapped, which stops short at end of file
+size_t file_mmap(struct file *file, struct page_table *root, size_t vaddr,
+		 size_t offset, size_t len, int prot) {
+  if (offset % PAGE_SIZE != 0 || vaddr % PAGE_SIZE != 0)
+    return FILE_ERROR;
+  if ((prot & PROT_WRITE) && (file->flags & O_ACCMODE) == O_RDONLY)
+    return FILE_ERROR;
+  size_t size = ext2_inode_size(file->inode);
+  size_t num_pages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+  uint64_t bits = PTE_USER | PTE_READ | (prot & PROT_WRITE ? PTE_WRITE : 0);
+  size_t i = 0;
+  for (; i < num_pages; ++i) {
+    size_t index = offset / PAGE_SIZE + i;
+    if (index * PAGE_SIZE >= size)
+      break;
+    struct cache_page *page =
+	page_cache_get(file->inode, index, num_pages - i - 1);
+    if (page == NULL)
+      break;
+    page_cache_map(page, prot & PROT_WRITE);
+    map(root, vaddr + i * PAGE_SIZE, (size_t)page->data, bits, 0);
+  }
+  asm volatile ("sfence.vma");
+  if (i != 0)
+    ++file->inode->refcount;
+  return i * PAGE_SIZE;
+}
+
+// Drop a mapping of `len` bytes of `inode` from page-aligned `offset` on,
+// as returned by file_mmap(), once its page table entries are gone
+void file_munmap(struct ext2_inode_info *inode, size_t offset, size_t len) {
+  for (size_t i = 0; i < len / PAGE_SIZE; ++i)
+    page_cache_unmap(inode, offset / PAGE_SIZE + i);
+  ext2_iput(inode);
+}
+
+int file_sync(void) {
+  return page_cache_writeback(NULL);
+}
@@ -0,0 +1,50 @@
+#ifndef FILE_H
+#define FILE_H
+
+#include <stddef.h>
+#include "ext2.h"
+#include "../mm/sv39.h"
+
+// Open flags
+#define O_RDONLY 0
+#define O_WRONLY 1
+#define O_RDWR 2
+#define O_ACCMODE 3
+
+// mmap protection flags
+#define PROT_READ (1 << 0)
+#define PROT_WRITE (1 << 1)
+
+// Seek origins
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+
+// Maximum length of a path passed in from user space
+#define FILE_PATH_MAX 256
+
+// Error return value for the file operations below
+#define FILE_ERROR ((size_t)-1)
+
+// An open file
+// `ra_next` and `ra_window` track sequential access for readahead:
+// reading page `ra_next` grows the window, anything else resets it
+struct file {
+  struct ext2_inode_info *inode;
+  size_t offset;
+  int flags;
+  size_t ra_next;
+  size_t ra_window;
+};
+
+struct file *file_open(const char *, int);
+void file_close(struct file *);
+size_t file_read(struct file *, struct page_table *, size_t, size_t);
+size_t file_write(struct file *, struct page_table *, size_t, size_t);
+size_t file_seek(struct file *, size_t, int);
+size_t file_mmap(struct file *, struct page_table *, size_t, size_t, size_t,
+		 int);
+void file_munmap(struct ext2_inode_info *, size_t, size_t);
+int file_sync(void);
+
+#endif
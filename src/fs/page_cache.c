@@ -0,0 +1,317 @@
+#include <stdbool.h>
+#include "page_cache.h"
+#include "ext2.h"
+#include "../virtio/block.h"
+#include "../common/common.h"
+#include "../mm/page.h"
+#include "../mm/kmem.h"
+
+static struct cache_page *PAGE_CACHE_HASH[PAGE_CACHE_HASH_SIZE];
+
+// Most recently used page at the head, least recently used at the tail
+static struct cache_page *PAGE_CACHE_LRU_HEAD = NULL;
+static struct cache_page *PAGE_CACHE_LRU_TAIL = NULL;
+
+static struct page_cache_stats PAGE_CACHE_STATS;
+
+// Dirty pages that page_cache_writeback() can clean, i.e. those not
+// mapped writable, which alone count towards PAGE_CACHE_DIRTY_BATCH
+static size_t PAGE_CACHE_CLEANABLE = 0;
+
+struct page_cache_stats page_cache_get_stats(void) {
+  return PAGE_CACHE_STATS;
+}
+
+static size_t page_cache_hash(uint32_t ino, size_t index) {
+  size_t h = ((size_t)ino * 0x9E3779B97F4A7C15ull) ^ index;
+  return (h ^ (h >> 29)) & (PAGE_CACHE_HASH_SIZE - 1);
+}
+
+static void lru_unlink(struct cache_page *page) {
+  if (page->lru_prev != NULL)
+    page->lru_prev->lru_next = page->lru_next;
+  else
+    PAGE_CACHE_LRU_HEAD = page->lru_next;
+  if (page->lru_next != NULL)
+    page->lru_next->lru_prev = page->lru_prev;
+  else
+    PAGE_CACHE_LRU_TAIL = page->lru_prev;
+}
+
+static void lru_push_front(struct cache_page *page) {
+  page->lru_prev = NULL;
+  page->lru_next = PAGE_CACHE_LRU_HEAD;
+  if (PAGE_CACHE_LRU_HEAD != NULL)
+    PAGE_CACHE_LRU_HEAD->lru_prev = page;
+  else
+    PAGE_CACHE_LRU_TAIL = page;
+  PAGE_CACHE_LRU_HEAD = page;
+}
+
+static struct cache_page *page_cache_lookup(struct ext2_inode_info *inode,
+					    size_t index) {
+  struct cache_page *page =
+      PAGE_CACHE_HASH[page_cache_hash(inode->ino, index)];
+  while (page != NULL && (page->inode != inode || page->index != index))
+    page = page->hash_next;
+  return page;
+}
+
+static void page_cache_remove(struct cache_page *page) {
+  struct cache_page **p =
+      &PAGE_CACHE_HASH[page_cache_hash(page->inode->ino, page->index)];
+  while (*p != page)
+    p = &(*p)->hash_next;
+  *p = page->hash_next;
+  lru_unlink(page);
+  dealloc_pages(page->data);
+  ext2_iput(page->inode);
+  kfree(page);
+  --PAGE_CACHE_STATS.pages;
+  ++PAGE_CACHE_STATS.evicted;
+}
+
+// Evict up to `n` clean, unmapped pages from the cold end of the LRU list
+// Dirty pages are written back first
+// Returns the number of pages evicted
+size_t page_cache_evict(size_t n) {
+  size_t evicted = 0;
+  bool wrote_back = false;
+  struct cache_page *page = PAGE_CACHE_LRU_TAIL;
+  while (page != NULL && evicted < n) {
+    struct cache_page *prev = page->lru_prev;
+    if (page->mapcount == 0) {
+      if ((page->flags & CACHE_DIRTY) && !wrote_back) {
+	// Write back everything at once rather than page by page
+	page_cache_writeback(NULL);
+	wrote_back = true;
+      }
+      if (!(page->flags & CACHE_DIRTY)) {
+	page_cache_remove(page);
+	++evicted;
+      }
+    }
+    page = prev;
+  }
+  return evicted;
+}
+
+// Drop a mapping of page `index` of `inode` made by file_mmap(): once
+// it is no longer mapped anywhere it can be evicted again, and is only
+// written back once more if it was mapped writable
+void page_cache_unmap(struct ext2_inode_info *inode, size_t index) {
+  struct cache_page *page = page_cache_lookup(inode, index);
+  if (page == NULL || page->mapcount == 0)
+    return;
+  if (--page->mapcount != 0 || !(page->flags & CACHE_MAPPED_WRITE))
+    return;
+  page->flags &= ~CACHE_MAPPED_WRITE;
+  if (page->flags & CACHE_DIRTY)
+    ++PAGE_CACHE_CLEANABLE;
+}
+
+// Allocate an empty (not up to date) cache page for (inode, index)
+static struct cache_page *page_cache_alloc(struct ext2_inode_info *inode,
+					   size_t index) {
+  if (PAGE_CACHE_STATS.pages >= PAGE_CACHE_MAX_PAGES)
+    page_cache_evict(PAGE_CACHE_RA_MAX);
+  void *data = alloc_page();
+  if (data == NULL && page_cache_evict(PAGE_CACHE_RA_MAX) > 0)
+    data = alloc_page();
+  if (data == NULL)
+    return NULL;
+  struct cache_page *page = kmalloc(sizeof(struct cache_page));
+  if (page == NULL) {
+    dealloc_pages(data);
+    return NULL;
+  }
+  // Each cached page holds a reference to its inode
+  ++inode->refcount;
+  page->inode = inode;
+  page->index = index;
+  page->data = data;
+  page->flags = 0;
+  page->mapcount = 0;
+  size_t bucket = page_cache_hash(inode->ino, index);
+  page->hash_next = PAGE_CACHE_HASH[bucket];
+  PAGE_CACHE_HASH[bucket] = page;
+  lru_push_front(page);
+  ++PAGE_CACHE_STATS.pages;
+  return page;
+}
+
+// Collect the disk segments backing `page`
+// Holes and blocks past the end of file are left zeroed in memory
+// Adjacent blocks are merged into a single segment
+static size_t page_segments(struct cache_page *page,
+			    struct block_segment *segs) {
+  size_t block_size = ext2_block_size();
+  size_t blocks_per_page = PAGE_SIZE / block_size;
+  size_t size = ext2_inode_size(page->inode);
+  size_t n = 0;
+  for (size_t i = 0; i < blocks_per_page; ++i) {
+    size_t lblock = page->index * blocks_per_page + i;
+    if (lblock * block_size >= size)
+      break;
+    uint32_t block = ext2_bmap(page->inode, lblock, 0);
+    if (block == 0)
+      continue;
+    size_t sector = ext2_block_to_sector(block);
+    uint8_t *buf = &((uint8_t *) page->data)[i * block_size];
+    if (n > 0 && segs[n - 1].sector +
+	(segs[n - 1].len >> BLOCK_SECTOR_ORDER) == sector
+	&& (uint8_t *) segs[n - 1].buf + segs[n - 1].len == buf)
+      segs[n - 1].len += block_size;
+    else {
+      segs[n].sector = sector;
+      segs[n].buf = buf;
+      segs[n].len = block_size;
+      ++n;
+    }
+  }
+  return n;
+}
+
+// Segments of a readahead batch, at most one per block of each page
+// Too big for the kernel stack
+static struct block_segment
+    FILL_SEGS[PAGE_CACHE_RA_MAX * (PAGE_SIZE / EXT2_MIN_BLOCK_SIZE)];
+
+// Read the given pages from disk with as few device requests as possible
+static int page_cache_fill(struct cache_page **pages, size_t n) {
+  size_t num_segs = 0;
+  for (size_t i = 0; i < n; ++i)
+    num_segs += page_segments(pages[i], &FILL_SEGS[num_segs]);
+  if (num_segs > 0 && block_rw(0, FILL_SEGS, num_segs))
+    return -1;
+  for (size_t i = 0; i < n; ++i)
+    pages[i]->flags |= CACHE_UPTODATE;
+  return 0;
+}
+
+// Get page `index` of `inode`, reading it from disk if it isn't cached
+// On a miss, up to `readahead` following pages are read in the same
+// batch so that sequential readers hit the cache afterwards
+struct cache_page *page_cache_get(struct ext2_inode_info *inode,
+				  size_t index, size_t readahead) {
+  struct cache_page *page = page_cache_lookup(inode, index);
+  if (page != NULL && (page->flags & CACHE_UPTODATE)) {
+    ++PAGE_CACHE_STATS.hits;
+    lru_unlink(page);
+    lru_push_front(page);
+    return page;
+  }
+  ++PAGE_CACHE_STATS.misses;
+  if (page == NULL && (page = page_cache_alloc(inode, index)) == NULL)
+    return NULL;
+
+  size_t last_index = (ext2_inode_size(inode) + PAGE_SIZE - 1) / PAGE_SIZE;
+  if (readahead > PAGE_CACHE_RA_MAX - 1)
+    readahead = PAGE_CACHE_RA_MAX - 1;
+  struct cache_page *batch[PAGE_CACHE_RA_MAX];
+  size_t n = 0;
+  batch[n++] = page;
+  for (size_t i = index + 1; i <= index + readahead && i < last_index; ++i) {
+    if (page_cache_lookup(inode, i) != NULL)
+      break;
+    struct cache_page *ra = page_cache_alloc(inode, i);
+    if (ra == NULL)
+      break;
+    batch[n++] = ra;
+  }
+  PAGE_CACHE_STATS.readahead += n - 1;
+  if (page_cache_fill(batch, n))
+    return NULL;
+  return page;
+}
+
+// Get page `index` of `inode` for writing
+// If the caller overwrites the whole page (`full` nonzero) or the page
+// lies entirely past the end of file, its old contents are not read
+struct cache_page *page_cache_get_for_write(struct ext2_inode_info *inode,
+					    size_t index, int full) {
+  if (!full && index * PAGE_SIZE < ext2_inode_size(inode))
+    return page_cache_get(inode, index, 0);
+  struct cache_page *page = page_cache_lookup(inode, index);
+  if (page == NULL && (page = page_cache_alloc(inode, index)) == NULL)
+    return NULL;
+  page->flags |= CACHE_UPTODATE;
+  return page;
+}
+
+// Count a mapping of `page` made by file_mmap(), writable if `write` is
+// nonzero
+// A page mapped writable may be modified at any time, so it counts as
+// dirty until it is no longer mapped
+void page_cache_map(struct cache_page *page, int write) {
+  ++page->mapcount;
+  if (!write || (page->flags & CACHE_MAPPED_WRITE))
+    return;
+  if (page->flags & CACHE_DIRTY)
+    --PAGE_CACHE_CLEANABLE;
+  page->flags |= CACHE_MAPPED_WRITE;
+  page_cache_mark_dirty(page);
+}
+
+// Pages mapped writable stay dirty for as long as they are mapped, so
+// only the others count towards starting a writeback
+void page_cache_mark_dirty(struct cache_page *page) {
+  if (page->flags & CACHE_DIRTY)
+    return;
+  page->flags |= CACHE_DIRTY;
+  ++PAGE_CACHE_STATS.dirty;
+  if (!(page->flags & CACHE_MAPPED_WRITE)
+      && ++PAGE_CACHE_CLEANABLE >= PAGE_CACHE_DIRTY_BATCH)
+    page_cache_writeback(NULL);
+}
+
+// Sort segments by sector so that the device sees ascending offsets and
+// adjacent blocks of different pages end up in the same request
+static void sort_segments(struct block_segment *segs, size_t n) {
+  for (size_t gap = n / 2; gap > 0; gap /= 2)
+    for (size_t i = gap; i < n; ++i) {
+      struct block_segment tmp = segs[i];
+      size_t j = i;
+      for (; j >= gap && segs[j - gap].sector > tmp.sector; j -= gap)
+	segs[j] = segs[j - gap];
+      segs[j] = tmp;
+    }
+}
+
+// Write back all dirty pages of `inode`, or of every inode if NULL
+int page_cache_writeback(struct ext2_inode_info *inode) {
+  size_t segs_per_page = PAGE_SIZE / ext2_block_size();
+  size_t max_segs = PAGE_SIZE / sizeof(struct block_segment);
+  struct block_segment *segs = alloc_page();
+  if (segs == NULL)
+    return -1;
+  int result = 0;
+  struct cache_page *page = PAGE_CACHE_LRU_HEAD;
+  while (page != NULL) {
+    size_t num_segs = 0;
+    size_t num_pages = 0;
+    for (; page != NULL && num_segs + segs_per_page <= max_segs;
+	 page = page->lru_next) {
+      if (!(page->flags & CACHE_DIRTY)
+	  || (inode != NULL && page->inode != inode))
+	continue;
+      num_segs += page_segments(page, &segs[num_segs]);
+      // Pages mapped writable may be modified behind our back, so they
+      // stay dirty for as long as they are mapped
+      if (!(page->flags & CACHE_MAPPED_WRITE)) {
+	page->flags &= ~CACHE_DIRTY;
+	--PAGE_CACHE_STATS.dirty;
+	--PAGE_CACHE_CLEANABLE;
+      }
+      ++num_pages;
+    }
+    sort_segments(segs, num_segs);
+    if (num_segs > 0 && block_rw(1, segs, num_segs))
+      result = -1;
+    PAGE_CACHE_STATS.written_back += num_pages;
+  }
+  dealloc_pages(segs);
+  if (ext2_sync_metadata())
+    result = -1;
+  return result;
+}
@@ -0,0 +1,67 @@
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ext2.h"
+
+/*
+ * Page cache for file contents, keyed by (inode, page index)
+ *
+ * Every cached page is a whole page from alloc_page() so that it can be
+ * mapped straight into user address spaces by mmap
+ * Pages are kept on an LRU list and evicted from the cold end when the
+ * cache is full or the page allocator runs dry, except for pages that
+ * are currently mapped by some process
+ */
+
+#define CACHE_UPTODATE (1 << 0)
+#define CACHE_DIRTY (1 << 1)
+#define CACHE_MAPPED_WRITE (1 << 2)
+
+// Number of hash buckets, must be a power of 2
+#define PAGE_CACHE_HASH_SIZE 256
+
+// Upper bound on the number of cached pages (16 MiB)
+#define PAGE_CACHE_MAX_PAGES 4096
+
+// Dirty pages are written back in batches of at least this many pages,
+// not counting those mapped writable, which writeback cannot clean
+#define PAGE_CACHE_DIRTY_BATCH 64
+
+// Sequential readahead window bounds, in pages
+#define PAGE_CACHE_RA_MIN 4
+#define PAGE_CACHE_RA_MAX 64
+
+struct cache_page {
+  struct ext2_inode_info *inode;
+  size_t index;
+  void *data;
+  uint32_t flags;
+  uint32_t mapcount;
+  struct cache_page *hash_next;
+  struct cache_page *lru_prev;
+  struct cache_page *lru_next;
+};
+
+struct page_cache_stats {
+  size_t pages;
+  size_t dirty;
+  size_t hits;
+  size_t misses;
+  size_t readahead;
+  size_t written_back;
+  size_t evicted;
+};
+
+struct cache_page *page_cache_get(struct ext2_inode_info *, size_t, size_t);
+struct cache_page *page_cache_get_for_write(struct ext2_inode_info *, size_t,
+					    int);
+void page_cache_map(struct cache_page *, int);
+void page_cache_mark_dirty(struct cache_page *);
+void page_cache_unmap(struct ext2_inode_info *, size_t);
+int page_cache_writeback(struct ext2_inode_info *);
+size_t page_cache_evict(size_t);
+struct page_cache_stats page_cache_get_stats(void);
+
+#endif
@@ -0,0 +1,132 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "futex.h"
+#include "../common/common.h"
+#include "../plic/cpu.h"
+#include "../mm/page.h"
+#include "../mm/sv39.h"
+#include "../process/process.h"
+#include "../process/sched.h"
+#include "../process/syscall.h"
+
+// Waiters by key, each bucket a list linked through their futex_next
+// field, in the order they started waiting
+static struct process *FUTEX_WAITERS[FUTEX_BUCKETS];
+
+// Number of processes waiting with a timeout, so that futex_expire()
+// has nothing to do most of the time
+static size_t FUTEX_TIMED = 0;
+
+#define FUTEX_BUCKET(root, addr) \
+  ((((size_t)(root) >> PAGE_ORDER) ^ ((addr) >> 2)) % FUTEX_BUCKETS)
+
+// Key of the futex word at `vaddr` in `process`, which must be mapped
+// (see src/ipc/futex.h): *root is NULL for a physical address
+static size_t futex_key(struct process const *process, size_t vaddr,
+			struct page_table **root) {
+  if (process_is_anon(process, vaddr, sizeof(uint32_t))) {
+    *root = process->space->root;
+    return vaddr;
+  }
+  *root = NULL;
+  return virt_to_phys(process->space->root, vaddr);
+}
+
+static void futex_remove(struct process *process) {
+  struct process **link =
+      &FUTEX_WAITERS[FUTEX_BUCKET(process->futex_root, process->futex_key)];
+  while (*link != process)
+    link = &(*link)->futex_next;
+  *link = process->futex_next;
+  if (process->sleep_until != 0) {
+    process->sleep_until = 0;
+    --FUTEX_TIMED;
+  }
+}
+
+// Make a waiter runnable again, returning `result` from SYS_FUTEX_WAIT
+static void futex_wake_one(struct process *process, size_t result) {
+  futex_remove(process);
+  process->frame->regs[10] = result;
+  process->state = PROCESS_RUNNING;
+  process->ready_stamp = GET_MTIME();
+}
+
+// SYS_FUTEX_WAIT: block the current process `process` until woken if the
+// word at `addr` holds `expected`, for at most `timeout` ticks unless it
+// is 0
+// Returns the PC to resume at if it does not block
+size_t futex_wait(struct process *process, size_t addr, uint32_t expected,
+		  size_t timeout, size_t mepc) {
+  uint32_t value;
+  if ((addr & (sizeof(uint32_t) - 1)) != 0
+      || copy_from_user(process->space->root, &value, addr, sizeof(value)) !=
+      sizeof(value) || value != expected) {
+    process->frame->regs[10] = SYSCALL_ERROR;
+    return mepc + 4;
+  }
+  // The word was just read, so it is mapped
+  process->futex_key = futex_key(process, addr, &process->futex_root);
+  process->futex_next = NULL;
+  struct process **link =
+      &FUTEX_WAITERS[FUTEX_BUCKET(process->futex_root, process->futex_key)];
+  while (*link != NULL)
+    link = &(*link)->futex_next;
+  *link = process;
+  if (timeout != 0) {
+    process->sleep_until = GET_MTIME() + timeout;
+    ++FUTEX_TIMED;
+  }
+  process->state = PROCESS_WAITING;
+  sched_block(process, mepc + 4);
+}
+
+// SYS_FUTEX_WAKE: wake up to `n` processes waiting on the word at `addr`,
+// in the order they started waiting
+// Returns the number of processes woken
+size_t futex_wake(struct process *process, size_t addr, size_t n) {
+  if ((addr & (sizeof(uint32_t) - 1)) != 0)
+    return SYSCALL_ERROR;
+  // Fault the word in if need be, so that it has a physical address
+  uint32_t value;
+  if (copy_from_user(process->space->root, &value, addr, sizeof(value)) !=
+      sizeof(value))
+    return SYSCALL_ERROR;
+  struct page_table *root;
+  size_t key = futex_key(process, addr, &root);
+  size_t woken = 0;
+  struct process *waiter = FUTEX_WAITERS[FUTEX_BUCKET(root, key)];
+  while (waiter != NULL && woken < n) {
+    struct process *next = waiter->futex_next;
+    if (waiter->futex_root == root && waiter->futex_key == key) {
+      futex_wake_one(waiter, 0);
+      ++woken;
+    }
+    waiter = next;
+  }
+  return woken;
+}
+
+// Wake the waiters whose timeout expired by `now`
+// Called on each timer interrupt
+void futex_expire(size_t now) {
+  for (size_t i = 0; i < FUTEX_BUCKETS && FUTEX_TIMED != 0; ++i) {
+    struct process *waiter = FUTEX_WAITERS[i];
+    while (waiter != NULL) {
+      struct process *next = waiter->futex_next;
+      if (waiter->sleep_until != 0 && waiter->sleep_until <= now)
+	futex_wake_one(waiter, FUTEX_TIMEDOUT);
+      waiter = next;
+    }
+  }
+}
+
+// Take `process`, which is exiting, off the waiters, if it is one
+void futex_cancel(struct process *process) {
+  struct process *waiter =
+      FUTEX_WAITERS[FUTEX_BUCKET(process->futex_root, process->futex_key)];
+  while (waiter != NULL && waiter != process)
+    waiter = waiter->futex_next;
+  if (waiter != NULL)
+    futex_remove(process);
+}
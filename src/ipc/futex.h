@@ -0,0 +1,71 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../process/process.h"
+#include "../process/syscall.h"
+
+/*
+ * Futexes
+ *
+ * SYS_FUTEX_WAIT(addr, expected, timeout) blocks the caller as long as
+ * the 32-bit word at `addr` holds `expected`, checked atomically with
+ * going to sleep, and SYS_FUTEX_WAKE(addr, n) wakes up to `n` processes
+ * waiting on it. They are the slow path of locks kept in user memory,
+ * which only enter the kernel when a process actually has to wait
+ *
+ * Waiters are kept in a hash table keyed by the physical address of the
+ * word (from virt_to_phys()), so that processes mapping the same page,
+ * e.g. the same file, wait on the same futex. Anonymous memory is only
+ * ever mapped by one address space, but its frames change as it is
+ * swapped out to zram or merged, so it is keyed by page table and
+ * virtual address instead
+ *
+ * The timeout is in mtime ticks, 0 meaning none, and is checked on each
+ * timer interrupt
+ */
+
+#define FUTEX_BUCKETS 64
+
+// Returned by SYS_FUTEX_WAIT once the timeout expires
+// It returns 0 when woken and SYSCALL_ERROR if the word did not hold
+// the expected value or is not mapped
+#define FUTEX_TIMEDOUT 1
+
+size_t futex_wait(struct process *, size_t, uint32_t, size_t, size_t);
+size_t futex_wake(struct process *, size_t, size_t);
+void futex_expire(size_t);
+void futex_cancel(struct process *);
+
+/*
+ * Mutex for U-mode, a futex word that is 0 when unlocked, 1 when locked
+ * and 2 when locked with processes (possibly) waiting for it (see
+ * Drepper, "Futexes Are Tricky"), so that neither locking nor unlocking
+ * it uncontended makes a system call
+ *
+ * These are macros as U-mode code cannot call kernel functions
+ */
+
+#define FUTEX_MUTEX_LOCK(mutex) ({\
+  uint32_t *_mutex = (mutex);\
+  uint32_t _c = 0;\
+  if (!__atomic_compare_exchange_n(_mutex, &_c, 1, 0, __ATOMIC_ACQUIRE,\
+				   __ATOMIC_RELAXED)) {\
+    /* Mark it contended, so that the owner wakes us when unlocking */\
+    if (_c != 2)\
+      _c = __atomic_exchange_n(_mutex, 2, __ATOMIC_ACQUIRE);\
+    while (_c != 0) {\
+      make_syscall(SYS_FUTEX_WAIT, _mutex, 2, 0);\
+      _c = __atomic_exchange_n(_mutex, 2, __ATOMIC_ACQUIRE);\
+    }\
+  }\
+})
+
+#define FUTEX_MUTEX_UNLOCK(mutex) ({\
+  uint32_t *_mutex = (mutex);\
+  if (__atomic_exchange_n(_mutex, 0, __ATOMIC_RELEASE) == 2)\
+    make_syscall(SYS_FUTEX_WAKE, _mutex, 1);\
+})
+
+#endif
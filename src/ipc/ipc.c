@@ -0,0 +1,211 @@
+#include <stddef.h>
+#include "ipc.h"
+#include "../common/common.h"
+#include "../plic/cpu.h"
+#include "../mm/page.h"
+#include "../process/process.h"
+#include "../process/sched.h"
+#include "../process/syscall.h"
+
+// An endpoint, with FIFO queues of the processes blocked sending to and
+// receiving from it, linked through their ipc_next field
+struct ipc_endpoint {
+  struct process *senders;
+  struct process *senders_tail;
+  struct process *receivers;
+  struct process *receivers_tail;
+};
+
+static struct ipc_endpoint ENDPOINTS[IPC_MAX_ENDPOINTS];
+static size_t NUM_ENDPOINTS = 0;
+
+// Create a new endpoint and return its number, or SYSCALL_ERROR if there
+// are IPC_MAX_ENDPOINTS already
+size_t ipc_create(void) {
+  if (NUM_ENDPOINTS == IPC_MAX_ENDPOINTS)
+    return SYSCALL_ERROR;
+  ENDPOINTS[NUM_ENDPOINTS] = (struct ipc_endpoint) {
+  NULL, NULL, NULL, NULL};
+  return NUM_ENDPOINTS++;
+}
+
+static void ipc_push(struct process **head, struct process **tail,
+		     struct process *process) {
+  process->ipc_next = NULL;
+  if (*head == NULL)
+    *head = process;
+  else
+    (*tail)->ipc_next = process;
+  *tail = process;
+}
+
+static struct process *ipc_pop(struct process **head) {
+  struct process *process = *head;
+  if (process != NULL)
+    *head = process->ipc_next;
+  return process;
+}
+
+// Unlink `process` from a queue, if it is on it
+static void ipc_unlink(struct process **head, struct process **tail,
+		       struct process *process) {
+  struct process *prev = NULL;
+  for (struct process **link = head; *link != NULL;
+       prev = *link, link = &(*link)->ipc_next)
+    if (*link == process) {
+      *link = process->ipc_next;
+      if (*tail == process)
+	*tail = prev;
+      return;
+    }
+}
+
+// Move the message of `sender` (a2-a5) to `receiver` (a1-a4, with the PID
+// of the sender in a0), along with its pages if it has any
+// The sender gets the number of pages moved in a0
+static void ipc_deliver(struct process *sender, struct process *receiver) {
+  size_t *from = &sender->frame->regs[12];
+  size_t *to = &receiver->frame->regs[10];
+  to[0] = sender->pid;
+  to[1] = from[0];
+  to[2] = from[1];
+  to[3] = from[2];
+  to[4] = from[3];
+  size_t moved = 0;
+  if (from[0] & IPC_PAGES) {
+    size_t n = from[2];
+    if (n > receiver->ipc_window_pages)
+      n = receiver->ipc_window_pages;
+    moved = process_move_pages(sender, from[1], receiver,
+			       receiver->ipc_window, n);
+    to[2] = receiver->ipc_window;
+    to[3] = moved;
+  }
+  sender->frame->regs[10] = moved;
+}
+
+// Make a process blocked in IPC runnable again
+static void ipc_wake(struct process *process) {
+  process->ipc_state = IPC_IDLE;
+  process->state = PROCESS_RUNNING;
+  process->ready_stamp = GET_MTIME();
+}
+
+static void ipc_sent(struct process *);
+
+// Have `receiver` take the message of the first sender queued on
+// `endpoint`, if there is one
+// Returns 1 if it did, 0 otherwise
+static int ipc_take(struct process *receiver, struct ipc_endpoint *endpoint) {
+  struct process *sender = ipc_pop(&endpoint->senders);
+  if (sender == NULL)
+    return 0;
+  ipc_deliver(sender, receiver);
+  ipc_sent(sender);
+  return 1;
+}
+
+// Wait for a message on `endpoint`, unless one is already queued
+// Returns 1 if `receiver` got a message, 0 if it now waits for one
+static int ipc_wait(struct process *receiver, struct ipc_endpoint *endpoint) {
+  if (ipc_take(receiver, endpoint))
+    return 1;
+  receiver->ipc_state = IPC_RECEIVING;
+  receiver->state = PROCESS_WAITING;
+  ipc_push(&endpoint->receivers, &endpoint->receivers_tail, receiver);
+  return 0;
+}
+
+// Called once the message of a queued `sender` was taken: it is done,
+// unless it still has to receive the reply to its call
+static void ipc_sent(struct process *sender) {
+  if (sender->ipc_state == IPC_CALLING
+      && !ipc_wait(sender, &ENDPOINTS[sender->ipc_reply]))
+    return;
+  ipc_wake(sender);
+}
+
+// Send (`reply` = SYSCALL_ERROR) or call (receiving on `reply`
+// afterwards) from the current process `process`
+static size_t ipc_send_to(struct process *process, size_t endpoint,
+			  size_t reply, size_t mepc) {
+  if (endpoint >= NUM_ENDPOINTS
+      || (reply != SYSCALL_ERROR && reply >= NUM_ENDPOINTS)) {
+    process->frame->regs[10] = SYSCALL_ERROR;
+    return mepc + 4;
+  }
+  struct ipc_endpoint *ep = &ENDPOINTS[endpoint];
+  struct process *receiver = ipc_pop(&ep->receivers);
+  if (receiver == NULL) {
+    // Wait for a receiver, which takes the message from our registers
+    process->ipc_state = reply != SYSCALL_ERROR ? IPC_CALLING : IPC_SENDING;
+    process->ipc_reply = reply;
+    process->state = PROCESS_WAITING;
+    ipc_push(&ep->senders, &ep->senders_tail, process);
+    sched_block(process, mepc + 4);
+  }
+  ipc_deliver(process, receiver);
+  ipc_wake(receiver);
+  if (reply != SYSCALL_ERROR)
+    ipc_wait(process, &ENDPOINTS[reply]);
+  // Run the receiver right away rather than going through the
+  // scheduler: it has what it was waiting for, and the sender, if still
+  // runnable, only gets to run again once it is scheduled
+  process->pc = mepc + 4;
+  ++process->nvcsw;
+  sched_set_current(receiver);
+  process_switch(process, receiver);
+  PANIC("ipc_send_to(): failed to switch to process %d\n", receiver->pid);
+}
+
+// SYS_IPC_SEND: send the message in a2-a5 to `endpoint`
+size_t ipc_send(struct process *process, size_t endpoint, size_t mepc) {
+  return ipc_send_to(process, endpoint, SYSCALL_ERROR, mepc);
+}
+
+// SYS_IPC_CALL: send the message in a2-a5 to `endpoint`, then receive
+// one from `reply`
+size_t ipc_call(struct process *process, size_t endpoint, size_t reply,
+		size_t mepc) {
+  if (reply == SYSCALL_ERROR) {
+    process->frame->regs[10] = SYSCALL_ERROR;
+    return mepc + 4;
+  }
+  return ipc_send_to(process, endpoint, reply, mepc);
+}
+
+// SYS_IPC_RECV: receive a message from `endpoint` into a0-a4
+size_t ipc_recv(struct process *process, size_t endpoint, size_t mepc) {
+  if (endpoint >= NUM_ENDPOINTS) {
+    process->frame->regs[10] = SYSCALL_ERROR;
+    return mepc + 4;
+  }
+  if (!ipc_wait(process, &ENDPOINTS[endpoint]))
+    sched_block(process, mepc + 4);
+  return mepc + 4;
+}
+
+// SYS_IPC_WINDOW: pages received by `process` from now on are mapped at
+// `vaddr`, up to `npages` of them, which must be anonymous memory
+// Returns 0, or SYSCALL_ERROR if it is not
+size_t ipc_window(struct process *process, size_t vaddr, size_t npages) {
+  if (npages > IPC_MAX_PAGES || (vaddr & (PAGE_SIZE - 1)) != 0
+      || (npages != 0 && !process_is_anon(process, vaddr, npages * PAGE_SIZE)))
+    return SYSCALL_ERROR;
+  process->ipc_window = vaddr;
+  process->ipc_window_pages = npages;
+  return 0;
+}
+
+// Take `process`, which is exiting, off the endpoint queue it is blocked
+// on, if any
+void ipc_cancel(struct process *process) {
+  if (process->ipc_state == IPC_IDLE)
+    return;
+  for (size_t i = 0; i < NUM_ENDPOINTS; ++i) {
+    ipc_unlink(&ENDPOINTS[i].senders, &ENDPOINTS[i].senders_tail, process);
+    ipc_unlink(&ENDPOINTS[i].receivers, &ENDPOINTS[i].receivers_tail,
+	       process);
+  }
+  process->ipc_state = IPC_IDLE;
+}
@@ -0,0 +1,69 @@
+#ifndef IPC_H
+#define IPC_H
+
+#include <stddef.h>
+#include "../process/process.h"
+
+/*
+ * Synchronous message passing
+ *
+ * Processes exchange messages through endpoints, created with
+ * SYS_IPC_CREATE and known to every process by number. Sending blocks
+ * until a receiver takes the message and receiving until a sender
+ * provides one; whichever of the two comes second completes the
+ * exchange, and a sender that finds a receiver waiting switches
+ * straight to it
+ *
+ * A message is four words, passed in registers a2-a5 on the way in and
+ * returned in a1-a4, with the sender's PID in a0; the kernel moves them
+ * from one trap frame to the other without copying them anywhere else.
+ * ipc_syscall() in src/asm/crt0.s loads them from and stores them into
+ * a struct ipc_message for C callers
+ *
+ * With IPC_PAGES set in the tag, words[0] and words[1] are the address
+ * and number of pages of anonymous memory to move to the receiver: they
+ * are unmapped from the sender, which finds zeroed pages there on its
+ * next touch, and mapped into the receive window of the receiver
+ * (SYS_IPC_WINDOW) in place of what it had there, without copying. The
+ * receiver gets the address and number of pages moved in words[0] and
+ * words[1], and the sender the number in a0; pages that do not fit in
+ * the window stay with the sender
+ *
+ * SYS_IPC_CALL sends a message and then receives one on a second
+ * endpoint, without returning to U-mode in between: a client waiting for
+ * its reply, or a server replying and waiting for the next request,
+ * takes two direct switches per round trip
+ */
+
+#define IPC_MAX_ENDPOINTS 16
+
+// Most pages moved by a single message
+#define IPC_MAX_PAGES 256
+
+// Message tag bits; the rest are free for the sender to use
+#define IPC_PAGES (1ull << 63)
+
+struct ipc_message {
+  size_t tag;
+  size_t words[3];
+};
+
+// What a process blocked in IPC is doing (struct process, ipc_state)
+#define IPC_IDLE 0
+#define IPC_SENDING 1
+#define IPC_CALLING 2
+#define IPC_RECEIVING 3
+
+// Defined in src/asm/crt0.s, for U-mode
+// Takes the system call number, an endpoint, a message and, for
+// SYS_IPC_CALL, the endpoint to receive the reply on
+size_t ipc_syscall(size_t, size_t, struct ipc_message *, size_t);
+
+size_t ipc_create(void);
+size_t ipc_send(struct process *, size_t, size_t);
+size_t ipc_recv(struct process *, size_t, size_t);
+size_t ipc_call(struct process *, size_t, size_t, size_t);
+size_t ipc_window(struct process *, size_t, size_t);
+void ipc_cancel(struct process *);
+
+#endif
@@ -1,6 +1,7 @@
 #include "uart/uart.h"
 #include "syscon/syscon.h"
 #include "common/common.h"
+#include "common/boot.h"
 #include "mm/page.h"
 #include "mm/sv39.h"
 #include "mm/kmem.h"
@@ -9,6 +10,16 @@
 #include "plic/plic.h"
 #include "process/process.h"
 #include "process/sched.h"
+#include "virtio/virtio.h"
+#include "virtio/block.h"
+#include "fs/ext2.h"
+#include "sbi/sbi.h"
+#include "fdt/fdt.h"
+#include "profile/profile.h"
+#include "rtc/rtc.h"
+#ifdef BENCH
+#include "bench/bench.h"
+#endif
 
 extern const size_t INIT_START;
 extern const size_t INIT_END;
@@ -23,15 +34,21 @@ extern const size_t BSS_END;
 extern const size_t KERNEL_STACK_START;
 extern const size_t KERNEL_STACK_END;
 extern const size_t HEAP_START;
-extern const size_t HEAP_SIZE;
+extern size_t HEAP_SIZE;
 extern const size_t MAKE_SYSCALL;
 extern size_t KERNEL_TABLE;
 
 const char HELLO[] =
     "Hello World! This is a dynamically allocated string using the byte-grained allocator.";
 
+// Size of a level 1 leaf (megapage) in Sv39
+#define MEGAPAGE_ORDER 21
+#define MEGAPAGE_SIZE (1ull << MEGAPAGE_ORDER)
+
 // Identity map range
-// Takes a contiguous allocation of memory and maps it using PAGE_SIZE
+// Takes a contiguous allocation of memory and maps it using PAGE_SIZE,
+// or megapages for the parts that are suitably aligned
+// Ranges mapped into the same root must not overlap
 // `start` must not exceed `end`
 void id_map_range(struct page_table *root, size_t start, size_t end,
 		  uint64_t bits) {
@@ -40,22 +57,109 @@ void id_map_range(struct page_table *root, size_t start, size_t end,
   ASSERT(PTE_IS_LEAF(bits),
 	 "id_map_range(): Provided bits must correspond to leaf entry");
   size_t memaddr = start & ~(PAGE_SIZE - 1);
-  size_t num_kb_pages = (align_val(end, PAGE_ORDER) - memaddr) / PAGE_SIZE;
-  for (size_t i = 0; i < num_kb_pages; ++i) {
-    map(root, memaddr, memaddr, bits, 0);
-    memaddr += PAGE_SIZE;
-  }
+  end = align_val(end, PAGE_ORDER);
+  while (memaddr < end)
+    if (memaddr % MEGAPAGE_SIZE == 0 && end - memaddr >= MEGAPAGE_SIZE) {
+      map(root, memaddr, memaddr, bits, 1);
+      memaddr += MEGAPAGE_SIZE;
+    } else {
+      map(root, memaddr, memaddr, bits, 0);
+      memaddr += PAGE_SIZE;
+    }
+}
+
+// Build the kernel address space and turn on paging
+// The kernel and all devices are identity mapped with global mappings,
+// which every process address space shares (see map_global()), so the
+// kernel stays mapped across traps and address space switches
+static void kmap_init(void) {
+  struct page_table *root = kmem_get_page_table();
+  id_map_range(root, INIT_START, INIT_END, PTE_RX | PTE_GLOBAL);
+  id_map_range(root, TEXT_START, TEXT_END, PTE_RX | PTE_GLOBAL);
+  id_map_range(root, RODATA_START, RODATA_END, PTE_READ | PTE_GLOBAL);
+  id_map_range(root, DATA_START, DATA_END, PTE_RW | PTE_GLOBAL);
+  id_map_range(root, BSS_START, BSS_END, PTE_RW | PTE_GLOBAL);
+  id_map_range(root, HEAP_START, HEAP_START + HEAP_SIZE, PTE_RW | PTE_GLOBAL);
+  id_map_range(root, KERNEL_STACK_START, KERNEL_STACK_END,
+	       PTE_RW | PTE_GLOBAL);
+
+  // Memory-mapped devices
+  id_map_range(root, SYSCON_ADDR, SYSCON_ADDR + PAGE_SIZE,
+	       PTE_RW | PTE_GLOBAL);
+  id_map_range(root, CLINT_ADDR, CLINT_ADDR + 0x10000, PTE_RW | PTE_GLOBAL);
+  id_map_range(root, PLIC_ADDR, PLIC_ADDR + 0x210000, PTE_RW | PTE_GLOBAL);
+  id_map_range(root, UART_ADDR, UART_ADDR + PAGE_SIZE, PTE_RW | PTE_GLOBAL);
+  id_map_range(root, RTC_ADDR, RTC_ADDR + PAGE_SIZE, PTE_RW | PTE_GLOBAL);
+  id_map_range(root, VIRTIO_MMIO_START,
+	       VIRTIO_MMIO_START + VIRTIO_MMIO_NUM_SLOTS * VIRTIO_MMIO_STRIDE,
+	       PTE_RW | PTE_GLOBAL);
+
+  KERNEL_TABLE = SATP_FROM(MODE_SV39, 0, (size_t)root >> PAGE_ORDER);
+  CSR_WRITE(satp, KERNEL_TABLE);
+  SFENCE_VMA();
 }
 
 void kmain(void) {
+  boot_phase("M-mode setup");
+  // Everything else depends on what the device tree says, so read it
+  // before touching any device or memory beyond the kernel image
+  int fdt = fdt_init(BOOT_FDT);
+  if (PLATFORM.ram_start + PLATFORM.ram_size > HEAP_START)
+    HEAP_SIZE = PLATFORM.ram_start + PLATFORM.ram_size - HEAP_START;
+  boot_phase("device tree");
   uart_init();
+  if (fdt == 0)
+    fdt_print();
+  else
+    kprintf("No device tree found at %p, assuming QEMU virt defaults\n",
+	    BOOT_FDT);
+  boot_phase("uart_init");
   page_init();
+  // Memory zones per NUMA node, with allocations preferring the node of
+  // the boot hart, which is the only one we run on
+  for (size_t i = 0; i < PLATFORM.num_memory; ++i)
+    page_set_node(PLATFORM.memory[i].start,
+		  PLATFORM.memory[i].start + PLATFORM.memory[i].size,
+		  PLATFORM.memory[i].node);
+  page_set_local_node(PLATFORM.hart_node[0]);
+  boot_phase("page_init");
   kmem_init();
+  boot_phase("kmem_init");
+  kmap_init();
+  boot_phase("kernel page table");
+  kprintf("Running in S-mode with Sv39 paging enabled\n");
+
+  // Traps taken in the kernel save registers on the kernel stack
+  s_mode_trap_init();
 
-  PLIC_SET_THRESHOLD(0);
-  PLIC_ENABLE(PLIC_UART);
-  PLIC_SET_PRIO(PLIC_UART, 1);
+  plic_init();
+  plic_register(PLIC_UART, uart_interrupt, NULL, 1);
+  boot_phase("PLIC setup");
 
+  rtc_init();
+  kprintf("Wall clock: ");
+  rtc_print_date(rtc_now_ns());
+  kputchar('\n');
+  boot_phase("RTC");
+
+  if (block_init() == 0 && ext2_mount() == 0)
+    kprintf("Mounted ext2 filesystem from virtio block device\n");
+  else
+    kprintf("No ext2 filesystem found, continuing without storage\n");
+  boot_phase("storage");
+
+#ifdef PROFILE
+  ASSERT(profile_start(PROFILE_HZ) == 0,
+	 "kmain(): failed to allocate the profiler sample buffer\n");
+  kprintf("Profiling at %d Hz, press Ctrl-C to dump the samples\n",
+	  PROFILE_HZ);
+#endif
+
+#ifdef BENCH
+  bench_run();
+#endif
+
+  boot_phase("profiler/benchmarks");
   kprintf("Initializing the process scheduler ...\n");
   sched_init();
 
@@ -69,11 +173,15 @@ void kmain(void) {
 	 "kmain(): process structure returned from scheduler was unexpectedly NULL\n");
   kprintf("Our first process has PID = %d\n", process->pid);
 
+  boot_phase("scheduler setup");
+
   kprintf("Issuing our first context switch timer ...\n");
-  set_timer_interrupt_delay_us(1 * US_PER_SECOND);
+  // process_switch() sets the timer for the end of this time slice
+  sched_slice_over(GET_MTIME());
 
-  switch_to_user((size_t)process->frame, process->pc,
-		 SATP_FROM(MODE_SV39, process->pid,
-			   (size_t)process->root >> PAGE_ORDER));
+  // The report itself is not part of the last phase
+  boot_phase("first user entry");
+  boot_print_phases();
+  process_switch(NULL, process);
   PANIC("kmain(): failed to start our first process!\n");
 }
@@ -0,0 +1,170 @@
+#include <stddef.h>
+#include "latency.h"
+#include "../common/common.h"
+#include "../uart/uart.h"
+#include "../plic/cpu.h"
+#include "../process/process.h"
+#include "../process/sched.h"
+#include "../process/pid.h"
+
+static struct latency_histogram TIMER_LATENCY;
+static struct latency_histogram WAKEUP_LATENCY;
+static struct latency_histogram TRAP_LATENCY[LATENCY_TRAP_SLOTS];
+static struct latency_histogram WORK_LATENCY;
+
+// The trap being handled, if any, see latency_trap_enter()
+static size_t TRAP_SLOT;
+static size_t TRAP_START;
+static int TRAP_PENDING = 0;
+
+static size_t latency_bucket(size_t ticks) {
+  if (ticks == 0)
+    return 0;
+  size_t bucket = 64 - __builtin_clzl(ticks);
+  return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+void latency_record(struct latency_histogram *histogram, size_t ticks) {
+  ++histogram->count;
+  histogram->total += ticks;
+  if (ticks > histogram->max)
+    histogram->max = ticks;
+  ++histogram->buckets[latency_bucket(ticks)];
+}
+
+void latency_clear(struct latency_histogram *histogram) {
+  memset(histogram, 0, sizeof(struct latency_histogram));
+}
+
+// Upper bound on the `permille`th per mille of the recorded latencies,
+// e.g. latency_percentile(histogram, 990) for the 99th percentile
+size_t latency_percentile(struct latency_histogram const *histogram,
+			  size_t permille) {
+  size_t rank = (histogram->count * permille + 999) / 1000;
+  size_t seen = 0;
+  for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+    seen += histogram->buckets[i];
+    if (seen >= rank && seen != 0) {
+      // The last bucket is open-ended, and nothing exceeds the maximum
+      size_t bound =
+	  i < LATENCY_BUCKETS - 1 ? (1ull << i) - 1 : histogram->max;
+      return bound < histogram->max ? bound : histogram->max;
+    }
+  }
+  return 0;
+}
+
+// Print a summary line followed by the non-empty buckets
+void latency_print(struct latency_histogram const *histogram) {
+  if (histogram->count == 0) {
+    kprintf(" none\n");
+    return;
+  }
+  kprintf(" n=%lu avg=%lu max=%lu p50<=%lu p99<=%lu p99.9<=%lu ticks\n",
+	  histogram->count, histogram->total / histogram->count,
+	  histogram->max, latency_percentile(histogram, 500),
+	  latency_percentile(histogram, 990), latency_percentile(histogram,
+								 999));
+  for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+    if (histogram->buckets[i] == 0)
+      continue;
+    size_t lo = i == 0 ? 0 : 1ull << (i - 1);
+    if (i == LATENCY_BUCKETS - 1)
+      kprintf("  %10lu -            %10lu\n", lo, histogram->buckets[i]);
+    else
+      kprintf("  %10lu - %10lu %10lu\n", lo, (1ull << i) - 1,
+	      histogram->buckets[i]);
+  }
+}
+
+// Record that the supervisor timer interrupt was handled `ticks` after
+// its deadline
+void latency_timer(size_t ticks) {
+  latency_record(&TIMER_LATENCY, ticks);
+}
+
+// Record that a process waited `ticks` for the CPU, into its own
+// histogram and the one over all processes
+void latency_wakeup(struct latency_histogram *histogram, size_t ticks) {
+  latency_record(histogram, ticks);
+  latency_record(&WAKEUP_LATENCY, ticks);
+}
+
+// Called on entry to the S-mode trap handler at mtime `now`
+void latency_trap_enter(size_t cause, size_t now) {
+  TRAP_SLOT = LATENCY_TRAP_SLOT(cause);
+  TRAP_START = now;
+  TRAP_PENDING = 1;
+}
+
+// Called when the trap handler returns, runs deferred work or leaves for
+// U-mode through a context switch, whichever comes first
+// Interrupts taken while deferred work runs are then recorded on their
+// own
+void latency_trap_exit(void) {
+  if (!TRAP_PENDING)
+    return;
+  TRAP_PENDING = 0;
+  latency_record(&TRAP_LATENCY[TRAP_SLOT], GET_MTIME() - TRAP_START);
+}
+
+// Record that deferred work ran `ticks` after it was queued
+void latency_work(size_t ticks) {
+  latency_record(&WORK_LATENCY, ticks);
+}
+
+// The histogram selected by `kind` (LATENCY_TIMER etc.) and `index`, or
+// NULL if there is no such histogram
+struct latency_histogram const *latency_get(size_t kind, size_t index) {
+  switch (kind) {
+  case LATENCY_TIMER:
+    return &TIMER_LATENCY;
+  case LATENCY_WAKEUP:
+    if (index == 0)
+      return &WAKEUP_LATENCY;
+    struct process *process = pid_find(index);
+    return process != NULL ? &process->wait_latency : NULL;
+  case LATENCY_TRAP:
+    return index < LATENCY_TRAP_SLOTS ? &TRAP_LATENCY[index] : NULL;
+  case LATENCY_WORK:
+    return &WORK_LATENCY;
+  default:
+    return NULL;
+  }
+}
+
+static void latency_print_process(struct process *process) {
+  kprintf("wakeup pid %d:", process->pid);
+  latency_print(&process->wait_latency);
+}
+
+void latency_print_all(void) {
+  kprintf("All latencies in mtime ticks (%lu per second)\n",
+	  TICKS_PER_SECOND);
+  kprintf("timer:");
+  latency_print(&TIMER_LATENCY);
+  kprintf("wakeup:");
+  latency_print(&WAKEUP_LATENCY);
+  sched_for_each(latency_print_process);
+  for (size_t i = 0; i < LATENCY_TRAP_SLOTS; ++i) {
+    if (TRAP_LATENCY[i].count == 0)
+      continue;
+    kprintf("trap %s %lu:", i < 16 ? "exception" : "interrupt", i % 16);
+    latency_print(&TRAP_LATENCY[i]);
+  }
+  kprintf("work:");
+  latency_print(&WORK_LATENCY);
+}
+
+static void latency_reset_process(struct process *process) {
+  latency_clear(&process->wait_latency);
+}
+
+void latency_reset(void) {
+  latency_clear(&TIMER_LATENCY);
+  latency_clear(&WAKEUP_LATENCY);
+  for (size_t i = 0; i < LATENCY_TRAP_SLOTS; ++i)
+    latency_clear(&TRAP_LATENCY[i]);
+  latency_clear(&WORK_LATENCY);
+  sched_for_each(latency_reset_process);
+}
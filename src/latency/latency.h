@@ -0,0 +1,63 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stddef.h>
+
+/*
+ * Latency histograms
+ *
+ * Latencies are measured in mtime ticks and counted into log2 buckets:
+ * bucket 0 holds latencies of 0 ticks and bucket i > 0 those in
+ * [2^(i-1), 2^i), with the last bucket also taking everything longer
+ *
+ * Four kinds of latency are recorded:
+ * - timer: how late the supervisor timer interrupt was handled, i.e.
+ *   mtime on trap entry minus the deadline that was programmed
+ * - wakeup: how long a runnable process waited for the CPU, both over
+ *   all processes and per process (see struct process)
+ * - trap: time spent in the S-mode trap handler, per trap cause, until
+ *   it runs deferred work or leaves for U-mode
+ * - work: how long deferred work (see src/plic/work.h) stayed queued
+ *
+ * The `lat` console command prints them and `lat reset` clears them;
+ * user programs can read them with SYS_LATENCY
+ */
+
+#define LATENCY_BUCKETS 32
+
+struct latency_histogram {
+  size_t count;
+  size_t total;
+  size_t max;
+  size_t buckets[LATENCY_BUCKETS];
+};
+
+// Histograms readable through SYS_LATENCY
+// For LATENCY_WAKEUP, the index is a PID (0 = all processes); for
+// LATENCY_TRAP, a trap cause slot as returned by LATENCY_TRAP_SLOT()
+#define LATENCY_TIMER 0
+#define LATENCY_WAKEUP 1
+#define LATENCY_TRAP 2
+#define LATENCY_WORK 3
+
+// Exception codes take the first 16 slots, interrupts the next 16
+#define LATENCY_TRAP_SLOTS 32
+#define LATENCY_TRAP_SLOT(cause) \
+  ((((cause) >> 63) ? 16 : 0) + ((cause) & 0xF))
+
+void latency_record(struct latency_histogram *, size_t);
+void latency_clear(struct latency_histogram *);
+size_t latency_percentile(struct latency_histogram const *, size_t);
+void latency_print(struct latency_histogram const *);
+
+void latency_timer(size_t);
+void latency_wakeup(struct latency_histogram *, size_t);
+void latency_trap_enter(size_t, size_t);
+void latency_trap_exit(void);
+void latency_work(size_t);
+
+struct latency_histogram const *latency_get(size_t, size_t);
+void latency_print_all(void);
+void latency_reset(void);
+
+#endif
@@ -0,0 +1,128 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "huge.h"
+#include "page.h"
+#include "../common/common.h"
+
+static int HUGE_ENABLED = 1;
+
+static size_t HUGE_MAPPED = 0;
+static size_t HUGE_ALLOCATED = 0;
+static size_t HUGE_FALLBACKS = 0;
+static size_t HUGE_COLLAPSED = 0;
+static size_t HUGE_SPLIT = 0;
+
+#define PTE_FRAME(pte) (((pte) & ~0x3FFull) << 2)
+
+void huge_set_enabled(int enabled) {
+  HUGE_ENABLED = enabled;
+}
+
+int huge_enabled(void) {
+  return HUGE_ENABLED;
+}
+
+// Megapage leaf PTE mapping `vaddr` in `root`, or NULL if there is none
+uint64_t *huge_pte(struct page_table *root, size_t vaddr) {
+  uint64_t *pte = get_pte_at(root, vaddr, 1);
+  return pte != NULL && PTE_IS_VALID(*pte) && PTE_IS_LEAF(*pte) ? pte : NULL;
+}
+
+// Map a zeroed megapage for the block at 2 MiB-aligned `vaddr`, which
+// must have nothing mapped in it, not even a level 0 page table
+// Returns 0 on success and -1 if there is no free megapage
+int huge_map(struct page_table *root, size_t vaddr) {
+  uint64_t *pte = get_pte_at(root, vaddr, 1);
+  if (pte != NULL && PTE_IS_VALID(*pte))
+    return -1;
+  void *page = alloc_pages_aligned(HUGE_PAGE_PAGES, HUGE_PAGE_PAGES);
+  if (page == NULL) {
+    ++HUGE_FALLBACKS;
+    return -1;
+  }
+  map(root, vaddr, (size_t)page, PTE_USER_RW, 1);
+  ++HUGE_MAPPED;
+  ++HUGE_ALLOCATED;
+  return 0;
+}
+
+// Split the megapage mapping `vaddr`, if any, into 4 KiB pages with the
+// same permissions and accessed and dirty bits, each of which can then
+// be unmapped and freed on its own
+// The caller has to flush the TLB
+// Returns 0 on success, or if there is no megapage there, and -1 if
+// there is no memory for the page table
+int huge_split(struct page_table *root, size_t vaddr) {
+  if (huge_pte(root, vaddr) == NULL)
+    return 0;
+  struct page_table *table = alloc_page();
+  if (table == NULL)
+    return -1;
+  // Reclaiming memory for the page table may have split it already
+  uint64_t *pte = huge_pte(root, vaddr);
+  if (pte == NULL) {
+    dealloc_pages(table);
+    return 0;
+  }
+  size_t frame = PTE_FRAME(*pte);
+  uint64_t bits = *pte & 0x3FF;
+  page_split((void *)frame);
+  for (size_t i = 0; i < PT_NUM_ENTRIES; ++i)
+    table->entries[i] = ((frame + i * PAGE_SIZE) >> 2) | bits;
+  *pte = ((size_t)table >> 2) | PTE_VALID;
+  --HUGE_MAPPED;
+  ++HUGE_SPLIT;
+  return 0;
+}
+
+// Collapse the block at 2 MiB-aligned `vaddr` into a megapage if all of
+// its pages are mapped private and writable, i.e. neither swapped out
+// nor shared by same-page merging
+// The caller makes sure the block is anonymous memory, and has to flush
+// the TLB
+// Returns 1 if it was collapsed, 0 otherwise
+int huge_collapse(struct page_table *root, size_t vaddr) {
+  uint64_t *pte = get_pte_at(root, vaddr, 1);
+  if (pte == NULL || PTE_IS_INVALID(*pte) || PTE_IS_LEAF(*pte))
+    return 0;
+  struct page_table *table = (struct page_table *)PTE_FRAME(*pte);
+  uint64_t bits = 0;
+  for (size_t i = 0; i < PT_NUM_ENTRIES; ++i) {
+    uint64_t entry = table->entries[i];
+    if (PTE_IS_INVALID(entry) || !(entry & PTE_WRITE) || !(entry & PTE_USER))
+      return 0;
+    bits |= entry & (PTE_ACCESS | PTE_DIRTY);
+  }
+  uint8_t *page = alloc_pages_aligned(HUGE_PAGE_PAGES, HUGE_PAGE_PAGES);
+  if (page == NULL)
+    return 0;
+  for (size_t i = 0; i < PT_NUM_ENTRIES; ++i) {
+    void *frame = (void *)PTE_FRAME(table->entries[i]);
+    memcpy(page + i * PAGE_SIZE, frame, PAGE_SIZE);
+    dealloc_pages(frame);
+  }
+  dealloc_pages(table);
+  *pte = ((size_t)page >> 2) | PTE_USER_RW | bits | PTE_VALID;
+  ++HUGE_MAPPED;
+  ++HUGE_COLLAPSED;
+  return 1;
+}
+
+// Free the megapage mapping `vaddr`, if any, leaving its block unmapped
+// The caller has to flush the TLB
+void huge_free(struct page_table *root, size_t vaddr) {
+  uint64_t *pte = huge_pte(root, vaddr);
+  if (pte == NULL)
+    return;
+  dealloc_pages((void *)PTE_FRAME(*pte));
+  *pte = 0;
+  --HUGE_MAPPED;
+}
+
+void huge_get_stats(struct huge_stats *stats) {
+  stats->mapped = HUGE_MAPPED;
+  stats->allocated = HUGE_ALLOCATED;
+  stats->fallbacks = HUGE_FALLBACKS;
+  stats->collapsed = HUGE_COLLAPSED;
+  stats->split = HUGE_SPLIT;
+}
@@ -0,0 +1,63 @@
+#ifndef HUGE_H
+#define HUGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "page.h"
+#include "sv39.h"
+
+/*
+ * Transparent huge pages
+ *
+ * Anonymous memory is mapped on first touch, normally 4 KiB at a time.
+ * When the touched address lies in a 2 MiB-aligned block that is wholly
+ * anonymous memory and has nothing mapped yet, process_fault() maps a
+ * megapage (a level 1 leaf) for the whole block instead, if there are
+ * 512 contiguous, aligned free pages; otherwise it falls back to a 4 KiB
+ * page. Large mmap() regions are placed on a 2 MiB boundary for this
+ *
+ * Blocks that were filled in 4 KiB at a time are collapsed later: at the
+ * end of each time slice, process_collapse() looks for blocks of the
+ * interrupted process whose 512 pages are all mapped private and
+ * writable, copies them into a megapage and frees them along with their
+ * level 0 page table
+ *
+ * A megapage is split back into 4 KiB pages whenever a single page of it
+ * has to be dealt with: when it is swapped out to zram or moved to
+ * another process through IPC. Same-page merging skips megapages
+ *
+ * A megapage is always writable, so the only faults on one are for its
+ * accessed and dirty bits on harts that leave them to software
+ */
+
+#define HUGE_PAGE_ORDER 21
+#define HUGE_PAGE_SIZE (1ull << HUGE_PAGE_ORDER)
+#define HUGE_PAGE_PAGES (HUGE_PAGE_SIZE / PAGE_SIZE)
+
+// Blocks collapsed by process_collapse() per time slice at most
+#define HUGE_COLLAPSE_BLOCKS 2
+
+// - mapped: megapages currently mapped
+// - allocated: megapages mapped on first touch
+// - fallbacks: first touches that found no free megapage and mapped a
+//   4 KiB page instead
+// - collapsed: blocks of 4 KiB pages collapsed into a megapage
+// - split: megapages split into 4 KiB pages
+struct huge_stats {
+  size_t mapped;
+  size_t allocated;
+  size_t fallbacks;
+  size_t collapsed;
+  size_t split;
+};
+
+void huge_set_enabled(int);
+int huge_enabled(void);
+uint64_t *huge_pte(struct page_table *, size_t);
+int huge_map(struct page_table *, size_t);
+int huge_split(struct page_table *, size_t);
+int huge_collapse(struct page_table *, size_t);
+void huge_free(struct page_table *, size_t);
+void huge_get_stats(struct huge_stats *);
+
+#endif
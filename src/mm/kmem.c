@@ -9,6 +9,11 @@ static size_t *KMEM_HEAD = NULL;
 // Keep track of memory footprint
 static size_t KMEM_ALLOC = 0;
 static struct page_table *KMEM_PAGE_TABLE = NULL;
+// Statistics, see struct kmem_stats
+static size_t KMEM_IN_USE = 0;
+static size_t KMEM_PEAK = 0;
+static size_t KMEM_ALLOCATIONS = 0;
+static size_t KMEM_FAILURES = 0;
 
 void *kmem_get_head(void) {
   return (void *)KMEM_HEAD;
@@ -30,6 +35,10 @@ void kmem_init(void) {
   KMEM_HEAD = (size_t *)k_alloc;
   KMMD_SET_FREE(KMEM_HEAD);
   KMMD_SET_SIZE(KMEM_HEAD, KMEM_ALLOC * PAGE_SIZE);
+  KMEM_IN_USE = 0;
+  KMEM_PEAK = 0;
+  KMEM_ALLOCATIONS = 0;
+  KMEM_FAILURES = 0;
   KMEM_PAGE_TABLE = (struct page_table *)alloc_page();
   ASSERT(KMEM_PAGE_TABLE != NULL,
 	 "kmem_init(): got NULL pointer when requesting single page for kernel page table");
@@ -39,8 +48,7 @@ void *kcalloc(size_t num, size_t size) {
   size_t total_size = align_val(num * size, 3);
   uint8_t *result = (uint8_t *) kmalloc(total_size);
   if (result != NULL)
-    for (size_t i = 0; i < total_size; ++i)
-      result[i] = 0;
+    memset(result, 0, total_size);
   return (void *)result;
 }
 
@@ -60,9 +68,14 @@ void *kmalloc(size_t sz) {
 	KMMD_SET_SIZE(head, size);
       } else
 	KMMD_SET_SIZE(head, chunk_size);
+      KMEM_IN_USE += KMMD_GET_SIZE(head);
+      if (KMEM_IN_USE > KMEM_PEAK)
+	KMEM_PEAK = KMEM_IN_USE;
+      ++KMEM_ALLOCATIONS;
       return (void *)&head[1];
     } else
       head = (size_t *)&((uint8_t *) head)[KMMD_GET_SIZE(head)];
+  ++KMEM_FAILURES;
   return NULL;
 }
 
@@ -92,8 +105,11 @@ static void coalesce(void) {
 void kfree(void *ptr) {
   if (ptr != NULL) {
     size_t *p = &((size_t *)ptr)[-1];
-    if (KMMD_IS_TAKEN(p))
+    if (KMMD_IS_TAKEN(p)) {
+      KMEM_IN_USE -= KMMD_GET_SIZE(p);
+      --KMEM_ALLOCATIONS;
       KMMD_SET_FREE(p);
+    }
     coalesce();
   }
 }
@@ -111,3 +127,21 @@ void kmem_print_table(void) {
   }
   kputchar('\n');
 }
+
+void kmem_get_stats(struct kmem_stats *stats) {
+  stats->arena_bytes = KMEM_ALLOC * PAGE_SIZE;
+  stats->bytes_in_use = KMEM_IN_USE;
+  stats->peak_bytes_in_use = KMEM_PEAK;
+  stats->allocations = KMEM_ALLOCATIONS;
+  stats->alloc_failures = KMEM_FAILURES;
+}
+
+// Page, kmalloc(), zram, same-page merging and huge page statistics
+// together; `extents` as for page_get_stats()
+void mem_get_stats(struct mem_stats *stats, int extents) {
+  page_get_stats(&stats->pages, extents);
+  kmem_get_stats(&stats->kmem);
+  zram_get_stats(&stats->zram);
+  ksm_get_stats(&stats->ksm);
+  huge_get_stats(&stats->huge);
+}
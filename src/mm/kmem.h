@@ -2,6 +2,10 @@
 #define KMEM_H
 
 #include <stddef.h>
+#include "page.h"
+#include "zram.h"
+#include "ksm.h"
+#include "huge.h"
 
 /*
  * Here comes our byte-grained memory allocator
@@ -31,6 +35,25 @@
 })
 #define KMMD_GET_SIZE(block) (*(const size_t *)(block) & ~KMMD_TAKEN)
 
+// kmalloc() statistics, kept up to date on every call
+// Byte counts include the 8-byte KMMD header of each block
+struct kmem_stats {
+  size_t arena_bytes;
+  size_t bytes_in_use;
+  size_t peak_bytes_in_use;
+  size_t allocations;
+  size_t alloc_failures;
+};
+
+// Everything SYS_MEMSTAT reports
+struct mem_stats {
+  struct page_stats pages;
+  struct kmem_stats kmem;
+  struct zram_stats zram;
+  struct ksm_stats ksm;
+  struct huge_stats huge;
+};
+
 void *kmem_get_head(void);
 struct page_table *kmem_get_page_table(void);
 size_t kmem_get_num_allocations(void);
@@ -41,5 +64,7 @@ void *kmalloc(size_t);
 void kfree(void *);
 
 void kmem_print_table(void);
+void kmem_get_stats(struct kmem_stats *);
+void mem_get_stats(struct mem_stats *, int);
 
 #endif
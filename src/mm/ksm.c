@@ -0,0 +1,170 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "ksm.h"
+#include "kmem.h"
+#include "page.h"
+#include "../common/common.h"
+
+// A shared frame, in two hash chains: by contents and by address
+struct ksm_frame {
+  uint64_t hash;
+  size_t frame;
+  size_t refs;
+  struct ksm_frame *next_hash;
+  struct ksm_frame *next_frame;
+};
+
+// Last page seen with a given hash (modulo KSM_CANDIDATES)
+struct ksm_candidate {
+  uint64_t hash;
+  struct page_table *root;
+  size_t vaddr;
+};
+
+static int KSM_ENABLED = 0;
+static struct ksm_frame *KSM_BY_HASH[KSM_BUCKETS];
+static struct ksm_frame *KSM_BY_FRAME[KSM_BUCKETS];
+static struct ksm_candidate KSM_CANDIDATE[KSM_CANDIDATES];
+
+static size_t KSM_SHARED_FRAMES = 0;
+static size_t KSM_SHARING = 0;
+static size_t KSM_SCANNED = 0;
+static size_t KSM_MERGED = 0;
+static size_t KSM_UNSHARED = 0;
+
+#define KSM_FRAME_BUCKET(frame) (((frame) >> PAGE_ORDER) % KSM_BUCKETS)
+#define PTE_FRAME(pte) (((pte) & ~0x3FFull) << 2)
+
+void ksm_set_enabled(int enabled) {
+  KSM_ENABLED = enabled;
+}
+
+int ksm_enabled(void) {
+  return KSM_ENABLED;
+}
+
+// 64-bit multiplicative hash of a page, a word at a time
+uint64_t ksm_hash(const void *page) {
+  const uint64_t *words = page;
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); ++i)
+    hash = (hash ^ words[i]) * 0x100000001b3ull;
+  return hash ^ hash >> 32;
+}
+
+static struct ksm_frame *ksm_find_frame(size_t frame) {
+  struct ksm_frame *shared = KSM_BY_FRAME[KSM_FRAME_BUCKET(frame)];
+  while (shared != NULL && shared->frame != frame)
+    shared = shared->next_frame;
+  return shared;
+}
+
+// Point the user PTE at `pte` to shared frame `frame`, read-only
+static void ksm_map_shared(uint64_t *pte, size_t frame) {
+  *pte = ((frame >> PAGE_ORDER) << 10) | (*pte & 0x3FF & ~PTE_WRITE);
+}
+
+// Merge the page mapped at `vaddr` in `root` with an identical one, if
+// there is one
+// Only private (writable) user pages are merged; the caller has to
+// flush the TLB once done
+// Returns 1 if the page was merged, 0 otherwise
+int ksm_merge(struct page_table *root, size_t vaddr) {
+  uint64_t *pte = get_pte(root, vaddr);
+  if (pte == NULL || PTE_IS_INVALID(*pte) || !(*pte & PTE_WRITE)
+      || !(*pte & PTE_USER))
+    return 0;
+  ++KSM_SCANNED;
+  size_t frame = PTE_FRAME(*pte);
+  uint64_t hash = ksm_hash((const void *)frame);
+
+  for (struct ksm_frame * shared = KSM_BY_HASH[hash % KSM_BUCKETS];
+       shared != NULL; shared = shared->next_hash)
+    if (shared->hash == hash
+	&& memcmp((const void *)shared->frame, (const void *)frame,
+		  PAGE_SIZE) == 0) {
+      ksm_map_shared(pte, shared->frame);
+      dealloc_pages((void *)frame);
+      ++shared->refs;
+      ++KSM_SHARING;
+      ++KSM_MERGED;
+      return 1;
+    }
+
+  struct ksm_candidate *candidate = &KSM_CANDIDATE[hash % KSM_CANDIDATES];
+  if (candidate->root != NULL && candidate->hash == hash) {
+    uint64_t *other = get_pte(candidate->root, candidate->vaddr);
+    if (other != NULL && other != pte && PTE_IS_VALID(*other)
+	&& (*other & PTE_WRITE) && (*other & PTE_USER)
+	&& memcmp((const void *)PTE_FRAME(*other), (const void *)frame,
+		  PAGE_SIZE) == 0) {
+      struct ksm_frame *shared = kmalloc(sizeof(struct ksm_frame));
+      if (shared == NULL)
+	return 0;
+      shared->hash = hash;
+      shared->frame = PTE_FRAME(*other);
+      shared->refs = 2;
+      shared->next_hash = KSM_BY_HASH[hash % KSM_BUCKETS];
+      KSM_BY_HASH[hash % KSM_BUCKETS] = shared;
+      shared->next_frame = KSM_BY_FRAME[KSM_FRAME_BUCKET(shared->frame)];
+      KSM_BY_FRAME[KSM_FRAME_BUCKET(shared->frame)] = shared;
+      ksm_map_shared(other, shared->frame);
+      ksm_map_shared(pte, shared->frame);
+      dealloc_pages((void *)frame);
+      candidate->root = NULL;
+      ++KSM_SHARED_FRAMES;
+      KSM_SHARING += 2;
+      ++KSM_MERGED;
+      return 1;
+    }
+  }
+  candidate->hash = hash;
+  candidate->root = root;
+  candidate->vaddr = vaddr;
+  return 0;
+}
+
+// Forget the candidates in page table `root`, which is about to be freed
+// (and could be reused for another address space)
+void ksm_forget(struct page_table const *root) {
+  for (size_t i = 0; i < KSM_CANDIDATES; ++i)
+    if (KSM_CANDIDATE[i].root == root)
+      KSM_CANDIDATE[i].root = NULL;
+}
+
+// Number of mappings of shared frame `frame`, or 0 if it is not one
+size_t ksm_refs(size_t frame) {
+  struct ksm_frame *shared = ksm_find_frame(frame);
+  return shared != NULL ? shared->refs : 0;
+}
+
+// Drop a mapping of shared frame `frame`, on a copy-on-write fault or
+// when the page is unmapped
+// Once the last mapping is dropped, the frame is no longer shared, but
+// not freed: whoever dropped it keeps it as a private page
+void ksm_unshare(size_t frame) {
+  struct ksm_frame *shared = ksm_find_frame(frame);
+  ASSERT(shared != NULL, "ksm_unshare(): %p is not a shared frame", frame);
+  ++KSM_UNSHARED;
+  --KSM_SHARING;
+  if (--shared->refs != 0)
+    return;
+  struct ksm_frame **link = &KSM_BY_HASH[shared->hash % KSM_BUCKETS];
+  while (*link != shared)
+    link = &(*link)->next_hash;
+  *link = shared->next_hash;
+  link = &KSM_BY_FRAME[KSM_FRAME_BUCKET(frame)];
+  while (*link != shared)
+    link = &(*link)->next_frame;
+  *link = shared->next_frame;
+  kfree(shared);
+  --KSM_SHARED_FRAMES;
+}
+
+void ksm_get_stats(struct ksm_stats *stats) {
+  stats->shared_frames = KSM_SHARED_FRAMES;
+  stats->sharing = KSM_SHARING;
+  stats->scanned = KSM_SCANNED;
+  stats->merged = KSM_MERGED;
+  stats->unshared = KSM_UNSHARED;
+}
@@ -0,0 +1,60 @@
+#ifndef KSM_H
+#define KSM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sv39.h"
+
+/*
+ * Same-page merging
+ *
+ * When enabled (`ksm on` on the console), the timer interrupt offers a
+ * few anonymous pages of the interrupted process at a time to
+ * ksm_merge() (see process_merge()). Each page is hashed and looked up:
+ *
+ * - among the shared frames: if one has the same contents, the page is
+ *   remapped read-only to it and its own frame freed
+ * - otherwise among the candidates, which remember the last page seen
+ *   with each hash: if that page still has the same contents, its frame
+ *   becomes a new shared frame for both
+ *
+ * Contents are always compared byte for byte; the hash only narrows the
+ * search. Writing to a shared page faults, and process_fault() gives the
+ * writer a private copy again (copy-on-write), or the frame itself once
+ * it is the last one using it
+ *
+ * Candidates are kept by page table and address, and are only trusted
+ * after checking that the page is still mapped there
+ */
+
+// Size of the shared frame and candidate hash tables
+#define KSM_BUCKETS 64
+#define KSM_CANDIDATES 256
+
+// Anonymous pages offered to ksm_merge() per timer interrupt
+#define KSM_SCAN_PAGES 256
+
+// - shared_frames: frames currently shared
+// - sharing: mappings of those frames, so sharing - shared_frames pages
+//   are saved
+// - scanned/merged: pages offered to and merged by ksm_merge()
+// - unshared: mappings of shared frames dropped, on copy-on-write
+//   faults or when the page is unmapped
+struct ksm_stats {
+  size_t shared_frames;
+  size_t sharing;
+  size_t scanned;
+  size_t merged;
+  size_t unshared;
+};
+
+void ksm_set_enabled(int);
+int ksm_enabled(void);
+uint64_t ksm_hash(const void *);
+int ksm_merge(struct page_table *, size_t);
+void ksm_forget(struct page_table const *);
+size_t ksm_refs(size_t);
+void ksm_unshare(size_t);
+void ksm_get_stats(struct ksm_stats *);
+
+#endif
@@ -4,13 +4,26 @@
 #include "../uart/uart.h"
 
 extern const size_t HEAP_START;
-extern const size_t HEAP_SIZE;
+extern size_t HEAP_SIZE;
 extern const size_t HEAP_END;
 
 static size_t HEAP_BOTTOM = 0;
 static size_t NUM_PAGES = 0;
 static size_t ALLOC_START = 0;
 static size_t ALLOC_END = 0;
+static size_t PAGES_USED = 0;
+static size_t PAGE_ALLOC_FAILURES = 0;
+
+// Zones in address order, covering all pages
+static struct page_zone ZONES[PAGE_MAX_ZONES];
+static size_t NUM_ZONES = 0;
+// Node alloc_pages() prefers, i.e. that of the hart we run on
+static size_t LOCAL_NODE = 0;
+
+// Called when an allocation fails, to free up at least the given number
+// of pages (see page_set_reclaim_handler())
+static size_t (*RECLAIM_HANDLER)(size_t) = NULL;
+static bool RECLAIMING = false;
 
 size_t get_num_pages(void) {
   return NUM_PAGES;
@@ -27,14 +40,36 @@ static size_t page_address_from_id(size_t id) {
   return ALLOC_START + PAGE_SIZE * id;
 }
 
+// Zone of page `id`
+static struct page_zone *page_zone_of(size_t id) {
+  for (size_t i = 0; i < NUM_ZONES; ++i)
+    if (ZONES[i].start <= id && id < ZONES[i].end)
+      return &ZONES[i];
+  return NULL;
+}
+
+// Initialize the metadata of `zone` up to at least page `pages`, in
+// chunks of PAGE_INIT_CHUNK pages
+static void page_init_metadata(struct page_zone *zone, size_t pages) {
+  size_t end = zone->initialized + PAGE_INIT_CHUNK;
+  if (end < pages)
+    end = pages;
+  if (end > zone->end)
+    end = zone->end;
+  struct page *ptr = (struct page *)HEAP_BOTTOM;
+  // Explicitly mark the new pages as free
+  memset(&ptr[zone->initialized], 0,
+	 (end - zone->initialized) * sizeof(struct page));
+  zone->initialized = end;
+}
+
 // Initialize the heap for page allocation
+// The page metadata is only initialized as alloc_pages() grows into the
+// heap, so this takes the same time whatever the size of memory
+// All pages start out in a single zone on node 0
 void page_init(void) {
   HEAP_BOTTOM = HEAP_START;
   NUM_PAGES = HEAP_SIZE / PAGE_SIZE;
-  struct page *ptr = (struct page *)HEAP_BOTTOM;
-  // Explicitly mark all pages as free
-  for (size_t i = 0; i < NUM_PAGES; ++i)
-    ptr[i].flags = 0;
   ALLOC_START =
       align_val(HEAP_BOTTOM + NUM_PAGES * sizeof(struct page), PAGE_ORDER);
   ALLOC_END = page_address_from_id(NUM_PAGES);
@@ -46,51 +81,196 @@ void page_init(void) {
   ALLOC_END = HEAP_BOTTOM + HEAP_SIZE;
   ASSERT(page_address_from_id(NUM_PAGES) <= ALLOC_END,
 	 "page_init(): Heap extends beyond our available memory region!");
+  PAGES_USED = 0;
+  PAGE_ALLOC_FAILURES = 0;
+  ZONES[0] = (struct page_zone) {
+  .node = 0,.start = 0,.end = NUM_PAGES,.initialized = 0,.used = 0,.remote =
+	0};
+  NUM_ZONES = 1;
+  LOCAL_NODE = 0;
+}
+
+// Make page `id` the start of a zone, splitting the zone it is in
+static void page_zone_split(size_t id) {
+  struct page_zone *zone = page_zone_of(id);
+  if (zone == NULL || zone->start == id)
+    return;
+  ASSERT(NUM_ZONES < PAGE_MAX_ZONES,
+	 "page_zone_split(): more than %d memory zones", PAGE_MAX_ZONES);
+  size_t i = zone - ZONES;
+  for (size_t j = NUM_ZONES; j > i + 1; --j)
+    ZONES[j] = ZONES[j - 1];
+  ++NUM_ZONES;
+  ZONES[i + 1] = ZONES[i];
+  ZONES[i + 1].start = id;
+  if (ZONES[i].initialized > id)
+    ZONES[i].initialized = id;
+  else
+    ZONES[i + 1].initialized = id;
+  ZONES[i].end = id;
+}
+
+// Assign the pages in physical address range [start, end) to NUMA node
+// `node`
+// Only allowed before the first allocation
+void page_set_node(size_t start, size_t end, size_t node) {
+  ASSERT(PAGES_USED == 0,
+	 "page_set_node(): zones cannot change once pages are allocated");
+  start = start > ALLOC_START ? (start - ALLOC_START) / PAGE_SIZE : 0;
+  end = end > ALLOC_START ? (end - ALLOC_START) / PAGE_SIZE : 0;
+  if (end > NUM_PAGES)
+    end = NUM_PAGES;
+  if (start >= end)
+    return;
+  page_zone_split(start);
+  page_zone_split(end);
+  for (size_t i = 0; i < NUM_ZONES; ++i)
+    if (start <= ZONES[i].start && ZONES[i].end <= end)
+      ZONES[i].node = node;
+}
+
+void page_set_local_node(size_t node) {
+  LOCAL_NODE = node;
 }
 
-// Attempts to allocate the specified number of contiguous free pages
-// and returns a pointer to the beginning of the first page if successful
+size_t page_get_local_node(void) {
+  return LOCAL_NODE;
+}
+
+// First fit for `n` contiguous free pages within `zone`, the first of
+// them aligned to `align` pages, taking them if found
+static void *page_zone_alloc(struct page_zone *zone, size_t n, size_t align) {
+  struct page *ptr = (struct page *)HEAP_BOTTOM;
+  size_t i = zone->start;
+  while (true) {
+    for (; i + n <= zone->initialized; ++i) {
+      if ((page_address_from_id(i) / PAGE_SIZE) % align != 0)
+	continue;
+      // Check that the next `n` pages are all free
+      bool found = true;
+      for (size_t j = 0; j < n; ++j)
+	if (ptr[i + j].flags & PAGE_TAKEN) {
+	  found = false;
+	  break;
+	}
+      if (!found)
+	continue;
+
+      // Mark the next `n` pages as all taken and indicate
+      // the last page
+      for (size_t j = 0; j < n; ++j)
+	ptr[i + j].flags = PAGE_TAKEN;
+      ptr[i + n - 1].flags |= PAGE_LAST;
+      zone->used += n;
+      PAGES_USED += n;
+
+      // Zero memory for all `n` pages and return a pointer to
+      // the beginning of the 1st page
+      void *result = (void *)page_address_from_id(i);
+      page_zero(result, PAGE_SIZE * n);
+      return result;
+    }
+
+    // Grow into the rest of the zone and resume the scan where it
+    // stopped: a fit found now must overlap the new pages
+    if (zone->initialized == zone->end)
+      return NULL;
+    page_init_metadata(zone, zone->initialized + n);
+  }
+}
+
+// `n` contiguous pages aligned to `align` pages from the zones of `node`,
+// or failing that from those of the other nodes
+static void *page_alloc_zones(size_t n, size_t node, size_t align) {
+  for (int local = 1; local >= 0; --local)
+    for (size_t i = 0; i < NUM_ZONES; ++i) {
+      if ((ZONES[i].node == node) != local)
+	continue;
+      void *result = page_zone_alloc(&ZONES[i], n, align);
+      if (result != NULL) {
+	if (!local)
+	  ZONES[i].remote += n;
+	return result;
+      }
+    }
+  return NULL;
+}
+
+// Attempts to allocate the specified number of contiguous free pages,
+// preferably on NUMA node `node`, and returns a pointer to the
+// beginning of the first page if successful
+// Zones on other nodes are only tried if there is no room on `node`,
+// and the reclaim handler if there is no room anywhere
 // All allocated pages are automatically zeroed if successful
 // Otherwise, return NULL
-void *alloc_pages(size_t n) {
+void *alloc_pages_node(size_t n, size_t node) {
   ASSERT(n != 0, "alloc_pages(): attempted to allocate 0 pages");
-  struct page *ptr = (struct page *)HEAP_BOTTOM;
-  for (size_t i = 0; i + n < NUM_PAGES + 1; ++i) {
-    // Check that the next `n` pages are all free
-    bool found = true;
-    for (size_t j = 0; j < n; ++j)
-      if (ptr[i + j].flags & PAGE_TAKEN) {
-	found = false;
-	break;
-      }
-    if (!found)
-      continue;
-
-    // Mark the next `n` pages as all taken and indicate
-    // the last page
-    for (size_t j = 0; j < n; ++j)
-      ptr[i + j].flags = PAGE_TAKEN;
-    ptr[i + n - 1].flags |= PAGE_LAST;
-
-    // Zero memory for all `n` pages and return a pointer to
-    // the beginning of the 1st page
-    // Do it in chunks of size_t bytes for efficiency
-    size_t *result = (size_t *)page_address_from_id(i);
-    size_t size = (PAGE_SIZE * n) / sizeof(size_t);
-    for (size_t j = 0; j < size; ++j)
-      result[j] = 0;
-    return (void *)result;
-  }
+  void *result = page_alloc_zones(n, node, 1);
+  if (result != NULL)
+    return result;
 
   // Failed to find `n` contiguous free pages
+  // Give the reclaim handler one chance to free some up, unless the
+  // allocation is its own
+  if (RECLAIM_HANDLER != NULL && !RECLAIMING) {
+    RECLAIMING = true;
+    size_t freed = RECLAIM_HANDLER(n);
+    // If the retry fails too, it counts the failure
+    void *result = freed != 0 ? alloc_pages_node(n, node) : NULL;
+    RECLAIMING = false;
+    if (freed != 0)
+      return result;
+  }
+  ++PAGE_ALLOC_FAILURES;
   return NULL;
 }
 
+// Set the function alloc_pages() calls when it runs out of memory
+// It should free at least the given number of pages if it can, and
+// return how many it freed; allocations it makes itself are not
+// reclaimed for
+void page_set_reclaim_handler(size_t (*handler)(size_t)) {
+  RECLAIM_HANDLER = handler;
+}
+
+// Allocate `n` contiguous zeroed pages on the local node if possible,
+// see alloc_pages_node()
+void *alloc_pages(size_t n) {
+  return alloc_pages_node(n, LOCAL_NODE);
+}
+
 // Attempts to allocate a single zeroed free page; NULL otherwise
 void *alloc_page(void) {
   return alloc_pages(1);
 }
 
+// Allocate `n` contiguous zeroed pages on the local node if possible,
+// the first of them aligned to `align` pages (a power of two), e.g. for
+// a megapage
+// The reclaim handler is not called, as these allocations have a
+// fallback: swapping out pages just to get an aligned run would cost
+// more than it saves
+// Returns NULL if there is no such run free, which does not count as an
+// allocation failure
+void *alloc_pages_aligned(size_t n, size_t align) {
+  ASSERT(n != 0, "alloc_pages_aligned(): attempted to allocate 0 pages");
+  return page_alloc_zones(n, LOCAL_NODE, align);
+}
+
+// Turn the allocation of contiguous pages starting at `ptr` into one
+// allocation per page, so that each can be freed on its own
+// Returns the number of pages
+size_t page_split(void *ptr) {
+  struct page *p =
+      (struct page *)(HEAP_BOTTOM + ((size_t)ptr - ALLOC_START) / PAGE_SIZE);
+  size_t n = 1;
+  for (; !(p->flags & PAGE_LAST); ++p, ++n) {
+    ASSERT(p->flags & PAGE_TAKEN, "page_split(): %p is not allocated", ptr);
+    p->flags |= PAGE_LAST;
+  }
+  return n;
+}
+
 // Deallocate a set of contiguous pages from a pointer returned
 // from alloc_pages()
 void dealloc_pages(void *ptr) {
@@ -102,11 +282,15 @@ void dealloc_pages(void *ptr) {
 	 && addr < HEAP_BOTTOM + HEAP_SIZE,
 	 "dealloc_pages(): Variable addr = %p outside heap range [%p, %p)",
 	 addr, HEAP_BOTTOM, HEAP_BOTTOM + HEAP_SIZE);
+  struct page_zone *zone = page_zone_of(addr - HEAP_BOTTOM);
+  ASSERT(zone != NULL, "dealloc_pages(): %p is not in any zone", ptr);
 
   // Keep clearing pages until we hit the last page
   struct page *p = (struct page *)addr;
+  size_t freed = 0;
   while ((p->flags & PAGE_TAKEN) && !(p->flags & PAGE_LAST)) {
     p->flags = 0;
+    ++freed;
     ++p;
   }
   ASSERT(p->flags & PAGE_LAST,
@@ -115,6 +299,9 @@ void dealloc_pages(void *ptr) {
 
   // Clear the flags on the last page
   p->flags = 0;
+  ++freed;
+  zone->used -= freed;
+  PAGES_USED -= freed;
 }
 
 void print_page_allocations(void) {
@@ -127,27 +314,33 @@ void print_page_allocations(void) {
   kprintf("METADATA: [%p, %p)\n", ptr, &ptr[NUM_PAGES]);
   kprintf("PAGES: [%p, %p)\n", ALLOC_START, ALLOC_END);
   kprintf("========================================\n");
-  for (size_t i = 0; i < NUM_PAGES; ++i) {
-    if (ptr[i].flags & PAGE_TAKEN) {
-      size_t start_addr = page_address_from_id(i);
-      if (ptr[i].flags & PAGE_LAST) {
-	kprintf("[%p, %p): 1 page\n", start_addr, start_addr + PAGE_SIZE);
-	++total;
-	continue;
-      }
-      ++i;
-      while (i < NUM_PAGES && (ptr[i].flags & PAGE_TAKEN)
-	     && !(ptr[i].flags & PAGE_LAST))
+  for (size_t z = 0; z < NUM_ZONES; ++z) {
+    struct page_zone *zone = &ZONES[z];
+    kprintf("NODE %d: [%p, %p)\n", zone->node,
+	    page_address_from_id(zone->start), page_address_from_id(zone->end));
+    // Pages beyond zone->initialized have never been allocated
+    for (size_t i = zone->start; i < zone->initialized; ++i) {
+      if (ptr[i].flags & PAGE_TAKEN) {
+	size_t start_addr = page_address_from_id(i);
+	if (ptr[i].flags & PAGE_LAST) {
+	  kprintf("[%p, %p): 1 page\n", start_addr, start_addr + PAGE_SIZE);
+	  ++total;
+	  continue;
+	}
 	++i;
-      ASSERT(i < NUM_PAGES,
-	     "print_page_allocations(): reached end of metadata before finding the last page");
-      ASSERT(ptr[i].flags & PAGE_TAKEN,
-	     "print_page_allocations(): found free page before reaching the "
-	     "last page - possible double-free error");
-      size_t end_addr = page_address_from_id(i + 1);
-      size_t pages = (end_addr - start_addr) / PAGE_SIZE;
-      kprintf("[%p, %p): %d pages\n", start_addr, end_addr, pages);
-      total += pages;
+	while (i < zone->initialized && (ptr[i].flags & PAGE_TAKEN)
+	       && !(ptr[i].flags & PAGE_LAST))
+	  ++i;
+	ASSERT(i < zone->initialized,
+	       "print_page_allocations(): reached end of metadata before finding the last page");
+	ASSERT(ptr[i].flags & PAGE_TAKEN,
+	       "print_page_allocations(): found free page before reaching the "
+	       "last page - possible double-free error");
+	size_t end_addr = page_address_from_id(i + 1);
+	size_t pages = (end_addr - start_addr) / PAGE_SIZE;
+	kprintf("[%p, %p): %d pages\n", start_addr, end_addr, pages);
+	total += pages;
+      }
     }
   }
   kprintf("========================================\n");
@@ -157,3 +350,51 @@ void print_page_allocations(void) {
 	  TOTAL_BYTES - ALLOC_BYTES);
   kputchar('\n');
 }
+
+// Fill in `stats`
+// The free extent histogram and largest free extent take a walk over
+// the page metadata, so they are only filled in if `extents` is nonzero
+void page_get_stats(struct page_stats *stats, int extents) {
+  stats->total_pages = NUM_PAGES;
+  stats->used_pages = PAGES_USED;
+  stats->free_pages = NUM_PAGES - PAGES_USED;
+  stats->metadata_pages = (ALLOC_START - HEAP_BOTTOM) / PAGE_SIZE;
+  stats->alloc_failures = PAGE_ALLOC_FAILURES;
+  stats->largest_free_extent = 0;
+  memset(stats->free_extents, 0, sizeof(stats->free_extents));
+  stats->num_zones = NUM_ZONES;
+  for (size_t z = 0; z < NUM_ZONES; ++z) {
+    stats->zones[z].node = ZONES[z].node;
+    stats->zones[z].start_addr = page_address_from_id(ZONES[z].start);
+    stats->zones[z].total_pages = ZONES[z].end - ZONES[z].start;
+    stats->zones[z].used_pages = ZONES[z].used;
+    stats->zones[z].remote_pages = ZONES[z].remote;
+  }
+  if (!extents)
+    return;
+  struct page *ptr = (struct page *)HEAP_BOTTOM;
+  // Free extents are counted per zone, as no allocation can span two
+  for (size_t z = 0; z < NUM_ZONES; ++z) {
+    struct page_zone *zone = &ZONES[z];
+    size_t i = zone->start;
+    while (i < zone->end) {
+      if (i < zone->initialized && (ptr[i].flags & PAGE_TAKEN)) {
+	++i;
+	continue;
+      }
+      size_t start = i;
+      while (i < zone->initialized && !(ptr[i].flags & PAGE_TAKEN))
+	++i;
+      // Pages beyond zone->initialized are all free
+      if (i == zone->initialized)
+	i = zone->end;
+      size_t length = i - start;
+      size_t bucket = 63 - __builtin_clzl(length);
+      if (bucket >= PAGE_EXTENT_BUCKETS)
+	bucket = PAGE_EXTENT_BUCKETS - 1;
+      ++stats->free_extents[bucket];
+      if (length > stats->largest_free_extent)
+	stats->largest_free_extent = length;
+    }
+  }
+}
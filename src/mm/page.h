@@ -13,14 +13,72 @@ struct page {
   uint8_t flags;
 };
 
+// Page metadata is initialized this many pages at a time, as
+// alloc_pages() first reaches them
+#define PAGE_INIT_CHUNK 4096
+
+// Free extents of 2^i to 2^(i+1) - 1 pages are counted in bucket i
+#define PAGE_EXTENT_BUCKETS 24
+
+// Most memory zones the page allocator keeps track of
+#define PAGE_MAX_ZONES 8
+
+// A zone is a contiguous range of pages on one NUMA node
+// Allocations never span zones
+struct page_zone {
+  size_t node;
+  // Page IDs [start, end)
+  size_t start;
+  size_t end;
+  // Page metadata is initialized lazily: only the entries of pages
+  // [start, initialized) are valid, and all pages beyond are free
+  size_t initialized;
+  size_t used;
+  // Pages handed out to allocations that preferred another node
+  size_t remote;
+};
+
+// Per-zone part of struct page_stats
+struct page_zone_stats {
+  size_t node;
+  size_t start_addr;
+  size_t total_pages;
+  size_t used_pages;
+  size_t remote_pages;
+};
+
+// Page allocator statistics
+// The counters are kept up to date by alloc_pages() and dealloc_pages();
+// only the free extent fields need a walk over the page metadata
+struct page_stats {
+  size_t total_pages;
+  size_t free_pages;
+  size_t used_pages;
+  // Pages holding the page metadata itself, not part of total_pages
+  size_t metadata_pages;
+  size_t alloc_failures;
+  size_t largest_free_extent;
+  size_t free_extents[PAGE_EXTENT_BUCKETS];
+  size_t num_zones;
+  struct page_zone_stats zones[PAGE_MAX_ZONES];
+};
+
 size_t get_num_pages(void);
 
 size_t align_val(size_t, size_t);
 
 void page_init(void);
+void page_set_node(size_t, size_t, size_t);
+void page_set_local_node(size_t);
+size_t page_get_local_node(void);
+void *alloc_pages_node(size_t, size_t);
+void page_set_reclaim_handler(size_t (*)(size_t));
 void *alloc_pages(size_t);
 void *alloc_page(void);
+void *alloc_pages_aligned(size_t, size_t);
+size_t page_split(void *);
 void dealloc_pages(void *);
 void print_page_allocations(void);
+void page_get_stats(struct page_stats *, int);
 
 #endif
@@ -0,0 +1,83 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "slab.h"
+#include "page.h"
+#include "../common/common.h"
+
+#define SLAB_OF(object) ((struct slab *)((size_t)(object) & ~(PAGE_SIZE - 1)))
+
+// Objects per slab of `cache`
+#define SLAB_OBJECTS(cache) (SLAB_MAX_SIZE / (cache)->size)
+
+static void slab_unlink(struct slab_cache *cache, struct slab *slab) {
+  if (slab->prev != NULL)
+    slab->prev->next = slab->next;
+  else
+    cache->partial = slab->next;
+  if (slab->next != NULL)
+    slab->next->prev = slab->prev;
+}
+
+static void slab_push(struct slab_cache *cache, struct slab *slab) {
+  slab->prev = NULL;
+  slab->next = cache->partial;
+  if (cache->partial != NULL)
+    cache->partial->prev = slab;
+  cache->partial = slab;
+}
+
+// Allocate a new slab for `cache`, with all of its objects free
+static struct slab *slab_grow(struct slab_cache *cache) {
+  struct slab *slab = alloc_page();
+  if (slab == NULL)
+    return NULL;
+  slab->free = NULL;
+  slab->in_use = 0;
+  uint8_t *objects = (uint8_t *)(slab + 1);
+  for (size_t i = SLAB_OBJECTS(cache); i-- > 0;) {
+    void **object = (void **)(objects + i * cache->size);
+    *object = slab->free;
+    slab->free = object;
+  }
+  slab_push(cache, slab);
+  ++cache->slabs;
+  return slab;
+}
+
+// Allocate an object from `cache`; NULL if there is no memory left
+// Its contents are undefined
+void *slab_alloc(struct slab_cache *cache) {
+  ASSERT(cache->size >= sizeof(void *) && cache->size <= SLAB_MAX_SIZE,
+	 "slab_alloc(): object size %d does not fit in a slab\n",
+	 cache->size);
+  struct slab *slab = cache->partial;
+  if (slab == NULL && (slab = slab_grow(cache)) == NULL)
+    return NULL;
+  void **object = slab->free;
+  slab->free = *object;
+  ++slab->in_use;
+  ++cache->objects;
+  if (slab->free == NULL)
+    slab_unlink(cache, slab);
+  return object;
+}
+
+// Return `object`, allocated from `cache`, to it
+void slab_free(struct slab_cache *cache, void *object) {
+  if (object == NULL)
+    return;
+  struct slab *slab = SLAB_OF(object);
+  ASSERT(slab->in_use != 0, "slab_free(): %p is not allocated\n", object);
+  if (slab->free == NULL)
+    slab_push(cache, slab);
+  *(void **)object = slab->free;
+  slab->free = object;
+  --slab->in_use;
+  --cache->objects;
+  if (slab->in_use == 0
+      && (slab->prev != NULL || slab->next != NULL)) {
+    slab_unlink(cache, slab);
+    dealloc_pages(slab);
+    --cache->slabs;
+  }
+}
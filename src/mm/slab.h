@@ -0,0 +1,55 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include "page.h"
+
+/*
+ * Slab caches of fixed-size objects
+ *
+ * Objects that are allocated and freed all the time, such as process
+ * structures, come from a cache of their own rather than from kmalloc():
+ * each slab is a single page, starting with a struct slab, carved into
+ * as many objects as fit after it. Free objects are linked through their
+ * first word, so allocating and freeing one takes constant time and
+ * never fragments the kmalloc() arena
+ *
+ * Slabs with free objects are kept on a list; a slab whose objects are
+ * all free goes back to the page allocator, unless it is the only one
+ * with free objects left, so that a single allocation and free in a row
+ * does not allocate and free a page every time
+ */
+
+// Header at the start of each slab page
+struct slab {
+  struct slab *prev;
+  struct slab *next;
+  void *free;
+  size_t in_use;
+};
+
+// - size: object size, rounded up to a multiple of 8 bytes
+// - partial: slabs with at least one free object
+// - slabs/objects: pages and objects currently allocated
+struct slab_cache {
+  size_t size;
+  struct slab *partial;
+  size_t slabs;
+  size_t objects;
+};
+
+// Objects larger than this do not fit in a slab
+#define SLAB_MAX_SIZE (PAGE_SIZE - sizeof(struct slab))
+
+// Initializer for a cache of objects of `type`
+#define SLAB_CACHE(type) ((struct slab_cache){\
+  .size = (sizeof(type) + 7) & ~7ull,\
+  .partial = NULL,\
+  .slabs = 0,\
+  .objects = 0\
+})
+
+void *slab_alloc(struct slab_cache *);
+void slab_free(struct slab_cache *, void *);
+
+#endif
@@ -77,8 +77,22 @@ void map(struct page_table *root, size_t vaddr, size_t paddr, uint64_t bits,
       bits | PTE_VALID;
 }
 
+/*
+ * Share the global (kernel) mappings of `kernel` with `root`
+ * The level 2 entries are copied as-is, so the lower level page tables
+ * are shared between all address spaces and never freed by unmap()
+ */
+void map_global(struct page_table *root, struct page_table const *kernel) {
+  ASSERT(root != NULL && kernel != NULL,
+	 "map_global(): page tables should not be NULL");
+  for (size_t i = 0; i < PT_NUM_ENTRIES; ++i)
+    if (PTE_IS_VALID(kernel->entries[i]))
+      root->entries[i] = kernel->entries[i] | PTE_GLOBAL;
+}
+
 /*
  * Unmap and free all memory associated with root page table
+ * Global (kernel) entries are shared and left alone
  * The root itself should be freed manually
  */
 void unmap(struct page_table *root) {
@@ -87,6 +101,8 @@ void unmap(struct page_table *root) {
   // Start with level 2
   for (size_t lv2 = 0; lv2 < PT_NUM_ENTRIES; ++lv2) {
     uint64_t entry_lv2 = root->entries[lv2];
+    if (entry_lv2 & PTE_GLOBAL)
+      continue;
     if (PTE_IS_VALID(entry_lv2) && PTE_IS_BRANCH(entry_lv2)) {
       // This is a valid entry, so drill down and free
       struct page_table *table_lv1 =
@@ -103,6 +119,65 @@ void unmap(struct page_table *root) {
   }
 }
 
+/*
+ * Number of 4 KiB pages mapped with PTE_USER in the address space of
+ * `root` (a megapage counts as 512 pages)
+ * Global (kernel) entries are skipped, as in unmap()
+ */
+size_t count_user_pages(struct page_table const *root) {
+  ASSERT(root != NULL, "count_user_pages(): root should not be NULL");
+  size_t count = 0;
+  for (size_t lv2 = 0; lv2 < PT_NUM_ENTRIES; ++lv2) {
+    uint64_t entry_lv2 = root->entries[lv2];
+    if (PTE_IS_INVALID(entry_lv2) || (entry_lv2 & PTE_GLOBAL))
+      continue;
+    if (PTE_IS_LEAF(entry_lv2)) {
+      if (entry_lv2 & PTE_USER)
+	count += PT_NUM_ENTRIES * PT_NUM_ENTRIES;
+      continue;
+    }
+    const struct page_table *table_lv1 =
+	(const struct page_table *)((entry_lv2 & ~0x3FFull) << 2);
+    for (size_t lv1 = 0; lv1 < PT_NUM_ENTRIES; ++lv1) {
+      uint64_t entry_lv1 = table_lv1->entries[lv1];
+      if (PTE_IS_INVALID(entry_lv1))
+	continue;
+      if (PTE_IS_LEAF(entry_lv1)) {
+	if (entry_lv1 & PTE_USER)
+	  count += PT_NUM_ENTRIES;
+	continue;
+      }
+      const struct page_table *table_lv0 =
+	  (const struct page_table *)((entry_lv1 & ~0x3FFull) << 2);
+      for (size_t lv0 = 0; lv0 < PT_NUM_ENTRIES; ++lv0)
+	if (PTE_IS_VALID(table_lv0->entries[lv0])
+	    && (table_lv0->entries[lv0] & PTE_USER))
+	  ++count;
+    }
+  }
+  return count;
+}
+
+// Level 0 PTE for `vaddr`, valid or not, or NULL if there is no level 0
+// page table for it (or it is part of a larger page)
+uint64_t *get_pte(struct page_table *root, size_t vaddr) {
+  return get_pte_at(root, vaddr, 0);
+}
+
+// Level `level` (0 or 1) PTE for `vaddr`, valid or not, or NULL if there
+// is no page table at that level for it (or it is part of a larger page)
+uint64_t *get_pte_at(struct page_table *root, size_t vaddr, int level) {
+  ASSERT(root != NULL, "get_pte(): root should not be NULL");
+  uint64_t *entries = root->entries;
+  for (int i = 2; i > level; --i) {
+    uint64_t pte = entries[(vaddr >> (12 + 9 * i)) & 0x1FF];
+    if (PTE_IS_INVALID(pte) || PTE_IS_LEAF(pte))
+      return NULL;
+    entries = (uint64_t *) ((pte & ~0x3FFull) << 2);
+  }
+  return &entries[(vaddr >> (12 + 9 * level)) & 0x1FF];
+}
+
 /*
  * Software implementation of Sv39 address translation logic
  * This is included despite the translation already implemented in hardware
@@ -143,3 +218,102 @@ size_t virt_to_phys(struct page_table const *root, size_t vaddr) {
   // No valid mapping at this point - return 0
   return 0x0;
 }
+
+// Called by copy_to_user() and friends on user addresses that are not
+// mapped, or not writable when written to, so that memory which is only
+// mapped on first touch or shared copy-on-write (see process_fault())
+// can be mapped in; returns 0 if it was
+static int (*USER_FAULT_HANDLER)(struct page_table const *, size_t, int) =
+    NULL;
+
+void set_user_fault_handler(int (*handler)
+			     (struct page_table const *, size_t, int)) {
+  USER_FAULT_HANDLER = handler;
+}
+
+// Whether `vaddr` is mapped for user space, and writable if `write` is
+// nonzero, going by the leaf PTE mapping it at whichever level
+static int user_accessible(struct page_table const *root, size_t vaddr,
+			   int write) {
+  const uint64_t *entries = root->entries;
+  for (int i = 2; i >= 0; --i) {
+    uint64_t pte = entries[(vaddr >> (12 + 9 * i)) & 0x1FF];
+    if (PTE_IS_INVALID(pte))
+      return 0;
+    if (PTE_IS_LEAF(pte))
+      return (pte & PTE_USER) && (!write || (pte & PTE_WRITE));
+    entries = (const uint64_t *)((pte & ~0x3FFull) << 2);
+  }
+  return 0;
+}
+
+// virt_to_phys() for a user address about to be read (`write` zero) or
+// written, going through the user fault handler if need be
+// Kernel addresses, and anything else not mapped with PTE_USER, are
+// refused: the kernel's global mappings are in every address space
+static size_t user_to_phys(struct page_table const *root, size_t vaddr,
+			   int write) {
+  if (vaddr < USER_SPACE_START)
+    return 0;
+  if (user_accessible(root, vaddr, write))
+    return virt_to_phys(root, vaddr);
+  if (USER_FAULT_HANDLER == NULL || USER_FAULT_HANDLER(root, vaddr, write))
+    return 0;
+  return user_accessible(root, vaddr, write) ? virt_to_phys(root, vaddr) : 0;
+}
+
+/*
+ * Copy `n` bytes from kernel memory at `src` to user virtual address `dst`
+ * in the address space described by `root`, one page at a time
+ * Returns the number of bytes copied, which falls short of `n` if part of
+ * the destination range is not mapped writable
+ */
+size_t copy_to_user(struct page_table const *root, size_t dst,
+		    const void *src, size_t n) {
+  size_t done = 0;
+  while (done < n) {
+    size_t vaddr = dst + done;
+    size_t chunk = PAGE_SIZE - vaddr % PAGE_SIZE;
+    if (chunk > n - done)
+      chunk = n - done;
+    size_t paddr = user_to_phys(root, vaddr, 1);
+    if (paddr == 0)
+      break;
+    memcpy((void *)paddr, (const uint8_t *)src + done, chunk);
+    done += chunk;
+  }
+  return done;
+}
+
+// Counterpart of copy_to_user() for reading from user memory
+size_t copy_from_user(struct page_table const *root, void *dst, size_t src,
+		      size_t n) {
+  size_t done = 0;
+  while (done < n) {
+    size_t vaddr = src + done;
+    size_t chunk = PAGE_SIZE - vaddr % PAGE_SIZE;
+    if (chunk > n - done)
+      chunk = n - done;
+    size_t paddr = user_to_phys(root, vaddr, 0);
+    if (paddr == 0)
+      break;
+    memcpy((uint8_t *) dst + done, (const void *)paddr, chunk);
+    done += chunk;
+  }
+  return done;
+}
+
+// Copy a NUL-terminated string of at most `n - 1` characters from user
+// space
+// Returns the length of the string, or `n` if it doesn't fit or faults
+size_t copy_string_from_user(struct page_table const *root, char *dst,
+			     size_t src, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    if (copy_from_user(root, &dst[i], src + i, 1) != 1)
+      return n;
+    if (dst[i] == '\0')
+      return i;
+  }
+  dst[n - 1] = '\0';
+  return n;
+}
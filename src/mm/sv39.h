@@ -1,6 +1,7 @@
 #ifndef SV39_H
 #define SV39_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 // MODE=8 encodes Sv39 paging in SATP register
@@ -16,6 +17,9 @@
 #define PTE_GLOBAL (1 << 5)
 #define PTE_ACCESS (1 << 6)
 #define PTE_DIRTY (1 << 7)
+// Software (RSW) bit marking an invalid PTE that holds a swap entry
+// instead, see src/mm/zram.h
+#define PTE_SWAPPED (1 << 8)
 
 // Common PTE bit combinations
 #define PTE_RW (PTE_READ | PTE_WRITE)
@@ -35,6 +39,13 @@
 
 // Construct SATP from MODE, ASID and PPN fields
 #define SATP_FROM(mode, asid, ppn) (((size_t)(mode) << 60) | ((size_t)(asid) << 44) | ppn)
+#define SATP_PPN ((1ull << 44) - 1)
+
+// The kernel identity-maps RAM and devices into the bottom of every
+// address space with global mappings, so user space starts at 64 GiB to
+// keep the two from sharing any root page table entry
+// copy_to_user() and friends refuse addresses below it
+#define USER_SPACE_START 0x1000000000ull
 
 // A page table is exactly 4096 / 8 = 512 64-bit entries
 #define PT_NUM_ENTRIES 512
@@ -43,7 +54,16 @@ struct page_table {
 };
 
 void map(struct page_table *, size_t, size_t, uint64_t, int);
+void map_global(struct page_table *, struct page_table const *);
 void unmap(struct page_table *);
+size_t count_user_pages(struct page_table const *);
+uint64_t *get_pte(struct page_table *, size_t);
+uint64_t *get_pte_at(struct page_table *, size_t, int);
 size_t virt_to_phys(struct page_table const *, size_t);
+void set_user_fault_handler(int (*)(struct page_table const *, size_t, int));
+size_t copy_to_user(struct page_table const *, size_t, const void *, size_t);
+size_t copy_from_user(struct page_table const *, void *, size_t, size_t);
+size_t copy_string_from_user(struct page_table const *, char *, size_t,
+			     size_t);
 
 #endif
@@ -0,0 +1,243 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "zram.h"
+#include "page.h"
+#include "../common/common.h"
+
+// Pool page compressed pages are currently appended to
+static struct zram_page *ZRAM_CURRENT = NULL;
+
+static size_t ZRAM_STORED_PAGES = 0;
+static size_t ZRAM_COMPRESSED_BYTES = 0;
+static size_t ZRAM_POOL_PAGES = 0;
+static size_t ZRAM_SWAP_OUTS = 0;
+static size_t ZRAM_SWAP_INS = 0;
+static size_t ZRAM_INCOMPRESSIBLE = 0;
+
+// Position + 1 of the last occurrence of each hashed 4-byte sequence
+static uint16_t ZRAM_HASH[1 << ZRAM_HASH_BITS];
+
+// Compressed page, preceded by its 2-byte length, as it is stored
+static uint8_t ZRAM_SCRATCH[ZRAM_MAX_COMPRESSED];
+
+static uint32_t zram_read32(const uint8_t *ptr) {
+  return ptr[0] | ptr[1] << 8 | ptr[2] << 16 | (uint32_t) ptr[3] << 24;
+}
+
+// Write the extension bytes of a length too large for its 4-bit field
+// in the token, which holds 15
+static uint8_t *zram_put_length(uint8_t *out, uint8_t *end, size_t len) {
+  for (; len >= 255; len -= 255) {
+    if (out == end)
+      return NULL;
+    *out++ = 255;
+  }
+  if (out == end)
+    return NULL;
+  *out++ = len;
+  return out;
+}
+
+static int zram_get_length(const uint8_t **in, const uint8_t *end,
+			   size_t *len) {
+  while (*in < end) {
+    uint8_t byte = *(*in)++;
+    *len += byte;
+    if (byte != 255)
+      return 0;
+  }
+  return -1;
+}
+
+// Append a sequence of `lit_len` literals followed by a match of
+// `match_len` bytes `offset` bytes back, or by nothing if `match_len` is 0
+// Returns the new end of the output, or NULL if it does not fit
+static uint8_t *zram_put_sequence(uint8_t *out, uint8_t *end,
+				  const uint8_t *lit, size_t lit_len,
+				  size_t offset, size_t match_len) {
+  if (out == end)
+    return NULL;
+  size_t match = match_len != 0 ? match_len - ZRAM_MIN_MATCH : 0;
+  *out++ = (lit_len < 15 ? lit_len : 15) << 4 | (match < 15 ? match : 15);
+  if (lit_len >= 15 && (out = zram_put_length(out, end, lit_len - 15)) == NULL)
+    return NULL;
+  if ((size_t)(end - out) < lit_len)
+    return NULL;
+  for (size_t i = 0; i < lit_len; ++i)
+    out[i] = lit[i];
+  out += lit_len;
+  if (match_len == 0)
+    return out;
+  if (end - out < 2)
+    return NULL;
+  *out++ = offset & 0xFF;
+  *out++ = offset >> 8;
+  if (match >= 15)
+    out = zram_put_length(out, end, match - 15);
+  return out;
+}
+
+// Compress `n` bytes from `src` into at most `cap` bytes at `dst`
+// Returns the compressed size, or 0 if it would exceed `cap`
+// Matches are found through a hash table of the last position of each
+// 4-byte sequence, so this makes a single pass over the input
+size_t zram_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+  ASSERT(n < (1 << 16), "zram_compress(): %d bytes is too large", n);
+  memset(ZRAM_HASH, 0, sizeof(ZRAM_HASH));
+  uint8_t *out = dst;
+  uint8_t *end = dst + cap;
+  size_t anchor = 0;		// start of the pending literals
+  size_t i = 0;
+  while (i + ZRAM_MIN_MATCH <= n) {
+    uint32_t seq = zram_read32(&src[i]);
+    size_t hash = (uint32_t) (seq * 2654435761u) >> (32 - ZRAM_HASH_BITS);
+    size_t candidate = ZRAM_HASH[hash];
+    ZRAM_HASH[hash] = i + 1;
+    if (candidate == 0 || zram_read32(&src[candidate - 1]) != seq) {
+      ++i;
+      continue;
+    }
+    --candidate;
+    size_t len = ZRAM_MIN_MATCH;
+    while (i + len < n && src[candidate + len] == src[i + len])
+      ++len;
+    out = zram_put_sequence(out, end, &src[anchor], i - anchor,
+			    i - candidate, len);
+    if (out == NULL)
+      return 0;
+    i += len;
+    anchor = i;
+  }
+  out = zram_put_sequence(out, end, &src[anchor], n - anchor, 0, 0);
+  return out != NULL ? (size_t)(out - dst) : 0;
+}
+
+// Decompress the `n` bytes at `src` into at most `cap` bytes at `dst`
+// Returns the decompressed size, or 0 if the input is corrupt or does
+// not fit
+size_t zram_decompress(const uint8_t *src, size_t n, uint8_t *dst,
+		       size_t cap) {
+  const uint8_t *in = src;
+  const uint8_t *end = src + n;
+  size_t out = 0;
+  while (in < end) {
+    uint8_t token = *in++;
+    size_t lit_len = token >> 4;
+    if (lit_len == 15 && zram_get_length(&in, end, &lit_len) != 0)
+      return 0;
+    if ((size_t)(end - in) < lit_len || cap - out < lit_len)
+      return 0;
+    for (size_t i = 0; i < lit_len; ++i)
+      dst[out + i] = in[i];
+    in += lit_len;
+    out += lit_len;
+    // The last sequence has no match
+    if (in == end)
+      return out;
+    if (end - in < 2)
+      return 0;
+    size_t offset = in[0] | in[1] << 8;
+    in += 2;
+    size_t match_len = token & 0xF;
+    if (match_len == 15 && zram_get_length(&in, end, &match_len) != 0)
+      return 0;
+    match_len += ZRAM_MIN_MATCH;
+    if (offset == 0 || offset > out || cap - out < match_len)
+      return 0;
+    // Byte by byte, as the match may overlap what it produces
+    for (size_t i = 0; i < match_len; ++i)
+      dst[out + i] = dst[out + i - offset];
+    out += match_len;
+  }
+  return 0;
+}
+
+// Compress the page at `page` into the pool
+// On success, the page is freed (or becomes a pool page itself if there
+// is no memory left for a new one) and the swap entry to store in its
+// PTE is returned
+// Returns 0, leaving the page alone, if it does not compress to
+// ZRAM_MAX_COMPRESSED bytes or less
+uint64_t zram_store(void *page) {
+  size_t len = zram_compress(page, PAGE_SIZE, &ZRAM_SCRATCH[2],
+			     ZRAM_MAX_COMPRESSED - 2);
+  if (len == 0) {
+    ++ZRAM_INCOMPRESSIBLE;
+    return 0;
+  }
+  ZRAM_SCRATCH[0] = len & 0xFF;
+  ZRAM_SCRATCH[1] = len >> 8;
+  size_t size = align_val(len + 2, 3);
+
+  int reuse = 0;
+  if (ZRAM_CURRENT == NULL || ZRAM_CURRENT->used + size > PAGE_SIZE) {
+    struct zram_page *pool = alloc_page();
+    if (pool == NULL) {
+      // The page is in the scratch buffer by now, so its frame can be
+      // the new pool page
+      pool = page;
+      reuse = 1;
+    }
+    if (ZRAM_CURRENT != NULL && ZRAM_CURRENT->live == 0) {
+      dealloc_pages(ZRAM_CURRENT);
+      --ZRAM_POOL_PAGES;
+    }
+    pool->used = sizeof(struct zram_page);
+    pool->live = 0;
+    ZRAM_CURRENT = pool;
+    ++ZRAM_POOL_PAGES;
+  }
+  size_t offset = ZRAM_CURRENT->used;
+  memcpy((uint8_t *) ZRAM_CURRENT + offset, ZRAM_SCRATCH, len + 2);
+  ZRAM_CURRENT->used += size;
+  ZRAM_CURRENT->live += size;
+  if (!reuse)
+    dealloc_pages(page);
+  ++ZRAM_STORED_PAGES;
+  ++ZRAM_SWAP_OUTS;
+  ZRAM_COMPRESSED_BYTES += size;
+  return ZRAM_ENTRY(ZRAM_CURRENT, offset, size);
+}
+
+// Drop the compressed page of swap entry `entry` from the pool
+void zram_free(uint64_t entry) {
+  ASSERT(entry & PTE_SWAPPED, "zram_free(): %p is not a swap entry", entry);
+  struct zram_page *pool = (struct zram_page *)ZRAM_ENTRY_POOL(entry);
+  size_t size = ZRAM_ENTRY_SIZE(entry);
+  ASSERT(pool->live >= size,
+	 "zram_free(): pool page %p holds only %d bytes, not %d", pool,
+	 pool->live, size);
+  pool->live -= size;
+  --ZRAM_STORED_PAGES;
+  ZRAM_COMPRESSED_BYTES -= size;
+  if (pool->live == 0 && pool != ZRAM_CURRENT) {
+    dealloc_pages(pool);
+    --ZRAM_POOL_PAGES;
+  }
+}
+
+// Decompress the page of swap entry `entry` into the page at `page` and
+// drop it from the pool
+// Returns 0 on success and -1 if the compressed copy is corrupt, in
+// which case it is kept
+int zram_load(uint64_t entry, void *page) {
+  ASSERT(entry & PTE_SWAPPED, "zram_load(): %p is not a swap entry", entry);
+  const uint8_t *blob =
+      (const uint8_t *)ZRAM_ENTRY_POOL(entry) + ZRAM_ENTRY_OFFSET(entry);
+  size_t len = blob[0] | blob[1] << 8;
+  if (len + 2 > ZRAM_ENTRY_SIZE(entry)
+      || zram_decompress(&blob[2], len, page, PAGE_SIZE) != PAGE_SIZE)
+    return -1;
+  zram_free(entry);
+  ++ZRAM_SWAP_INS;
+  return 0;
+}
+
+void zram_get_stats(struct zram_stats *stats) {
+  stats->stored_pages = ZRAM_STORED_PAGES;
+  stats->compressed_bytes = ZRAM_COMPRESSED_BYTES;
+  stats->pool_pages = ZRAM_POOL_PAGES;
+  stats->swap_outs = ZRAM_SWAP_OUTS;
+  stats->swap_ins = ZRAM_SWAP_INS;
+  stats->incompressible = ZRAM_INCOMPRESSIBLE;
+}
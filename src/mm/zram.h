@@ -0,0 +1,74 @@
+#ifndef ZRAM_H
+#define ZRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "page.h"
+#include "sv39.h"
+
+/*
+ * Compressed in-memory swap
+ *
+ * When alloc_pages() runs out of memory, cold anonymous user pages are
+ * compressed into a pool of kernel pages and their frames are freed
+ * (see process_reclaim()). The PTE of such a page is left invalid and
+ * instead holds a swap entry describing where the compressed copy
+ * lives; the next page fault on it decompresses it into a new frame
+ *
+ * Compressed pages are packed one after the other into pool pages, each
+ * of which starts with a struct zram_page and is freed once none of the
+ * pages it holds is left
+ *
+ * The codec is a byte-oriented LZ77 in the style of LZ4: a sequence of
+ * literals followed by a back reference of at least ZRAM_MIN_MATCH bytes
+ */
+
+// Pages that compress to more than this are left alone
+#define ZRAM_MAX_COMPRESSED (PAGE_SIZE * 3 / 4)
+
+#define ZRAM_MIN_MATCH 4
+#define ZRAM_HASH_BITS 12
+
+// Swap entries, stored in an invalid PTE:
+// - PTE[8]: PTE_SWAPPED
+// - PTE[18:10]: offset into the pool page, in 8-byte units
+// - PTE[28:19]: stored size, in 8-byte units
+// - PTE[63:29]: PPN of the pool page
+#define ZRAM_ENTRY(pool, offset, size) \
+  ((((size_t)(pool) >> PAGE_ORDER) << 29) | (((size) >> 3) << 19) | \
+   (((offset) >> 3) << 10) | PTE_SWAPPED)
+#define ZRAM_ENTRY_POOL(entry) (((entry) >> 29) << PAGE_ORDER)
+#define ZRAM_ENTRY_OFFSET(entry) ((((entry) >> 10) & 0x1FF) << 3)
+#define ZRAM_ENTRY_SIZE(entry) ((((entry) >> 19) & 0x3FF) << 3)
+
+// Header of a pool page
+struct zram_page {
+  // Bytes handed out so far, including this header
+  size_t used;
+  // Bytes of compressed pages still stored
+  size_t live;
+};
+
+// - stored_pages/compressed_bytes: pages currently swapped out and the
+//   space they take in the pool
+// - swap_outs/swap_ins: pages compressed and decompressed since boot
+// - incompressible: pages left in memory for exceeding
+//   ZRAM_MAX_COMPRESSED
+struct zram_stats {
+  size_t stored_pages;
+  size_t compressed_bytes;
+  size_t pool_pages;
+  size_t swap_outs;
+  size_t swap_ins;
+  size_t incompressible;
+};
+
+size_t zram_compress(const uint8_t *, size_t, uint8_t *, size_t);
+size_t zram_decompress(const uint8_t *, size_t, uint8_t *, size_t);
+
+uint64_t zram_store(void *);
+int zram_load(uint64_t, void *);
+void zram_free(uint64_t);
+void zram_get_stats(struct zram_stats *);
+
+#endif
@@ -1,9 +1,25 @@
 #include <stddef.h>
 #include "cpu.h"
 #include "../common/common.h"
+#include "../sbi/sbi.h"
+
+static size_t TIMER_DEADLINE = -1;
+
+// Set timer interrupt to fire when mtime reaches `deadline`
+// mtimecmp belongs to M-mode, which also has to clear the pending
+// supervisor timer interrupt, so this goes through the SBI
+void set_timer_interrupt_at(size_t deadline) {
+  TIMER_DEADLINE = deadline;
+  sbi_call(SBI_SET_TIMER, deadline, 0);
+}
+
+// The deadline last passed to set_timer_interrupt_at()
+size_t get_timer_deadline(void) {
+  return TIMER_DEADLINE;
+}
 
 // Set timer interrupt to fire `us` microseconds from now
 void set_timer_interrupt_delay_us(size_t us) {
-  *(size_t *)MTIMECMP_ADDR =
-      *(size_t *)MTIME_ADDR + us * (TICKS_PER_SECOND / US_PER_SECOND);
+  set_timer_interrupt_at(GET_MTIME() +
+			 us * TICKS_PER_SECOND / US_PER_SECOND);
 }
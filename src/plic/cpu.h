@@ -2,15 +2,25 @@
 #define CPU_H
 
 #include <stddef.h>
+#include "../fdt/fdt.h"
 
-#define CLINT_ADDR 0x2000000
+// Memory-mapped address of the CLINT, from the device tree
+#define CLINT_ADDR (PLATFORM.clint)
 
 // Microseconds per second
 #define US_PER_SECOND 1000000ull
 
-// The QEMU clock frequency is 0x989680 (= 10 MHz) according to our
-// device tree
-#define TICKS_PER_SECOND 0x989680ull
+// Frequency of mtime, from the timebase-frequency of the device tree
+// (0x989680 = 10 MHz on QEMU)
+#define TICKS_PER_SECOND (PLATFORM.timebase_frequency)
+
+// `ticks` of mtime in microseconds, splitting off whole seconds first so
+// that the multiplication cannot overflow
+#define TICKS_TO_US(ticks) ({\
+  size_t _ticks = (ticks);\
+  _ticks / TICKS_PER_SECOND * US_PER_SECOND +\
+    _ticks % TICKS_PER_SECOND * US_PER_SECOND / TICKS_PER_SECOND;\
+})
 
 // See section 3.2.1 (machine timer registers) of RISC-V privileged spec
 // for details on mtime, mtimecmp registers:
@@ -19,14 +29,17 @@
 // From our device tree, our QEMU virt RISC-V board has an
 // SiFive-compatible CLINT
 // Based on section 6.1 (CLINT Memory Map) of the SiFive E31 manual,
-// the MMIO addresses of the two registers are as follows:
+// the two registers are at the following offsets (0x02004000 and
+// 0x0200bff8 on QEMU):
 //
-// - mtimecmp: 0x02004000
-// - mtime: 0x0200bff8
+// - mtimecmp: 0x4000
+// - mtime: 0xbff8
 //
 // https://sifive.cdn.prismic.io/sifive%2Fc89f6e5a-cf9e-44c3-a3db-04420702dcc1_sifive+e31+manual+v19.08.pdf
-#define MTIMECMP_ADDR 0x02004000ull
-#define MTIME_ADDR 0x0200BFF8ull
+#define MTIMECMP_ADDR (CLINT_ADDR + 0x4000)
+#define MTIME_ADDR (CLINT_ADDR + 0xBFF8)
+
+#define GET_MTIME() (*(volatile size_t *)MTIME_ADDR)
 
 #define GET_MSCRATCH() ({\
   size_t _mscratch;\
@@ -46,6 +59,71 @@
   asm volatile ("csrw mie, %0" :: "r"((size_t)(mie)));\
 })
 
+#define SET_SIE(sie) ({\
+  asm volatile ("csrw sie, %0" :: "r"((size_t)(sie)));\
+})
+
+// Generic CSR accessors
+#define CSR_READ(csr) ({\
+  size_t _csr;\
+  asm volatile ("csrr %0, " #csr : "=r"(_csr));\
+  _csr;\
+})
+
+#define CSR_WRITE(csr, val) ({\
+  asm volatile ("csrw " #csr ", %0" :: "r"((size_t)(val)));\
+})
+
+#define CSR_SET(csr, bits) ({\
+  asm volatile ("csrs " #csr ", %0" :: "r"((size_t)(bits)));\
+})
+
+#define CSR_CLEAR(csr, bits) ({\
+  asm volatile ("csrc " #csr ", %0" :: "r"((size_t)(bits)));\
+})
+
+// Cycle counter and the time CSR (a read-only copy of mtime)
+// Unlike mtime itself, these can be read from U-mode once enabled in
+// scounteren
+#define GET_CYCLE() CSR_READ(cycle)
+#define GET_TIME() CSR_READ(time)
+
+// misa as read in M-mode at boot (see _start in src/asm/crt0.s)
+// S-mode cannot read misa itself
+extern const size_t MISA;
+#define MISA_EXTENSION(c) (1ull << ((c) - 'A'))
+#define HAS_VECTOR() (MISA & MISA_EXTENSION('V'))
+
+// mstatus.VS/sstatus.VS: vector unit state, must not be Off to use RVV
+// Off except while the kernel's memory routines run (see
+// src/common/common.c)
+#define SSTATUS_VS (0b11ull << 9)
+#define SSTATUS_VS_INITIAL (0b01ull << 9)
+
+// sstatus.SIE: interrupts enabled in S-mode
+#define SSTATUS_SIE (1 << 1)
+
+// sstatus.SPP: privilege mode a trap was taken from (1 = S-mode)
+#define SSTATUS_SPP (1 << 8)
+
+// Interrupt enable/pending bits shared by mie/mip and sie/sip
+#define IRQ_S_SOFT 1
+#define IRQ_S_TIMER 5
+#define IRQ_M_TIMER 7
+#define IRQ_S_EXT 9
+
+// Flush the whole TLB after changing page tables
+#define SFENCE_VMA() ({\
+  asm volatile ("sfence.vma" ::: "memory");\
+})
+
+// Flush the non-global TLB entries of address space `asid` only
+#define SFENCE_VMA_ASID(asid) ({\
+  asm volatile ("sfence.vma zero, %0" :: "r"((size_t)(asid)) : "memory");\
+})
+
 void set_timer_interrupt_delay_us(size_t);
+void set_timer_interrupt_at(size_t);
+size_t get_timer_deadline(void);
 
 #endif
@@ -1 +1,113 @@
 #include "plic.h"
+#include "cpu.h"
+#include "../common/common.h"
+#include "../uart/uart.h"
+
+struct plic_source {
+  plic_handler_t handler;
+  void *data;
+  struct plic_source_stats stats;
+};
+
+static struct plic_source PLIC_SOURCES[PLIC_NUM_SOURCES];
+
+// Claims for sources without a registered handler
+static size_t PLIC_SPURIOUS = 0;
+
+// Unmask all priorities and start with every source disabled
+void plic_init(void) {
+  for (uint32_t source = 1; source < PLIC_NUM_SOURCES; ++source) {
+    PLIC_DISABLE(source);
+    PLIC_SET_PRIO(source, 0);
+  }
+  PLIC_SET_THRESHOLD(0);
+}
+
+// Install `handler` for `source` and enable it with the given priority
+// Returns 0 on success and -1 if the source is invalid or already taken
+int plic_register(uint32_t source, plic_handler_t handler, void *data,
+		  uint32_t priority) {
+  if (source == 0 || source >= PLIC_NUM_SOURCES || handler == NULL
+      || PLIC_SOURCES[source].handler != NULL)
+    return -1;
+  PLIC_SOURCES[source].handler = handler;
+  PLIC_SOURCES[source].data = data;
+  plic_set_priority(source, priority);
+  plic_enable(source);
+  return 0;
+}
+
+void plic_unregister(uint32_t source) {
+  if (source == 0 || source >= PLIC_NUM_SOURCES)
+    return;
+  plic_disable(source);
+  PLIC_SOURCES[source].handler = NULL;
+  PLIC_SOURCES[source].data = NULL;
+}
+
+void plic_enable(uint32_t source) {
+  if (source != 0 && source < PLIC_NUM_SOURCES)
+    PLIC_ENABLE(source);
+}
+
+void plic_disable(uint32_t source) {
+  if (source != 0 && source < PLIC_NUM_SOURCES)
+    PLIC_DISABLE(source);
+}
+
+// Priority 0 never interrupts, 7 is the highest
+void plic_set_priority(uint32_t source, uint32_t priority) {
+  if (source != 0 && source < PLIC_NUM_SOURCES)
+    PLIC_SET_PRIO(source, priority);
+}
+
+// Service external interrupts until none are pending
+// Claiming again after each completion lets a single trap handle every
+// source that fired in the meantime, in priority order
+// Returns the number of interrupts serviced
+size_t plic_handle(void) {
+  size_t handled = 0;
+  uint32_t source;
+  while ((source = PLIC_CLAIM()) != 0) {
+    if (source < PLIC_NUM_SOURCES && PLIC_SOURCES[source].handler != NULL) {
+      struct plic_source *s = &PLIC_SOURCES[source];
+      size_t start = GET_MTIME();
+      s->handler(source, s->data);
+      size_t elapsed = GET_MTIME() - start;
+      ++s->stats.count;
+      s->stats.total_ticks += elapsed;
+      if (elapsed > s->stats.max_ticks)
+	s->stats.max_ticks = elapsed;
+    } else
+      ++PLIC_SPURIOUS;
+    PLIC_COMPLETE(source);
+    ++handled;
+  }
+  return handled;
+}
+
+struct plic_source_stats plic_get_stats(uint32_t source) {
+  struct plic_source_stats none = { 0 };
+  if (source == 0 || source >= PLIC_NUM_SOURCES)
+    return none;
+  return PLIC_SOURCES[source].stats;
+}
+
+size_t plic_get_spurious(void) {
+  return PLIC_SPURIOUS;
+}
+
+void plic_print_stats(void) {
+  kputchar('\n');
+  kprintf("PLIC INTERRUPT STATISTICS\n");
+  kprintf("source\tcount\tavg ticks\tmax ticks\n");
+  for (uint32_t source = 1; source < PLIC_NUM_SOURCES; ++source) {
+    struct plic_source_stats *stats = &PLIC_SOURCES[source].stats;
+    if (stats->count == 0)
+      continue;
+    kprintf("%d\t%d\t%d\t\t%d\n", source, stats->count,
+	    stats->total_ticks / stats->count, stats->max_ticks);
+  }
+  kprintf("spurious\t%d\n", PLIC_SPURIOUS);
+  kputchar('\n');
+}
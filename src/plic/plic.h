@@ -1,7 +1,21 @@
 #ifndef PLIC_H
 #define PLIC_H
 
-#define PLIC_ADDR 0xc000000
+#include <stddef.h>
+#include <stdint.h>
+#include "../fdt/fdt.h"
+
+// Memory-mapped address of the PLIC, from the device tree
+#define PLIC_ADDR (PLATFORM.plic)
+
+// Interrupt sources are numbered 1 through PLIC_NUM_SOURCES - 1
+// (0 is reserved) - our device tree has riscv,ndev = <0x35>
+#define PLIC_NUM_SOURCES 54
+
+// PLIC context we take interrupts on
+// Context 0 is hart 0 in M-mode and context 1 is hart 0 in S-mode,
+// where the kernel runs
+#define PLIC_CONTEXT 1
 
 /*
  * PLIC registers
@@ -38,28 +52,36 @@
 
 // Interrupt enables (`enables0`, `enables1`)
 // Similar to interrupt pending bits, but starting from
-// PLIC_ADDR + 0x2000 and the valid bits are writable (except
-// enables0[0] which is read-only 0), to specify which interrupt
+// PLIC_ADDR + 0x2000 + 0x80 * context and the valid bits are writable
+// (except enables0[0] which is read-only 0), to specify which interrupt
 // source(s) to enable
+// Each source is a single bit, so enabling or disabling one source must
+// read-modify-write the enable word to leave the other sources alone
+#define PLIC_ENABLE_WORD(source) \
+  ((volatile uint32_t *)&((uint8_t *)PLIC_ADDR)\
+    [0x2000 + 0x80 * PLIC_CONTEXT + 4 * ((source) >> 5)])
 #define PLIC_ENABLE(source) ({\
-  if (!((source) & ~0x1Full))\
-    *(uint32_t *)&((uint8_t *)PLIC_ADDR)[0x2000] = 1ull << (source);\
-  else \
-    *(uint32_t *)&((uint8_t *)PLIC_ADDR)[0x2004] = 1ull << ((source) & 0x1F);\
+  *PLIC_ENABLE_WORD(source) |= 1u << ((source) & 0x1F);\
+})
+#define PLIC_DISABLE(source) ({\
+  *PLIC_ENABLE_WORD(source) &= ~(1u << ((source) & 0x1F));\
 })
+#define PLIC_IS_ENABLED(source) \
+  (!!(*PLIC_ENABLE_WORD(source) & (1u << ((source) & 0x1F))))
 
 // Priority threshold
-// PLIC_ADDR + 0x200000 is a 32-bit register threshold[31:0]
-// specifying which priority level interrupts <= threshold
+// PLIC_ADDR + 0x200000 + 0x1000 * context is a 32-bit register
+// threshold[31:0] specifying which priority level interrupts <= threshold
 // should be masked
 // The only valid values are [0, 8) where 0 means "do not mask"
 // and 7 means "mask all interrupts"
 #define PLIC_SET_THRESHOLD(threshold) ({\
-  *(uint32_t *)&((uint8_t *)PLIC_ADDR)[0x200000] = (threshold) & 0x7;\
+  *(uint32_t *)&((uint8_t *)PLIC_ADDR)[0x200000 + 0x1000 * PLIC_CONTEXT] =\
+    (threshold) & 0x7;\
 })
 
 // Interrupt claim/complete register
-// PLIC_ADDR + 0x200004 is a 32-bit register for claiming (read)
+// PLIC_ADDR + 0x200004 + 0x1000 * context is a 32-bit register for claiming (read)
 // and completing (write) interrupts, where the value specifies the
 // interrupt source
 // Claiming an interrupt means the OS kernel informs the hardware that
@@ -68,9 +90,12 @@
 // Completing an interrupt means the OS kernel informs the hardware
 // that it has finished handling the interrupt and ready to wait for
 // the next interrupt from the same source
-#define PLIC_CLAIM() (*(uint32_t *)&((uint8_t *)PLIC_ADDR)[0x200004])
+#define PLIC_CLAIM_REG \
+  (*(volatile uint32_t *)&((uint8_t *)PLIC_ADDR)\
+    [0x200004 + 0x1000 * PLIC_CONTEXT])
+#define PLIC_CLAIM() (PLIC_CLAIM_REG)
 #define PLIC_COMPLETE(source) ({\
-  *(uint32_t *)&((uint8_t *)PLIC_ADDR)[0x200004] = (source);\
+  PLIC_CLAIM_REG = (source);\
 })
 
 // UART interrupt
@@ -78,4 +103,27 @@
 // i.e. it has source = 10
 #define PLIC_UART 10
 
+// Interrupt handler for a single source
+// Called with the source number and the data pointer given at
+// registration time, between claim and complete
+typedef void (*plic_handler_t)(uint32_t, void *);
+
+// Per-source statistics, with handler latency in mtime ticks
+struct plic_source_stats {
+  size_t count;
+  size_t total_ticks;
+  size_t max_ticks;
+};
+
+void plic_init(void);
+int plic_register(uint32_t, plic_handler_t, void *, uint32_t);
+void plic_unregister(uint32_t);
+void plic_enable(uint32_t);
+void plic_disable(uint32_t);
+void plic_set_priority(uint32_t, uint32_t);
+size_t plic_handle(void);
+struct plic_source_stats plic_get_stats(uint32_t);
+size_t plic_get_spurious(void);
+void plic_print_stats(void);
+
 #endif
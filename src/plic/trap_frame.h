@@ -14,6 +14,9 @@ struct trap_frame {
   size_t satp;
   void *trap_stack;
   size_t hartid;
+
+  // Floating point control and status register
+  size_t fcsr;
 };
 
 #define ZERO_TRAP_FRAME ((struct trap_frame){\
@@ -21,9 +24,8 @@ struct trap_frame {
   .fregs = {},\
   .satp = 0,\
   .trap_stack = NULL,\
-  .hartid = 0\
+  .hartid = 0,\
+  .fcsr = 0\
 })
 
-struct trap_frame *get_kernel_trap_frame(void);
-
 #endif
@@ -4,73 +4,153 @@
 #include "../common/common.h"
 #include "cpu.h"
 #include "plic.h"
+#include "work.h"
 #include "../syscon/syscon.h"
 #include "../process/syscall.h"
 #include "../process/sched.h"
 #include "../process/process.h"
+#include "../process/fp.h"
 #include "../mm/sv39.h"
 #include "../mm/page.h"
+#include "../mm/ksm.h"
+#include "../mm/huge.h"
+#include "../latency/latency.h"
+#include "../ipc/futex.h"
 
+// Common to all trap handlers: time spent in U-mode until now (`now`) is
+// charged to the current process, and the time spent in the kernel from
+// here on to the kernel on its behalf
+// Returns the current process, or NULL if the trap came from S-mode
+static struct process *trap_enter(size_t cause, size_t status, size_t now) {
+  latency_trap_enter(cause, now);
+  struct process *current = !(status & SSTATUS_SPP) ? sched_current() : NULL;
+  if (current != NULL)
+    process_account(current, 1);
+  return current;
+}
+
+// Common to all trap handlers returning to where the trap came from
+static void trap_exit(struct process *current, size_t status) {
+  latency_trap_exit();
+  // Not when interrupting deferred work, which picks up anything queued
+  // meanwhile itself
+  if (!(status & SSTATUS_SPP))
+    work_run();
+  if (current != NULL)
+    process_account(current, 0);
+}
+
+// Timer interrupt (forwarded by M-mode) at mtime `now`, with `current`
+// interrupted at `epc`
+// Does not return, as it switches processes
+static void trap_timer(struct process *current, size_t epc, size_t now) {
+  size_t deadline = get_timer_deadline();
+  latency_timer(now > deadline ? now - deadline : 0);
+  futex_expire(now);
+  // The timer also fires for real-time processes (see
+  // sched_arm_timer()), which only switch processes if they have to
+  int slice_over = sched_slice_over(now);
+  if (current != NULL) {
+    current->pc = epc;
+    if (slice_over) {
+      // Working set over the last time slice
+      process_age(current);
+      if (ksm_enabled())
+	process_merge(current, KSM_SCAN_PAGES);
+      if (huge_enabled())
+	process_collapse(current, HUGE_COLLAPSE_BLOCKS);
+    }
+  }
+  struct process *process = slice_over ? sched_schedule() : sched_preempt();
+  ASSERT(process != NULL,
+	 "trap_timer(): unexpected got NULL when attempting to schedule next process\n");
+  if (slice_over)
+    kprintf("Context switch: scheduling next process with PID = %d\n",
+	    process->pid);
+  if (current != NULL && current != process)
+    ++current->nivcsw;
+  process_switch(current, process);
+  PANIC("trap_timer(): failed to switch to process %d\n", process->pid);
+}
+
+// Entry points for the trap vectors in src/asm/crt0.s that skip decoding
+// the cause, for traps from U-mode
+
+// System call that does not switch processes, from the fast path in
+// s_exception_entry
+// Only the caller-saved registers are in `frame`
+size_t s_syscall_handler(size_t epc, struct trap_frame *frame) {
+  struct process *current = trap_enter(8, 0, GET_MTIME());
+  size_t return_pc = do_syscall(epc, frame);
+  trap_exit(current, 0);
+  return return_pc;
+}
+
+// External interrupt
+// Only the caller-saved registers are in the trap frame
+size_t s_external_handler(size_t epc) {
+  struct process *current =
+      trap_enter(CAUSE_INTERRUPT | IRQ_S_EXT, 0, GET_MTIME());
+  plic_handle();
+  trap_exit(current, 0);
+  return epc;
+}
+
+// Timer interrupt; does not return
+void s_timer_handler(size_t epc) {
+  size_t now = GET_MTIME();
+  trap_timer(trap_enter(CAUSE_INTERRUPT | IRQ_S_TIMER, 0, now), epc, now);
+}
+
+// S-mode trap handler
+// Everything except the machine timer and SBI calls is delegated to
+// S-mode (see _start in src/asm/crt0.s), so this is where syscalls,
+// page faults and device interrupts are handled, apart from the cases
+// above
+//
 // Handle only the following interrupts for now:
 //
 // - Load page faults
-// - Store/AMO page faults
+// - Store/AMO page faults, including the first touch of stack and
+//   anonymous mmap() pages and copy-on-write (see process_fault())
 // - Timer interrupts
-// - External interrupts (UART only)
+// - External interrupts (dispatched by the PLIC to registered handlers,
+//   which may queue work to run before returning to U-mode, see
+//   src/plic/work.h)
+//
+// While that work runs, external interrupts may come in from S-mode (see
+// s_trap_from_kernel in src/asm/crt0.s), and are all this handles then
 //
 // Panic on all other interrupts for the time being, so we know there's
 // an issue with our code when we get an unexpected type of interrupt
-size_t m_mode_trap_handler(size_t epc, size_t tval, size_t cause, size_t hart,
+size_t s_mode_trap_handler(size_t epc, size_t tval, size_t cause, size_t hart,
 			   size_t status, struct trap_frame *frame) {
   size_t return_pc = epc;
   size_t exception_code = CAUSE_EXCEPTION_CODE(cause);
+  size_t now = GET_MTIME();
+  struct process *current = trap_enter(cause, status, now);
   if (CAUSE_IS_INTERRUPT(cause)) {
     switch (exception_code) {
-    case 7:
-      // Timer interrupt
-      {
-	set_timer_interrupt_delay_us(1 * US_PER_SECOND);
-	struct process *process = sched_schedule();
-	ASSERT(process != NULL,
-	       "m_mode_trap_handler(): unexpected got NULL when attempting to schedule next process\n");
-	kprintf("Context switch: scheduling next process with PID = %d\n",
-		process->pid);
-	switch_to_user((size_t)process->frame, process->pc,
-		       SATP_FROM(MODE_SV39, process->pid,
-				 (size_t)process->root >> PAGE_ORDER));
-      }
+    case IRQ_S_TIMER:
+      trap_timer(current, epc, now);
       break;
-    case 11:
-      // External interrupt (UART)
-      {
-	uint32_t claim = PLIC_CLAIM();
-	ASSERT(claim == PLIC_UART,
-	       "m_mode_trap_handler(): unknown interrupt source #%d with machine external interrupt\n",
-	       claim);
-	uint8_t rcvd = uart_get();
-	switch (rcvd) {
-	case 3:
-	  poweroff();
-	case 13:
-	  kprintf("\n");
-	  break;
-	case 127:
-	  kprintf("%c %c", 8, 8);
-	  break;
-	default:
-	  kprintf("%c", rcvd);
-	}
-	PLIC_COMPLETE(claim);
-      }
+    case IRQ_S_EXT:
+      // External interrupt
+      // Only the top halves run here, with interrupts disabled
+      plic_handle();
       break;
     default:
-      PANIC("m_mode_trap_handler(): unknown interrupt with exception code %d\n",
+      PANIC("s_mode_trap_handler(): unknown interrupt with exception code %d\n",
 	    exception_code);
     }
   } else {
     switch (exception_code) {
     case 2:
       // Illegal instruction
+      // The first FP instruction of a process after a context switch
+      // lands here, see src/process/fp.c
+      if (current != NULL && fp_trap(current, epc, tval, status))
+	break;
       HALT();
       break;
     case 8:
@@ -79,20 +159,31 @@ size_t m_mode_trap_handler(size_t epc, size_t tval, size_t cause, size_t hart,
       break;
     case 13:
       // Load page fault
+      if (current != NULL)
+	++current->page_faults;
+      // Retry the access if the page was only waiting to be touched
+      if (current != NULL && process_fault(current, tval, 0) == 0)
+	break;
       kprintf("Load page fault: attempted to dereference address %p\n", tval);
       return_pc += 4;
       break;
     case 15:
       // Store/AMO page fault
+      if (current != NULL)
+	++current->page_faults;
+      // Retry the access if the page was only waiting to be touched
+      if (current != NULL && process_fault(current, tval, 1) == 0)
+	break;
       kprintf("Store/AMO page fault: attempted to dereference address %p\n",
 	      tval);
       return_pc += 4;
       break;
     default:
       PANIC
-	  ("m_mode_trap_handler(): unknown synchronous trap with exception code %d\n",
+	  ("s_mode_trap_handler(): unknown synchronous trap with exception code %d\n",
 	   exception_code);
     }
   }
+  trap_exit(current, status);
   return return_pc;
 }
@@ -4,10 +4,14 @@
 #include <stddef.h>
 #include "trap_frame.h"
 
+#define CAUSE_INTERRUPT (1ull << 63)
 #define CAUSE_IS_INTERRUPT(cause) (((size_t)(cause) >> 63) & 1)
 #define CAUSE_EXCEPTION_CODE(cause) ((size_t)(cause) & 0x7FFFFFFFFFFFFFFFull)
 
-size_t m_mode_trap_handler(size_t, size_t, size_t, size_t, size_t,
+size_t s_mode_trap_handler(size_t, size_t, size_t, size_t, size_t,
 			   struct trap_frame *);
+size_t s_syscall_handler(size_t, struct trap_frame *);
+size_t s_external_handler(size_t);
+void s_timer_handler(size_t);
 
 #endif
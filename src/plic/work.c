@@ -0,0 +1,60 @@
+#include <stddef.h>
+#include "work.h"
+#include "cpu.h"
+#include "../common/common.h"
+#include "../latency/latency.h"
+
+// Queued work, oldest first, linked through their next field
+static struct work *WORK_HEAD = NULL;
+static struct work *WORK_TAIL = NULL;
+
+// Queue `work` to run before the kernel returns to U-mode
+// Called from interrupt handlers, with interrupts disabled
+void work_queue(struct work *work) {
+  if (work->queued)
+    return;
+  work->queued = 1;
+  work->stamp = GET_MTIME();
+  work->next = NULL;
+  if (WORK_HEAD == NULL)
+    WORK_HEAD = work;
+  else
+    WORK_TAIL->next = work;
+  WORK_TAIL = work;
+}
+
+// Take the oldest queued work item off the queue, or return NULL if
+// there is none
+// Interrupts must be disabled, as their handlers may queue more work
+static struct work *work_pop(void) {
+  struct work *work = WORK_HEAD;
+  if (work != NULL) {
+    WORK_HEAD = work->next;
+    work->queued = 0;
+  }
+  return work;
+}
+
+// Run queued work, including any queued by interrupts taken meanwhile,
+// until there is none left
+// Called from the trap handler with interrupts disabled, which they are
+// again on return
+// Returns the number of work items run
+size_t work_run(void) {
+  size_t ran = 0;
+  struct work *work = work_pop();
+  if (work == NULL)
+    return 0;
+  // Only external interrupts may come in while work runs
+  size_t sie = CSR_READ(sie);
+  CSR_CLEAR(sie, 1 << IRQ_S_TIMER);
+  do {
+    latency_work(GET_MTIME() - work->stamp);
+    CSR_SET(sstatus, SSTATUS_SIE);
+    work->func(work->data);
+    CSR_CLEAR(sstatus, SSTATUS_SIE);
+    ++ran;
+  } while ((work = work_pop()) != NULL);
+  CSR_WRITE(sie, sie);
+  return ran;
+}
@@ -0,0 +1,45 @@
+#ifndef WORK_H
+#define WORK_H
+
+#include <stddef.h>
+
+/*
+ * Deferred work
+ *
+ * Interrupt handlers (top halves) run with interrupts disabled, so they
+ * only do what cannot wait, e.g. acknowledging the device and taking
+ * its data, and queue a work item for the rest. Queued work (bottom
+ * halves) runs in FIFO order with external interrupts enabled, once the
+ * trap handler is done and before it returns to U-mode or switches
+ * processes, so a slow bottom half, like a console command printing to
+ * the UART, does not hold off further interrupts
+ *
+ * The timer interrupt stays masked while work runs: scheduling happens
+ * on the way back to U-mode anyway, and the kernel is not preemptible
+ */
+
+// A work item, queued at most once at a time: queueing it again before it
+// runs does nothing, so its function must handle everything that
+// happened since it was queued
+// - stamp: mtime when it was queued, for the work latency histogram
+struct work {
+  void (*func)(void *);
+  void *data;
+  struct work *next;
+  int queued;
+  size_t stamp;
+};
+
+// Initializer for a work item calling `fn` with `arg`
+#define WORK_INIT(fn, arg) ((struct work){\
+  .func = (fn),\
+  .data = (arg),\
+  .next = NULL,\
+  .queued = 0,\
+  .stamp = 0\
+})
+
+void work_queue(struct work *);
+size_t work_run(void);
+
+#endif
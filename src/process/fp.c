@@ -0,0 +1,90 @@
+#include <stdint.h>
+#include "fp.h"
+#include "process.h"
+#include "../plic/cpu.h"
+#include "../mm/sv39.h"
+
+// Process whose FP state is currently live in the FP registers
+static struct process *FP_OWNER = NULL;
+
+static struct fp_stats FP_STATS;
+
+struct fp_stats fp_get_stats(void) {
+  return FP_STATS;
+}
+
+// Called on every context switch from `prev` (NULL if none) to `next`,
+// before returning to user space
+void fp_switch(struct process *prev, struct process *next) {
+  ++FP_STATS.switches;
+  size_t fs = CSR_READ(sstatus) & SSTATUS_FS;
+  if (prev != NULL && fs == SSTATUS_FS_DIRTY) {
+    // `prev` modified its registers since they were restored
+    fp_save(prev->frame);
+    ++prev->fp_saves;
+    ++FP_STATS.saves;
+  }
+  CSR_CLEAR(sstatus, SSTATUS_FS);
+  // If nobody else used the FP unit since `next` last ran, its state is
+  // still live and there is nothing to restore
+  if (next == FP_OWNER)
+    CSR_SET(sstatus, SSTATUS_FS_CLEAN);
+}
+
+// Whether `insn` is an F/D extension instruction or accesses one of the
+// FP CSRs (fflags, frm, fcsr)
+static int is_fp_instruction(uint32_t insn) {
+  if ((insn & 0x3) != 0x3) {
+    // Compressed: c.fld/c.fsd (quadrant 0), c.fldsp/c.fsdsp (quadrant 2)
+    uint32_t funct3 = (insn >> 13) & 0x7;
+    uint32_t quadrant = insn & 0x3;
+    return (quadrant == 0 || quadrant == 2) && (funct3 == 1 || funct3 == 5);
+  }
+  switch (insn & 0x7f) {
+  case 0x07:			// LOAD-FP
+  case 0x27:			// STORE-FP
+  case 0x43:			// FMADD
+  case 0x47:			// FMSUB
+  case 0x4b:			// FNMSUB
+  case 0x4f:			// FNMADD
+  case 0x53:			// OP-FP
+    return 1;
+  case 0x73:			// SYSTEM
+    {
+      uint32_t csr = insn >> 20;
+      return ((insn >> 12) & 0x7) != 0 && csr >= 1 && csr <= 3;
+    }
+  default:
+    return 0;
+  }
+}
+
+// Handle an illegal instruction exception from `process`
+// If it was the first FP instruction since the process was switched in,
+// restore its FP state and return 1 so that the instruction is retried
+// Otherwise return 0
+int fp_trap(struct process *process, size_t epc, size_t tval, size_t status) {
+  if (process == NULL || (status & SSTATUS_FS) != SSTATUS_FS_OFF)
+    return 0;
+  uint32_t insn = (uint32_t) tval;
+  if (insn == 0
+      && copy_from_user(process->space->root, &insn, epc, sizeof(insn)) !=
+      sizeof(insn))
+    return 0;
+  if (!is_fp_instruction(insn))
+    return 0;
+  CSR_SET(sstatus, SSTATUS_FS_INITIAL);
+  fp_restore(process->frame);
+  CSR_CLEAR(sstatus, SSTATUS_FS);
+  CSR_SET(sstatus, SSTATUS_FS_CLEAN);
+  FP_OWNER = process;
+  ++process->fp_restores;
+  ++FP_STATS.restores;
+  return 1;
+}
+
+// Forget about a process that is going away
+void fp_forget(struct process *process) {
+  if (FP_OWNER == process)
+    FP_OWNER = NULL;
+}
@@ -0,0 +1,43 @@
+#ifndef FP_H
+#define FP_H
+
+#include <stddef.h>
+#include "../plic/trap_frame.h"
+
+/*
+ * Lazy floating point context switching
+ *
+ * sstatus.FS (bits 14:13) tracks the state of the FP registers:
+ * - Off: any FP instruction raises an illegal instruction exception
+ * - Initial/Clean: the registers match what was last saved or restored
+ * - Dirty: the registers were written since then
+ *
+ * A process starts with FS = Off. Its first FP instruction traps, and
+ * only then are its registers restored from its trap frame. When
+ * switching away, the registers are saved only if FS is Dirty, so
+ * processes that never touch FP never pay for it
+ */
+#define SSTATUS_FS (0b11ull << 13)
+#define SSTATUS_FS_OFF (0b00ull << 13)
+#define SSTATUS_FS_INITIAL (0b01ull << 13)
+#define SSTATUS_FS_CLEAN (0b10ull << 13)
+#define SSTATUS_FS_DIRTY (0b11ull << 13)
+
+struct fp_stats {
+  size_t saves;
+  size_t restores;
+  size_t switches;
+};
+
+struct process;
+
+// Defined in src/asm/crt0.s
+void fp_save(struct trap_frame *);
+void fp_restore(struct trap_frame *);
+
+void fp_switch(struct process *, struct process *);
+int fp_trap(struct process *, size_t, size_t, size_t);
+void fp_forget(struct process *);
+struct fp_stats fp_get_stats(void);
+
+#endif
@@ -0,0 +1,108 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "pid.h"
+#include "../common/common.h"
+#include "../mm/page.h"
+#include "../plic/cpu.h"
+
+// Allocated PIDs and ASIDs, bit 0 (PID 0, the kernel ASID) reserved
+static uint64_t PID_BITMAP[PID_MAX / 64] = { 1 };
+static uint64_t ASID_BITMAP[ASID_MAX / 64] = { 1 };
+
+// Where the next search for a free PID or ASID starts
+static size_t PID_NEXT = 1;
+static size_t ASID_NEXT = 1;
+
+// Process of each allocated PID, PID_PER_PAGE PIDs per page
+// The pages are kept once allocated: all of them take 64 pages
+static struct process **PID_TABLE[PID_MAX / PID_PER_PAGE];
+
+// Set and return the first clear bit of the `bits` bits of `bitmap` from
+// *next on, wrapping around, and move *next past it
+// Returns 0 (which is reserved) if every bit is set
+static size_t bitmap_alloc(uint64_t *bitmap, size_t bits, size_t *next) {
+  size_t words = bits / 64;
+  size_t start = *next / 64;
+  // The first word comes up twice: from *next on, and in full once the
+  // search wraps around
+  for (size_t i = 0; i <= words; ++i) {
+    size_t w = (start + i) % words;
+    uint64_t free = ~bitmap[w];
+    if (i == 0)
+      free &= ~0ull << (*next % 64);
+    if (free == 0)
+      continue;
+    size_t bit = w * 64 + __builtin_ctzll(free);
+    bitmap[w] |= 1ull << (bit % 64);
+    *next = (bit + 1) % bits;
+    return bit;
+  }
+  return 0;
+}
+
+#define BITMAP_CLEAR(bitmap, bit) \
+  ((bitmap)[(bit) / 64] &= ~(1ull << ((bit) % 64)))
+#define BITMAP_TEST(bitmap, bit) (((bitmap)[(bit) / 64] >> ((bit) % 64)) & 1)
+
+// Allocate a PID for `process`
+// Returns 0 if there is none left or no memory for the table
+size_t pid_alloc(struct process *process) {
+  size_t pid = bitmap_alloc(PID_BITMAP, PID_MAX, &PID_NEXT);
+  if (pid == 0)
+    return 0;
+  struct process **page = PID_TABLE[pid / PID_PER_PAGE];
+  if (page == NULL) {
+    page = alloc_page();
+    if (page == NULL) {
+      BITMAP_CLEAR(PID_BITMAP, pid);
+      return 0;
+    }
+    PID_TABLE[pid / PID_PER_PAGE] = page;
+  }
+  page[pid % PID_PER_PAGE] = process;
+  return pid;
+}
+
+// Free `pid` once its process has been reaped
+void pid_free(size_t pid) {
+  ASSERT(pid != 0 && pid < PID_MAX && BITMAP_TEST(PID_BITMAP, pid),
+	 "pid_free(): PID %d is not allocated\n", pid);
+  BITMAP_CLEAR(PID_BITMAP, pid);
+  PID_TABLE[pid / PID_PER_PAGE][pid % PID_PER_PAGE] = NULL;
+}
+
+// Look up a process by PID, dead or alive; NULL if there is none
+struct process *pid_find(size_t pid) {
+  if (pid == 0 || pid >= PID_MAX || !BITMAP_TEST(PID_BITMAP, pid))
+    return NULL;
+  return PID_TABLE[pid / PID_PER_PAGE][pid % PID_PER_PAGE];
+}
+
+// Call `func` on every process with a PID, in PID order
+// `func` may free the PID of the process it is passed, but no other
+void pid_for_each(void (*func)(struct process *)) {
+  for (size_t w = 0; w < PID_MAX / 64; ++w) {
+    uint64_t used = PID_BITMAP[w] & (w == 0 ? ~1ull : ~0ull);
+    while (used != 0) {
+      size_t pid = w * 64 + __builtin_ctzll(used);
+      used &= used - 1;
+      func(PID_TABLE[pid / PID_PER_PAGE][pid % PID_PER_PAGE]);
+    }
+  }
+}
+
+// Allocate an ASID for a new address space
+// Returns 0 if there is none left
+size_t asid_alloc(void) {
+  return bitmap_alloc(ASID_BITMAP, ASID_MAX, &ASID_NEXT);
+}
+
+// Free the ASID of an address space that is no longer mapped anywhere
+// Its TLB entries are flushed so that they cannot show up in the next
+// address space to get it
+void asid_free(size_t asid) {
+  ASSERT(asid != 0 && asid < ASID_MAX && BITMAP_TEST(ASID_BITMAP, asid),
+	 "asid_free(): ASID %d is not allocated\n", asid);
+  BITMAP_CLEAR(ASID_BITMAP, asid);
+  SFENCE_VMA_ASID(asid);
+}
@@ -0,0 +1,40 @@
+#ifndef PID_H
+#define PID_H
+
+#include <stddef.h>
+#include "process.h"
+#include "../mm/page.h"
+
+/*
+ * PID and ASID allocation
+ *
+ * PIDs are handed out from a bitmap, next fit, so that a PID is not
+ * reused right after it was freed, and only freed once its process has
+ * been reaped (see process_exit()), so that a PID always names the same
+ * process for as long as anyone can still ask about it. PID 0 is never
+ * used, as system calls take it to mean the caller
+ *
+ * Processes are found by PID in a two-level table: a page of process
+ * pointers per PID_PER_PAGE PIDs, allocated the first time one of its
+ * PIDs is, so that lookup takes constant time however many processes
+ * there are
+ *
+ * ASIDs come from a bitmap of their own: several threads share an
+ * address space and ASID, and there are more ASIDs than PIDs, so the
+ * two limits are independent. ASID 0 belongs to the kernel (see
+ * KERNEL_TABLE in src/asm/crt0.s)
+ */
+
+#define PID_MAX 32768
+#define PID_PER_PAGE (PAGE_SIZE / sizeof(struct process *))
+
+#define ASID_MAX 65536
+
+size_t pid_alloc(struct process *);
+void pid_free(size_t);
+struct process *pid_find(size_t);
+void pid_for_each(void (*)(struct process *));
+size_t asid_alloc(void);
+void asid_free(size_t);
+
+#endif
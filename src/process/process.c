@@ -1,13 +1,34 @@
 #include "process.h"
 #include "syscall.h"
+#include "fp.h"
+#include "sched.h"
+#include "pid.h"
 #include "../mm/kmem.h"
 #include "../common/common.h"
 #include "../mm/page.h"
 #include "../mm/sv39.h"
+#include "../mm/zram.h"
+#include "../mm/ksm.h"
+#include "../mm/slab.h"
+#include "../mm/huge.h"
+#include "../plic/cpu.h"
+#include "../plic/work.h"
+#include "../ipc/ipc.h"
+#include "../ipc/futex.h"
+#include "../rtc/rtc.h"
 
 extern const size_t MAKE_SYSCALL;
+extern const size_t IPC_SYSCALL;
+extern size_t KERNEL_TABLE;
 
-static uint16_t NEXT_PID = 1;
+// Start of the 2 MiB block `vaddr` is in (see src/mm/huge.h)
+#define HUGE_BLOCK(vaddr) ((vaddr) & ~(HUGE_PAGE_SIZE - 1))
+
+// Memory mapped by a level 2 PTE, i.e. by a whole level 1 page table
+#define TABLE_L1_SIZE (HUGE_PAGE_SIZE * PT_NUM_ENTRIES)
+
+static struct slab_cache PROCESS_CACHE = SLAB_CACHE(struct process);
+static struct slab_cache SPACE_CACHE = SLAB_CACHE(struct address_space);
 
 // This is just a temporary measure
 // Ideally, we want to move our hardcoded init process
@@ -19,47 +40,707 @@ void init_process(void) {
   }
 }
 
+// Allocate a thread in address space `space`, with a zeroed trap frame
+// Returns NULL if there is no memory or PID left
+static struct process *process_alloc(struct address_space *space) {
+  struct process *process = slab_alloc(&PROCESS_CACHE);
+  if (process == NULL)
+    return NULL;
+  process->frame = (struct trap_frame *)alloc_page();
+  if (process->frame == NULL) {
+    slab_free(&PROCESS_CACHE, process);
+    return NULL;
+  }
+  process->pid = pid_alloc(process);
+  if (process->pid == 0) {
+    dealloc_pages(process->frame);
+    slab_free(&PROCESS_CACHE, process);
+    return NULL;
+  }
+  process->stack = NULL;
+  process->pc = 0;
+  process->space = space;
+  ++space->refs;
+  process->state = PROCESS_RUNNING;
+  process->sleep_until = 0;
+  for (size_t i = 0; i < PROCESS_MAX_FILES; ++i)
+    process->files[i] = NULL;
+  process->fp_saves = 0;
+  process->fp_restores = 0;
+  process->utime = 0;
+  process->stime = 0;
+  process->acct_stamp = 0;
+  process->nvcsw = 0;
+  process->nivcsw = 0;
+  process->page_faults = 0;
+  process->syscalls = 0;
+  process->ready_stamp = GET_MTIME();
+  latency_clear(&process->wait_latency);
+  process->ipc_next = NULL;
+  process->ipc_state = IPC_IDLE;
+  process->ipc_reply = 0;
+  process->ipc_window = 0;
+  process->ipc_window_pages = 0;
+  process->futex_next = NULL;
+  process->futex_root = NULL;
+  process->futex_key = 0;
+  process->dl_runtime = 0;
+  process->dl_deadline = 0;
+  process->dl_period = 0;
+  process->dl_release = 0;
+  process->dl_budget = 0;
+  process->dl_stamp = 0;
+  process->dl_state = SCHED_DL_READY;
+  process->dl_missed = 0;
+  process->dl_misses = 0;
+  process->parent = NULL;
+  process->exit_status = 0;
+  process->wait_pid = 0;
+  process->wait_status = 0;
+  process->sched_node = NULL;
+  process->dl_throttles = 0;
+  return process;
+}
+
 struct process *create_process(void (*func)(void)) {
   size_t func_paddr = (size_t)func;	// determine process physical address
-  size_t func_vaddr = func_paddr;	// set process virtual address
+  size_t func_vaddr = func_paddr + USER_TEXT_OFFSET;	// set process virtual address
+
+  // Initialize address space
+  struct address_space *space = slab_alloc(&SPACE_CACHE);
+  ASSERT(space != NULL,
+	 "create_process(): failed to allocate memory for address space\n");
+  space->asid = asid_alloc();
+  ASSERT(space->asid != 0, "create_process(): out of ASIDs\n");
+  space->root = (struct page_table *)alloc_page();
+  ASSERT(space->root != NULL,
+	 "create_process(): failed to allocate page for process root page table\n");
+  // Every address space includes the kernel so that traps need not
+  // switch page tables
+  map_global(space->root, kmem_get_page_table());
+  space->refs = 0;
+  space->mmap_next = MMAP_ADDR;
+  for (size_t i = 0; i < PROCESS_MAX_REGIONS; ++i)
+    space->regions[i] = (struct process_region) {
+    0, 0};
+  for (size_t i = 0; i < PROCESS_MAX_FILE_MAPS; ++i)
+    space->file_maps[i] = (struct process_file_map) {
+    NULL, 0, 0};
+  space->working_set = 0;
+  space->swapped = 0;
+  space->ksm_cursor = 0;
+  space->reclaim_pass = 0;
 
   // Initialize process structure
-  struct process *process = kmalloc(sizeof(struct process));
+  struct process *process = process_alloc(space);
   ASSERT(process != NULL,
 	 "create_process(): failed to allocate memory for process structure\n");
-  process->frame = (struct trap_frame *)alloc_page();
-  ASSERT(process->frame != NULL,
-	 "create_process(): failed to allocate page for process context frame\n");
-  process->stack = alloc_pages(STACK_PAGES);
-  ASSERT(process->stack != NULL,
-	 "create_process(): failed to allocate %d pages for process stack\n",
-	 STACK_PAGES);
   process->pc = func_vaddr;
-  process->pid = NEXT_PID++;
-  process->root = (struct page_table *)alloc_page();
-  ASSERT(process->root != NULL,
-	 "create_process(): failed to allocate page for process root page table\n");
-  process->state = PROCESS_RUNNING;
-  process->sleep_until = 0;
 
-  size_t stack_paddr = (size_t)process->stack;	// obtain stack physical address
   // Set stack pointer to point to top of process stack
+  // The stack pages themselves are mapped by process_fault()
   process->frame->regs[2] = STACK_ADDR + PAGE_SIZE * STACK_PAGES;	// sp = x2
 
-  // Map process stack to virtual memory
-  for (size_t i = 0; i < STACK_PAGES; ++i)
-    map(process->root, STACK_ADDR + i * PAGE_SIZE, stack_paddr + i * PAGE_SIZE,
-	PTE_USER_RW, 0);
-
   // Map user program to virtual memory
   for (size_t i = 0; i < 100; ++i)
-    map(process->root, func_vaddr + i * PAGE_SIZE, func_paddr + i * PAGE_SIZE,
+    map(space->root, func_vaddr + i * PAGE_SIZE, func_paddr + i * PAGE_SIZE,
 	PTE_USER_RX, 0);
 
   // Map make_syscall() to virtual memory
   // This is required since otherwise user programs cannot make
   // system calls from user space
-  map(process->root, MAKE_SYSCALL, MAKE_SYSCALL, PTE_USER_RX, 0);
+  map(space->root, MAKE_SYSCALL + USER_TEXT_OFFSET, MAKE_SYSCALL,
+      PTE_USER_RX, 0);
+  // Likewise for ipc_syscall(), which may be on the next page
+  map(space->root, IPC_SYSCALL + USER_TEXT_OFFSET, IPC_SYSCALL,
+      PTE_USER_RX, 0);
+  // The time page, for reading the time without a system call
+  map(space->root, TIME_PAGE_ADDR, (size_t)rtc_time_page(),
+      PTE_USER | PTE_READ, 0);
 
   return process;
 }
+
+// Create a thread of `parent` starting at user address `entry` with
+// `arg` in a0, on a stack of STACK_PAGES pages taken from the anonymous
+// memory of the address space
+// Returns NULL if the address space has no region slot left for the
+// stack or there is no memory left
+struct process *create_thread(struct process *parent, size_t entry,
+			      size_t arg) {
+  size_t stack = process_add_region(parent, PAGE_SIZE * STACK_PAGES);
+  if (stack == 0)
+    return NULL;
+  // The stack region is not given back on failure, as regions cannot be
+  // removed yet
+  struct process *process = process_alloc(parent->space);
+  if (process == NULL)
+    return NULL;
+  process->pc = entry;
+  process->parent = parent;
+  process->frame->regs[2] = stack + PAGE_SIZE * STACK_PAGES;	// sp = x2
+  process->frame->regs[10] = arg;	// a0 = x10
+  return process;
+}
+
+// Charge the time since the last call to user time (`user` nonzero, on
+// trap entry from U-mode) or kernel time (on the way back to U-mode)
+void process_account(struct process *process, int user) {
+  size_t now = GET_MTIME();
+  if (user)
+    process->utime += now - process->acct_stamp;
+  else
+    process->stime += now - process->acct_stamp;
+  process->acct_stamp = now;
+}
+
+// Reserve `length` bytes of anonymous memory at the end of the mmap
+// region of the address space of `process`, on a 2 MiB boundary if it
+// is at least that large, so that it can be mapped with megapages
+// Returns the start address of the region, or 0 if the address space
+// has no region slot left
+size_t process_add_region(struct process *process, size_t length) {
+  struct address_space *space = process->space;
+  for (size_t i = 0; i < PROCESS_MAX_REGIONS; ++i)
+    if (space->regions[i].start == space->regions[i].end) {
+      if (length >= HUGE_PAGE_SIZE)
+	space->mmap_next = align_val(space->mmap_next, HUGE_PAGE_ORDER);
+      space->regions[i].start = space->mmap_next;
+      space->regions[i].end = space->mmap_next + align_val(length, PAGE_ORDER);
+      space->mmap_next = space->regions[i].end;
+      return space->regions[i].start;
+    }
+  return 0;
+}
+
+// Range [*start, *end) of the `i`th anonymous memory range of `process`:
+// the stack, then its regions
+// Returns 0 if there is no such range
+static int process_anon_range(struct process const *process, size_t i,
+			      size_t *start, size_t *end) {
+  if (i == 0) {
+    *start = STACK_ADDR;
+    *end = STACK_ADDR + PAGE_SIZE * STACK_PAGES;
+    return 1;
+  }
+  if (i > PROCESS_MAX_REGIONS)
+    return 0;
+  *start = process->space->regions[i - 1].start;
+  *end = process->space->regions[i - 1].end;
+  return 1;
+}
+
+// Whether [vaddr, vaddr + length) lies within a single anonymous memory
+// range of `process`
+int process_is_anon(struct process const *process, size_t vaddr,
+		    size_t length) {
+  size_t start, end;
+  for (size_t i = 0; process_anon_range(process, i, &start, &end); ++i)
+    if (start <= vaddr && vaddr < end && length <= end - vaddr)
+      return 1;
+  return 0;
+}
+
+// Handle a page fault of `process` at `vaddr`, on a write if `write` is
+// nonzero
+// If `vaddr` is in the stack or an anonymous region, map a page for it
+// and return 0 so that the access can be retried:
+// - on first touch, a zeroed page from the local NUMA node
+//   (first-touch placement), or a megapage for the whole 2 MiB block if
+//   it lies within the same range and nothing is mapped in it yet (see
+//   src/mm/huge.h)
+// - if the page was swapped out, a page it is decompressed into
+// - on a write to a page shared by same-page merging, a private copy
+//   of it (copy-on-write)
+// - if the page is mapped but its accessed or dirty bit is clear (for
+//   harts that leave them to software), the same page (or megapage)
+//   with them set
+// Returns -1 otherwise, or if there is no memory left
+int process_fault(struct process *process, size_t vaddr, int write) {
+  int valid = 0;
+  size_t start, end;
+  for (size_t i = 0; !valid && process_anon_range(process, i, &start, &end);
+       ++i)
+    valid = start <= vaddr && vaddr < end;
+  if (!valid)
+    return -1;
+  vaddr &= ~(size_t)(PAGE_SIZE - 1);
+  uint64_t *huge = huge_pte(process->space->root, vaddr);
+  if (huge != NULL) {
+    uint64_t bits = PTE_ACCESS | (write ? PTE_DIRTY : 0);
+    if ((*huge & bits) == bits)
+      return -1;
+    *huge |= bits;
+    SFENCE_VMA();
+    return 0;
+  }
+  uint64_t *pte = get_pte(process->space->root, vaddr);
+  if (pte != NULL && PTE_IS_VALID(*pte)) {
+    size_t frame = (*pte & ~0x3FFull) << 2;
+    if (write && !(*pte & PTE_WRITE)) {
+      size_t refs = ksm_refs(frame);
+      if (refs == 0)
+	return -1;
+      if (refs > 1) {
+	void *page = alloc_page();
+	if (page == NULL)
+	  return -1;
+	memcpy(page, (const void *)frame, PAGE_SIZE);
+	map(process->space->root, vaddr, (size_t)page,
+	    PTE_USER_RW | PTE_ACCESS | PTE_DIRTY, 0);
+      } else
+	// Nobody else uses the frame anymore, so it is ours again
+	*pte |= PTE_WRITE | PTE_ACCESS | PTE_DIRTY;
+      ksm_unshare(frame);
+      SFENCE_VMA();
+      return 0;
+    }
+    uint64_t bits = PTE_ACCESS | (write ? PTE_DIRTY : 0);
+    if ((*pte & bits) == bits)
+      // Really a permission fault
+      return -1;
+    *pte |= bits;
+    SFENCE_VMA();
+    return 0;
+  }
+  size_t block = HUGE_BLOCK(vaddr);
+  if (pte == NULL && huge_enabled() && start <= block
+      && block + HUGE_PAGE_SIZE <= end
+      && huge_map(process->space->root, block) == 0) {
+    SFENCE_VMA();
+    return 0;
+  }
+  void *page = alloc_page();
+  if (page == NULL)
+    return -1;
+  // Reclaiming memory for the page never frees page tables, so `pte`
+  // is still good
+  if (pte != NULL && (*pte & PTE_SWAPPED)) {
+    if (zram_load(*pte, page) != 0) {
+      dealloc_pages(page);
+      return -1;
+    }
+    --process->space->swapped;
+  }
+  map(process->space->root, vaddr, (size_t)page, PTE_USER_RW, 0);
+  SFENCE_VMA();
+  return 0;
+}
+
+// User fault handler for copy_to_user() and friends (see
+// set_user_fault_handler()), which only knows about the address space
+// of the current process
+int process_user_fault(struct page_table const *root, size_t vaddr,
+		       int write) {
+  struct process *process = sched_current();
+  if (process == NULL || process->space->root != root)
+    return -1;
+  return process_fault(process, vaddr, write);
+}
+
+// Scan the accessed bits of the anonymous pages of `process`, counting
+// and clearing them, so that the count is the number of pages touched
+// since the previous scan
+// This runs at the end of every time slice, so the page tables are
+// walked directly, skipping whatever has no page table under it: large
+// regions that are mostly untouched cost next to nothing
+// Returns the new working set size
+size_t process_age(struct process *process) {
+  size_t count = 0;
+  size_t start, end;
+  for (size_t i = 0; process_anon_range(process, i, &start, &end); ++i)
+    for (size_t vaddr = start; vaddr < end;) {
+      size_t block_end = HUGE_BLOCK(vaddr) + HUGE_PAGE_SIZE;
+      uint64_t *pte = get_pte_at(process->space->root, vaddr, 1);
+      if (pte == NULL) {
+	// No level 1 page table, so nothing mapped in the whole 1 GiB
+	vaddr = (vaddr & ~(TABLE_L1_SIZE - 1)) + TABLE_L1_SIZE;
+	continue;
+      }
+      if (PTE_IS_INVALID(*pte)) {
+	vaddr = block_end;
+	continue;
+      }
+      if (PTE_IS_LEAF(*pte)) {
+	// Megapage
+	if (*pte & PTE_ACCESS) {
+	  *pte &= ~(uint64_t) PTE_ACCESS;
+	  count += HUGE_PAGE_PAGES;
+	}
+	vaddr = block_end;
+	continue;
+      }
+      struct page_table *table =
+	  (struct page_table *)((*pte & ~0x3FFull) << 2);
+      for (; vaddr < end && vaddr < block_end; vaddr += PAGE_SIZE) {
+	uint64_t *entry = &table->entries[(vaddr >> PAGE_ORDER) & 0x1FF];
+	if (PTE_IS_VALID(*entry) && (*entry & PTE_ACCESS)) {
+	  *entry &= ~(uint64_t) PTE_ACCESS;
+	  ++count;
+	}
+      }
+    }
+  SFENCE_VMA();
+  process->space->working_set = count;
+  return count;
+}
+
+// Offer up to `budget` anonymous pages of `process` to ksm_merge(),
+// continuing where the previous call left off and starting over once
+// past the last one
+// Returns the number of pages merged
+size_t process_merge(struct process *process, size_t budget) {
+  size_t skip = process->space->ksm_cursor;
+  size_t merged = 0;
+  size_t start, end;
+  for (size_t i = 0; process_anon_range(process, i, &start, &end); ++i) {
+    size_t pages = (end - start) / PAGE_SIZE;
+    if (skip >= pages) {
+      skip -= pages;
+      continue;
+    }
+    for (size_t vaddr = start + skip * PAGE_SIZE; vaddr < end;
+	 vaddr += PAGE_SIZE) {
+      if (budget-- == 0) {
+	SFENCE_VMA();
+	return merged;
+      }
+      merged += ksm_merge(process->space->root, vaddr);
+      ++process->space->ksm_cursor;
+    }
+    skip = 0;
+  }
+  process->space->ksm_cursor = 0;
+  SFENCE_VMA();
+  return merged;
+}
+
+// Collapse up to `budget` 2 MiB blocks of anonymous memory of `process`
+// whose pages are all mapped private and writable into megapages (see
+// src/mm/huge.h)
+// Returns the number of blocks collapsed
+size_t process_collapse(struct process *process, size_t budget) {
+  size_t collapsed = 0;
+  size_t start, end;
+  for (size_t i = 0; process_anon_range(process, i, &start, &end); ++i)
+    for (size_t block = align_val(start, HUGE_PAGE_ORDER);
+	 block + HUGE_PAGE_SIZE <= end && collapsed < budget;
+	 block += HUGE_PAGE_SIZE)
+      collapsed += huge_collapse(process->space->root, block);
+  if (collapsed != 0)
+    SFENCE_VMA();
+  return collapsed;
+}
+
+// Free whatever anonymous page `process` has at `vaddr`, be it a private
+// page, a mapping of a page shared by same-page merging or a page
+// swapped out to zram, and leave it unmapped
+// A megapage has to be split first (huge_split())
+// The caller has to flush the TLB
+void process_drop_page(struct process *process, size_t vaddr) {
+  uint64_t *pte = get_pte(process->space->root, vaddr);
+  if (pte == NULL)
+    return;
+  if (*pte & PTE_SWAPPED) {
+    zram_free(*pte);
+    --process->space->swapped;
+  } else if (PTE_IS_VALID(*pte)) {
+    size_t frame = (*pte & ~0x3FFull) << 2;
+    size_t refs = ksm_refs(frame);
+    if (refs != 0)
+      ksm_unshare(frame);
+    if (refs <= 1)
+      dealloc_pages((void *)frame);
+  }
+  *pte = 0;
+}
+
+// Move `n` anonymous pages of `from` at `src` to `to` at `dst`, without
+// copying them: each is unmapped from `from` and mapped into `to` in
+// place of what it had there
+// Pages `from` has not touched yet are allocated first, and those it
+// shares with others copied, so that `to` gets a private page each time
+// Megapages on either side are split first
+// Stops at the first page of `from` that is not anonymous memory or
+// cannot be allocated
+// Returns the number of pages moved
+size_t process_move_pages(struct process *from, size_t src,
+			  struct process *to, size_t dst, size_t n) {
+  size_t moved = 0;
+  if ((src & (PAGE_SIZE - 1)) != 0)
+    return 0;
+  for (; moved < n; ++moved) {
+    size_t s = src + moved * PAGE_SIZE;
+    size_t d = dst + moved * PAGE_SIZE;
+    if (!process_is_anon(from, s, PAGE_SIZE)
+	|| huge_split(from->space->root, s) != 0
+	|| huge_split(to->space->root, d) != 0)
+      break;
+    uint64_t *pte = get_pte(from->space->root, s);
+    if (pte == NULL || PTE_IS_INVALID(*pte) || !(*pte & PTE_WRITE)) {
+      // A first touch may map a megapage, to be split like the others
+      if (process_fault(from, s, 1) != 0
+	  || huge_split(from->space->root, s) != 0)
+	break;
+      pte = get_pte(from->space->root, s);
+    }
+    size_t frame = (*pte & ~0x3FFull) << 2;
+    *pte = 0;
+    process_drop_page(to, d);
+    map(to->space->root, d, frame, PTE_USER_RW | PTE_ACCESS | PTE_DIRTY, 0);
+  }
+  SFENCE_VMA();
+  return moved;
+}
+
+// State of process_reclaim() for process_reclaim_one()
+static size_t RECLAIM_TARGET = 0;
+static size_t RECLAIM_FREED = 0;
+static int RECLAIM_PASS = 0;
+static size_t RECLAIM_GENERATION = 0;
+
+// Swap out anonymous pages of `process` whose accessed bit is clear,
+// clearing it on the others to give them a second chance, until
+// RECLAIM_TARGET pages have been freed
+// On the second pass, every page is swapped out
+// Megapages get their second chance whole, and are split to be swapped
+// out
+static void process_reclaim_one(struct process *process) {
+  // Threads sharing an address space scan it once per pass
+  if (process->space->reclaim_pass == RECLAIM_GENERATION)
+    return;
+  process->space->reclaim_pass = RECLAIM_GENERATION;
+  size_t start, end;
+  for (size_t i = 0; process_anon_range(process, i, &start, &end); ++i)
+    for (size_t vaddr = start;
+	 vaddr < end && RECLAIM_FREED < RECLAIM_TARGET; vaddr += PAGE_SIZE) {
+      uint64_t *huge = huge_pte(process->space->root, vaddr);
+      if (huge != NULL) {
+	if ((*huge & PTE_ACCESS) && RECLAIM_PASS == 0) {
+	  *huge &= ~(uint64_t) PTE_ACCESS;
+	  vaddr = HUGE_BLOCK(vaddr) + HUGE_PAGE_SIZE - PAGE_SIZE;
+	  continue;
+	}
+	if (huge_split(process->space->root, vaddr) != 0) {
+	  vaddr = HUGE_BLOCK(vaddr) + HUGE_PAGE_SIZE - PAGE_SIZE;
+	  continue;
+	}
+      }
+      uint64_t *pte = get_pte(process->space->root, vaddr);
+      // Pages shared by same-page merging are read-only, and left alone
+      if (pte == NULL || PTE_IS_INVALID(*pte) || !(*pte & PTE_WRITE))
+	continue;
+      if ((*pte & PTE_ACCESS) && RECLAIM_PASS == 0) {
+	*pte &= ~(uint64_t) PTE_ACCESS;
+	continue;
+      }
+      uint64_t entry = zram_store((void *)((*pte & ~0x3FFull) << 2));
+      if (entry == 0)
+	continue;
+      *pte = entry;
+      ++process->space->swapped;
+      ++RECLAIM_FREED;
+    }
+}
+
+// Reclaim handler of the page allocator (see page_set_reclaim_handler())
+// Compresses cold anonymous pages of all processes into zram until at
+// least `n` (and PROCESS_RECLAIM_BATCH) pages are freed, or there is
+// nothing left to compress
+// Returns the number of pages swapped out; as a swapped out page may
+// end up as a zram pool page, slightly fewer may have been freed
+size_t process_reclaim(size_t n) {
+  RECLAIM_TARGET = n > PROCESS_RECLAIM_BATCH ? n : PROCESS_RECLAIM_BATCH;
+  RECLAIM_FREED = 0;
+  for (RECLAIM_PASS = 0; RECLAIM_PASS < 2 && RECLAIM_FREED < RECLAIM_TARGET;
+       ++RECLAIM_PASS) {
+    ++RECLAIM_GENERATION;
+    sched_for_each(process_reclaim_one);
+  }
+  // The freed pages must not be reachable through stale TLB entries
+  // once they are handed out again
+  SFENCE_VMA();
+  return RECLAIM_FREED;
+}
+
+void process_get_stats(struct process const *process,
+		       struct process_stats *stats) {
+  stats->pid = process->pid;
+  stats->state = process->state;
+  stats->utime = process->utime;
+  stats->stime = process->stime;
+  stats->nvcsw = process->nvcsw;
+  stats->nivcsw = process->nivcsw;
+  stats->page_faults = process->page_faults;
+  stats->syscalls = process->syscalls;
+  stats->resident_pages = count_user_pages(process->space->root);
+  stats->working_set_pages = process->space->working_set;
+  stats->swapped_pages = process->space->swapped;
+  stats->deadline_misses = process->dl_misses;
+  stats->deadline_throttles = process->dl_throttles;
+}
+
+// Drop the reference of `process` to its address space, and free the
+// address space along with all of its anonymous memory once no thread
+// uses it anymore
+static void process_put_space(struct process *process) {
+  struct address_space *space = process->space;
+  if (--space->refs == 0) {
+    size_t start, end;
+    for (size_t i = 0; process_anon_range(process, i, &start, &end); ++i)
+      for (size_t vaddr = start; vaddr < end; vaddr += PAGE_SIZE)
+	if (huge_pte(space->root, vaddr) != NULL) {
+	  huge_free(space->root, vaddr);
+	  vaddr = HUGE_BLOCK(vaddr) + HUGE_PAGE_SIZE - PAGE_SIZE;
+	} else
+	  process_drop_page(process, vaddr);
+    for (size_t i = 0; i < PROCESS_MAX_FILE_MAPS; ++i)
+      if (space->file_maps[i].length != 0)
+	file_munmap(space->file_maps[i].inode, space->file_maps[i].offset,
+		    space->file_maps[i].length);
+    ksm_forget(space->root);
+    // Get off the page tables before freeing them if the exiting
+    // process is the current one
+    if ((CSR_READ(satp) & SATP_PPN) == (size_t)space->root >> PAGE_ORDER)
+      CSR_WRITE(satp, KERNEL_TABLE);
+    unmap(space->root);
+    dealloc_pages(space->root);
+    asid_free(space->asid);
+    slab_free(&SPACE_CACHE, space);
+  }
+  process->space = NULL;
+}
+
+// Free the PID and structure of a dead process
+static void process_reap(struct process *process) {
+  pid_free(process->pid);
+  slab_free(&PROCESS_CACHE, process);
+}
+
+// Free `process`, a thread that was created but never added to the
+// scheduler
+void process_destroy(struct process *process) {
+  process_put_space(process);
+  dealloc_pages(process->frame);
+  process_reap(process);
+}
+
+// Hand the exit status of dead `child` to `parent`, which is waiting for
+// it (SYS_WAITPID), and reap it
+static void process_collect(struct process *parent, struct process *child) {
+  if (parent->wait_status != 0) {
+    // copy_to_user() only faults in memory of the current process, which
+    // `parent` need not be
+    process_fault(parent, parent->wait_status, 1);
+    copy_to_user(parent->space->root, parent->wait_status,
+		 &child->exit_status, sizeof(child->exit_status));
+  }
+  parent->frame->regs[10] = child->pid;
+  parent->wait_pid = 0;
+  if (parent->state == PROCESS_WAITING) {
+    parent->state = PROCESS_RUNNING;
+    parent->ready_stamp = GET_MTIME();
+  }
+  process_reap(child);
+}
+
+// The process exiting, for process_orphan()
+static struct process *EXITING = NULL;
+
+// Children of the exiting process have nobody to collect their exit
+// status anymore: the dead ones are reaped now, the others once they exit
+static void process_orphan(struct process *process) {
+  if (process->parent != EXITING)
+    return;
+  process->parent = NULL;
+  if (process->state == PROCESS_DEAD)
+    process_reap(process);
+}
+
+// End `process` with exit status `status` (see PROCESS_EXIT_KILLED),
+// releasing everything it holds but its PID and structure, which stay
+// until its parent collects the status
+// If it is the current process, another one runs instead and this does
+// not return
+void process_exit(struct process *process, size_t status) {
+  int current = process == sched_current();
+  if (process->state == PROCESS_WAITING) {
+    ipc_cancel(process);
+    futex_cancel(process);
+  }
+  process->wait_pid = 0;
+  sched_set_deadline(process, 0, 0, 0);
+  fp_forget(process);
+  for (size_t i = 0; i < PROCESS_MAX_FILES; ++i)
+    if (process->files[i] != NULL) {
+      file_close(process->files[i]);
+      process->files[i] = NULL;
+    }
+  EXITING = process;
+  pid_for_each(process_orphan);
+  process_put_space(process);
+  dealloc_pages(process->frame);
+  process->frame = NULL;
+  sched_remove(process);
+  process->state = PROCESS_DEAD;
+  process->exit_status = status;
+  struct process *parent = process->parent;
+  if (parent == NULL)
+    process_reap(process);
+  else if (parent->wait_pid == process->pid)
+    process_collect(parent, process);
+  if (current) {
+    process_switch(NULL, sched_schedule());
+    PANIC("process_exit(): failed to switch process\n");
+  }
+}
+
+// SYS_WAITPID: wait for child `pid` of the current process `process` to
+// exit, then reap it and store its exit status at `status` unless it is 0
+// Returns the PC to resume at if it does not block, with the PID of the
+// child or SYSCALL_ERROR in a0
+size_t process_wait(struct process *process, size_t pid, size_t status,
+		    size_t mepc) {
+  struct process *child = pid_find(pid);
+  if (child == NULL || child->parent != process
+      || (status & (sizeof(size_t) - 1)) != 0) {
+    process->frame->regs[10] = SYSCALL_ERROR;
+    return mepc + 4;
+  }
+  process->wait_pid = pid;
+  process->wait_status = status;
+  if (child->state == PROCESS_DEAD) {
+    process_collect(process, child);
+    return mepc + 4;
+  }
+  process->state = PROCESS_WAITING;
+  sched_block(process, mepc + 4);
+}
+
+// Leave `prev` (NULL if there is none) and run `next` in U-mode
+// The time until here is charged to `prev` as kernel time, and `next`
+// starts running in U-mode now
+// `prev` stays runnable, so its wait for the CPU starts here too
+// Between threads of the same address space, satp is left alone and the
+// TLB kept
+// Deferred work runs first, as kernel time of `prev`
+void process_switch(struct process *prev, struct process *next) {
+  latency_trap_exit();
+  work_run();
+  size_t now = GET_MTIME();
+  if (prev != NULL)
+    process_account(prev, 0);
+  if (next != prev) {
+    if (prev != NULL)
+      prev->ready_stamp = now;
+    latency_wakeup(&next->wait_latency, now - next->ready_stamp);
+  }
+  next->acct_stamp = now;
+  fp_switch(prev, next);
+  sched_arm_timer();
+  struct address_space *space = next->space;
+  switch_to_user((size_t)next->frame, next->pc,
+		 prev != NULL && prev->space == space ? 0 :
+		 SATP_FROM(MODE_SV39, space->asid,
+			   (size_t)space->root >> PAGE_ORDER));
+}
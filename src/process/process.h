@@ -4,18 +4,55 @@
 #include <stddef.h>
 #include <stdint.h>
 #include "../plic/trap_frame.h"
+#include "../fs/file.h"
+#include "../latency/latency.h"
+#include "../mm/sv39.h"
 
 // Defined in src/asm/crt0.s
-void switch_to_user(size_t, size_t, size_t);
+void switch_to_user(size_t, size_t, size_t) __attribute__((noreturn));
 
 // Number of pages per process stack
 #define STACK_PAGES 2
 
+// User programs are currently linked into the kernel image, so their
+// code is mapped at this fixed offset from its physical address, at the
+// start of user space (see src/mm/sv39.h)
+#define USER_TEXT_OFFSET USER_SPACE_START
+
 // Start of virtual stack address (bottom)
-#define STACK_ADDR 0x100000000ull
+#define STACK_ADDR 0x2000000000ull
 
 // Start of process virtual address space
-#define PROCESS_STARTING_ADDR 0x80000000ull
+#define PROCESS_STARTING_ADDR USER_TEXT_OFFSET
+
+// Read-only time page (see src/rtc/rtc.h), mapped into every process
+#define TIME_PAGE_ADDR 0x1f00000000ull
+
+// Start of the region where mmap() places file mappings
+#define MMAP_ADDR 0x3000000000ull
+
+// Maximum number of open files per process
+#define PROCESS_MAX_FILES 16
+
+// Maximum number of anonymous mmap() regions per process
+#define PROCESS_MAX_REGIONS 8
+
+// Maximum number of file mmap() mappings per address space
+#define PROCESS_MAX_FILE_MAPS 8
+
+// Fewest pages process_reclaim() swaps out at once, so that allocating
+// a page at a time does not rescan all processes every time
+#define PROCESS_RECLAIM_BATCH 32
+
+// Anonymous memory [start, end), whose pages are only allocated and
+// mapped on first touch (see process_fault())
+// An unused slot has start == end == 0
+struct process_region {
+  size_t start;
+  size_t end;
+};
+
+struct process_ll;
 
 // Init process - hardcoded for now, for testing purposes only
 void init_process(void);
@@ -25,29 +62,179 @@ void init_process(void);
 //   the scheduler picks it
 // - PROCESS_SLEEPING: the process is waiting for a certain
 //   amount of time
-// - PROCESS_WAITING: the process is waiting on I/O
-// - PROCESS_DEAD: the process has finished and waiting to
-//   be cleaned up
+// - PROCESS_WAITING: the process is waiting on I/O, IPC or a futex
+//   (see src/ipc/)
+// - PROCESS_DEAD: the process has exited and its parent has yet
+//   to collect its exit status (SYS_WAITPID), after which it is reaped
+//   and its PID freed
 #define PROCESS_RUNNING (1 << 0)
 #define PROCESS_SLEEPING (1 << 1)
 #define PROCESS_WAITING (1 << 2)
 #define PROCESS_DEAD (1 << 3)
 
+// Exit status of a process: the low 8 bits of what it passed to
+// SYS_EXIT, or PROCESS_EXIT_KILLED if it was killed (SYS_KILL)
+#define PROCESS_EXIT_MASK 0xff
+#define PROCESS_EXIT_KILLED 0x100
+
+// File mapping (mmap() of a file), `length` bytes of `inode` from
+// `offset` on, released with file_munmap() when the address space goes
+// An unused slot has length == 0
+struct process_file_map {
+  struct ext2_inode_info *inode;
+  size_t offset;
+  size_t length;
+};
+
+// Address space, shared by the threads of a process (SYS_THREAD_CREATE)
+// - asid: the ASID it is mapped with (see src/process/pid.h)
+// - refs: number of threads using it
+// - mmap_next, regions: where mmap() places the next mapping, and the
+//   anonymous memory regions, which include the stacks of threads other
+//   than the first
+// - file_maps: the file mappings, whose page cache pages stay pinned
+//   until the address space is freed
+// - working_set, swapped, ksm_cursor, reclaim_pass: see process_age(),
+//   process_reclaim() and process_merge()
+struct address_space {
+  struct page_table *root;
+  size_t asid;
+  size_t refs;
+  size_t mmap_next;
+  struct process_region regions[PROCESS_MAX_REGIONS];
+  struct process_file_map file_maps[PROCESS_MAX_FILE_MAPS];
+  size_t working_set;
+  size_t swapped;
+  size_t ksm_cursor;
+  size_t reclaim_pass;
+};
+
 // Process structure
+// This is what the scheduler runs, i.e. a single thread: its address
+// space (`space`) may be shared with other threads, but its registers,
+// stack, state and open files are its own
 // We need to know the exact sizes and positions
 // of each field since we might need to access them
 // in assembly
+// The stack, like anonymous mmap() regions, is mapped page by page on
+// first touch, from the NUMA node of the hart touching it, so `stack`
+// is NULL
+// Real-time processes (dl_period != 0, see src/process/sched.c) get
+// dl_runtime ticks of CPU time every dl_period ticks, within dl_deadline
+// ticks of the start of the period at dl_release
+// - dl_budget: CPU time left in the current period, as of dl_stamp if
+//   the process is running
+// - dl_state: SCHED_DL_READY, SCHED_DL_THROTTLED or SCHED_DL_DONE
+// - dl_missed: whether the deadline of the current period was missed
+// - dl_misses: deadlines missed so far
+// - dl_throttles: jobs that used up their budget without finishing
+// - parent: the thread that created it (SYS_THREAD_CREATE), which
+//   collects its exit status, or NULL for processes started by the
+//   kernel and those whose parent is gone; these are reaped as soon as
+//   they exit
+// - exit_status: see PROCESS_EXIT_KILLED
+// - wait_pid, wait_status: the child waited for in SYS_WAITPID, and
+//   where its exit status goes
+// - sched_node: its node in the list of processes of the scheduler
 struct process {
   struct trap_frame *frame;	// process[535:0]
   void *stack;			// process[543:536]
   size_t pc;			// process[551:544]
-  uint16_t pid;			// process[553:552]
-  struct page_table *root;	// process[567:560]
+  uint32_t pid;			// process[555:552]
+  struct address_space *space;	// process[567:560]
   size_t state;			// process[575:568]
   size_t sleep_until;		// process[583:576]
+  struct file *files[PROCESS_MAX_FILES];	// process[711:584]
+  size_t fp_saves;		// process[719:712]
+  size_t fp_restores;		// process[727:720]
+  size_t utime;			// process[735:728]
+  size_t stime;			// process[743:736]
+  size_t acct_stamp;		// process[751:744]
+  size_t nvcsw;			// process[759:752]
+  size_t nivcsw;		// process[767:760]
+  size_t page_faults;		// process[775:768]
+  size_t syscalls;		// process[783:776]
+  size_t ready_stamp;		// process[791:784]
+  struct latency_histogram wait_latency;	// process[1071:792]
+  struct process *ipc_next;	// process[1079:1072]
+  size_t ipc_state;		// process[1087:1080]
+  size_t ipc_reply;		// process[1095:1088]
+  size_t ipc_window;		// process[1103:1096]
+  size_t ipc_window_pages;	// process[1111:1104]
+  struct process *futex_next;	// process[1119:1112]
+  struct page_table *futex_root;	// process[1127:1120]
+  size_t futex_key;		// process[1135:1128]
+  size_t dl_runtime;		// process[1143:1136]
+  size_t dl_deadline;		// process[1151:1144]
+  size_t dl_period;		// process[1159:1152]
+  size_t dl_release;		// process[1167:1160]
+  size_t dl_budget;		// process[1175:1168]
+  size_t dl_stamp;		// process[1183:1176]
+  size_t dl_state;		// process[1191:1184]
+  size_t dl_missed;		// process[1199:1192]
+  size_t dl_misses;		// process[1207:1200]
+  struct process *parent;	// process[1215:1208]
+  size_t exit_status;		// process[1223:1216]
+  size_t wait_pid;		// process[1231:1224]
+  size_t wait_status;		// process[1239:1232]
+  struct process_ll *sched_node;	// process[1247:1240]
+  size_t dl_throttles;		// process[1255:1248]
+};
+
+// Resource usage of a process (thread), as returned by SYS_PSTAT
+// Memory is counted for its whole address space
+// Times are in mtime ticks (TICKS_PER_SECOND per second)
+// - utime/stime: time spent in U-mode and in the kernel on its behalf
+// - nvcsw/nivcsw: voluntary (yield) and involuntary (timer) context
+//   switches away from the process
+// - resident_pages: user pages currently mapped
+// - working_set_pages: anonymous pages accessed since the previous scan
+//   of their accessed bits (see process_age())
+// - swapped_pages: anonymous pages compressed into zram
+// - deadline_misses: periods in which a real-time process did not finish
+//   its job (yield) by its deadline, though it had budget left
+// - deadline_throttles: periods in which it used up its budget first
+struct process_stats {
+  size_t pid;
+  size_t state;
+  size_t utime;
+  size_t stime;
+  size_t nvcsw;
+  size_t nivcsw;
+  size_t page_faults;
+  size_t syscalls;
+  size_t resident_pages;
+  size_t working_set_pages;
+  size_t swapped_pages;
+  size_t deadline_misses;
+  size_t deadline_throttles;
 };
 
 // Create a new process from function pointer
 struct process *create_process(void (*)(void));
 
+// Create a new thread of a process, in its address space
+struct process *create_thread(struct process *, size_t, size_t);
+
+// Switch from the current process (if any) to another in U-mode
+void process_switch(struct process *, struct process *)
+    __attribute__((noreturn));
+
+void process_account(struct process *, int);
+size_t process_add_region(struct process *, size_t);
+int process_fault(struct process *, size_t, int);
+int process_user_fault(struct page_table const *, size_t, int);
+size_t process_age(struct process *);
+size_t process_reclaim(size_t);
+size_t process_merge(struct process *, size_t);
+size_t process_collapse(struct process *, size_t);
+int process_is_anon(struct process const *, size_t, size_t);
+void process_drop_page(struct process *, size_t);
+size_t process_move_pages(struct process *, size_t, struct process *, size_t,
+			  size_t);
+void process_get_stats(struct process const *, struct process_stats *);
+void process_exit(struct process *, size_t);
+size_t process_wait(struct process *, size_t, size_t, size_t);
+void process_destroy(struct process *);
+
 #endif
@@ -3,20 +3,54 @@
 #include "../common/common.h"
 #include "process.h"
 #include "../mm/kmem.h"
+#include "../mm/sv39.h"
+#include "../mm/page.h"
+#include "../mm/slab.h"
+#include "../plic/cpu.h"
+#include "../plic/work.h"
+#include "../syscon/syscon.h"
+#include "../ipc/futex.h"
 
 static struct process_ll *PROCESSES = NULL;
+static struct slab_cache NODE_CACHE = SLAB_CACHE(struct process_ll);
+static struct process *CURRENT = NULL;
+
+// End of the time slice of the current normal process
+static size_t SLICE_END = -1;
+
+// Total utilization of the admitted real-time processes, in units of
+// 1 / SCHED_DL_UNIT
+static size_t DL_UTILIZATION = 0;
+
+// The process most recently handed out by sched_schedule(), i.e. the one
+// whose trap we are handling
+struct process *sched_current(void) {
+  return CURRENT;
+}
 
 void sched_init(void) {
   ASSERT(PROCESSES == NULL,
 	 "sched_init(): should only be called once at system startup\n");
+  // Lets syscalls touch user memory that is mapped on first touch
+  set_user_fault_handler(process_user_fault);
+  // Out of memory, swap out user pages instead of failing
+  page_set_reclaim_handler(process_reclaim);
   sched_enqueue(init_process);
 }
 
 void sched_enqueue(void (*func)(void)) {
-  struct process_ll *nd = kmalloc(sizeof(struct process_ll));
-  ASSERT(nd != NULL,
+  ASSERT(sched_add(create_process(func)) == 0,
 	 "sched_enqueue(): failed to allocate linked list node for new process\n");
-  nd->process = create_process(func);
+}
+
+// Add `process` to the processes run by the scheduler
+// Returns 0 on success and -1 if there is no memory left
+int sched_add(struct process *process) {
+  struct process_ll *nd = slab_alloc(&NODE_CACHE);
+  if (nd == NULL)
+    return -1;
+  nd->process = process;
+  process->sched_node = nd;
   if (PROCESSES == NULL) {
     nd->prev = nd;
     nd->next = nd;
@@ -27,14 +61,273 @@ void sched_enqueue(void (*func)(void)) {
     PROCESSES->prev->next = nd;
     PROCESSES->prev = nd;
   }
+  return 0;
 }
 
-struct process *sched_schedule(void) {
-  ASSERT(PROCESSES != NULL,
-	 "sched_schedule(): cannot schedule a process from an empty process list - did you call sched_init()?\n");
-  struct process *process = PROCESSES->process;
-  ASSERT(process != NULL,
-	 "sched_schedule(): process structure from head of process list was unexpectedly NULL\n");
-  PROCESSES = PROCESSES->next;
+// Take `process`, which is exiting, off the processes run by the
+// scheduler
+void sched_remove(struct process *process) {
+  struct process_ll *nd = process->sched_node;
+  if (nd == NULL)
+    return;
+  if (nd->next == nd)
+    PROCESSES = NULL;
+  else {
+    nd->prev->next = nd->next;
+    nd->next->prev = nd->prev;
+    if (PROCESSES == nd)
+      PROCESSES = nd->next;
+  }
+  slab_free(&NODE_CACHE, nd);
+  process->sched_node = NULL;
+  if (CURRENT == process)
+    CURRENT = NULL;
+}
+
+// Charge the real-time process that has been running since its dl_stamp
+// for its time until `now`, and throttle it if that uses up its budget
+static void sched_dl_charge(size_t now) {
+  struct process *process = CURRENT;
+  if (process == NULL || process->dl_period == 0
+      || process->dl_state != SCHED_DL_READY)
+    return;
+  size_t used = now - process->dl_stamp;
+  process->dl_budget -= used < process->dl_budget ? used : process->dl_budget;
+  process->dl_stamp = now;
+  if (process->dl_budget == 0) {
+    process->dl_state = SCHED_DL_THROTTLED;
+    ++process->dl_throttles;
+  }
+}
+
+// Count the deadlines missed by `now` and start the periods begun by then
+// Only a job still waiting to run by its deadline misses it; one that
+// was throttled instead is counted in dl_throttles
+static void sched_dl_update(size_t now) {
+  struct process_ll *nd = PROCESSES;
+  do {
+    struct process *process = nd->process;
+    nd = nd->next;
+    if (process->dl_period == 0)
+      continue;
+    if (process->dl_state == SCHED_DL_READY && !process->dl_missed
+	&& now >= process->dl_release + process->dl_deadline) {
+      process->dl_missed = 1;
+      ++process->dl_misses;
+    }
+    if (now < process->dl_release + process->dl_period)
+      continue;
+    // Periods in which the process was not even scheduled are skipped
+    process->dl_release +=
+	(now - process->dl_release) / process->dl_period * process->dl_period;
+    process->dl_budget = process->dl_runtime;
+    process->dl_state = SCHED_DL_READY;
+    process->dl_missed = 0;
+  } while (nd != PROCESSES);
+}
+
+// Runnable real-time process with a job left and the earliest deadline,
+// or NULL if there is none
+static struct process *sched_dl_pick(void) {
+  struct process *best = NULL;
+  struct process_ll *nd = PROCESSES;
+  do {
+    struct process *process = nd->process;
+    nd = nd->next;
+    if (process->dl_period != 0 && process->dl_state == SCHED_DL_READY
+	&& process->state == PROCESS_RUNNING
+	&& (best == NULL
+	    || process->dl_release + process->dl_deadline <
+	    best->dl_release + best->dl_deadline))
+      best = process;
+  } while (nd != PROCESSES);
+  return best;
+}
+
+static struct process *sched_set(struct process *process, size_t now) {
+  if (process->dl_period != 0)
+    process->dl_stamp = now;
+  CURRENT = process;
   return process;
 }
+
+// Wait for an interrupt, with every process blocked
+// The hart sleeps in wfi. External interrupts are then taken as they are
+// while deferred work runs (see s_trap_from_kernel in src/asm/crt0.s),
+// and the work they queue is run here. The timer is not taken, as its
+// handler would switch processes from under our caller: futex timeouts
+// and the next scheduling event are dealt with here instead, and arming
+// the timer for that event also clears the interrupt
+static void sched_idle(void) {
+  size_t sie = CSR_READ(sie);
+  CSR_WRITE(sie, (1 << IRQ_S_EXT) | (1 << IRQ_S_TIMER));
+  asm volatile ("wfi");
+  if (CSR_READ(sip) & (1 << IRQ_S_TIMER)) {
+    size_t now = GET_MTIME();
+    futex_expire(now);
+    sched_slice_over(now);
+    sched_dl_update(now);
+    sched_arm_timer();
+  }
+  CSR_CLEAR(sie, 1 << IRQ_S_TIMER);
+  CSR_SET(sstatus, SSTATUS_SIE);
+  CSR_CLEAR(sstatus, SSTATUS_SIE);
+  work_run();
+  CSR_WRITE(sie, sie);
+}
+
+// Pick the next process to run
+// Real-time processes with a job left come first, earliest deadline
+// first; otherwise the runnable normal processes take turns, round robin
+// Processes blocked in IPC or on a futex are skipped; if every process
+// is, the hart idles until an interrupt wakes one up (sched_idle())
+// Once the last process has exited, the system powers off
+struct process *sched_schedule(void) {
+  for (;;) {
+    if (PROCESSES == NULL) {
+      kprintf("sched_schedule(): all processes have exited\n");
+      poweroff();
+      PANIC("sched_schedule(): failed to power off\n");
+    }
+    size_t now = GET_MTIME();
+    sched_dl_charge(now);
+    sched_dl_update(now);
+    struct process *process = sched_dl_pick();
+    if (process != NULL)
+      return sched_set(process, now);
+    struct process_ll *nd = PROCESSES;
+    do {
+      process = nd->process;
+      ASSERT(process != NULL,
+	     "sched_schedule(): process structure in process list was unexpectedly NULL\n");
+      nd = nd->next;
+      if (process->state == PROCESS_RUNNING && process->dl_period == 0) {
+	PROCESSES = nd;
+	return sched_set(process, now);
+      }
+    } while (nd != PROCESSES);
+    sched_idle();
+  }
+}
+
+// Like sched_schedule(), but within the time slice of the current
+// process: it keeps running unless a real-time process has to run
+// instead
+struct process *sched_preempt(void) {
+  size_t now = GET_MTIME();
+  sched_dl_charge(now);
+  sched_dl_update(now);
+  struct process *process = sched_dl_pick();
+  if (process != NULL)
+    return sched_set(process, now);
+  if (CURRENT != NULL && CURRENT->state == PROCESS_RUNNING
+      && CURRENT->dl_period == 0)
+    return CURRENT;
+  return sched_schedule();
+}
+
+// Whether the time slice of the current normal process is over by `now`,
+// in which case a new one starts
+int sched_slice_over(size_t now) {
+  if (now < SLICE_END)
+    return 0;
+  SLICE_END = now + SCHED_SLICE_US * TICKS_PER_SECOND / US_PER_SECOND;
+  return 1;
+}
+
+// Set the timer for the next scheduling event: the end of the time
+// slice, the next period of a real-time process or, if the current
+// process is one, the end of its budget
+void sched_arm_timer(void) {
+  size_t at = SLICE_END;
+  struct process_ll *nd = PROCESSES;
+  if (nd != NULL)
+    do {
+      struct process *process = nd->process;
+      nd = nd->next;
+      if (process->dl_period != 0
+	  && process->dl_release + process->dl_period < at)
+	at = process->dl_release + process->dl_period;
+    } while (nd != PROCESSES);
+  if (CURRENT != NULL && CURRENT->dl_period != 0
+      && CURRENT->dl_state == SCHED_DL_READY
+      && CURRENT->dl_stamp + CURRENT->dl_budget < at)
+    at = CURRENT->dl_stamp + CURRENT->dl_budget;
+  if (at != get_timer_deadline())
+    set_timer_interrupt_at(at);
+}
+
+// Make `process` a real-time process getting `runtime` ticks of CPU time
+// in every `period` ticks, within `deadline` ticks of the start of each
+// period, or a normal process again if `runtime` is 0
+// It is only admitted if the utilization (runtime / period) of all
+// real-time processes stays at most 1
+// Returns 0 on success and -1 otherwise
+int sched_set_deadline(struct process *process, size_t runtime,
+		       size_t deadline, size_t period) {
+  size_t old = process->dl_period != 0 ?
+      SCHED_DL_UTIL(process->dl_runtime, process->dl_period) : 0;
+  if (runtime == 0) {
+    DL_UTILIZATION -= old;
+    process->dl_period = 0;
+    return 0;
+  }
+  if (runtime > deadline || deadline > period)
+    return -1;
+  size_t util = SCHED_DL_UTIL(runtime, period);
+  if (DL_UTILIZATION - old + util > SCHED_DL_UNIT)
+    return -1;
+  DL_UTILIZATION += util - old;
+  process->dl_runtime = runtime;
+  process->dl_deadline = deadline;
+  process->dl_period = period;
+  // The first period starts now
+  size_t now = GET_MTIME();
+  process->dl_release = now;
+  process->dl_budget = runtime;
+  process->dl_stamp = now;
+  process->dl_state = SCHED_DL_READY;
+  process->dl_missed = 0;
+  // For when the process is the current one, as it usually is
+  sched_arm_timer();
+  return 0;
+}
+
+// The current job of real-time process `process` is done (it yielded),
+// so it waits for its next period
+void sched_dl_done(struct process *process) {
+  if (process->dl_period == 0)
+    return;
+  sched_dl_charge(GET_MTIME());
+  process->dl_state = SCHED_DL_DONE;
+}
+
+// Block the current process `process`, which its caller has already
+// taken off the runnable processes, and run another one
+// `process` resumes at `pc` once woken
+void sched_block(struct process *process, size_t pc) {
+  process->pc = pc;
+  ++process->nvcsw;
+  struct process *next = sched_schedule();
+  process_switch(process, next);
+  PANIC("sched_block(): failed to switch process\n");
+}
+
+// Make `process` the current process without going through the round
+// robin, for handing the CPU straight to it (see src/ipc/ipc.c)
+void sched_set_current(struct process *process) {
+  size_t now = GET_MTIME();
+  sched_dl_charge(now);
+  sched_set(process, now);
+}
+
+// Call `func` on every process
+void sched_for_each(void (*func)(struct process *)) {
+  struct process_ll *nd = PROCESSES;
+  if (nd == NULL)
+    return;
+  do {
+    func(nd->process);
+    nd = nd->next;
+  } while (nd != PROCESSES);
+}
@@ -1,6 +1,27 @@
 #ifndef SCHED_H
 #define SCHED_H
 
+#include <stddef.h>
+#include "../plic/cpu.h"
+
+// Time slice of normal processes
+#define SCHED_SLICE_US US_PER_SECOND
+
+// Real-time processes (sched_set_deadline())
+// Utilization is runtime / period in units of 1 / SCHED_DL_UNIT, rounded
+// up so that admission errs on the safe side
+#define SCHED_DL_UNIT (1ull << 20)
+#define SCHED_DL_UTIL(runtime, period) \
+  (((runtime) * SCHED_DL_UNIT + (period) - 1) / (period))
+
+// State of the job of the current period of a real-time process
+// - SCHED_DL_READY: it has budget left to run
+// - SCHED_DL_THROTTLED: it used up its budget without finishing
+// - SCHED_DL_DONE: it finished (yielded)
+#define SCHED_DL_READY 0
+#define SCHED_DL_THROTTLED 1
+#define SCHED_DL_DONE 2
+
 struct process_ll {
   struct process *process;
   struct process_ll *prev;
@@ -9,6 +30,17 @@ struct process_ll {
 
 void sched_init(void);
 void sched_enqueue(void (*)(void));
+int sched_add(struct process *);
+void sched_remove(struct process *);
 struct process *sched_schedule(void);
+struct process *sched_preempt(void);
+int sched_slice_over(size_t);
+void sched_arm_timer(void);
+int sched_set_deadline(struct process *, size_t, size_t, size_t);
+void sched_dl_done(struct process *);
+struct process *sched_current(void);
+void sched_set_current(struct process *);
+void sched_block(struct process *, size_t) __attribute__((noreturn));
+void sched_for_each(void (*)(struct process *));
 
 #endif
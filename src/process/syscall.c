@@ -1,19 +1,247 @@
 #include "syscall.h"
+#include "process.h"
+#include "sched.h"
+#include "pid.h"
 #include "../common/common.h"
 #include "../uart/uart.h"
+#include "../fs/file.h"
+#include "../mm/page.h"
+#include "../mm/sv39.h"
+#include "../mm/kmem.h"
+#include "../latency/latency.h"
+#include "../ipc/ipc.h"
+#include "../ipc/futex.h"
+#ifdef BENCH
+#include "../bench/bench.h"
+#endif
+
+// Look up an open file of the current process
+static struct file *get_file(struct process *process, size_t fd) {
+  return fd < PROCESS_MAX_FILES ? process->files[fd] : NULL;
+}
+
+static size_t sys_open(struct process *process, size_t path, size_t flags) {
+  char kpath[FILE_PATH_MAX];
+  if (copy_string_from_user(process->space->root, kpath, path, FILE_PATH_MAX) >=
+      FILE_PATH_MAX)
+    return SYSCALL_ERROR;
+  size_t fd = 0;
+  while (fd < PROCESS_MAX_FILES && process->files[fd] != NULL)
+    ++fd;
+  if (fd == PROCESS_MAX_FILES)
+    return SYSCALL_ERROR;
+  struct file *file = file_open(kpath, (int)flags);
+  if (file == NULL)
+    return SYSCALL_ERROR;
+  process->files[fd] = file;
+  return fd;
+}
+
+static size_t sys_close(struct process *process, size_t fd) {
+  struct file *file = get_file(process, fd);
+  if (file == NULL)
+    return SYSCALL_ERROR;
+  file_close(file);
+  process->files[fd] = NULL;
+  return 0;
+}
+
+// mmap(fd, offset, length, prot): map a file into the mmap region of the
+// current process and return its virtual address
+// With fd = -1, map `length` bytes of zeroed anonymous memory instead,
+// whose pages are allocated on first touch
+// Anonymous memory is always mapped readable and writable, so `prot` has
+// to be PROT_READ | PROT_WRITE for it
+static size_t sys_mmap(struct process *process, size_t fd, size_t offset,
+		       size_t length, size_t prot) {
+  if (fd == (size_t)-1) {
+    if (prot != (PROT_READ | PROT_WRITE))
+      return SYSCALL_ERROR;
+    size_t vaddr = length != 0 ? process_add_region(process, length) : 0;
+    return vaddr != 0 ? vaddr : SYSCALL_ERROR;
+  }
+  struct file *file = get_file(process, fd);
+  if (file == NULL || length == 0)
+    return SYSCALL_ERROR;
+  struct process_file_map *slot = NULL;
+  for (size_t i = 0; i < PROCESS_MAX_FILE_MAPS && slot == NULL; ++i)
+    if (process->space->file_maps[i].length == 0)
+      slot = &process->space->file_maps[i];
+  if (slot == NULL)
+    return SYSCALL_ERROR;
+  size_t vaddr = process->space->mmap_next;
+  size_t mapped =
+      file_mmap(file, process->space->root, vaddr, offset, length, (int)prot);
+  if (mapped == FILE_ERROR || mapped == 0)
+    return SYSCALL_ERROR;
+  *slot = (struct process_file_map) {
+  file->inode, offset, mapped};
+  process->space->mmap_next += align_val(mapped, PAGE_ORDER);
+  return vaddr;
+}
+
+static size_t sys_thread_create(struct process *process, size_t entry,
+				size_t arg) {
+  struct process *thread = create_thread(process, entry, arg);
+  if (thread == NULL)
+    return SYSCALL_ERROR;
+  if (sched_add(thread) != 0) {
+    process_destroy(thread);
+    return SYSCALL_ERROR;
+  }
+  return thread->pid;
+}
+
+static size_t sys_pstat(struct process *process, size_t pid, size_t buf) {
+  struct process *target = pid == 0 ? process : pid_find(pid);
+  // Dead processes have no address space left to count
+  if (target == NULL || target->state == PROCESS_DEAD)
+    return SYSCALL_ERROR;
+  struct process_stats stats;
+  process_get_stats(target, &stats);
+  if (copy_to_user(process->space->root, buf, &stats, sizeof(stats)) !=
+      sizeof(stats))
+    return SYSCALL_ERROR;
+  return 0;
+}
+
+// kill(pid): end another process, or the caller itself, in which case
+// it does not return
+static size_t sys_kill(size_t pid) {
+  struct process *target = pid_find(pid);
+  if (target == NULL || target->state == PROCESS_DEAD)
+    return SYSCALL_ERROR;
+  process_exit(target, PROCESS_EXIT_KILLED);
+  return 0;
+}
+
+static size_t sys_latency(struct process *process, size_t kind,
+			  size_t index, size_t buf) {
+  struct latency_histogram const *histogram = latency_get(kind, index);
+  if (histogram == NULL)
+    return SYSCALL_ERROR;
+  if (copy_to_user(process->space->root, buf, histogram,
+		   sizeof(struct latency_histogram)) !=
+      sizeof(struct latency_histogram))
+    return SYSCALL_ERROR;
+  return 0;
+}
+
+static size_t sys_memstat(struct process *process, size_t buf) {
+  struct mem_stats stats;
+  mem_get_stats(&stats, 1);
+  if (copy_to_user(process->space->root, buf, &stats, sizeof(stats)) !=
+      sizeof(stats))
+    return SYSCALL_ERROR;
+  return 0;
+}
 
 size_t do_syscall(size_t mepc, struct trap_frame *frame) {
-  // a0 = x10
+  // a0 = x10 holds the syscall number, a1-a5 = x11-x15 the arguments
+  // The result is returned in a0
   size_t syscall_number = frame->regs[10];
+  size_t *args = &frame->regs[11];
+  struct process *process = sched_current();
+  ++process->syscalls;
   switch (syscall_number) {
-  case 0:
-    // TODO: Program exit
-    PANIC("do_syscall(): exit() system call not implemented (syscall %d)\n",
-	  syscall_number);
-  case 1:
+  case SYS_EXIT:
+    process_exit(process, args[0] & PROCESS_EXIT_MASK);
+    PANIC("do_syscall(): exit() failed to switch process\n");
+  case SYS_TEST:
     // Test syscall
     kprintf("Test syscall\n");
     return mepc + 4;
+  case SYS_OPEN:
+    frame->regs[10] = sys_open(process, args[0], args[1]);
+    return mepc + 4;
+  case SYS_CLOSE:
+    frame->regs[10] = sys_close(process, args[0]);
+    return mepc + 4;
+  case SYS_READ:
+    {
+      struct file *file = get_file(process, args[0]);
+      frame->regs[10] = file != NULL ?
+	  file_read(file, process->space->root, args[1], args[2]) : SYSCALL_ERROR;
+    }
+    return mepc + 4;
+  case SYS_WRITE:
+    {
+      struct file *file = get_file(process, args[0]);
+      frame->regs[10] = file != NULL ?
+	  file_write(file, process->space->root, args[1], args[2]) : SYSCALL_ERROR;
+    }
+    return mepc + 4;
+  case SYS_SEEK:
+    {
+      struct file *file = get_file(process, args[0]);
+      frame->regs[10] = file != NULL ?
+	  file_seek(file, args[1], (int)args[2]) : SYSCALL_ERROR;
+    }
+    return mepc + 4;
+  case SYS_MMAP:
+    frame->regs[10] = sys_mmap(process, args[0], args[1], args[2], args[3]);
+    return mepc + 4;
+  case SYS_SYNC:
+    frame->regs[10] = file_sync() ? SYSCALL_ERROR : 0;
+    return mepc + 4;
+  case SYS_YIELD:
+    // Give up the CPU and resume after the ecall when scheduled again
+    frame->regs[10] = 0;
+    process->pc = mepc + 4;
+    sched_dl_done(process);
+    {
+      struct process *next = sched_schedule();
+      if (next != process)
+	++process->nvcsw;
+      process_switch(process, next);
+    }
+    PANIC("do_syscall(): yield() failed to switch process\n");
+  case SYS_GETPID:
+    frame->regs[10] = process->pid;
+    return mepc + 4;
+  case SYS_PSTAT:
+    frame->regs[10] = sys_pstat(process, args[0], args[1]);
+    return mepc + 4;
+  case SYS_LATENCY:
+    frame->regs[10] = sys_latency(process, args[0], args[1], args[2]);
+    return mepc + 4;
+  case SYS_MEMSTAT:
+    frame->regs[10] = sys_memstat(process, args[0]);
+    return mepc + 4;
+  case SYS_IPC_CREATE:
+    frame->regs[10] = ipc_create();
+    return mepc + 4;
+  case SYS_IPC_SEND:
+    return ipc_send(process, args[0], mepc);
+  case SYS_IPC_RECV:
+    return ipc_recv(process, args[0], mepc);
+  case SYS_IPC_CALL:
+    return ipc_call(process, args[0], args[5], mepc);
+  case SYS_IPC_WINDOW:
+    frame->regs[10] = ipc_window(process, args[0], args[1]);
+    return mepc + 4;
+  case SYS_FUTEX_WAIT:
+    return futex_wait(process, args[0], (uint32_t) args[1], args[2], mepc);
+  case SYS_FUTEX_WAKE:
+    frame->regs[10] = futex_wake(process, args[0], args[1]);
+    return mepc + 4;
+  case SYS_THREAD_CREATE:
+    frame->regs[10] = sys_thread_create(process, args[0], args[1]);
+    return mepc + 4;
+  case SYS_SCHED_DEADLINE:
+    frame->regs[10] = sched_set_deadline(process, args[0], args[1], args[2])
+	? SYSCALL_ERROR : 0;
+    return mepc + 4;
+  case SYS_WAITPID:
+    return process_wait(process, args[0], args[1], mepc);
+  case SYS_KILL:
+    frame->regs[10] = sys_kill(args[0]);
+    return mepc + 4;
+#ifdef BENCH
+  case SYS_BENCH:
+    bench_report(args[0], args[1], args[2], args[3], args[4]);
+    return mepc + 4;
+#endif
   default:
     // FIXME: handle this gracefully as errors in user space should not
     // bring down the system
@@ -4,8 +4,78 @@
 #include <stddef.h>
 #include "../plic/trap_frame.h"
 
+// System call numbers, passed in a0
+// Arguments are passed in a1-a5 and the result is returned in a0
+// System calls that may switch processes must be listed in
+// SYSCALL_SWITCHES in src/asm/crt0.s, as the others take a fast path
+// that leaves the callee-saved registers out of the trap frame
+// exit(status): end the caller, see PROCESS_EXIT_MASK in
+// src/process/process.h
+#define SYS_EXIT 0
+#define SYS_TEST 1
+#define SYS_OPEN 2
+#define SYS_CLOSE 3
+#define SYS_READ 4
+#define SYS_WRITE 5
+#define SYS_SEEK 6
+#define SYS_MMAP 7
+#define SYS_SYNC 8
+#define SYS_YIELD 9
+#define SYS_GETPID 10
+// Only available in benchmark builds, see src/bench/bench.h
+#define SYS_BENCH 11
+// pstat(pid, struct process_stats *): resource usage of a process
+// (pid 0 = the caller), see src/process/process.h
+#define SYS_PSTAT 12
+// latency(kind, index, struct latency_histogram *): copy out a latency
+// histogram, see src/latency/latency.h
+#define SYS_LATENCY 13
+// memstat(struct mem_stats *): page, kmalloc(), zram, same-page merging
+// and huge page statistics, including the free extent histogram, see
+// src/mm/kmem.h
+#define SYS_MEMSTAT 14
+// Synchronous IPC, see src/ipc/ipc.h
+// ipc_create(): new endpoint number
+// ipc_send(endpoint, message in a2-a5)
+// ipc_recv(endpoint): message in a1-a4, sender PID in a0
+// ipc_call(endpoint, message in a2-a5, reply endpoint in a6): send, then
+// receive from the reply endpoint
+// ipc_window(vaddr, npages): where to map pages received
+#define SYS_IPC_CREATE 15
+#define SYS_IPC_SEND 16
+#define SYS_IPC_RECV 17
+#define SYS_IPC_CALL 18
+#define SYS_IPC_WINDOW 19
+// futex_wait(addr, expected, timeout), futex_wake(addr, n), see
+// src/ipc/futex.h
+#define SYS_FUTEX_WAIT 20
+#define SYS_FUTEX_WAKE 21
+// thread_create(entry, arg): start a thread of the caller's process at
+// `entry` with `arg` in a0 and return its PID (see struct process in
+// src/process/process.h)
+#define SYS_THREAD_CREATE 22
+// sched_deadline(runtime, deadline, period): make the caller a
+// real-time process, scheduled earliest deadline first ahead of all
+// others, or a normal one again with runtime 0; in mtime ticks
+// Fails unless runtime <= deadline <= period and the total utilization
+// of real-time processes stays at most 1
+// A real-time process yields (SYS_YIELD) once done for the period
+#define SYS_SCHED_DEADLINE 23
+// waitpid(pid, size_t *status): wait for child `pid` of the caller (a
+// thread it created) to exit, reap it and store its exit status unless
+// `status` is NULL; returns `pid`
+// kill(pid): end a process, with exit status PROCESS_EXIT_KILLED
+// PIDs are only reused once their process has been reaped, see
+// src/process/pid.h
+#define SYS_WAITPID 24
+#define SYS_KILL 25
+
+// Returned in a0 when a system call fails
+#define SYSCALL_ERROR ((size_t)-1)
+
 // Defined in src/asm/crt0.s
-size_t make_syscall(size_t);
+// Takes the system call number followed by its arguments
+size_t make_syscall(size_t, ...);
 
 size_t do_syscall(size_t, struct trap_frame *);
 
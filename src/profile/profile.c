@@ -0,0 +1,137 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "profile.h"
+#include "../common/common.h"
+#include "../uart/uart.h"
+#include "../plic/cpu.h"
+#include "../sbi/sbi.h"
+#include "../mm/page.h"
+#include "../mm/sv39.h"
+#include "../process/process.h"
+#include "../process/sched.h"
+
+extern const size_t TEXT_START;
+extern const size_t TEXT_END;
+extern const size_t KERNEL_STACK_START;
+extern const size_t KERNEL_STACK_END;
+
+// Shared with M-mode, which runs without translation but sees the same
+// (identity mapped) memory
+static struct profile_buffer *volatile PROFILE_BUFFER = NULL;
+
+// Start sampling `hz` times per second
+// Returns 0 on success and -1 if the sample buffer cannot be allocated
+int profile_start(size_t hz) {
+  if (hz == 0)
+    return -1;
+  if (PROFILE_BUFFER == NULL) {
+    struct profile_buffer *buffer = alloc_pages(PROFILE_BUFFER_PAGES);
+    if (buffer == NULL)
+      return -1;
+    buffer->capacity =
+	(PROFILE_BUFFER_PAGES * PAGE_SIZE - sizeof(struct profile_buffer)) /
+	sizeof(struct profile_sample);
+    PROFILE_BUFFER = buffer;
+  }
+  PROFILE_BUFFER->count = 0;
+  PROFILE_BUFFER->dropped = 0;
+  sbi_call(SBI_PROFILE, TICKS_PER_SECOND / hz, 0);
+  return 0;
+}
+
+void profile_stop(void) {
+  sbi_call(SBI_PROFILE, 0, 0);
+}
+
+// Read a word of the interrupted context, going through its page table
+// if it was running in U-mode
+static size_t profile_read(struct page_table const *root, size_t addr) {
+  if (root != NULL) {
+    addr = virt_to_phys(root, addr);
+    if (addr == 0)
+      return 0;
+  }
+  return *(const size_t *)addr;
+}
+
+// Walk the frame pointer chain starting at `fp`
+// With frame pointers, GCC saves ra at fp - 8 and the caller's fp at
+// fp - 16. Leaf functions only save fp (at fp - 8), in which case the
+// return address is still in ra, which is only meaningful for the
+// innermost frame
+static void profile_walk(struct profile_sample *sample, size_t fp, size_t ra,
+			 struct page_table const *root) {
+  size_t stack_lo = KERNEL_STACK_START, stack_hi = KERNEL_STACK_END;
+  size_t text_lo = TEXT_START, text_hi = TEXT_END;
+  if (root != NULL) {
+    stack_lo = STACK_ADDR;
+    stack_hi = STACK_ADDR + STACK_PAGES * PAGE_SIZE;
+    text_lo += USER_TEXT_OFFSET;
+    text_hi += USER_TEXT_OFFSET;
+  }
+#define IN_TEXT(addr) (text_lo <= (addr) && (addr) < text_hi)
+  while (sample->depth < PROFILE_MAX_DEPTH && fp % sizeof(size_t) == 0 &&
+	 stack_lo + 2 * sizeof(size_t) <= fp && fp <= stack_hi) {
+    size_t word = profile_read(root, fp - sizeof(size_t));
+    size_t ret, next;
+    if (IN_TEXT(word)) {
+      ret = word;
+      next = profile_read(root, fp - 2 * sizeof(size_t));
+    } else if (sample->depth == 0 && IN_TEXT(ra)) {
+      ret = ra;
+      next = word;
+    } else
+      break;
+    sample->callers[sample->depth++] = ret;
+    // Callers' frames are further up the stack
+    if (next <= fp)
+      break;
+    fp = next;
+  }
+#undef IN_TEXT
+}
+
+// Record a sample of the context interrupted at `epc` with saved
+// registers `regs` (indexed by register number)
+// Runs in M-mode
+void profile_record(size_t epc, size_t mstatus, size_t *regs) {
+  struct profile_buffer *buffer = PROFILE_BUFFER;
+  if (buffer == NULL)
+    return;
+  if (buffer->count == buffer->capacity) {
+    ++buffer->dropped;
+    return;
+  }
+  struct profile_sample *sample = &buffer->samples[buffer->count++];
+  struct process *current = sched_current();
+  sample->pc = epc;
+  sample->mode = (mstatus >> 11) & 0b11;
+  sample->pid = current != NULL ? current->pid : 0;
+  sample->depth = 0;
+  struct page_table const *root = NULL;
+  if (sample->mode == PROFILE_MODE_USER) {
+    if (current == NULL)
+      return;
+    root = current->space->root;
+  }
+  // s0 = x8 is the frame pointer, ra = x1
+  profile_walk(sample, regs[8], regs[1], root);
+}
+
+// Stop sampling and print all samples for misc/profile.py
+void profile_dump(void) {
+  struct profile_buffer *buffer = PROFILE_BUFFER;
+  if (buffer == NULL)
+    return;
+  profile_stop();
+  kprintf("prof begin\n");
+  for (size_t i = 0; i < buffer->count; ++i) {
+    struct profile_sample *sample = &buffer->samples[i];
+    kprintf("prof %x %x %lx", sample->pid, sample->mode, sample->pc);
+    for (size_t j = 0; j < sample->depth; ++j)
+      kprintf(" %lx", sample->callers[j]);
+    kputchar('\n');
+  }
+  kprintf("prof end samples=%lu dropped=%lu\n", buffer->count,
+	  buffer->dropped);
+}
@@ -0,0 +1,62 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Timer-driven sampling profiler
+ *
+ * The M-mode layer multiplexes a periodic sampling deadline onto the
+ * CLINT timer next to the one S-mode programs (see src/sbi/sbi.c). On
+ * every sample it records the interrupted PC, the current PID, the
+ * privilege mode and up to PROFILE_MAX_DEPTH return addresses found by
+ * walking the frame pointer chain, into a buffer preallocated by
+ * profile_start()
+ *
+ * profile_dump() prints the samples as lines of the form
+ *
+ *   prof <pid> <mode> <pc> [<return address> ...]
+ *
+ * (all in hex, mode 0 = U, 1 = S) for misc/profile.py to symbolize
+ * against the kernel image. `make profile` does all of this
+ */
+
+// Default sampling rate for `make profile`
+#ifndef PROFILE_HZ
+#define PROFILE_HZ 1000
+#endif
+
+#define PROFILE_MAX_DEPTH 8
+
+// Number of pages reserved for samples by profile_start()
+#define PROFILE_BUFFER_PAGES 256
+
+// Privilege modes, as encoded in mstatus.MPP
+#define PROFILE_MODE_USER 0
+#define PROFILE_MODE_SUPERVISOR 1
+
+struct profile_sample {
+  size_t pc;
+  uint32_t pid;
+  uint8_t mode;
+  uint8_t depth;
+  size_t callers[PROFILE_MAX_DEPTH];
+};
+
+struct profile_buffer {
+  size_t capacity;
+  size_t count;
+  // Samples that did not fit into the buffer
+  size_t dropped;
+  struct profile_sample samples[];
+};
+
+int profile_start(size_t);
+void profile_stop(void);
+void profile_dump(void);
+
+// Called from the M-mode timer interrupt
+void profile_record(size_t, size_t, size_t *);
+
+#endif
@@ -0,0 +1,73 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "rtc.h"
+#include "../common/common.h"
+#include "../uart/uart.h"
+#include "../mm/page.h"
+
+// Shared with every process, see rtc.h
+static struct time_page *TIME_PAGE = NULL;
+
+#define RTC_REG(offset) (*(volatile uint32_t *)(RTC_ADDR + (offset)))
+
+// Wall-clock time according to the RTC, in nanoseconds since the Unix
+// epoch
+uint64_t rtc_read(void) {
+  uint64_t low = RTC_REG(RTC_TIME_LOW);
+  uint64_t high = RTC_REG(RTC_TIME_HIGH);
+  return high << 32 | low;
+}
+
+// Set the wall clock and the RTC to `ns` nanoseconds since the Unix
+// epoch
+void rtc_set(uint64_t ns) {
+  RTC_REG(RTC_TIME_HIGH) = ns >> 32;
+  RTC_REG(RTC_TIME_LOW) = ns & 0xFFFFFFFF;
+  uint64_t epoch = ns - TICKS_TO_NS(GET_MTIME(), TICKS_PER_SECOND);
+  __atomic_store_n(&TIME_PAGE->seq, TIME_PAGE->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  TIME_PAGE->ticks_per_second = TICKS_PER_SECOND;
+  TIME_PAGE->boot_epoch_ns = epoch;
+  __atomic_store_n(&TIME_PAGE->seq, TIME_PAGE->seq + 1, __ATOMIC_RELEASE);
+}
+
+// Allocate the time page and set the wall clock from the RTC
+void rtc_init(void) {
+  TIME_PAGE = alloc_page();
+  ASSERT(TIME_PAGE != NULL, "rtc_init(): failed to allocate the time page\n");
+  // Let U-mode read the time CSR
+  CSR_SET(scounteren, 1 << 1);
+  rtc_set(rtc_read());
+}
+
+// Wall-clock time in nanoseconds since the Unix epoch
+uint64_t rtc_now_ns(void) {
+  return TIME_PAGE->boot_epoch_ns +
+      TICKS_TO_NS(GET_MTIME(), TIME_PAGE->ticks_per_second);
+}
+
+struct time_page *rtc_time_page(void) {
+  return TIME_PAGE;
+}
+
+// Print `ns` nanoseconds since the Unix epoch as a UTC date and time
+// See Howard Hinnant, "chrono-Compatible Low-Level Date Algorithms"
+// (civil_from_days)
+void rtc_print_date(uint64_t ns) {
+  uint64_t secs = ns / NS_PER_SECOND;
+  uint64_t days = secs / 86400;
+  uint64_t rem = secs % 86400;
+  // Days since 0000-03-01, in 400-year eras of 146097 days
+  uint64_t z = days + 719468;
+  uint64_t era = z / 146097;
+  uint64_t doe = z - era * 146097;
+  uint64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  uint64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  uint64_t mp = (5 * doy + 2) / 153;
+  uint64_t day = doy - (153 * mp + 2) / 5 + 1;
+  uint64_t month = mp < 10 ? mp + 3 : mp - 9;
+  uint64_t year = yoe + era * 400 + (month <= 2);
+  kprintf("%lu-%lu%lu-%lu%lu %lu%lu:%lu%lu:%lu%lu UTC", year, month / 10,
+	  month % 10, day / 10, day % 10, rem / 36000, rem / 3600 % 10,
+	  rem % 3600 / 600, rem % 3600 / 60 % 10, rem % 60 / 10, rem % 10);
+}
@@ -0,0 +1,78 @@
+#ifndef RTC_H
+#define RTC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../fdt/fdt.h"
+#include "../plic/cpu.h"
+#include "../process/process.h"
+
+/*
+ * Wall clock and time page
+ *
+ * At boot, rtc_init() reads the wall clock from the Goldfish RTC (see
+ * https://android.googlesource.com/platform/external/qemu/+/master/docs/GOLDFISH-VIRTUAL-HARDWARE.TXT)
+ * once, as nanoseconds since the Unix epoch, and from then on the time
+ * is kept by mtime
+ *
+ * The time page, a read-only page mapped at TIME_PAGE_ADDR into every
+ * process (see src/process/process.h), holds what U-mode needs to turn
+ * the time CSR into wall-clock time, so that TIME_PAGE_NOW_NS() reads
+ * the time without a system call. The kernel makes seq odd while it
+ * updates the page, and readers retry if it was odd or changed under
+ * them
+ */
+
+// Memory-mapped address of the RTC, from the device tree
+#define RTC_ADDR (PLATFORM.rtc)
+
+// Goldfish RTC registers
+// Reading TIME_LOW latches the high half of the time into TIME_HIGH,
+// and writing either half sets that half of the time
+#define RTC_TIME_LOW 0x00
+#define RTC_TIME_HIGH 0x04
+
+#define NS_PER_SECOND 1000000000ull
+
+// - seq: odd while the kernel updates the page
+// - ticks_per_second: mtime (and time CSR) frequency
+// - boot_epoch_ns: wall-clock time when mtime was 0, in nanoseconds
+//   since the Unix epoch
+struct time_page {
+  uint32_t seq;
+  uint32_t reserved;
+  uint64_t ticks_per_second;
+  uint64_t boot_epoch_ns;
+};
+
+// Convert mtime `ticks` at `freq` ticks per second to nanoseconds,
+// without overflowing for the first few centuries of uptime
+#define TICKS_TO_NS(ticks, freq) \
+  ((ticks) / (freq) * NS_PER_SECOND +\
+   (ticks) % (freq) * NS_PER_SECOND / (freq))
+
+// Wall-clock time in nanoseconds since the Unix epoch, for U-mode
+// This is a macro as U-mode code cannot call kernel functions
+#define TIME_PAGE_NOW_NS() ({\
+  volatile struct time_page *_page =\
+    (volatile struct time_page *)TIME_PAGE_ADDR;\
+  uint32_t _seq;\
+  uint64_t _freq, _epoch, _ticks;\
+  do {\
+    _seq = __atomic_load_n(&_page->seq, __ATOMIC_ACQUIRE);\
+    _freq = _page->ticks_per_second;\
+    _epoch = _page->boot_epoch_ns;\
+    _ticks = GET_TIME();\
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);\
+  } while ((_seq & 1) || _page->seq != _seq);\
+  _epoch + TICKS_TO_NS(_ticks, _freq);\
+})
+
+void rtc_init(void);
+uint64_t rtc_read(void);
+uint64_t rtc_now_ns(void);
+void rtc_set(uint64_t);
+struct time_page *rtc_time_page(void);
+void rtc_print_date(uint64_t);
+
+#endif
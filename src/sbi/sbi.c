@@ -0,0 +1,93 @@
+#include <stdint.h>
+#include "sbi.h"
+#include "../plic/cpu.h"
+#include "../plic/trap_handler.h"
+#include "../syscon/syscon.h"
+#include "../common/common.h"
+#include "../uart/uart.h"
+#include "../profile/profile.h"
+
+// Deadlines multiplexed onto mtimecmp: the one S-mode asked for through
+// SBI_SET_TIMER, and the next profiler sample (see src/profile/)
+// Both are (size_t)-1 when not armed
+static size_t S_DEADLINE = -1;
+static size_t PROFILE_DEADLINE = -1;
+static size_t PROFILE_PERIOD = 0;
+
+// Point mtimecmp at the earlier of the two deadlines
+// The machine timer stays masked while neither is armed
+static void m_timer_program(void) {
+  size_t next =
+      S_DEADLINE < PROFILE_DEADLINE ? S_DEADLINE : PROFILE_DEADLINE;
+  *(volatile size_t *)MTIMECMP_ADDR = next;
+  if (next != (size_t)-1)
+    CSR_SET(mie, 1 << IRQ_M_TIMER);
+  else
+    CSR_CLEAR(mie, 1 << IRQ_M_TIMER);
+}
+
+static size_t sbi_handle(size_t function, size_t arg0) {
+  switch (function) {
+  case SBI_SET_TIMER:
+    // Program the next deadline and withdraw the supervisor timer
+    // interrupt we forwarded for the previous one
+    S_DEADLINE = arg0;
+    CSR_CLEAR(mip, 1 << IRQ_S_TIMER);
+    m_timer_program();
+    return 0;
+  case SBI_PROFILE:
+    PROFILE_PERIOD = arg0;
+    PROFILE_DEADLINE = arg0 != 0 ? GET_MTIME() + arg0 : (size_t)-1;
+    m_timer_program();
+    return 0;
+  case SBI_SHUTDOWN:
+    poweroff();
+    return 0;
+  default:
+    return SBI_ERR_NOT_SUPPORTED;
+  }
+}
+
+// M-mode trap handler, called from m_trap_vector with the interrupted
+// registers saved in `regs` (indexed by register number)
+// Only the machine timer and ecalls from S-mode should ever get here;
+// everything else is delegated to S-mode
+size_t m_mode_trap_handler(size_t cause, size_t epc, size_t *regs) {
+  size_t exception_code = CAUSE_EXCEPTION_CODE(cause);
+  if (CAUSE_IS_INTERRUPT(cause)) {
+    switch (exception_code) {
+    case IRQ_M_TIMER:
+      {
+	size_t now = GET_MTIME();
+	if (now >= PROFILE_DEADLINE) {
+	  profile_record(epc, CSR_READ(mstatus), regs);
+	  PROFILE_DEADLINE = now + PROFILE_PERIOD;
+	}
+	// Forward S-mode's deadline as a supervisor timer interrupt
+	// It stays disarmed until S-mode programs the next one through
+	// SBI_SET_TIMER
+	if (now >= S_DEADLINE) {
+	  CSR_SET(mip, 1 << IRQ_S_TIMER);
+	  S_DEADLINE = -1;
+	}
+	m_timer_program();
+      }
+      return epc;
+    default:
+      PANIC("m_mode_trap_handler(): unexpected interrupt %d\n",
+	    exception_code);
+    }
+  }
+  switch (exception_code) {
+  case 9:
+    // Environment call from S-mode
+    // a0 = x10, a1 = x11, a7 = x17
+    regs[10] = sbi_handle(regs[17], regs[10]);
+    return epc + 4;
+  default:
+    PANIC
+	("m_mode_trap_handler(): unexpected trap with exception code %d at %p\n",
+	 exception_code, epc);
+  }
+  return epc;
+}
@@ -0,0 +1,32 @@
+#ifndef SBI_H
+#define SBI_H
+
+#include <stddef.h>
+
+/*
+ * Thin M-mode layer
+ *
+ * The kernel runs in S-mode; M-mode only keeps what S-mode cannot do
+ * itself, exposed through a small subset of the legacy SBI calling
+ * convention (function ID in a7, arguments in a0 and a1, result in a0)
+ * See https://github.com/riscv-non-isa/riscv-sbi-doc for details
+ */
+
+// Legacy SBI extension IDs
+#define SBI_SET_TIMER 0
+#define SBI_SHUTDOWN 8
+
+// Our own calls, from the firmware-specific extension space
+// SBI_PROFILE: sample every a0 mtime ticks (0 stops), see src/profile/
+#define SBI_PROFILE 0x0A000000
+
+// Returned for unknown SBI calls
+#define SBI_ERR_NOT_SUPPORTED ((size_t)-2)
+
+// Defined in src/asm/crt0.s
+size_t sbi_call(size_t, size_t, size_t);
+void s_mode_trap_init(void);
+
+size_t m_mode_trap_handler(size_t, size_t, size_t *);
+
+#endif
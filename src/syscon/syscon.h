@@ -1,9 +1,11 @@
 #ifndef SYSCON_H
 #define SYSCON_H
 
-// "test" syscon-compatible device is at memory-mapped address 0x100000
-// according to our device tree
-#define SYSCON_ADDR 0x100000
+#include "../fdt/fdt.h"
+
+// Memory-mapped address of the "test" syscon-compatible device
+// (0x100000 on QEMU), from the device tree
+#define SYSCON_ADDR (PLATFORM.syscon)
 
 void poweroff(void);
 void reboot(void);
@@ -2,8 +2,23 @@
 #include <stdint.h>
 #include <stdarg.h>
 #include <limits.h>
+#include <stdbool.h>
 #include "uart.h"
 #include "../common/common.h"
+#include "../syscon/syscon.h"
+#include "../profile/profile.h"
+#include "../console/console.h"
+#include "../plic/work.h"
+
+// Characters received by uart_interrupt() and not yet handled by
+// uart_work(), a ring buffer with a single producer and consumer
+// Characters arriving while it is full are dropped
+static uint8_t UART_RX[UART_RX_SIZE];
+static volatile size_t UART_RX_HEAD = 0;
+static volatile size_t UART_RX_TAIL = 0;
+
+static void uart_work(void *);
+static struct work UART_WORK = WORK_INIT(uart_work, NULL);
 
 /*
  * Initialize NS16550A UART
@@ -46,6 +61,39 @@ uint8_t uart_get(void) {
   return *(uint8_t *) UART_ADDR;
 }
 
+// PLIC handler for received characters
+// Only takes them out of the receive FIFO, leaving the rest to
+// uart_work()
+void uart_interrupt(uint32_t source, void *data) {
+  volatile uint8_t *ptr = (uint8_t *) UART_ADDR;
+  // Data ready (LSR[0])
+  while (ptr[5] & 0b1) {
+    uint8_t rcvd = uart_get();
+    if (UART_RX_HEAD - UART_RX_TAIL == UART_RX_SIZE)
+      continue;
+    UART_RX[UART_RX_HEAD % UART_RX_SIZE] = rcvd;
+    ++UART_RX_HEAD;
+  }
+  work_queue(&UART_WORK);
+}
+
+// Deferred work for received characters
+// Echo them back, with Ctrl-C powering off the machine (after printing
+// the profiler samples if we were profiling)
+static void uart_work(void *data) {
+  while (UART_RX_TAIL != UART_RX_HEAD) {
+    uint8_t rcvd = UART_RX[UART_RX_TAIL % UART_RX_SIZE];
+    ++UART_RX_TAIL;
+    switch (rcvd) {
+    case 3:
+      profile_dump();
+      poweroff();
+    default:
+      console_input(rcvd);
+    }
+  }
+}
+
 int kputchar(int character) {
   uart_put((uint8_t) character);
   return character;
@@ -64,6 +112,73 @@ int kputs(const char *str) {
   return 0;
 }
 
+// Format `n` in the given base (at most 16) into the buffer ending at
+// `end`, returning where it starts
+static char *kformat_unsigned(char *end, size_t n, unsigned base, bool upper) {
+  do {
+    char digit = TO_HEX_DIGIT(n % base);
+    *--end = upper ? toupper(digit) : digit;
+    n /= base;
+  } while (n);
+  return end;
+}
+
+// Print `n` in the given base (at most 16)
+static void kprint_unsigned(size_t n, unsigned base, bool upper) {
+  char buf[64];
+  char *end = &buf[sizeof(buf)];
+  for (char *p = kformat_unsigned(end, n, base, upper); p != end; ++p)
+    kputchar(*p);
+}
+
+// Print `value`, an argument for the conversion `specifier` (one of
+// d/i/u/o/x/X/c/s, with d/i already sign-extended), in a field of at
+// least `width` characters padded with spaces on the left, or on the
+// right if `left`
+static void kprint_field(char specifier, size_t value, size_t width,
+			 bool left) {
+  char buf[65];
+  char *end = &buf[sizeof(buf)];
+  char *str = end;
+  switch (specifier) {
+  case 'd':
+  case 'i':
+    str = kformat_unsigned(end, (long)value < 0 ? -value : value, 10, false);
+    if ((long)value < 0)
+      *--str = '-';
+    break;
+  case 'u':
+    str = kformat_unsigned(end, value, 10, false);
+    break;
+  case 'o':
+    str = kformat_unsigned(end, value, 8, false);
+    break;
+  case 'x':
+  case 'X':
+    str = kformat_unsigned(end, value, 16, specifier == 'X');
+    break;
+  case 'c':
+    *--str = (char)value;
+    break;
+  case 's':
+    str = (char *)value;
+    end = str;
+    while (*end != '\0')
+      ++end;
+    break;
+  }
+  size_t len = end - str;
+  size_t pad = width > len ? width - len : 0;
+  if (!left)
+    for (size_t i = 0; i < pad; ++i)
+      kputchar(' ');
+  for (char *p = str; p != end; ++p)
+    kputchar(*p);
+  if (left)
+    for (size_t i = 0; i < pad; ++i)
+      kputchar(' ');
+}
+
 // Limited version of vprintf() which only supports the following
 // specifiers:
 // 
@@ -77,7 +192,11 @@ int kputs(const char *str) {
 // - p: Pointer address
 // - %: Literal '%'
 // 
-// None of the sub-specifiers are supported for the sake of simplicity.
+// The `l` length modifier is supported on d/i/u/o/x/X for printing
+// 64-bit values, e.g. cycle counts, and so is a minimum field width
+// (optionally left-justified with `-`) on all of d/i/u/o/x/X/c/s for
+// printing tables. None of the other sub-specifiers are supported for
+// the sake of simplicity.
 // The `n` specifier is not supported since that is a major source of
 // security vulnerabilities. None of the floating-point specifiers are
 // supported since floating point operations don't make sense in kernel
@@ -90,6 +209,76 @@ void kvprintf(const char *format, va_list arg) {
       ++format;
       if (!*format)
 	return;
+      bool left = *format == '-';
+      if (left)
+	++format;
+      size_t width = 0;
+      while ('0' <= *format && *format <= '9')
+	width = width * 10 + (*format++ - '0');
+      if (width != 0) {
+	bool is_long = *format == 'l';
+	if (is_long)
+	  ++format;
+	size_t value;
+	switch (*format) {
+	case 'd':
+	case 'i':
+	  value = is_long ? va_arg(arg, long) : va_arg(arg, int);
+	  break;
+	case 'u':
+	case 'o':
+	case 'x':
+	case 'X':
+	case 'c':
+	  value = is_long ? va_arg(arg, size_t) : va_arg(arg, unsigned);
+	  break;
+	case 's':
+	  value = (size_t)va_arg(arg, char *);
+	  break;
+	case '\0':
+	  return;
+	default:
+	  kputchar('%');
+	  kputchar(*format++);
+	  continue;
+	}
+	kprint_field(*format, value, width, left);
+	++format;
+	continue;
+      }
+      if (*format == 'l') {
+	++format;
+	switch (*format) {
+	case 'd':
+	case 'i':
+	  {
+	    long n = va_arg(arg, long);
+	    if (n < 0)
+	      kputchar('-');
+	    kprint_unsigned(n < 0 ? -(size_t)n : (size_t)n, 10, false);
+	  }
+	  break;
+	case 'u':
+	  kprint_unsigned(va_arg(arg, size_t), 10, false);
+	  break;
+	case 'o':
+	  kprint_unsigned(va_arg(arg, size_t), 8, false);
+	  break;
+	case 'x':
+	  kprint_unsigned(va_arg(arg, size_t), 16, false);
+	  break;
+	case 'X':
+	  kprint_unsigned(va_arg(arg, size_t), 16, true);
+	  break;
+	case '\0':
+	  return;
+	default:
+	  kprint("%l");
+	  kputchar(*format);
+	}
+	++format;
+	continue;
+      }
       switch (*format) {
       case 'd':
       case 'i':
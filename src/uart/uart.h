@@ -4,14 +4,19 @@
 #include <stddef.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include "../fdt/fdt.h"
 
-// 0x10000000 is memory-mapped address of UART according to device tree
-#define UART_ADDR 0x10000000
+// Memory-mapped address of the UART, from the device tree
+#define UART_ADDR (PLATFORM.uart)
+
+// Received characters buffered until they are handled, a power of 2
+#define UART_RX_SIZE 64
 
 #define TO_HEX_DIGIT(n) ('0' + (n) + ((n) < 10 ? 0 : 'a' - '0' - 10))
 
 void uart_init(void);
 uint8_t uart_get(void);
+void uart_interrupt(uint32_t, void *);
 int kputchar(int);
 int kputs(const char *);
 void kvprintf(const char *, va_list);
@@ -0,0 +1,178 @@
+#include <stdbool.h>
+#include "block.h"
+#include "virtio.h"
+#include "../common/common.h"
+#include "../uart/uart.h"
+#include "../plic/plic.h"
+
+static size_t BLOCK_BASE = 0;
+static struct virtq *BLOCK_QUEUE = NULL;
+static bool BLOCK_READ_ONLY = false;
+static size_t BLOCK_CAPACITY = 0;
+
+// Index into the used ring up to which completions have been consumed
+static uint16_t BLOCK_USED_IDX = 0;
+
+// Request headers and status bytes, indexed by the head descriptor of
+// each request chain
+static struct virtio_blk_req_header BLOCK_HEADERS[VIRTIO_RING_SIZE];
+static volatile uint8_t BLOCK_STATUS[VIRTIO_RING_SIZE];
+
+int block_present(void) {
+  return BLOCK_QUEUE != NULL;
+}
+
+// Capacity of the device in sectors
+size_t block_capacity(void) {
+  return BLOCK_CAPACITY;
+}
+
+// Probe for a virtio block device and bring it up
+// Returns 0 on success and -1 if there is no usable device
+int block_init(void) {
+  size_t base = virtio_find_device(VIRTIO_DEV_BLOCK);
+  if (base == 0)
+    return -1;
+
+  // Reset the device, then acknowledge it and announce our driver
+  VIRTIO_REG(base, VIRTIO_MMIO_STATUS) = 0;
+  uint32_t status = VIRTIO_STATUS_ACKNOWLEDGE;
+  VIRTIO_REG(base, VIRTIO_MMIO_STATUS) = status;
+  status |= VIRTIO_STATUS_DRIVER;
+  VIRTIO_REG(base, VIRTIO_MMIO_STATUS) = status;
+
+  // We don't need any optional features, but note whether the
+  // device is read-only
+  VIRTIO_REG(base, VIRTIO_MMIO_HOST_FEATURES_SEL) = 0;
+  uint32_t features = VIRTIO_REG(base, VIRTIO_MMIO_HOST_FEATURES);
+  BLOCK_READ_ONLY = !!(features & (1 << VIRTIO_BLK_F_RO));
+  VIRTIO_REG(base, VIRTIO_MMIO_GUEST_FEATURES_SEL) = 0;
+  VIRTIO_REG(base, VIRTIO_MMIO_GUEST_FEATURES) =
+      features & (1 << VIRTIO_BLK_F_RO);
+  status |= VIRTIO_STATUS_FEATURES_OK;
+  VIRTIO_REG(base, VIRTIO_MMIO_STATUS) = status;
+  if (!(VIRTIO_REG(base, VIRTIO_MMIO_STATUS) & VIRTIO_STATUS_FEATURES_OK)) {
+    VIRTIO_REG(base, VIRTIO_MMIO_STATUS) = VIRTIO_STATUS_FAILED;
+    return -1;
+  }
+
+  struct virtq *vq = virtio_setup_queue(base, 0);
+  if (vq == NULL) {
+    VIRTIO_REG(base, VIRTIO_MMIO_STATUS) = VIRTIO_STATUS_FAILED;
+    return -1;
+  }
+  status |= VIRTIO_STATUS_DRIVER_OK;
+  VIRTIO_REG(base, VIRTIO_MMIO_STATUS) = status;
+
+  // Capacity (in sectors) is the first 64-bit field of the config space
+  volatile uint32_t *config = (volatile uint32_t *)(base + VIRTIO_MMIO_CONFIG);
+  BLOCK_CAPACITY = (size_t)config[0] | ((size_t)config[1] << 32);
+
+  BLOCK_BASE = base;
+  BLOCK_QUEUE = vq;
+  BLOCK_USED_IDX = 0;
+  plic_register(virtio_slot_irq(base), block_irq, NULL, 1);
+  kprintf("virtio-blk: found device at %p with %d sectors%s\n", base,
+	  BLOCK_CAPACITY, BLOCK_READ_ONLY ? " (read-only)" : "");
+  return 0;
+}
+
+// Acknowledge a pending interrupt from the block device
+// We poll for completions, so there is nothing else to do here
+void block_irq(uint32_t source, void *data) {
+  if (BLOCK_BASE == 0)
+    return;
+  uint32_t pending = VIRTIO_REG(BLOCK_BASE, VIRTIO_MMIO_INTERRUPT_STATUS);
+  VIRTIO_REG(BLOCK_BASE, VIRTIO_MMIO_INTERRUPT_ACK) = pending;
+}
+
+// Number of segments starting at segs[0] that can be merged into a
+// single request because their sectors are contiguous
+static size_t block_run_length(struct block_segment *segs, size_t n) {
+  size_t run = 1;
+  while (run < n && run < BLOCK_MAX_SEGS_PER_REQUEST &&
+	 segs[run - 1].sector + (segs[run - 1].len >> BLOCK_SECTOR_ORDER) ==
+	 segs[run].sector)
+    ++run;
+  return run;
+}
+
+// Submit a batch of sector transfers and wait for all of them
+// Adjacent segments with contiguous sectors are merged into a single
+// request with a chained data descriptor per segment, and as many
+// requests as fit into the ring are submitted with a single notify
+// Returns 0 on success and -1 if any request failed
+int block_rw(int write, struct block_segment *segs, size_t n) {
+  if (BLOCK_QUEUE == NULL || (write && BLOCK_READ_ONLY))
+    return -1;
+  struct virtq *vq = BLOCK_QUEUE;
+  int result = 0;
+  size_t i = 0;
+  while (i < n) {
+    // Fill the descriptor table from the start - all requests of the
+    // previous batch have completed at this point
+    size_t next_desc = 0;
+    uint16_t heads[VIRTIO_RING_SIZE];
+    size_t num_requests = 0;
+    while (i < n) {
+      size_t run = block_run_length(&segs[i], n - i);
+      if (next_desc + run + 2 > VIRTIO_RING_SIZE)
+	break;
+      uint16_t head = next_desc++;
+      BLOCK_HEADERS[head].type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+      BLOCK_HEADERS[head].reserved = 0;
+      BLOCK_HEADERS[head].sector = segs[i].sector;
+      BLOCK_STATUS[head] = 0xff;
+      vq->desc[head].addr = (size_t)&BLOCK_HEADERS[head];
+      vq->desc[head].len = sizeof(struct virtio_blk_req_header);
+      vq->desc[head].flags = VIRTQ_DESC_F_NEXT;
+      vq->desc[head].next = next_desc;
+      for (size_t j = 0; j < run; ++j) {
+	uint16_t d = next_desc++;
+	vq->desc[d].addr = (size_t)segs[i + j].buf;
+	vq->desc[d].len = segs[i + j].len;
+	vq->desc[d].flags =
+	    VIRTQ_DESC_F_NEXT | (write ? 0 : VIRTQ_DESC_F_WRITE);
+	vq->desc[d].next = next_desc;
+      }
+      uint16_t s = next_desc++;
+      vq->desc[s].addr = (size_t)&BLOCK_STATUS[head];
+      vq->desc[s].len = 1;
+      vq->desc[s].flags = VIRTQ_DESC_F_WRITE;
+      vq->desc[s].next = 0;
+      vq->avail.ring[(vq->avail.idx + num_requests) % VIRTIO_RING_SIZE] =
+	  head;
+      heads[num_requests++] = head;
+      i += run;
+    }
+    ASSERT(num_requests > 0,
+	   "block_rw(): request does not fit into the virtqueue\n");
+
+    // Publish the whole batch, then notify the device once
+    __sync_synchronize();
+    vq->avail.idx += num_requests;
+    __sync_synchronize();
+    VIRTIO_REG(BLOCK_BASE, VIRTIO_MMIO_QUEUE_NOTIFY) = 0;
+
+    uint16_t target = BLOCK_USED_IDX + num_requests;
+    while (*(volatile uint16_t *)&vq->used.idx != target) ;
+    __sync_synchronize();
+    BLOCK_USED_IDX = target;
+    block_irq(0, NULL);
+
+    for (size_t r = 0; r < num_requests; ++r)
+      if (BLOCK_STATUS[heads[r]] != VIRTIO_BLK_S_OK)
+	result = -1;
+  }
+  return result;
+}
+
+int block_read(size_t sector, void *buf, uint32_t len) {
+  struct block_segment seg = {.sector = sector,.buf = buf,.len = len };
+  return block_rw(0, &seg, 1);
+}
+
+int block_write(size_t sector, void *buf, uint32_t len) {
+  struct block_segment seg = {.sector = sector,.buf = buf,.len = len };
+  return block_rw(1, &seg, 1);
+}
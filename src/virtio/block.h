@@ -0,0 +1,48 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// VirtIO block devices always address storage in 512-byte sectors
+#define BLOCK_SECTOR_ORDER 9
+#define BLOCK_SECTOR_SIZE (1 << BLOCK_SECTOR_ORDER)
+
+// Request types
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+
+// Request status written back by the device
+#define VIRTIO_BLK_S_OK 0
+
+// Feature bits
+#define VIRTIO_BLK_F_RO 5
+
+// Maximum number of data descriptors chained into a single request
+// Physically contiguous runs of sectors are merged into one request
+// (one header, many buffers, one status byte) up to this limit
+#define BLOCK_MAX_SEGS_PER_REQUEST 32
+
+struct virtio_blk_req_header {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t sector;
+};
+
+// One contiguous range of sectors transferred to or from `buf`
+// `len` must be a multiple of BLOCK_SECTOR_SIZE
+struct block_segment {
+  size_t sector;
+  void *buf;
+  uint32_t len;
+};
+
+int block_init(void);
+int block_present(void);
+size_t block_capacity(void);
+int block_rw(int, struct block_segment *, size_t);
+int block_read(size_t, void *, uint32_t);
+int block_write(size_t, void *, uint32_t);
+void block_irq(uint32_t, void *);
+
+#endif
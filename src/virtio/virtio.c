@@ -0,0 +1,40 @@
+#include "virtio.h"
+#include "../common/common.h"
+#include "../mm/page.h"
+
+// Probe the virtio-mmio slots for a device with the given device ID
+// Returns the MMIO base address of the first match, or 0 if not found
+size_t virtio_find_device(uint32_t device_id) {
+  for (size_t i = 0; i < VIRTIO_MMIO_NUM_SLOTS; ++i) {
+    size_t base = VIRTIO_MMIO_START + i * VIRTIO_MMIO_STRIDE;
+    if (VIRTIO_REG(base, VIRTIO_MMIO_MAGIC_VALUE) != VIRTIO_MAGIC)
+      continue;
+    if (VIRTIO_REG(base, VIRTIO_MMIO_DEVICE_ID) == device_id)
+      return base;
+  }
+  return 0;
+}
+
+// PLIC interrupt source of a virtio-mmio slot
+int virtio_slot_irq(size_t base) {
+  return 1 + (base - VIRTIO_MMIO_START) / VIRTIO_MMIO_STRIDE;
+}
+
+// Allocate and register virtqueue `queue` with the device at `base`
+// The device should already be in the DRIVER state
+struct virtq *virtio_setup_queue(size_t base, uint32_t queue) {
+  VIRTIO_REG(base, VIRTIO_MMIO_QUEUE_SEL) = queue;
+  uint32_t num_max = VIRTIO_REG(base, VIRTIO_MMIO_QUEUE_NUM_MAX);
+  if (num_max < VIRTIO_RING_SIZE)
+    return NULL;
+  VIRTIO_REG(base, VIRTIO_MMIO_QUEUE_NUM) = VIRTIO_RING_SIZE;
+
+  size_t num_pages = align_val(sizeof(struct virtq), PAGE_ORDER) / PAGE_SIZE;
+  struct virtq *vq = (struct virtq *)alloc_pages(num_pages);
+  if (vq == NULL)
+    return NULL;
+  VIRTIO_REG(base, VIRTIO_MMIO_GUEST_PAGE_SIZE) = PAGE_SIZE;
+  VIRTIO_REG(base, VIRTIO_MMIO_QUEUE_ALIGN) = PAGE_SIZE;
+  VIRTIO_REG(base, VIRTIO_MMIO_QUEUE_PFN) = (size_t)vq >> PAGE_ORDER;
+  return vq;
+}
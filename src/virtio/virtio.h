@@ -0,0 +1,107 @@
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../fdt/fdt.h"
+
+/*
+ * Legacy (version 1) VirtIO over MMIO
+ * See section 4.2.4 (Legacy interface) of the VirtIO 1.1 spec for details
+ * https://docs.oasis-open.org/virtio/virtio/v1.1/virtio-v1.1.pdf
+ *
+ * QEMU provides 8 virtio-mmio slots starting at 0x10001000, each 0x1000
+ * bytes apart, with interrupt sources 1 to 8. The first slot and number
+ * of slots come from the device tree
+ */
+#define VIRTIO_MMIO_START (PLATFORM.virtio)
+#define VIRTIO_MMIO_STRIDE 0x1000ull
+#define VIRTIO_MMIO_NUM_SLOTS (PLATFORM.virtio_slots)
+
+// Magic value "virt" in little endian
+#define VIRTIO_MAGIC 0x74726976
+
+// Device IDs
+#define VIRTIO_DEV_NONE 0
+#define VIRTIO_DEV_BLOCK 2
+
+// MMIO register offsets (legacy layout)
+#define VIRTIO_MMIO_MAGIC_VALUE 0x000
+#define VIRTIO_MMIO_VERSION 0x004
+#define VIRTIO_MMIO_DEVICE_ID 0x008
+#define VIRTIO_MMIO_VENDOR_ID 0x00c
+#define VIRTIO_MMIO_HOST_FEATURES 0x010
+#define VIRTIO_MMIO_HOST_FEATURES_SEL 0x014
+#define VIRTIO_MMIO_GUEST_FEATURES 0x020
+#define VIRTIO_MMIO_GUEST_FEATURES_SEL 0x024
+#define VIRTIO_MMIO_GUEST_PAGE_SIZE 0x028
+#define VIRTIO_MMIO_QUEUE_SEL 0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX 0x034
+#define VIRTIO_MMIO_QUEUE_NUM 0x038
+#define VIRTIO_MMIO_QUEUE_ALIGN 0x03c
+#define VIRTIO_MMIO_QUEUE_PFN 0x040
+#define VIRTIO_MMIO_QUEUE_NOTIFY 0x050
+#define VIRTIO_MMIO_INTERRUPT_STATUS 0x060
+#define VIRTIO_MMIO_INTERRUPT_ACK 0x064
+#define VIRTIO_MMIO_STATUS 0x070
+#define VIRTIO_MMIO_CONFIG 0x100
+
+#define VIRTIO_REG(base, offset) (*(volatile uint32_t *)((base) + (offset)))
+
+// Device status bits
+#define VIRTIO_STATUS_ACKNOWLEDGE (1 << 0)
+#define VIRTIO_STATUS_DRIVER (1 << 1)
+#define VIRTIO_STATUS_DRIVER_OK (1 << 2)
+#define VIRTIO_STATUS_FEATURES_OK (1 << 3)
+#define VIRTIO_STATUS_FAILED (1 << 7)
+
+// Number of descriptors in each of our virtqueues
+// Must be a power of 2 and not exceed QueueNumMax of the device
+#define VIRTIO_RING_SIZE 128
+
+// Descriptor flags
+#define VIRTQ_DESC_F_NEXT (1 << 0)
+#define VIRTQ_DESC_F_WRITE (1 << 1)
+
+struct virtq_desc {
+  uint64_t addr;
+  uint32_t len;
+  uint16_t flags;
+  uint16_t next;
+};
+
+struct virtq_avail {
+  uint16_t flags;
+  uint16_t idx;
+  uint16_t ring[VIRTIO_RING_SIZE];
+  uint16_t event;
+};
+
+struct virtq_used_elem {
+  uint32_t id;
+  uint32_t len;
+};
+
+struct virtq_used {
+  uint16_t flags;
+  uint16_t idx;
+  struct virtq_used_elem ring[VIRTIO_RING_SIZE];
+  uint16_t event;
+};
+
+// A legacy virtqueue occupies physically contiguous memory:
+// the descriptor table and available ring, padded to a page boundary,
+// followed by the used ring
+struct virtq {
+  struct virtq_desc desc[VIRTIO_RING_SIZE];
+  struct virtq_avail avail;
+  uint8_t padding[4096 - (sizeof(struct virtq_desc) * VIRTIO_RING_SIZE +
+			  sizeof(struct virtq_avail)) % 4096];
+  struct virtq_used used;
+};
+
+size_t virtio_find_device(uint32_t);
+int virtio_slot_irq(size_t);
+struct virtq *virtio_setup_queue(size_t, uint32_t);
+
+#endif